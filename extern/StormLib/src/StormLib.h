@@ -901,6 +901,11 @@ typedef struct _TMPQFile
     bool           bLoadedSectorCRCs;           // If true, we already tried to load sector CRCs
     bool           bCheckSectorCRCs;            // If true, then SFileReadFile will check sector CRCs when reading the file
     bool           bIsWriteHandle;              // If true, this handle has been created by SFileCreateFile
+
+    // OTR
+    const void * const * ppvPrecompressedSectors; // Sectors the caller compressed ahead of SFileWriteFile
+    const DWORD  * pcbPrecompressedSectors;     // Size of each of them
+    DWORD          dwPrecompressedSectors;      // Number of entries in both arrays
 } TMPQFile;
 
 // Structure for SFileFindFirstFile and SFileFindNextFile
@@ -1103,6 +1108,10 @@ DWORD  WINAPI SFileEnumLocales(HANDLE hMpq, const char * szFileName, LCID * PtrF
 bool   WINAPI SFileCreateFile(HANDLE hMpq, const char * szArchivedName, ULONGLONG FileTime, DWORD dwFileSize, LCID lcFileLocale, DWORD dwFlags, HANDLE * phFile);
 bool   WINAPI SFileWriteFile(HANDLE hFile, const void * pvData, DWORD dwSize, DWORD dwCompression);
 bool   WINAPI SFileFinishFile(HANDLE hFile);
+// OTR: Hands SFileWriteFile sectors that were already compressed, e.g. on worker threads, so it only copies them.
+// Each one must be what SCompCompress produces for that sector with the compression given to SFileWriteFile.
+// The buffers must stay valid until the file is finished.
+bool   WINAPI SFileSetPrecompressedSectors(HANDLE hFile, const void * const * ppvSectors, const DWORD * pcbSectors, DWORD dwSectorCount);
 
 bool   WINAPI SFileAddFileEx(HANDLE hMpq, const TCHAR * szFileName, const char * szArchivedName, DWORD dwFlags, DWORD dwCompression, DWORD dwCompressionNext);
 bool   WINAPI SFileAddFile(HANDLE hMpq, const TCHAR * szFileName, const char * szArchivedName, DWORD dwFlags);
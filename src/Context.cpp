@@ -1,5 +1,6 @@
 #include "Context.h"
 #include "controller/KeyboardScancodes.h"
+#include <fstream>
 #include <iostream>
 #include <spdlog/async.h>
 #include <spdlog/sinks/rotating_file_sink.h>
@@ -60,15 +61,76 @@ Context::Context(std::string name, std::string shortName, std::string configFile
 
 void Context::Init(const std::vector<std::string>& otrFiles, const std::unordered_set<uint32_t>& validHashes,
                    uint32_t reservedThreadCount) {
-    InitLogging();
-    InitConfiguration();
-    InitConsoleVariables();
-    InitResourceManager(otrFiles, validHashes, reservedThreadCount);
-    InitControlDeck();
-    InitCrashHandler();
-    InitConsole();
-    InitWindow();
-    InitAudio();
+    mInitStart = std::chrono::steady_clock::now();
+    RunStartupStage("Logging", false, [this]() { InitLogging(); });
+    RunStartupStage("Configuration", false, [this]() { InitConfiguration(); });
+    RunStartupStage("Console Variables", false, [this]() { InitConsoleVariables(); });
+
+    // Opening the archives and reading the controller database are mostly waiting on disk, so they run next to the
+    // stages below. The window blocks in GetResourceManager once the GUI loads its fonts, osContInit blocks in
+    // TakeControllerMappings. SDL subsystem init is not thread safe, which keeps the window and audio on this thread.
+    ResolveArchivePaths();
+    mResourceManagerReady = false;
+    std::future<void> resourceManagerTask = std::async(std::launch::async, [&]() {
+        RunStartupStage("Resource Manager", true,
+                        [&]() { CreateResourceManager(otrFiles, validHashes, reservedThreadCount); });
+        mResourceManagerReady.store(true, std::memory_order_release);
+    });
+    mResourceManagerTask = resourceManagerTask.share();
+#if !defined(__WIIU__) && !defined(__SWITCH__)
+    mControllerMappingsTask = std::async(std::launch::async, [this]() {
+        std::string mappings;
+        RunStartupStage("Controller Database", true, [&mappings]() {
+            std::ifstream file(LocateFileAcrossAppDirs("gamecontrollerdb.txt"), std::ios::in | std::ios::binary);
+            if (file) {
+                mappings.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            }
+        });
+        return mappings;
+    });
+#endif
+
+    RunStartupStage("Control Deck", false, [this]() { InitControlDeck(); });
+    RunStartupStage("Crash Handler", false, [this]() { InitCrashHandler(); });
+    RunStartupStage("Console", false, [this]() { InitConsole(); });
+    RunStartupStage("Audio", false, [this]() { InitAudio(); });
+    RunStartupStage("Window", false, [this]() { InitWindow(); });
+
+    mResourceManagerTask.get();
+    CheckResourceManager();
+    LogStartupReport();
+}
+
+void Context::RunStartupStage(const std::string& name, bool background, const std::function<void()>& stage) {
+    const auto start = std::chrono::steady_clock::now();
+    stage();
+    const auto end = std::chrono::steady_clock::now();
+
+    const std::lock_guard<std::mutex> lock(mStartupStagesMutex);
+    mStartupStages.push_back({ name, std::chrono::duration<double, std::milli>(start - mInitStart).count(),
+                               std::chrono::duration<double, std::milli>(end - start).count(), background });
+}
+
+void Context::LogStartupReport() {
+    const std::lock_guard<std::mutex> lock(mStartupStagesMutex);
+    const auto total = std::chrono::steady_clock::now() - mInitStart;
+    SPDLOG_INFO("Startup took {:.1f} ms", std::chrono::duration<double, std::milli>(total).count());
+    for (const auto& stage : mStartupStages) {
+        SPDLOG_INFO("    {:<20} {:8.1f} ms, started at {:8.1f} ms{}", stage.Name, stage.DurationMs, stage.StartMs,
+                    stage.Background ? " (background)" : "");
+    }
+}
+
+std::vector<StartupStage> Context::GetStartupStages() {
+    const std::lock_guard<std::mutex> lock(mStartupStagesMutex);
+    return mStartupStages;
+}
+
+std::string Context::TakeControllerMappings() {
+    if (!mControllerMappingsTask.valid()) {
+        return "";
+    }
+    return mControllerMappingsTask.get();
 }
 
 void Context::InitLogging() {
@@ -125,8 +187,15 @@ void Context::InitLogging() {
         sinks.push_back(fileSink);
 #endif
 
+        // A full queue drops its oldest message instead of stalling the game thread on the sinks. Debug builds keep
+        // every message.
+#ifdef _DEBUG
+        const auto overflowPolicy = spdlog::async_overflow_policy::block;
+#else
+        const auto overflowPolicy = spdlog::async_overflow_policy::overrun_oldest;
+#endif
         mLogger = std::make_shared<spdlog::async_logger>(GetName(), sinks.begin(), sinks.end(), spdlog::thread_pool(),
-                                                         spdlog::async_overflow_policy::block);
+                                                         overflowPolicy);
 #ifdef _DEBUG
         GetLogger()->set_level(spdlog::level::trace);
 #else
@@ -158,14 +227,27 @@ void Context::InitConsoleVariables() {
 
 void Context::InitResourceManager(const std::vector<std::string>& otrFiles,
                                   const std::unordered_set<uint32_t>& validHashes, uint32_t reservedThreadCount) {
+    ResolveArchivePaths();
+    CreateResourceManager(otrFiles, validHashes, reservedThreadCount);
+    CheckResourceManager();
+}
+
+void Context::ResolveArchivePaths() {
     mMainPath = GetConfig()->GetString("Game.Main Archive", GetAppDirectoryPath());
     mPatchesPath = mConfig->GetString("Game.Patches Archive", GetAppDirectoryPath() + "/mods");
+}
+
+// Touches neither the config nor SDL, so it can run next to the rest of Init.
+void Context::CreateResourceManager(const std::vector<std::string>& otrFiles,
+                                    const std::unordered_set<uint32_t>& validHashes, uint32_t reservedThreadCount) {
     if (otrFiles.empty()) {
         mResourceManager = std::make_shared<ResourceManager>(mMainPath, mPatchesPath, validHashes, reservedThreadCount);
     } else {
         mResourceManager = std::make_shared<ResourceManager>(otrFiles, validHashes, reservedThreadCount);
     }
+}
 
+void Context::CheckResourceManager() {
     if (!mResourceManager->DidLoadSuccessfully()) {
 #if defined(__SWITCH__)
         printf("Main OTR file not found!\n");
@@ -219,6 +301,11 @@ std::shared_ptr<Config> Context::GetConfig() {
 }
 
 std::shared_ptr<ResourceManager> Context::GetResourceManager() {
+    if (!mResourceManagerReady.load(std::memory_order_acquire)) {
+        // The archives are still being opened. Besides Init this can be the input thread once the control deck
+        // exists, the future is shared so any number of waiters is fine.
+        mResourceManagerTask.wait();
+    }
     return mResourceManager;
 }
 
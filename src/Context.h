@@ -1,7 +1,12 @@
 #pragma once
 
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <unordered_set>
 #include <vector>
 #include <spdlog/spdlog.h>
@@ -16,6 +21,13 @@
 
 namespace LUS {
 
+struct StartupStage {
+    std::string Name;
+    double StartMs; // Relative to the start of Context::Init
+    double DurationMs;
+    bool Background;
+};
+
 class Context {
   public:
     static std::shared_ptr<Context> GetInstance();
@@ -50,6 +62,9 @@ class Context {
     std::string GetConfigFilePath();
     std::string GetName();
     std::string GetShortName();
+    std::vector<StartupStage> GetStartupStages();
+    // Contents of gamecontrollerdb.txt read during Init, empty when it was not prefetched. Only valid once.
+    std::string TakeControllerMappings();
 
     void InitLogging();
     void InitConfiguration();
@@ -66,6 +81,13 @@ class Context {
     Context() = default;
 
   private:
+    void RunStartupStage(const std::string& name, bool background, const std::function<void()>& stage);
+    void LogStartupReport();
+    void ResolveArchivePaths();
+    void CreateResourceManager(const std::vector<std::string>& otrFiles,
+                               const std::unordered_set<uint32_t>& validHashes, uint32_t reservedThreadCount);
+    void CheckResourceManager();
+
     static std::weak_ptr<Context> mContext;
 
     std::shared_ptr<spdlog::logger> mLogger;
@@ -84,5 +106,13 @@ class Context {
 
     std::string mName;
     std::string mShortName;
+
+    std::chrono::steady_clock::time_point mInitStart;
+    std::mutex mStartupStagesMutex;
+    std::vector<StartupStage> mStartupStages;
+    std::atomic<bool> mResourceManagerReady = true;
+    // Shared so Init and any thread that calls GetResourceManager during startup can all wait on it.
+    std::shared_future<void> mResourceManagerTask;
+    std::future<std::string> mControllerMappingsTask;
 };
 } // namespace LUS
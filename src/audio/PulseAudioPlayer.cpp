@@ -2,6 +2,7 @@
 
 #include "PulseAudioPlayer.h"
 #include "Context.h"
+#include "debug/Profiler.h"
 #include <spdlog/spdlog.h>
 
 namespace LUS {
@@ -169,6 +170,7 @@ int PulseAudioPlayer::GetDesiredBuffered() {
 }
 
 void PulseAudioPlayer::Play(const uint8_t* buff, size_t len) {
+    LUS_PROFILE_SCOPE("Audio Play");
     if (mStream == NULL || mContext == NULL || mMainLoop == NULL) {
         return;
     }
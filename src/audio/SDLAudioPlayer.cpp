@@ -1,4 +1,5 @@
 #include "SDLAudioPlayer.h"
+#include "debug/Profiler.h"
 #include <spdlog/spdlog.h>
 
 namespace LUS {
@@ -36,6 +37,7 @@ int SDLAudioPlayer::GetDesiredBuffered(void) {
 }
 
 void SDLAudioPlayer::Play(const uint8_t* buf, size_t len) {
+    LUS_PROFILE_SCOPE("Audio Play");
     if (Buffered() < 6000) {
         // Don't fill the audio buffer too much in case this happens
         SDL_QueueAudio(mDevice, buf, len);
@@ -1,5 +1,6 @@
 #ifdef _WIN32
 #include "WasapiAudioPlayer.h"
+#include "debug/Profiler.h"
 #include <spdlog/spdlog.h>
 
 // These constants are currently missing from the MinGW headers.
@@ -82,6 +83,7 @@ int WasapiAudioPlayer::GetDesiredBuffered(void) {
 }
 
 void WasapiAudioPlayer::Play(const uint8_t* buf, size_t len) {
+    LUS_PROFILE_SCOPE("Audio Play");
     if (!mInitialized) {
         if (!SetupStream()) {
             return;
@@ -7,6 +7,12 @@
 #include "public/bridge/consolevariablebridge.h"
 #include <imgui.h>
 
+#define SNAPSHOT_FRESH_BIT 0x80
+#define SNAPSHOT_INDEX_MASK 0x7F
+#define PAD_BUFFER_SIZE 6
+#define LATENCY_AVERAGE_WEIGHT 0.05
+#define LATENCY_PEAK_WINDOW 60
+
 #ifndef __WIIU__
 #include "controller/KeyboardController.h"
 #include "controller/SDLController.h"
@@ -22,14 +28,18 @@ ControlDeck::ControlDeck() : mPads(nullptr) {
 
 ControlDeck::~ControlDeck() {
     SPDLOG_TRACE("destruct control deck");
+    StopInputSampling();
 }
 
 void ControlDeck::Init(uint8_t* bits) {
     ScanDevices();
     mControllerBits = bits;
+    SetInputSamplingRate(CVarGetInteger("gInputSamplingRate", 0));
 }
 
 void ControlDeck::ScanDevices() {
+    const std::lock_guard<std::recursive_mutex> lock(mDevicesMutex);
+
     mPortList.clear();
     mDevices.clear();
 
@@ -78,14 +88,31 @@ void ControlDeck::ScanDevices() {
 }
 
 void ControlDeck::SetDeviceToPort(int32_t portIndex, int32_t deviceIndex) {
+    const std::lock_guard<std::recursive_mutex> lock(mDevicesMutex);
     const std::shared_ptr<Controller> backend = mDevices[deviceIndex];
     mPortList[portIndex] = deviceIndex;
     *mControllerBits |= (backend->Connected()) << portIndex;
 }
 
 void ControlDeck::WriteToPad(OSContPad* pad) {
+    const auto readStart = std::chrono::steady_clock::now();
     mPads = pad;
 
+    if (mInputThreadRunning) {
+        LatchSnapshotToPad(pad, readStart);
+    } else {
+        const std::lock_guard<std::recursive_mutex> lock(mDevicesMutex);
+        ReadDevicesToPad(pad);
+    }
+
+    UpdateReadTime(readStart);
+}
+
+void ControlDeck::ReadDevicesToPad(OSContPad* pad) {
+#ifndef __WIIU__
+    SDL_PumpEvents();
+#endif
+
     for (size_t i = 0; i < mPortList.size(); i++) {
         const std::shared_ptr<Controller> backend = mDevices[mPortList[i]];
 
@@ -112,6 +139,144 @@ void ControlDeck::WriteToPad(OSContPad* pad) {
     }
 }
 
+void ControlDeck::LatchSnapshotToPad(OSContPad* pad, std::chrono::steady_clock::time_point readStart) {
+    // The blocking state depends on ImGui and the console variables, which are only safe to query from this thread.
+    // The input thread picks it up on its next sample.
+    const bool blockedByGame = !mGameInputBlockers.empty();
+    mBlockKeyboardInput = blockedByGame || ShouldBlockKeyboardInput();
+    mBlockControllerInput = blockedByGame || ShouldBlockControllerInput();
+
+    if (mSnapshotMiddle.load(std::memory_order_relaxed) & SNAPSHOT_FRESH_BIT) {
+        mSnapshotFront = mSnapshotMiddle.exchange(mSnapshotFront, std::memory_order_acq_rel) & SNAPSHOT_INDEX_MASK;
+    }
+
+    const PadSnapshot& snapshot = mSnapshots[mSnapshotFront];
+    if (snapshot.SampledAt == std::chrono::steady_clock::time_point{}) {
+        // The input thread has not produced anything yet.
+        return;
+    }
+
+    const size_t lag = CVarGetInteger("gSimulatedInputLag", 0);
+    for (size_t i = 0; i < MAXCONTROLLERS; i++) {
+        auto& buffer = mLatchedPadBuffers[i];
+        buffer.push_front(snapshot.Pads[i]);
+        Controller::MergePad(&pad[i], buffer[std::min(buffer.size() - 1, lag)]);
+
+        while (buffer.size() > PAD_BUFFER_SIZE) {
+            buffer.pop_back();
+        }
+    }
+
+    const double sampleAge = std::chrono::duration<double, std::milli>(readStart - snapshot.SampledAt).count();
+    mLatencyStats.LastSampleAgeMs = sampleAge;
+    mLatencyStats.AverageSampleAgeMs += (sampleAge - mLatencyStats.AverageSampleAgeMs) * LATENCY_AVERAGE_WEIGHT;
+    mPeakSampleAgeWindow = std::max(mPeakSampleAgeWindow, sampleAge);
+}
+
+void ControlDeck::UpdateReadTime(std::chrono::steady_clock::time_point readStart) {
+    const double readTime =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - readStart).count();
+    mLatencyStats.LastReadTimeMs = readTime;
+    mLatencyStats.AverageReadTimeMs += (readTime - mLatencyStats.AverageReadTimeMs) * LATENCY_AVERAGE_WEIGHT;
+
+    if (++mLatencyWindowReads >= LATENCY_PEAK_WINDOW) {
+        mLatencyStats.PeakSampleAgeMs = mPeakSampleAgeWindow;
+        mPeakSampleAgeWindow = 0.0;
+        mLatencyWindowReads = 0;
+    }
+}
+
+void ControlDeck::SampleDevices(OSContPad* pads, bool blockKeyboard, bool blockControllers) {
+    for (size_t i = 0; i < mPortList.size(); i++) {
+        const std::shared_ptr<Controller> backend = mDevices[mPortList[i]];
+
+        if (backend->GetGuid() == "Auto") {
+            for (const auto& device : mDevices) {
+                const OSContPad state = device->SamplePad(i);
+                if (!(device->GetGuid() == "Keyboard" ? blockKeyboard : blockControllers)) {
+                    Controller::MergePad(&pads[i], state);
+                }
+            }
+            continue;
+        }
+
+        const OSContPad state = backend->SamplePad(i);
+        if (!(backend->GetGuid() == "Keyboard" ? blockKeyboard : blockControllers)) {
+            Controller::MergePad(&pads[i], state);
+        }
+    }
+}
+
+void ControlDeck::SampleInputLoop() {
+    const auto interval = std::chrono::nanoseconds(1000000000 / mSamplingRate);
+    auto nextSample = std::chrono::steady_clock::now();
+
+    while (mInputThreadRunning) {
+        {
+            const std::lock_guard<std::recursive_mutex> lock(mDevicesMutex);
+            PadSnapshot& snapshot = mSnapshots[mSnapshotBack];
+            snapshot.Pads.fill({});
+            SampleDevices(snapshot.Pads.data(), mBlockKeyboardInput, mBlockControllerInput);
+            snapshot.SampledAt = std::chrono::steady_clock::now();
+        }
+
+        mSnapshotBack =
+            mSnapshotMiddle.exchange(mSnapshotBack | SNAPSHOT_FRESH_BIT, std::memory_order_acq_rel) & SNAPSHOT_INDEX_MASK;
+
+        // If we fell behind (e.g. the thread was descheduled) don't try to catch up with a burst of samples.
+        nextSample = std::max(nextSample + interval, std::chrono::steady_clock::now());
+        std::this_thread::sleep_until(nextSample);
+    }
+}
+
+void ControlDeck::SetInputSamplingRate(uint32_t samplingRate) {
+    StopInputSampling();
+
+    mSamplingRate = samplingRate;
+    mLatencyStats = {};
+    mLatencyStats.SamplingRate = samplingRate;
+    if (samplingRate == 0) {
+        return;
+    }
+
+    for (auto& snapshot : mSnapshots) {
+        snapshot = {};
+    }
+    for (auto& buffer : mLatchedPadBuffers) {
+        buffer.clear();
+    }
+    mSnapshotBack = 0;
+    mSnapshotMiddle = 1;
+    mSnapshotFront = 2;
+
+    SPDLOG_INFO("Sampling input devices at {} Hz", samplingRate);
+    mInputThreadRunning = true;
+    mInputThread = std::thread(&ControlDeck::SampleInputLoop, this);
+}
+
+void ControlDeck::StopInputSampling() {
+    mInputThreadRunning = false;
+    if (mInputThread.joinable()) {
+        mInputThread.join();
+    }
+}
+
+uint32_t ControlDeck::GetInputSamplingRate() {
+    return mSamplingRate;
+}
+
+bool ControlDeck::IsSamplingInput() {
+    return mInputThreadRunning;
+}
+
+InputLatencyStats ControlDeck::GetInputLatencyStats() {
+    return mLatencyStats;
+}
+
+std::unique_lock<std::recursive_mutex> ControlDeck::LockDevices() {
+    return std::unique_lock<std::recursive_mutex>(mDevicesMutex);
+}
+
 OSContPad* ControlDeck::GetPads() {
     return mPads;
 }
@@ -333,17 +498,20 @@ void ControlDeck::UnblockGameInput(int32_t inputBlockId) {
 }
 
 bool ControlDeck::IsBlockingGameInput(const std::string& inputDeviceGuid) const {
-    // We block controller input if F1 menu is open and control navigation is on.
-    // This is because we don't want controller inputs to affect the game
-    bool shouldBlockControllerInput = CVarGetInteger("gOpenMenuBar", 0) && CVarGetInteger("gControlNav", 0);
+    bool inputDeviceIsKeyboard = inputDeviceGuid == "Keyboard";
+    return (!mGameInputBlockers.empty()) ||
+           (inputDeviceIsKeyboard ? ShouldBlockKeyboardInput() : ShouldBlockControllerInput());
+}
 
+bool ControlDeck::ShouldBlockKeyboardInput() const {
     // We block keyboard input if you're currently typing into a textfield.
     // This is because we don't want your keyboard typing to affect the game.
-    ImGuiIO io = ImGui::GetIO();
-    bool shouldBlockKeyboardInput = io.WantCaptureKeyboard;
+    return ImGui::GetIO().WantCaptureKeyboard;
+}
 
-    bool inputDeviceIsKeyboard = inputDeviceGuid == "Keyboard";
-    return (!mGameInputBlockers.empty()) ||
-           (inputDeviceIsKeyboard ? shouldBlockKeyboardInput : shouldBlockControllerInput);
+bool ControlDeck::ShouldBlockControllerInput() const {
+    // We block controller input if F1 menu is open and control navigation is on.
+    // This is because we don't want controller inputs to affect the game
+    return CVarGetInteger("gOpenMenuBar", 0) && CVarGetInteger("gControlNav", 0);
 }
 } // namespace LUS
@@ -1,11 +1,30 @@
 #pragma once
 
 #include "Controller.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <config/Config.h>
 
 namespace LUS {
 
+struct InputLatencyStats {
+    // Rate the input thread samples devices at, 0 when devices are polled synchronously in WriteToPad.
+    uint32_t SamplingRate = 0;
+    // Age of the pad state handed to the game, measured from the moment it was sampled. Keyboard state only changes
+    // when the main thread pumps window events, so for keyboards this is the age of the snapshot, not input latency.
+    double LastSampleAgeMs = 0.0;
+    double AverageSampleAgeMs = 0.0;
+    double PeakSampleAgeMs = 0.0;
+    // Time the game thread spent inside WriteToPad.
+    double LastReadTimeMs = 0.0;
+    double AverageReadTimeMs = 0.0;
+};
+
 class ControlDeck {
   public:
     ControlDeck();
@@ -27,12 +46,53 @@ class ControlDeck {
     void BlockGameInput(int32_t inputBlockId);
     void UnblockGameInput(int32_t inputBlockId);
     bool IsBlockingGameInput(const std::string& inputDeviceGuid) const;
+    void SetInputSamplingRate(uint32_t samplingRate);
+    uint32_t GetInputSamplingRate();
+    bool IsSamplingInput();
+    InputLatencyStats GetInputLatencyStats();
+    // Anything that changes a device's profile or button state from outside the input thread must hold this lock.
+    std::unique_lock<std::recursive_mutex> LockDevices();
 
   private:
+    struct PadSnapshot {
+        std::array<OSContPad, MAXCONTROLLERS> Pads = {};
+        std::chrono::steady_clock::time_point SampledAt = {};
+    };
+
+    bool ShouldBlockKeyboardInput() const;
+    bool ShouldBlockControllerInput() const;
+    void ReadDevicesToPad(OSContPad* pad);
+    void LatchSnapshotToPad(OSContPad* pad, std::chrono::steady_clock::time_point readStart);
+    void SampleDevices(OSContPad* pads, bool blockKeyboard, bool blockControllers);
+    void SampleInputLoop();
+    void StopInputSampling();
+    void UpdateReadTime(std::chrono::steady_clock::time_point readStart);
+
     std::vector<int32_t> mPortList = {};
     std::vector<std::shared_ptr<Controller>> mDevices = {};
     uint8_t* mControllerBits = nullptr;
     std::unordered_map<int32_t, bool> mGameInputBlockers;
     OSContPad* mPads;
+
+    // Guards mDevices, mPortList and the devices' profiles and button state while the input thread samples them.
+    // Recursive so the input editor can hold it across calls back into the deck.
+    std::recursive_mutex mDevicesMutex;
+    std::thread mInputThread;
+    std::atomic<bool> mInputThreadRunning = false;
+    uint32_t mSamplingRate = 0;
+    std::atomic<bool> mBlockKeyboardInput = false;
+    std::atomic<bool> mBlockControllerInput = false;
+
+    // Triple buffered so neither the input thread nor the game thread ever waits on the other. The input thread owns
+    // the back snapshot, the game thread owns the front snapshot and the two swap through the shared middle slot.
+    std::array<PadSnapshot, 3> mSnapshots;
+    uint8_t mSnapshotBack = 0;
+    std::atomic<uint8_t> mSnapshotMiddle = 1;
+    uint8_t mSnapshotFront = 2;
+    std::array<std::deque<OSContPad>, MAXCONTROLLERS> mLatchedPadBuffers;
+
+    InputLatencyStats mLatencyStats;
+    double mPeakSampleAgeWindow = 0.0;
+    uint32_t mLatencyWindowReads = 0;
 };
 } // namespace LUS
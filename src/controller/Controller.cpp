@@ -141,16 +141,27 @@ void Controller::ProcessStick(int8_t& x, int8_t& y, float deadzoneX, float deadz
 }
 
 void Controller::ReadToPad(OSContPad* pad, int32_t portIndex) {
-    ReadDevice(portIndex);
+    const OSContPad padToBuffer = SamplePad(portIndex);
 
-    OSContPad padToBuffer = { 0 };
+    if (pad == nullptr) {
+        return;
+    }
 
-#ifndef __WIIU__
-    SDL_PumpEvents();
-#endif
+    mPadBuffer.push_front(padToBuffer);
+    MergePad(pad, mPadBuffer[std::min(mPadBuffer.size() - 1, (size_t)CVarGetInteger("gSimulatedInputLag", 0))]);
+
+    while (mPadBuffer.size() > 6) {
+        mPadBuffer.pop_back();
+    }
+}
+
+OSContPad Controller::SamplePad(int32_t portIndex) {
+    ReadDevice(portIndex);
+
+    OSContPad state = { 0 };
 
     // Button Inputs
-    padToBuffer.button |= GetPressedButtons(portIndex) & 0xFFFF;
+    state.button |= GetPressedButtons(portIndex) & 0xFFFF;
 
     // Stick Inputs
     int8_t leftStickX = ReadStick(portIndex, LEFT, X);
@@ -159,52 +170,53 @@ void Controller::ReadToPad(OSContPad* pad, int32_t portIndex) {
     int8_t rightStickY = ReadStick(portIndex, RIGHT, Y);
 
     auto profile = GetProfile(portIndex);
-    ProcessStick(leftStickX, leftStickY, profile->AxisDeadzones[0], profile->AxisDeadzones[1],
-                 profile->NotchProximityThreshold);
-    ProcessStick(rightStickX, rightStickY, profile->AxisDeadzones[2], profile->AxisDeadzones[3],
-                 profile->NotchProximityThreshold);
+    ProcessStick(leftStickX, leftStickY, GetProfileValue(profile->AxisDeadzones, 0),
+                 GetProfileValue(profile->AxisDeadzones, 1), profile->NotchProximityThreshold);
+    ProcessStick(rightStickX, rightStickY, GetProfileValue(profile->AxisDeadzones, 2),
+                 GetProfileValue(profile->AxisDeadzones, 3), profile->NotchProximityThreshold);
 
-    if (pad == nullptr) {
-        return;
-    }
-
-    padToBuffer.stick_x = leftStickX;
-    padToBuffer.stick_y = leftStickY;
-    padToBuffer.right_stick_x = rightStickX;
-    padToBuffer.right_stick_y = rightStickY;
+    state.stick_x = leftStickX;
+    state.stick_y = leftStickY;
+    state.right_stick_x = rightStickX;
+    state.right_stick_y = rightStickY;
 
     // Gyro
-    padToBuffer.gyro_x = GetGyroX(portIndex);
-    padToBuffer.gyro_y = GetGyroY(portIndex);
+    state.gyro_x = GetGyroX(portIndex);
+    state.gyro_y = GetGyroY(portIndex);
 
-    mPadBuffer.push_front(padToBuffer);
-    if (pad != nullptr) {
-        auto& padFromBuffer =
-            mPadBuffer[std::min(mPadBuffer.size() - 1, (size_t)CVarGetInteger("gSimulatedInputLag", 0))];
-        pad->button |= padFromBuffer.button;
-        if (pad->stick_x == 0) {
-            pad->stick_x = padFromBuffer.stick_x;
-        }
-        if (pad->stick_y == 0) {
-            pad->stick_y = padFromBuffer.stick_y;
-        }
-        if (pad->gyro_x == 0) {
-            pad->gyro_x = padFromBuffer.gyro_x;
-        }
-        if (pad->gyro_y == 0) {
-            pad->gyro_y = padFromBuffer.gyro_y;
-        }
-        if (pad->right_stick_x == 0) {
-            pad->right_stick_x = padFromBuffer.right_stick_x;
-        }
-        if (pad->right_stick_y == 0) {
-            pad->right_stick_y = padFromBuffer.right_stick_y;
-        }
-    }
+    return state;
+}
 
-    while (mPadBuffer.size() > 6) {
-        mPadBuffer.pop_back();
+void Controller::MergePad(OSContPad* pad, const OSContPad& state) {
+    pad->button |= state.button;
+    if (pad->stick_x == 0) {
+        pad->stick_x = state.stick_x;
     }
+    if (pad->stick_y == 0) {
+        pad->stick_y = state.stick_y;
+    }
+    if (pad->gyro_x == 0) {
+        pad->gyro_x = state.gyro_x;
+    }
+    if (pad->gyro_y == 0) {
+        pad->gyro_y = state.gyro_y;
+    }
+    if (pad->right_stick_x == 0) {
+        pad->right_stick_x = state.right_stick_x;
+    }
+    if (pad->right_stick_y == 0) {
+        pad->right_stick_y = state.right_stick_y;
+    }
+}
+
+int32_t Controller::GetMapping(const DeviceProfile& profile, int32_t deviceButtonId) {
+    const auto it = profile.Mappings.find(deviceButtonId);
+    return it != profile.Mappings.end() ? it->second : 0;
+}
+
+float Controller::GetProfileValue(const std::unordered_map<int32_t, float>& values, int32_t key) {
+    const auto it = values.find(key);
+    return it != values.end() ? it->second : 0.0f;
 }
 
 void Controller::SetButtonMapping(int32_t portIndex, int32_t deviceButtonId, int32_t n64bitmask) {
@@ -52,6 +52,8 @@ class Controller {
 
     std::string GetControllerName();
     void ReadToPad(OSContPad* pad, int32_t portIndex);
+    OSContPad SamplePad(int32_t portIndex);
+    static void MergePad(OSContPad* pad, const OSContPad& state);
     void SetButtonMapping(int32_t portIndex, int32_t deviceButtonId, int32_t n64bitmask);
 
     std::shared_ptr<DeviceProfile> GetProfile(int32_t portIndex);
@@ -73,6 +75,10 @@ class Controller {
     int32_t mDeviceIndex;
     std::string mControllerName = "Unknown";
 
+    // Lookups that never insert, so reading a profile from the input thread doesn't modify it.
+    static int32_t GetMapping(const DeviceProfile& profile, int32_t deviceButtonId);
+    static float GetProfileValue(const std::unordered_map<int32_t, float>& values, int32_t key);
+
     int8_t ReadStick(int32_t portIndex, Stick stick, Axis axis);
     void ProcessStick(int8_t& x, int8_t& y, float deadzoneX, float deadzoneY, int32_t notchProxmityThreshold);
     double GetClosestNotch(double angle, double approximationThreshold);
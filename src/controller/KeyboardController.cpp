@@ -60,7 +60,8 @@ int32_t KeyboardController::ReadRawPress() {
 }
 
 const std::string KeyboardController::GetButtonName(int32_t portIndex, int32_t n64bitmask) {
-    std::map<int32_t, int32_t>& mappings = GetProfile(portIndex)->Mappings;
+    const auto lock = Context::GetInstance()->GetControlDeck()->LockDevices();
+    const std::map<int32_t, int32_t>& mappings = GetProfile(portIndex)->Mappings;
     // OTRTODO: This should get the scancode of all bits in the mask.
     const auto find =
         std::find_if(mappings.begin(), mappings.end(),
@@ -1,6 +1,7 @@
 #define NOMINMAX
 
 #include "SDLController.h"
+#include "Context.h"
 
 #include <spdlog/spdlog.h>
 #include <Utils/StringHelper.h>
@@ -84,6 +85,8 @@ void SDLController::NormalizeStickAxis(SDL_GameControllerAxis axisX, SDL_GameCon
 }
 
 int32_t SDLController::ReadRawPress() {
+    // The input thread updates, opens and closes the controller under the same lock.
+    const auto lock = Context::GetInstance()->GetControlDeck()->LockDevices();
     SDL_GameControllerUpdate();
 
     for (int32_t i = SDL_CONTROLLER_BUTTON_A; i < SDL_CONTROLLER_BUTTON_MAX; i++) {
@@ -131,9 +134,9 @@ void SDLController::ReadDevice(int32_t portIndex) {
         float gyroData[3];
         SDL_GameControllerGetSensorData(mController, SDL_SENSOR_GYRO, gyroData, 3);
 
-        float gyroDriftX = profile->GyroData[DRIFT_X] / 100.0f;
-        float gyroDriftY = profile->GyroData[DRIFT_Y] / 100.0f;
-        const float gyroSensitivity = profile->GyroData[GYRO_SENSITIVITY];
+        float gyroDriftX = GetProfileValue(profile->GyroData, DRIFT_X) / 100.0f;
+        float gyroDriftY = GetProfileValue(profile->GyroData, DRIFT_Y) / 100.0f;
+        const float gyroSensitivity = GetProfileValue(profile->GyroData, GYRO_SENSITIVITY);
 
         if (gyroDriftX == 0) {
             gyroDriftX = gyroData[0];
@@ -161,9 +164,9 @@ void SDLController::ReadDevice(int32_t portIndex) {
     for (int32_t i = SDL_CONTROLLER_BUTTON_A; i < SDL_CONTROLLER_BUTTON_MAX; i++) {
         if (profile->Mappings.contains(i)) {
             if (SDL_GameControllerGetButton(mController, static_cast<SDL_GameControllerButton>(i))) {
-                GetPressedButtons(portIndex) |= profile->Mappings[i];
+                GetPressedButtons(portIndex) |= GetMapping(*profile, i);
             } else {
-                GetPressedButtons(portIndex) &= ~profile->Mappings[i];
+                GetPressedButtons(portIndex) &= ~GetMapping(*profile, i);
             }
         }
     }
@@ -178,10 +181,10 @@ void SDLController::ReadDevice(int32_t portIndex) {
         const auto axis = static_cast<SDL_GameControllerAxis>(i);
         const auto posScancode = i | AXIS_SCANCODE_BIT;
         const auto negScancode = -posScancode;
-        const auto axisMinimumPress = profile->AxisMinimumPress[i];
-        const auto axisDeadzone = profile->AxisDeadzones[i];
-        const auto posButton = profile->Mappings[posScancode];
-        const auto negButton = profile->Mappings[negScancode];
+        const auto axisMinimumPress = GetProfileValue(profile->AxisMinimumPress, i);
+        const auto axisDeadzone = GetProfileValue(profile->AxisDeadzones, i);
+        const auto posButton = GetMapping(*profile, posScancode);
+        const auto negButton = GetMapping(*profile, negScancode);
         const auto axisValue = SDL_GameControllerGetAxis(mController, axis);
 
 #ifdef TARGET_WEB
@@ -302,6 +305,7 @@ void SDLController::ReadDevice(int32_t portIndex) {
 }
 
 int32_t SDLController::SetRumble(int32_t portIndex, bool rumble) {
+    const auto lock = Context::GetInstance()->GetControlDeck()->LockDevices();
     if (!CanRumble()) {
         return -1000;
     }
@@ -320,6 +324,7 @@ int32_t SDLController::SetRumble(int32_t portIndex, bool rumble) {
 }
 
 int32_t SDLController::SetLedColor(int32_t portIndex, Color_RGB8 color) {
+    const auto lock = Context::GetInstance()->GetControlDeck()->LockDevices();
     if (!CanSetLed()) {
         return -1000;
     }
@@ -330,8 +335,9 @@ int32_t SDLController::SetLedColor(int32_t portIndex, Color_RGB8 color) {
 
 const std::string SDLController::GetButtonName(int32_t portIndex, int32_t n64bitmask) {
     char buffer[50];
+    const auto lock = Context::GetInstance()->GetControlDeck()->LockDevices();
     // OTRTODO: This should get the scancode of all bits in the mask.
-    std::map<int32_t, int32_t>& mappings = GetProfile(portIndex)->Mappings;
+    const std::map<int32_t, int32_t>& mappings = GetProfile(portIndex)->Mappings;
 
     const auto find =
         std::find_if(mappings.begin(), mappings.end(),
@@ -0,0 +1,54 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+#ifdef LUS_ALLOCATION_COUNTER
+static thread_local uint64_t sThreadAllocations = 0;
+
+void* operator new(size_t size) {
+    sThreadAllocations++;
+    void* ptr = malloc(size != 0 ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
+#endif
+
+namespace LUS {
+uint64_t GetThreadAllocationCount() {
+#ifdef LUS_ALLOCATION_COUNTER
+    return sThreadAllocations;
+#else
+    return 0;
+#endif
+}
+
+bool IsAllocationCounterEnabled() {
+#ifdef LUS_ALLOCATION_COUNTER
+    return true;
+#else
+    return false;
+#endif
+}
+} // namespace LUS
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace LUS {
+// Number of operator new calls made by the calling thread so far. Builds configured with ENABLE_ALLOCATION_COUNTER
+// replace the global operator new to count them, other builds always return 0.
+uint64_t GetThreadAllocationCount();
+bool IsAllocationCounterEnabled();
+} // namespace LUS
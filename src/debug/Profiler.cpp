@@ -0,0 +1,150 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <spdlog/spdlog.h>
+
+#define PROFILER_EVENTS_PER_THREAD 65536 // must be a power of two
+
+namespace LUS {
+namespace {
+struct ProfileEvent {
+    const char* Name;
+    uint64_t Start;
+    uint64_t End;
+};
+
+// Single producer ring, only the owning thread writes. Readers copy it out and drop whatever the writer may have
+// overwritten while they were copying.
+struct ThreadEvents {
+    std::unique_ptr<ProfileEvent[]> Events = std::make_unique<ProfileEvent[]>(PROFILER_EVENTS_PER_THREAD);
+    std::atomic<uint64_t> Head = 0;
+    uint32_t ThreadId = 0;
+    std::string Name;
+};
+
+std::mutex sThreadsMutex;
+std::vector<std::shared_ptr<ThreadEvents>> sThreads;
+std::atomic<uint64_t> sCaptureStart = 0;
+std::atomic<uint64_t> sCaptureEnd = 0;
+thread_local std::shared_ptr<ThreadEvents> sThreadEvents;
+
+ThreadEvents* GetThreadEvents() {
+    if (sThreadEvents == nullptr) {
+        auto events = std::make_shared<ThreadEvents>();
+        const std::lock_guard<std::mutex> lock(sThreadsMutex);
+        events->ThreadId = static_cast<uint32_t>(sThreads.size()) + 1;
+        events->Name = "Thread " + std::to_string(events->ThreadId);
+        sThreads.push_back(events);
+        sThreadEvents = events;
+    }
+    return sThreadEvents.get();
+}
+
+void WriteEscaped(std::ofstream& file, const char* str) {
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\') {
+            file << '\\';
+        }
+        file << *str;
+    }
+}
+} // namespace
+
+uint64_t Profiler::Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void Profiler::Start() {
+    sCaptureStart = Now();
+    sCaptureEnd = UINT64_MAX;
+    mCapturing = true;
+}
+
+void Profiler::Stop() {
+    mCapturing = false;
+    sCaptureEnd = Now();
+}
+
+void Profiler::SetThreadName(const char* name) {
+    ThreadEvents* events = GetThreadEvents();
+    const std::lock_guard<std::mutex> lock(sThreadsMutex);
+    events->Name = name;
+}
+
+void Profiler::Record(const char* name, uint64_t start, uint64_t end) {
+    ThreadEvents* events = GetThreadEvents();
+    const uint64_t head = events->Head.load(std::memory_order_relaxed);
+    events->Events[head & (PROFILER_EVENTS_PER_THREAD - 1)] = { name, start, end };
+    events->Head.store(head + 1, std::memory_order_release);
+}
+
+bool Profiler::WriteChromeTrace(const std::string& filePath) {
+    std::vector<std::shared_ptr<ThreadEvents>> threads;
+    {
+        const std::lock_guard<std::mutex> lock(sThreadsMutex);
+        threads = sThreads;
+    }
+
+    std::ofstream file(filePath, std::ios::out | std::ios::trunc);
+    if (!file) {
+        SPDLOG_ERROR("Failed to open {} for the profiler trace", filePath);
+        return false;
+    }
+
+    const uint64_t captureStart = sCaptureStart;
+    const uint64_t captureEnd = sCaptureEnd;
+    std::vector<ProfileEvent> events;
+    size_t written = 0;
+    file << "{\"traceEvents\":[";
+    file.setf(std::ios::fixed);
+    file.precision(3);
+    for (const auto& thread : threads) {
+        events.clear();
+        const uint64_t head = thread->Head.load(std::memory_order_acquire);
+        const uint64_t first = head > PROFILER_EVENTS_PER_THREAD ? head - PROFILER_EVENTS_PER_THREAD : 0;
+        for (uint64_t i = first; i < head; i++) {
+            events.push_back(thread->Events[i & (PROFILER_EVENTS_PER_THREAD - 1)]);
+        }
+        const uint64_t after = thread->Head.load(std::memory_order_acquire);
+        // The writer fills slot after & mask before publishing after + 1, so that slot's old event is gone too.
+        const uint64_t overwritten =
+            after + 1 > PROFILER_EVENTS_PER_THREAD ? after + 1 - PROFILER_EVENTS_PER_THREAD : 0;
+        const uint64_t valid = std::max(first, overwritten);
+        events.erase(events.begin(), events.begin() + std::min<uint64_t>(events.size(), valid - first));
+
+        file << (written++ > 0 ? "," : "") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+             << thread->ThreadId << ",\"args\":{\"name\":\"";
+        {
+            const std::lock_guard<std::mutex> lock(sThreadsMutex);
+            WriteEscaped(file, thread->Name.c_str());
+        }
+        file << "\"}}";
+
+        for (const auto& event : events) {
+            if (event.Start < captureStart || event.End > captureEnd) {
+                continue;
+            }
+            file << ",\n{\"name\":\"";
+            WriteEscaped(file, event.Name);
+            file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->ThreadId
+                 << ",\"ts\":" << (event.Start - captureStart) / 1000.0
+                 << ",\"dur\":" << (event.End - event.Start) / 1000.0 << "}";
+            written++;
+        }
+    }
+    file << "\n]}\n";
+
+    if (!file) {
+        SPDLOG_ERROR("Failed to write the profiler trace to {}", filePath);
+        return false;
+    }
+    SPDLOG_INFO("Wrote {} profiler events to {}", written - threads.size(), filePath);
+    return true;
+}
+} // namespace LUS
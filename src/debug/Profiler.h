@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace LUS {
+// Records named time ranges into per-thread ring buffers that can be exported as a Chrome trace, viewable in
+// chrome://tracing or ui.perfetto.dev. Zones are only recorded while a capture is running, otherwise a zone costs a
+// single relaxed load. Zone names must be string literals, only the pointer is stored.
+class Profiler {
+  public:
+    static void Start();
+    static void Stop();
+    static bool WriteChromeTrace(const std::string& filePath);
+    static void SetThreadName(const char* name);
+
+    static bool IsCapturing() {
+        return mCapturing.load(std::memory_order_relaxed);
+    }
+    static uint64_t Now();
+    static void Record(const char* name, uint64_t start, uint64_t end);
+
+  private:
+    static inline std::atomic<bool> mCapturing = false;
+};
+
+class ProfileZone {
+  public:
+    explicit ProfileZone(const char* name) : mName(name), mActive(Profiler::IsCapturing()) {
+        if (mActive) {
+            mStart = Profiler::Now();
+        }
+    }
+    ~ProfileZone() {
+        if (mActive) {
+            Profiler::Record(mName, mStart, Profiler::Now());
+        }
+    }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+  private:
+    const char* mName;
+    bool mActive;
+    uint64_t mStart = 0;
+};
+} // namespace LUS
+
+// Define LUS_PROFILER_DISABLED (cmake -DENABLE_PROFILER=OFF) to compile every zone out.
+#ifndef LUS_PROFILER_DISABLED
+#define LUS_PROFILE_CONCAT_INNER(a, b) a##b
+#define LUS_PROFILE_CONCAT(a, b) LUS_PROFILE_CONCAT_INNER(a, b)
+#define LUS_PROFILE_SCOPE(name) LUS::ProfileZone LUS_PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define LUS_PROFILE_SCOPE(name)
+#endif
@@ -53,6 +53,10 @@ enum {
 #define SHADER_OPT_TEXEL1_MASK (1 << 13)
 #define SHADER_OPT_TEXEL0_BLEND (1 << 14)
 #define SHADER_OPT_TEXEL1_BLEND (1 << 15)
+#define SHADER_OPT_GPU_TRANSFORM (1 << 16)
+// Input number (1-7) the shade colour and shade alpha occupy, 0 if unused. Only with SHADER_OPT_GPU_TRANSFORM.
+#define SHADER_OPT_SHADE_RGB_SHIFT 17
+#define SHADER_OPT_SHADE_ALPHA_SHIFT 20
 
 struct ColorCombinerKey {
     uint64_t combine_mode;
@@ -78,6 +82,8 @@ struct CCFeatures {
     bool opt_alpha_threshold;
     bool opt_invisible;
     bool opt_grayscale;
+    bool opt_gpu_transform;
+    uint8_t shade_input[2]; // rgb, alpha
     bool used_textures[2];
     bool used_masks[2];
     bool used_blend[2];
@@ -1103,6 +1103,9 @@ struct GfxRenderingAPI gfx_direct3d11_api = { gfx_d3d11_get_name,
                                               gfx_d3d11_new_texture,
                                               gfx_d3d11_select_texture,
                                               gfx_d3d11_upload_texture,
+                                              nullptr,
+                                              nullptr,
+                                              nullptr,
                                               gfx_d3d11_set_sampler_parameters,
                                               gfx_d3d11_set_depth_test_and_mask,
                                               gfx_d3d11_set_zmode_decal,
@@ -1110,6 +1113,8 @@ struct GfxRenderingAPI gfx_direct3d11_api = { gfx_d3d11_get_name,
                                               gfx_d3d11_set_scissor,
                                               gfx_d3d11_set_use_alpha,
                                               gfx_d3d11_draw_triangles,
+                                              nullptr,
+                                              nullptr,
                                               gfx_d3d11_init,
                                               gfx_d3d11_on_resize,
                                               gfx_d3d11_start_frame,
@@ -840,6 +840,9 @@ struct GfxRenderingAPI gfx_gx2_api = { gfx_gx2_get_name,
                                        gfx_gx2_new_texture,
                                        gfx_gx2_select_texture,
                                        gfx_gx2_upload_texture,
+                                       nullptr,
+                                       nullptr,
+                                       nullptr,
                                        gfx_gx2_set_sampler_parameters,
                                        gfx_gx2_set_depth_test_and_mask,
                                        gfx_gx2_set_zmode_decal,
@@ -847,6 +850,8 @@ struct GfxRenderingAPI gfx_gx2_api = { gfx_gx2_get_name,
                                        gfx_gx2_set_scissor,
                                        gfx_gx2_set_use_alpha,
                                        gfx_gx2_draw_triangles,
+                                       nullptr,
+                                       nullptr,
                                        gfx_gx2_init,
                                        gfx_gx2_on_resize,
                                        gfx_gx2_start_frame,
@@ -1041,6 +1041,9 @@ struct GfxRenderingAPI gfx_metal_api = { gfx_metal_get_name,
                                          gfx_metal_new_texture,
                                          gfx_metal_select_texture,
                                          gfx_metal_upload_texture,
+                                         nullptr,
+                                         nullptr,
+                                         nullptr,
                                          gfx_metal_set_sampler_parameters,
                                          gfx_metal_set_depth_test_and_mask,
                                          gfx_metal_set_zmode_decal,
@@ -1048,6 +1051,8 @@ struct GfxRenderingAPI gfx_metal_api = { gfx_metal_get_name,
                                          gfx_metal_set_scissor,
                                          gfx_metal_set_use_alpha,
                                          gfx_metal_draw_triangles,
+                                         nullptr,
+                                         nullptr,
                                          gfx_metal_init,
                                          gfx_metal_on_resize,
                                          gfx_metal_start_frame,
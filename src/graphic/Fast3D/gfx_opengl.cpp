@@ -60,6 +60,14 @@ struct ShaderProgram {
     uint8_t num_attribs;
     GLint frame_count_location;
     GLint noise_scale_location;
+
+    // SHADER_OPT_GPU_TRANSFORM uniforms
+    bool gpu_transform;
+    GLint mtx_location;
+    GLint lighting_location, texgen_location, texgen_linear_location, fog_enabled_location;
+    GLint num_lights_location, light_dir_location, light_color_location, ambient_color_location;
+    GLint lookat_location, tex_scaling_location, fog_params_location, fog_color_location;
+    GLint tex_transform_locations[2];
 };
 
 struct Framebuffer {
@@ -73,10 +81,13 @@ struct Framebuffer {
 
 static map<pair<uint64_t, uint32_t>, struct ShaderProgram> shader_program_pool;
 static GLuint opengl_vbo;
+static GLuint opengl_ibo;
 #ifdef __APPLE__
 static GLuint opengl_vao;
 #endif
 static bool current_depth_mask;
+static struct ShaderProgram* current_shader_program;
+static bool opengl_texture_swizzle; // GL 3.3, needed to sample the narrow upload formats
 
 static uint32_t frame_count;
 
@@ -130,6 +141,7 @@ static void gfx_opengl_unload_shader(struct ShaderProgram* old_prg) {
 static void gfx_opengl_load_shader(struct ShaderProgram* new_prg) {
     // if (!new_prg) return;
     glUseProgram(new_prg->opengl_program_id);
+    current_shader_program = new_prg;
     gfx_opengl_vertex_array_set_attribs(new_prg);
     gfx_opengl_set_uniforms(new_prg);
 }
@@ -147,6 +159,133 @@ static void append_line(char* buf, size_t* len, const char* str) {
     buf[(*len)++] = '\n';
 }
 
+// Vertex shader for SHADER_OPT_GPU_TRANSFORM, a port of the transform, lighting, texgen and fog math in gfx_sp_vertex.
+// aVtxPos holds the model space position and the matrix palette slot, aVtxShade the vertex colour or normal.
+static size_t append_gpu_transform_vertex_shader(char* buf, size_t* len, const struct CCFeatures& cc_features) {
+#ifdef __APPLE__
+    const char* attribute = "in";
+    const char* varying = "out";
+    append_line(buf, len, "#version 410 core");
+#else
+    const char* attribute = "attribute";
+    const char* varying = "varying";
+    append_line(buf, len, "#version 110");
+#endif
+    const bool uses_texture = cc_features.used_textures[0] || cc_features.used_textures[1];
+    size_t num_floats = 8;
+
+    *len += sprintf(buf + *len, "%s vec4 aVtxPos;\n", attribute);
+    *len += sprintf(buf + *len, "%s vec4 aVtxShade;\n", attribute);
+    if (uses_texture) {
+        *len += sprintf(buf + *len, "%s vec2 aTexCoord;\n", attribute);
+        num_floats += 2;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (cc_features.used_textures[i]) {
+            *len += sprintf(buf + *len, "%s vec2 vTexCoord%d;\n", varying, i);
+            *len += sprintf(buf + *len, "uniform vec4 uTexTransform%d;\n", i);
+            for (int j = 0; j < 2; j++) {
+                if (cc_features.clamp[i][j]) {
+                    *len += sprintf(buf + *len, "%s float aTexClamp%s%d;\n", attribute, j == 0 ? "S" : "T", i);
+                    *len += sprintf(buf + *len, "%s float vTexClamp%s%d;\n", varying, j == 0 ? "S" : "T", i);
+                    num_floats += 1;
+                }
+            }
+        }
+    }
+    if (cc_features.opt_fog) {
+        *len += sprintf(buf + *len, "%s vec4 vFog;\n", varying);
+    }
+    if (cc_features.opt_grayscale) {
+        *len += sprintf(buf + *len, "%s vec4 aGrayscaleColor;\n", attribute);
+        *len += sprintf(buf + *len, "%s vec4 vGrayscaleColor;\n", varying);
+        num_floats += 4;
+    }
+    for (int i = 0; i < cc_features.num_inputs; i++) {
+        *len += sprintf(buf + *len, "%s vec%d aInput%d;\n", attribute, cc_features.opt_alpha ? 4 : 3, i + 1);
+        *len += sprintf(buf + *len, "%s vec%d vInput%d;\n", varying, cc_features.opt_alpha ? 4 : 3, i + 1);
+        num_floats += cc_features.opt_alpha ? 4 : 3;
+    }
+
+    *len += sprintf(buf + *len, "uniform mat4 uMtx[%d];\n", GFX_VERTEX_MAX_MATRICES);
+    append_line(buf, len, "uniform bool uLighting;");
+    append_line(buf, len, "uniform bool uTexGen;");
+    append_line(buf, len, "uniform bool uTexGenLinear;");
+    append_line(buf, len, "uniform bool uFogEnabled;");
+    append_line(buf, len, "uniform int uNumLights;");
+    *len += sprintf(buf + *len, "uniform vec3 uLightDir[%d];\n", GFX_VERTEX_MAX_LIGHTS);
+    *len += sprintf(buf + *len, "uniform vec3 uLightColor[%d];\n", GFX_VERTEX_MAX_LIGHTS);
+    append_line(buf, len, "uniform vec3 uAmbientColor;");
+    append_line(buf, len, "uniform vec3 uLookAt[2];");
+    append_line(buf, len, "uniform vec2 uTexScaling;");
+    append_line(buf, len, "uniform vec2 uFogParams;");
+    append_line(buf, len, "uniform vec3 uFogColor;");
+
+    append_line(buf, len, "void main() {");
+    append_line(buf, len, "vec4 pos = uMtx[int(aVtxPos.w)] * vec4(aVtxPos.xyz, 1.0);");
+    append_line(buf, len, "vec4 shade = aVtxShade;");
+    if (uses_texture) {
+        append_line(buf, len, "vec2 uv = aTexCoord;");
+    }
+    append_line(buf, len, "if (uLighting) {");
+    append_line(buf, len, "    vec3 col = uAmbientColor;");
+    *len += sprintf(buf + *len, "    for (int i = 0; i < %d; i++) {\n", GFX_VERTEX_MAX_LIGHTS);
+    append_line(buf, len, "        if (i >= uNumLights) break;");
+    append_line(buf, len, "        float intensity = dot(aVtxShade.xyz, uLightDir[i]);");
+    append_line(buf, len, "        if (intensity > 0.0) col = floor(col + intensity * uLightColor[i]);");
+    append_line(buf, len, "    }");
+    append_line(buf, len, "    shade.rgb = min(col, 255.0) / 255.0;");
+    if (uses_texture) {
+        append_line(buf, len, "    if (uTexGen) {");
+        append_line(buf, len, "        vec2 d = clamp(vec2(dot(aVtxShade.xyz, uLookAt[0]), "
+                              "dot(aVtxShade.xyz, uLookAt[1])), -1.0, 1.0);");
+        append_line(buf, len, "        d = uTexGenLinear ? vec2(acos(-d.x), acos(-d.y)) / 4.0 : (d + 1.0) / 4.0;");
+        append_line(buf, len, "        uv = floor(d * uTexScaling);");
+        append_line(buf, len, "    }");
+    }
+    append_line(buf, len, "}");
+    append_line(buf, len, "if (uFogEnabled) {");
+    append_line(buf, len, "    float w = abs(pos.w) < 0.001 ? 0.001 : pos.w;");
+    append_line(buf, len, "    float winv = 1.0 / w;");
+    append_line(buf, len, "    if (winv < 0.0) winv = 32767.0;");
+    append_line(buf, len, "    float fog = clamp(pos.z * winv * uFogParams.x + uFogParams.y, 0.0, 255.0);");
+    append_line(buf, len, "    shade.a = floor(fog) / 255.0;");
+    append_line(buf, len, "}");
+
+    for (int i = 0; i < 2; i++) {
+        if (cc_features.used_textures[i]) {
+            *len += sprintf(buf + *len, "vTexCoord%d = uv * uTexTransform%d.xy + uTexTransform%d.zw;\n", i, i, i);
+            for (int j = 0; j < 2; j++) {
+                if (cc_features.clamp[i][j]) {
+                    *len += sprintf(buf + *len, "vTexClamp%s%d = aTexClamp%s%d;\n", j == 0 ? "S" : "T", i,
+                                    j == 0 ? "S" : "T", i);
+                }
+            }
+        }
+    }
+    if (cc_features.opt_fog) {
+        append_line(buf, len, "vFog = vec4(uFogColor, shade.a);");
+    }
+    if (cc_features.opt_grayscale) {
+        append_line(buf, len, "vGrayscaleColor = aGrayscaleColor;");
+    }
+    for (int i = 0; i < cc_features.num_inputs; i++) {
+        *len += sprintf(buf + *len, "vInput%d = aInput%d;\n", i + 1, i + 1);
+    }
+    if (cc_features.shade_input[0] != 0) {
+        *len += sprintf(buf + *len, "vInput%d.rgb = shade.rgb;\n", cc_features.shade_input[0]);
+    }
+    if (cc_features.shade_input[1] != 0 && cc_features.opt_alpha) {
+        // Shade alpha is 100% for fog
+        *len += sprintf(buf + *len, "vInput%d.a = %s;\n", cc_features.shade_input[1],
+                        cc_features.opt_fog ? "1.0" : "shade.a");
+    }
+    append_line(buf, len, "gl_Position = pos;");
+    append_line(buf, len, "}");
+
+    return num_floats;
+}
+
 #define RAND_NOISE "((random(vec3(floor(gl_FragCoord.xy * noise_scale), float(frame_count))) + 1.0) / 2.0)"
 
 static const char* shader_item_to_str(uint32_t item, bool with_alpha, bool only_alpha, bool inputs_have_alpha,
@@ -248,99 +387,103 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
     struct CCFeatures cc_features;
     gfx_cc_get_features(shader_id0, shader_id1, &cc_features);
 
-    char vs_buf[1024];
+    char vs_buf[4096];
     char fs_buf[6000];
     size_t vs_len = 0;
     size_t fs_len = 0;
     size_t num_floats = 4;
 
     // Vertex shader
+    if (cc_features.opt_gpu_transform) {
+        num_floats = append_gpu_transform_vertex_shader(vs_buf, &vs_len, cc_features);
+    } else {
 #ifdef __APPLE__
-    append_line(vs_buf, &vs_len, "#version 410 core");
-    append_line(vs_buf, &vs_len, "in vec4 aVtxPos;");
+        append_line(vs_buf, &vs_len, "#version 410 core");
+        append_line(vs_buf, &vs_len, "in vec4 aVtxPos;");
 #else
-    append_line(vs_buf, &vs_len, "#version 110");
-    append_line(vs_buf, &vs_len, "attribute vec4 aVtxPos;");
+        append_line(vs_buf, &vs_len, "#version 110");
+        append_line(vs_buf, &vs_len, "attribute vec4 aVtxPos;");
 #endif
-    for (int i = 0; i < 2; i++) {
-        if (cc_features.used_textures[i]) {
+        for (int i = 0; i < 2; i++) {
+            if (cc_features.used_textures[i]) {
 #ifdef __APPLE__
-            vs_len += sprintf(vs_buf + vs_len, "in vec2 aTexCoord%d;\n", i);
-            vs_len += sprintf(vs_buf + vs_len, "out vec2 vTexCoord%d;\n", i);
+                vs_len += sprintf(vs_buf + vs_len, "in vec2 aTexCoord%d;\n", i);
+                vs_len += sprintf(vs_buf + vs_len, "out vec2 vTexCoord%d;\n", i);
 #else
-            vs_len += sprintf(vs_buf + vs_len, "attribute vec2 aTexCoord%d;\n", i);
-            vs_len += sprintf(vs_buf + vs_len, "varying vec2 vTexCoord%d;\n", i);
+                vs_len += sprintf(vs_buf + vs_len, "attribute vec2 aTexCoord%d;\n", i);
+                vs_len += sprintf(vs_buf + vs_len, "varying vec2 vTexCoord%d;\n", i);
 #endif
-            num_floats += 2;
-            for (int j = 0; j < 2; j++) {
-                if (cc_features.clamp[i][j]) {
+                num_floats += 2;
+                for (int j = 0; j < 2; j++) {
+                    if (cc_features.clamp[i][j]) {
 #ifdef __APPLE__
-                    vs_len += sprintf(vs_buf + vs_len, "in float aTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
-                    vs_len += sprintf(vs_buf + vs_len, "out float vTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
+                        vs_len += sprintf(vs_buf + vs_len, "in float aTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
+                        vs_len += sprintf(vs_buf + vs_len, "out float vTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
 #else
-                    vs_len += sprintf(vs_buf + vs_len, "attribute float aTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
-                    vs_len += sprintf(vs_buf + vs_len, "varying float vTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
+                        vs_len += sprintf(vs_buf + vs_len, "attribute float aTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
+                        vs_len += sprintf(vs_buf + vs_len, "varying float vTexClamp%s%d;\n", j == 0 ? "S" : "T", i);
 #endif
-                    num_floats += 1;
+                        num_floats += 1;
+                    }
                 }
             }
         }
-    }
-    if (cc_features.opt_fog) {
+        if (cc_features.opt_fog) {
 #ifdef __APPLE__
-        append_line(vs_buf, &vs_len, "in vec4 aFog;");
-        append_line(vs_buf, &vs_len, "out vec4 vFog;");
+            append_line(vs_buf, &vs_len, "in vec4 aFog;");
+            append_line(vs_buf, &vs_len, "out vec4 vFog;");
 #else
-        append_line(vs_buf, &vs_len, "attribute vec4 aFog;");
-        append_line(vs_buf, &vs_len, "varying vec4 vFog;");
+            append_line(vs_buf, &vs_len, "attribute vec4 aFog;");
+            append_line(vs_buf, &vs_len, "varying vec4 vFog;");
 #endif
-        num_floats += 4;
-    }
+            num_floats += 4;
+        }
 
-    if (cc_features.opt_grayscale) {
+        if (cc_features.opt_grayscale) {
 #ifdef __APPLE__
-        append_line(vs_buf, &vs_len, "in vec4 aGrayscaleColor;");
-        append_line(vs_buf, &vs_len, "out vec4 vGrayscaleColor;");
+            append_line(vs_buf, &vs_len, "in vec4 aGrayscaleColor;");
+            append_line(vs_buf, &vs_len, "out vec4 vGrayscaleColor;");
 #else
-        append_line(vs_buf, &vs_len, "attribute vec4 aGrayscaleColor;");
-        append_line(vs_buf, &vs_len, "varying vec4 vGrayscaleColor;");
+            append_line(vs_buf, &vs_len, "attribute vec4 aGrayscaleColor;");
+            append_line(vs_buf, &vs_len, "varying vec4 vGrayscaleColor;");
 #endif
-        num_floats += 4;
-    }
+            num_floats += 4;
+        }
 
-    for (int i = 0; i < cc_features.num_inputs; i++) {
+        for (int i = 0; i < cc_features.num_inputs; i++) {
 #ifdef __APPLE__
-        vs_len += sprintf(vs_buf + vs_len, "in vec%d aInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
-        vs_len += sprintf(vs_buf + vs_len, "out vec%d vInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
+            vs_len += sprintf(vs_buf + vs_len, "in vec%d aInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
+            vs_len += sprintf(vs_buf + vs_len, "out vec%d vInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
 #else
-        vs_len += sprintf(vs_buf + vs_len, "attribute vec%d aInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
-        vs_len += sprintf(vs_buf + vs_len, "varying vec%d vInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
+            vs_len += sprintf(vs_buf + vs_len, "attribute vec%d aInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
+            vs_len += sprintf(vs_buf + vs_len, "varying vec%d vInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
 #endif
-        num_floats += cc_features.opt_alpha ? 4 : 3;
-    }
-    append_line(vs_buf, &vs_len, "void main() {");
-    for (int i = 0; i < 2; i++) {
-        if (cc_features.used_textures[i]) {
-            vs_len += sprintf(vs_buf + vs_len, "vTexCoord%d = aTexCoord%d;\n", i, i);
-            for (int j = 0; j < 2; j++) {
-                if (cc_features.clamp[i][j]) {
-                    vs_len += sprintf(vs_buf + vs_len, "vTexClamp%s%d = aTexClamp%s%d;\n", j == 0 ? "S" : "T", i,
-                                      j == 0 ? "S" : "T", i);
+            num_floats += cc_features.opt_alpha ? 4 : 3;
+        }
+        append_line(vs_buf, &vs_len, "void main() {");
+        for (int i = 0; i < 2; i++) {
+            if (cc_features.used_textures[i]) {
+                vs_len += sprintf(vs_buf + vs_len, "vTexCoord%d = aTexCoord%d;\n", i, i);
+                for (int j = 0; j < 2; j++) {
+                    if (cc_features.clamp[i][j]) {
+                        vs_len += sprintf(vs_buf + vs_len, "vTexClamp%s%d = aTexClamp%s%d;\n", j == 0 ? "S" : "T", i,
+                                          j == 0 ? "S" : "T", i);
+                    }
                 }
             }
         }
+        if (cc_features.opt_fog) {
+            append_line(vs_buf, &vs_len, "vFog = aFog;");
+        }
+        if (cc_features.opt_grayscale) {
+            append_line(vs_buf, &vs_len, "vGrayscaleColor = aGrayscaleColor;");
+        }
+        for (int i = 0; i < cc_features.num_inputs; i++) {
+            vs_len += sprintf(vs_buf + vs_len, "vInput%d = aInput%d;\n", i + 1, i + 1);
+        }
+        append_line(vs_buf, &vs_len, "gl_Position = aVtxPos;");
+        append_line(vs_buf, &vs_len, "}");
     }
-    if (cc_features.opt_fog) {
-        append_line(vs_buf, &vs_len, "vFog = aFog;");
-    }
-    if (cc_features.opt_grayscale) {
-        append_line(vs_buf, &vs_len, "vGrayscaleColor = aGrayscaleColor;");
-    }
-    for (int i = 0; i < cc_features.num_inputs; i++) {
-        vs_len += sprintf(vs_buf + vs_len, "vInput%d = aInput%d;\n", i + 1, i + 1);
-    }
-    append_line(vs_buf, &vs_len, "gl_Position = aVtxPos;");
-    append_line(vs_buf, &vs_len, "}");
 
     // Fragment shader
 #ifdef __APPLE__
@@ -624,13 +767,28 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
     prg->attrib_sizes[cnt] = 4;
     ++cnt;
 
+    if (cc_features.opt_gpu_transform) {
+        prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aVtxShade");
+        prg->attrib_sizes[cnt] = 4;
+        ++cnt;
+
+        // Both textures derive their coordinates from the same vertex uv
+        if (cc_features.used_textures[0] || cc_features.used_textures[1]) {
+            prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aTexCoord");
+            prg->attrib_sizes[cnt] = 2;
+            ++cnt;
+        }
+    }
+
     for (int i = 0; i < 2; i++) {
         if (cc_features.used_textures[i]) {
             char name[32];
-            sprintf(name, "aTexCoord%d", i);
-            prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, name);
-            prg->attrib_sizes[cnt] = 2;
-            ++cnt;
+            if (!cc_features.opt_gpu_transform) {
+                sprintf(name, "aTexCoord%d", i);
+                prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, name);
+                prg->attrib_sizes[cnt] = 2;
+                ++cnt;
+            }
 
             for (int j = 0; j < 2; j++) {
                 if (cc_features.clamp[i][j]) {
@@ -643,7 +801,7 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
         }
     }
 
-    if (cc_features.opt_fog) {
+    if (cc_features.opt_fog && !cc_features.opt_gpu_transform) {
         prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aFog");
         prg->attrib_sizes[cnt] = 4;
         ++cnt;
@@ -704,6 +862,25 @@ static struct ShaderProgram* gfx_opengl_create_and_load_new_shader(uint64_t shad
     prg->frame_count_location = glGetUniformLocation(shader_program, "frame_count");
     prg->noise_scale_location = glGetUniformLocation(shader_program, "noise_scale");
 
+    prg->gpu_transform = cc_features.opt_gpu_transform;
+    if (prg->gpu_transform) {
+        prg->mtx_location = glGetUniformLocation(shader_program, "uMtx");
+        prg->lighting_location = glGetUniformLocation(shader_program, "uLighting");
+        prg->texgen_location = glGetUniformLocation(shader_program, "uTexGen");
+        prg->texgen_linear_location = glGetUniformLocation(shader_program, "uTexGenLinear");
+        prg->fog_enabled_location = glGetUniformLocation(shader_program, "uFogEnabled");
+        prg->num_lights_location = glGetUniformLocation(shader_program, "uNumLights");
+        prg->light_dir_location = glGetUniformLocation(shader_program, "uLightDir");
+        prg->light_color_location = glGetUniformLocation(shader_program, "uLightColor");
+        prg->ambient_color_location = glGetUniformLocation(shader_program, "uAmbientColor");
+        prg->lookat_location = glGetUniformLocation(shader_program, "uLookAt");
+        prg->tex_scaling_location = glGetUniformLocation(shader_program, "uTexScaling");
+        prg->fog_params_location = glGetUniformLocation(shader_program, "uFogParams");
+        prg->fog_color_location = glGetUniformLocation(shader_program, "uFogColor");
+        prg->tex_transform_locations[0] = glGetUniformLocation(shader_program, "uTexTransform0");
+        prg->tex_transform_locations[1] = glGetUniformLocation(shader_program, "uTexTransform1");
+    }
+
     return prg;
 }
 
@@ -733,8 +910,54 @@ static void gfx_opengl_select_texture(int tile, GLuint texture_id) {
     glBindTexture(GL_TEXTURE_2D, texture_id);
 }
 
+static const GLint opengl_swizzle_rgba[] = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
+static const GLint opengl_swizzle_la[] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+static const GLint opengl_swizzle_l[] = { GL_RED, GL_RED, GL_RED, GL_RED };
+
 static void gfx_opengl_upload_texture(const uint8_t* rgba32_buf, uint32_t width, uint32_t height) {
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba32_buf);
+    if (opengl_texture_swizzle) {
+        // Texture names are reused, so undo the swizzle of a previous luminance upload
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, opengl_swizzle_rgba);
+    }
+}
+
+static uint32_t gfx_opengl_get_supported_pixel_formats(void) {
+    if (!opengl_texture_swizzle) {
+        return 0;
+    }
+    return (1 << GFX_PIXEL_FORMAT_RGBA5551) | (1 << GFX_PIXEL_FORMAT_LA8) | (1 << GFX_PIXEL_FORMAT_L8);
+}
+
+static void gfx_opengl_upload_texture_format(const uint8_t* buf, enum GfxPixelFormat format, uint32_t width,
+                                             uint32_t height) {
+    const GLint* swizzle = opengl_swizzle_rgba;
+
+    // Rows of the narrow formats are tightly packed and may not be 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    switch (format) {
+        case GFX_PIXEL_FORMAT_RGBA8:
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+            break;
+        case GFX_PIXEL_FORMAT_RGBA5551:
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, width, height, 0, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, buf);
+            break;
+        case GFX_PIXEL_FORMAT_LA8:
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, width, height, 0, GL_RG, GL_UNSIGNED_BYTE, buf);
+            swizzle = opengl_swizzle_la;
+            break;
+        case GFX_PIXEL_FORMAT_L8:
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, buf);
+            swizzle = opengl_swizzle_l;
+            break;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+}
+
+static void gfx_opengl_upload_sub_texture(const uint8_t* rgba32_buf, uint32_t x, uint32_t y, uint32_t width,
+                                          uint32_t height) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba32_buf);
 }
 
 #ifdef __SWITCH__
@@ -831,6 +1054,43 @@ static void gfx_opengl_draw_triangles(float buf_vbo[], size_t buf_vbo_len, size_
     glDrawArrays(GL_TRIANGLES, 0, 3 * buf_vbo_num_tris);
 }
 
+static void gfx_opengl_draw_indexed_triangles(float buf_vbo[], size_t buf_vbo_len, uint16_t buf_ibo[],
+                                              size_t buf_ibo_len, size_t buf_vbo_num_tris) {
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * buf_vbo_len, buf_vbo, GL_STREAM_DRAW);
+    // Bound per draw, other GL users such as the ImGui backend may change the element buffer binding
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, opengl_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * buf_ibo_len, buf_ibo, GL_STREAM_DRAW);
+    glDrawElements(GL_TRIANGLES, buf_ibo_len, GL_UNSIGNED_SHORT, 0);
+}
+
+static void gfx_opengl_set_vertex_transform(const struct GfxVertexTransform* transform) {
+    struct ShaderProgram* prg = current_shader_program;
+    if (prg == NULL || !prg->gpu_transform) {
+        return;
+    }
+
+    const struct GfxVertexLighting* lighting = &transform->lighting;
+    glUniformMatrix4fv(prg->mtx_location, transform->num_matrices, GL_FALSE, &transform->matrices[0][0][0]);
+    glUniform1i(prg->lighting_location, lighting->lighting);
+    glUniform1i(prg->texgen_location, lighting->texgen);
+    glUniform1i(prg->texgen_linear_location, lighting->texgen_linear);
+    glUniform1i(prg->fog_enabled_location, lighting->fog);
+    if (lighting->lighting) {
+        glUniform1i(prg->num_lights_location, lighting->num_lights);
+        if (lighting->num_lights > 0) {
+            glUniform3fv(prg->light_dir_location, lighting->num_lights, &lighting->light_dirs[0][0]);
+            glUniform3fv(prg->light_color_location, lighting->num_lights, &lighting->light_colors[0][0]);
+        }
+        glUniform3fv(prg->ambient_color_location, 1, lighting->ambient_color);
+        glUniform3fv(prg->lookat_location, 2, &lighting->lookat[0][0]);
+        glUniform2fv(prg->tex_scaling_location, 1, lighting->texture_scaling);
+    }
+    glUniform2f(prg->fog_params_location, lighting->fog_mul, lighting->fog_offset);
+    glUniform3fv(prg->fog_color_location, 1, transform->fog_color);
+    glUniform4fv(prg->tex_transform_locations[0], 1, transform->tex_transform[0]);
+    glUniform4fv(prg->tex_transform_locations[1], 1, transform->tex_transform[1]);
+}
+
 static void gfx_opengl_init(void) {
 #ifndef __SWITCH__
     glewInit();
@@ -838,6 +1098,13 @@ static void gfx_opengl_init(void) {
 
     glGenBuffers(1, &opengl_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, opengl_vbo);
+    glGenBuffers(1, &opengl_ibo);
+
+    // Legacy contexts don't know GL_MAJOR_VERSION and leave the values untouched
+    GLint major_version = 0, minor_version = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major_version);
+    glGetIntegerv(GL_MINOR_VERSION, &minor_version);
+    opengl_texture_swizzle = major_version > 3 || (major_version == 3 && minor_version >= 3);
 
 #ifdef __APPLE__
     glGenVertexArrays(1, &opengl_vao);
@@ -1082,6 +1349,9 @@ struct GfxRenderingAPI gfx_opengl_api = { gfx_opengl_get_name,
                                           gfx_opengl_new_texture,
                                           gfx_opengl_select_texture,
                                           gfx_opengl_upload_texture,
+                                          gfx_opengl_upload_sub_texture,
+                                          gfx_opengl_get_supported_pixel_formats,
+                                          gfx_opengl_upload_texture_format,
                                           gfx_opengl_set_sampler_parameters,
                                           gfx_opengl_set_depth_test_and_mask,
                                           gfx_opengl_set_zmode_decal,
@@ -1089,6 +1359,8 @@ struct GfxRenderingAPI gfx_opengl_api = { gfx_opengl_get_name,
                                           gfx_opengl_set_scissor,
                                           gfx_opengl_set_use_alpha,
                                           gfx_opengl_draw_triangles,
+                                          gfx_opengl_draw_indexed_triangles,
+                                          gfx_opengl_set_vertex_transform,
                                           gfx_opengl_init,
                                           gfx_opengl_on_resize,
                                           gfx_opengl_start_frame,
@@ -13,7 +13,16 @@
 #include <unordered_map>
 #include <vector>
 #include <list>
-#include <stack>
+#include <atomic>
+#include <cstddef>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GFX_MATRIX_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#define GFX_MATRIX_NEON
+#include <arm_neon.h>
+#endif
 
 #ifndef _LANGUAGE_C
 #define _LANGUAGE_C
@@ -31,16 +40,20 @@
 #include "gfx_screen_config.h"
 
 #include "log/luslog.h"
+#include "log/LogRateLimiter.h"
 #include "window/gui/Gui.h"
 #include "resource/GameVersions.h"
 #include "resource/Resource.h"
 #include "resource/ResourceManager.h"
 #include "resource/type/Texture.h"
 #include "utils/Utils.h"
+#include "debug/AllocationCounter.h"
+#include "debug/Profiler.h"
 #include "libultraship/libultraship.h"
 
 uintptr_t gfxFramebuffer;
-std::stack<std::string> currentDir;
+// Borrowed from display lists or copied into the frame arena, cleared at the end of each frame
+static std::vector<std::string_view> currentDir;
 
 using namespace std;
 
@@ -69,6 +82,12 @@ using namespace std;
 
 #define TEXTURE_CACHE_MAX_SIZE 500
 
+#define TEXTURE_ATLAS_PAGE_SIZE 512
+#define TEXTURE_ATLAS_MAX_PAGES 4
+#define TEXTURE_ATLAS_MAX_TEXTURE_SIZE 64
+// Edge texels are repeated into a one texel border so filtering never reads a neighbouring texture
+#define TEXTURE_ATLAS_PADDING 1
+
 struct RGBA {
     uint8_t r, g, b, a;
 };
@@ -78,6 +97,14 @@ struct LoadedVertex {
     float u, v;
     struct RGBA color;
     uint8_t clip_rej;
+    // GPU transform path: the model space input, x/y/z/w and clip_rej are only computed when the CPU needs them
+    bool has_clip_pos;
+    uint8_t cn[4]; // colour or normal
+    float ob[3];
+    uint32_t gpu_matrix, gpu_lighting; // indices into gpu_vertex.matrices and gpu_vertex.lighting
+    // Slot of this vertex in buf_vbo, valid while buf_generation matches buf_vbo_generation
+    uint32_t buf_generation;
+    uint16_t buf_index;
 };
 
 static struct {
@@ -86,6 +113,28 @@ static struct {
     vector<uint32_t> free_texture_ids;
 } gfx_texture_cache;
 
+// Small textures drawn by texture rectangles (gTextureAtlas) are packed into shared pages, so runs of HUD and font
+// rectangles that switch textures keep batching into one draw call. Pages are filled shelf by shelf and only reset
+// once every texture on them has left the texture cache.
+struct TextureAtlasPage {
+    uint32_t texture_id;
+    uint16_t shelf_x, shelf_y, shelf_height;
+    uint32_t num_textures;
+    uint8_t cms, cmt;
+    bool linear_filter;
+};
+
+static struct {
+    bool enabled;
+    vector<struct TextureAtlasPage> pages;
+    vector<uint8_t> upload_buffer;
+    TextureCacheNode* import_node; // entry whose pixels the current import places in the atlas
+    int import_tile;
+
+    uint32_t draw_calls, draw_calls_saved;
+    struct GfxTextureAtlasStats last_frame_stats;
+} texture_atlas;
+
 struct ColorCombiner {
     uint64_t shader_id0;
     uint32_t shader_id1;
@@ -98,6 +147,7 @@ static map<ColorCombinerKey, struct ColorCombiner> color_combiner_pool;
 static map<ColorCombinerKey, struct ColorCombiner>::iterator prev_combiner = color_combiner_pool.end();
 
 static uint8_t* tex_upload_buffer = nullptr;
+static uint32_t supported_pixel_formats; // (1 << GfxPixelFormat) accepted by gfx_rapi->upload_texture_format
 
 static struct RSP {
     float modelview_matrix_stack[11][4][4];
@@ -105,6 +155,7 @@ static struct RSP {
 
     float MP_matrix[4][4];
     float P_matrix[4][4];
+    bool MP_matrix_dirty; // recomputed when vertices are loaded, see gfx_sp_update_mp_matrix
 
     Light_t lookat[2];
     Light_t current_lights[MAX_LIGHTS + 1];
@@ -152,6 +203,8 @@ static struct RDP {
         struct RawTexMetadata raw_tex_metadata;
         bool masked;
         bool blended;
+        const uint8_t* blend_mask;
+        const uint8_t* blend_replacement;
     } loaded_texture[2];
     struct {
         uint8_t fmt;
@@ -176,6 +229,7 @@ static struct RDP {
     struct RGBA env_color, prim_color, fog_color, fill_color, grayscale_color;
     struct XYWidthHeight viewport, scissor;
     bool viewport_or_scissor_changed;
+    bool draw_state_changed;
     void* z_buf_address;
     void* color_image_address;
 } rdp;
@@ -187,8 +241,54 @@ static struct RenderingState {
     struct XYWidthHeight viewport, scissor;
     struct ShaderProgram* shader_program;
     TextureCacheNode* textures[SHADER_MAX_TEXTURES];
+    int16_t atlas_pages[2]; // atlas page bound to texture unit 0 and 1, -1 if none
 } rendering_state;
 
+// Everything gfx_sp_tri1 derives from the RSP/RDP state. Only recomputed after a state command has set
+// rdp.draw_state_changed, so the steady-state triangle path just emits vertex data.
+static struct DrawState {
+    struct ColorCombiner* comb;
+    uint32_t tm;
+    bool use_alpha;
+    bool use_fog;
+    bool use_grayscale;
+    bool linear_filter;
+    uint8_t num_inputs;
+    bool used_textures[2];
+    bool per_triangle_inputs;
+    struct GfxClipParameters clip_parameters;
+    float tex_scale_s[2], tex_scale_t[2];
+    float tex_offset_s[2], tex_offset_t[2];
+    float tex_width[2], tex_height[2];
+    float tex_clamp_s[2], tex_clamp_t[2];
+    float fog_color[3];
+    float grayscale_color[4];
+    struct RGBA input_colors[2][7];
+    bool gpu_transform;
+    float tex_transform[2][4];
+} draw_state;
+
+// GPU transform path (gGpuVertexTransform). gfx_sp_vertex only records the model space vertex together with the
+// matrix and lighting state it was loaded with, deduplicated per frame. Each batch gathers the matrices its vertices
+// use into a small palette that is uploaded with the lighting state before the draw.
+struct GpuVertexMatrix {
+    float m[4][4];
+    uint32_t batch_id;
+    uint8_t batch_slot;
+};
+
+static struct {
+    bool enabled;
+    vector<struct GpuVertexMatrix> matrices;
+    vector<struct GfxVertexLighting> lighting;
+
+    struct GfxVertexTransform batch;
+    bool batch_active;
+    bool batch_invert_y;
+    uint32_t batch_lighting;
+    uint32_t batch_id = 1;
+} gpu_vertex;
+
 struct GfxDimensions gfx_current_window_dimensions;
 int32_t gfx_current_window_position_x;
 int32_t gfx_current_window_position_y;
@@ -205,12 +305,34 @@ uint32_t gfx_msaa_level = 1;
 static bool has_drawn_imgui_menu;
 
 static bool dropped_frame;
+static uint64_t frame_allocations; // heap allocations made while interpreting the last frame, debug builds only
+
+static struct {
+    struct GfxRenderStats current;
+    struct GfxRenderStats last_frame;
+} render_stats;
 
 static const std::unordered_map<Mtx*, MtxF>* current_mtx_replacements;
 
+#define MATRIX_CACHE_SIZE 1024 // direct mapped, must be a power of two
+
+// Matrices decoded during the current frame, keyed by their address. Skeletons load the same limb matrices several
+// times per frame, a hit skips both the replacement lookup and the fixed point decode.
+static struct MatrixCacheEntry {
+    const int32_t* addr;
+    uint32_t frame;
+    bool replaced; // taken from current_mtx_replacements
+    float m[4][4];
+} matrix_cache[MATRIX_CACHE_SIZE];
+static uint32_t matrix_cache_frame;
+
 static float buf_vbo[MAX_BUFFERED * (32 * 3)]; // 3 vertices in a triangle and 32 floats per vtx
 static size_t buf_vbo_len;
 static size_t buf_vbo_num_tris;
+static size_t buf_vbo_num_verts;
+static uint32_t buf_vbo_generation = 1;
+static uint16_t buf_ibo[MAX_BUFFERED * 3];
+static size_t buf_ibo_len;
 
 static struct GfxWindowManagerAPI* gfx_wapi;
 static struct GfxRenderingAPI* gfx_rapi;
@@ -235,40 +357,602 @@ struct MaskedTextureEntry {
     uint8_t* replacementData;
 };
 
-static map<string, MaskedTextureEntry> masked_textures;
+static map<string, MaskedTextureEntry, std::less<>> masked_textures;
+static uint32_t masked_textures_generation = 1; // bumped on registration, see LUS::Texture::BlendGeneration
 
-static std::string GetPathWithoutFileName(char* filePath) {
-    int len = strlen(filePath);
+#define FRAME_ARENA_BLOCK_SIZE (64 * 1024)
 
-    for (int i = len - 1; i >= 0; i--) {
-        if (filePath[i] == '/' || filePath[i] == '\\') {
-            return std::string(filePath).substr(0, i);
+// Bump allocator for data that only has to live until the end of the frame. Blocks are kept between frames, so a
+// steady state frame doesn't touch the heap.
+static struct {
+    std::vector<std::vector<uint8_t>> blocks;
+    size_t block; // the block being filled
+    size_t offset;
+} frame_arena;
+
+static void* gfx_frame_alloc(size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    while (frame_arena.block < frame_arena.blocks.size()) {
+        std::vector<uint8_t>& block = frame_arena.blocks[frame_arena.block];
+        if (frame_arena.offset + size <= block.size()) {
+            void* ptr = block.data() + frame_arena.offset;
+            frame_arena.offset += size;
+            return ptr;
         }
+        frame_arena.block++;
+        frame_arena.offset = 0;
     }
 
-    return filePath;
+    // Moving the outer vector keeps the data of the blocks in place
+    frame_arena.blocks.emplace_back(max<size_t>(size, FRAME_ARENA_BLOCK_SIZE));
+    frame_arena.offset = size;
+    return frame_arena.blocks.back().data();
+}
+
+static void gfx_frame_arena_reset(void) {
+    frame_arena.block = 0;
+    frame_arena.offset = 0;
+}
+
+static std::string_view GetPathWithoutFileName(const char* filePath) {
+    std::string_view path = filePath;
+    size_t separator = path.find_last_of("/\\");
+    return separator != std::string_view::npos ? path.substr(0, separator) : path;
 }
 
 static char* GetPathWithCurrentDir(char* filePath) {
     static char fullPath[4096]; // OTRTODO: This is probably a bad idea...
     if (filePath[0] == '>') {
-        sprintf(fullPath, "%s/%s", currentDir.top().c_str(), &filePath[1]);
+        snprintf(fullPath, sizeof(fullPath), "%.*s/%s", (int)currentDir.back().size(), currentDir.back().data(),
+                 &filePath[1]);
         return fullPath;
     } else
         return filePath;
 }
 
-static void gfx_flush(void) {
+static void gfx_flush(enum GfxFlushCause cause) {
     if (buf_vbo_len > 0) {
-        gfx_rapi->draw_triangles(buf_vbo, buf_vbo_len, buf_vbo_num_tris);
+        LUS_PROFILE_SCOPE("gfx_flush");
+        texture_atlas.draw_calls++;
+        render_stats.current.flushes[cause]++;
+        if (gpu_vertex.batch_active) {
+            gfx_rapi->set_vertex_transform(&gpu_vertex.batch);
+            gpu_vertex.batch_active = false;
+            gpu_vertex.batch.num_matrices = 0;
+            gpu_vertex.batch_id++;
+        }
+        if (buf_ibo_len > 0) {
+            gfx_rapi->draw_indexed_triangles(buf_vbo, buf_vbo_len, buf_ibo, buf_ibo_len, buf_vbo_num_tris);
+        } else {
+            gfx_rapi->draw_triangles(buf_vbo, buf_vbo_len, buf_vbo_num_tris);
+        }
         buf_vbo_len = 0;
         buf_vbo_num_tris = 0;
+        buf_vbo_num_verts = 0;
+        buf_ibo_len = 0;
+        buf_vbo_generation++;
+    }
+}
+
+// Retained geometry cache. Resource display lists called with G_DL_OTR_* are recorded the first time they run with a
+// given RSP/RDP/rendering state, then replayed from the recorded backend calls while that state is unchanged.
+#define RETAINED_GEOMETRY_MAX_ENTRIES 2048
+#define RETAINED_GEOMETRY_MAX_AGE 120 // frames
+#define RETAINED_GEOMETRY_MAX_CANDIDATES (RETAINED_GEOMETRY_MAX_ENTRIES * 4)
+
+enum RetainedCommandType : uint8_t {
+    RETAINED_UNLOAD_SHADER,
+    RETAINED_LOAD_SHADER,
+    RETAINED_SELECT_TEXTURE,
+    RETAINED_SET_SAMPLER_PARAMETERS,
+    RETAINED_SET_DEPTH_TEST_AND_MASK,
+    RETAINED_SET_ZMODE_DECAL,
+    RETAINED_SET_VIEWPORT,
+    RETAINED_SET_SCISSOR,
+    RETAINED_SET_USE_ALPHA,
+    RETAINED_DRAW_TRIANGLES,
+    RETAINED_DRAW_INDEXED_TRIANGLES,
+};
+
+enum RetainedRecordResult : uint8_t {
+    RETAINED_RECORD_OK,
+    RETAINED_RECORD_SKIP,        // Transient, e.g. a texture upload, try again next time
+    RETAINED_RECORD_UNCACHEABLE, // The display list itself can not be replayed
+};
+
+struct RetainedCommand {
+    RetainedCommandType type;
+    struct ShaderProgram* prg;
+    int32_t args[4];
+    uint32_t vbo_offset, vbo_len;
+    uint32_t ibo_offset, ibo_len;
+    uint32_t num_tris;
+};
+
+// Game memory read by the display list, it must still hash the same for a recording to be replayed
+struct RetainedInput {
+    const void* addr;
+    uint32_t size;
+    bool is_matrix;
+    uint64_t hash;
+};
+
+struct RetainedGeometry {
+    const Gfx* dl;
+    vector<RetainedCommand> commands;
+    vector<float> vbo;
+    vector<uint16_t> ibo;
+    vector<RetainedInput> inputs;
+
+    // State after the display list has run
+    struct RSP rsp;
+    struct RDP rdp;
+    struct RenderingState rendering_state;
+    struct DrawState draw_state;
+    uintptr_t segment_pointers[16];
+
+    uint32_t last_used_frame;
+    size_t size_bytes;
+};
+
+static struct {
+    bool enabled;
+    bool listening; // registered for resource invalidations
+    uint32_t frame;
+    unordered_map<uint64_t, RetainedGeometry> entries;
+    unordered_set<uint64_t> candidates; // keys seen once, recorded when they come back
+    set<const Gfx*> uncacheable;
+    size_t bytes_retained;
+    uint64_t hits, misses;
+
+    RetainedGeometry* recording;
+    RetainedRecordResult record_result;
+    struct GfxRenderingAPI* target_rapi;
+    struct GfxRenderingAPI recording_rapi;
+} retained_geometry;
+
+// Bumped from any thread when the resource manager dirties or unloads a resource recordings may depend on
+static std::atomic<uint32_t> retained_geometry_generation;
+static uint32_t retained_geometry_seen_generation;
+
+static uint64_t gfx_hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 32;
+    }
+    for (; size > 0; p++, size--) {
+        hash = (hash ^ *p) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static void gfx_retained_geometry_clear(void) {
+    if (retained_geometry.recording != nullptr) {
+        retained_geometry.record_result = RETAINED_RECORD_SKIP;
+    }
+    retained_geometry.entries.clear();
+    retained_geometry.candidates.clear();
+    retained_geometry.uncacheable.clear();
+    retained_geometry.bytes_retained = 0;
+}
+
+static void gfx_sp_update_mp_matrix(void);
+
+static void gfx_retained_fail(RetainedRecordResult result) {
+    if (retained_geometry.recording != nullptr && retained_geometry.record_result < result) {
+        retained_geometry.record_result = result;
+    }
+}
+
+static void gfx_retained_note_input(const void* addr, size_t size, bool is_matrix) {
+    if (retained_geometry.recording != nullptr && addr != nullptr) {
+        retained_geometry.recording->inputs.push_back(
+            { addr, (uint32_t)size, is_matrix, gfx_hash_bytes(0, addr, size) });
+    }
+}
+
+static void gfx_retained_record(RetainedCommandType type, struct ShaderProgram* prg = nullptr, int32_t a0 = 0,
+                                int32_t a1 = 0, int32_t a2 = 0, int32_t a3 = 0) {
+    RetainedCommand cmd = {};
+    cmd.type = type;
+    cmd.prg = prg;
+    cmd.args[0] = a0;
+    cmd.args[1] = a1;
+    cmd.args[2] = a2;
+    cmd.args[3] = a3;
+    retained_geometry.recording->commands.push_back(cmd);
+}
+
+static void gfx_retained_record_draw(RetainedCommandType type, const float buf_vbo[], size_t buf_vbo_len,
+                                     const uint16_t buf_ibo[], size_t buf_ibo_len, size_t buf_vbo_num_tris) {
+    RetainedGeometry* entry = retained_geometry.recording;
+    RetainedCommand cmd = {};
+    cmd.type = type;
+    cmd.vbo_offset = (uint32_t)entry->vbo.size();
+    cmd.vbo_len = (uint32_t)buf_vbo_len;
+    cmd.ibo_offset = (uint32_t)entry->ibo.size();
+    cmd.ibo_len = (uint32_t)buf_ibo_len;
+    cmd.num_tris = (uint32_t)buf_vbo_num_tris;
+    entry->vbo.insert(entry->vbo.end(), buf_vbo, buf_vbo + buf_vbo_len);
+    if (buf_ibo != nullptr) {
+        entry->ibo.insert(entry->ibo.end(), buf_ibo, buf_ibo + buf_ibo_len);
+    }
+    entry->commands.push_back(cmd);
+}
+
+// Recording backend, forwards everything to the real backend and logs the calls that can be replayed
+static void gfx_retained_unload_shader(struct ShaderProgram* old_prg) {
+    gfx_retained_record(RETAINED_UNLOAD_SHADER, old_prg);
+    retained_geometry.target_rapi->unload_shader(old_prg);
+}
+
+static void gfx_retained_load_shader(struct ShaderProgram* new_prg) {
+    gfx_retained_record(RETAINED_LOAD_SHADER, new_prg);
+    retained_geometry.target_rapi->load_shader(new_prg);
+}
+
+static struct ShaderProgram* gfx_retained_create_and_load_new_shader(uint64_t shader_id0, uint32_t shader_id1) {
+    gfx_retained_fail(RETAINED_RECORD_SKIP);
+    return retained_geometry.target_rapi->create_and_load_new_shader(shader_id0, shader_id1);
+}
+
+static uint32_t gfx_retained_new_texture(void) {
+    gfx_retained_fail(RETAINED_RECORD_SKIP);
+    return retained_geometry.target_rapi->new_texture();
+}
+
+static void gfx_retained_select_texture(int tile, uint32_t texture_id) {
+    gfx_retained_record(RETAINED_SELECT_TEXTURE, nullptr, tile, (int32_t)texture_id);
+    retained_geometry.target_rapi->select_texture(tile, texture_id);
+}
+
+static void gfx_retained_upload_texture(const uint8_t* rgba32_buf, uint32_t width, uint32_t height) {
+    gfx_retained_fail(RETAINED_RECORD_SKIP);
+    retained_geometry.target_rapi->upload_texture(rgba32_buf, width, height);
+}
+
+static void gfx_retained_upload_texture_format(const uint8_t* buf, enum GfxPixelFormat format, uint32_t width,
+                                               uint32_t height) {
+    gfx_retained_fail(RETAINED_RECORD_SKIP);
+    retained_geometry.target_rapi->upload_texture_format(buf, format, width, height);
+}
+
+static void gfx_retained_upload_sub_texture(const uint8_t* rgba32_buf, uint32_t x, uint32_t y, uint32_t width,
+                                            uint32_t height) {
+    gfx_retained_fail(RETAINED_RECORD_SKIP);
+    retained_geometry.target_rapi->upload_sub_texture(rgba32_buf, x, y, width, height);
+}
+
+static void gfx_retained_set_sampler_parameters(int sampler, bool linear_filter, uint32_t cms, uint32_t cmt) {
+    gfx_retained_record(RETAINED_SET_SAMPLER_PARAMETERS, nullptr, sampler, linear_filter, (int32_t)cms, (int32_t)cmt);
+    retained_geometry.target_rapi->set_sampler_parameters(sampler, linear_filter, cms, cmt);
+}
+
+static void gfx_retained_set_depth_test_and_mask(bool depth_test, bool z_upd) {
+    gfx_retained_record(RETAINED_SET_DEPTH_TEST_AND_MASK, nullptr, depth_test, z_upd);
+    retained_geometry.target_rapi->set_depth_test_and_mask(depth_test, z_upd);
+}
+
+static void gfx_retained_set_zmode_decal(bool zmode_decal) {
+    gfx_retained_record(RETAINED_SET_ZMODE_DECAL, nullptr, zmode_decal);
+    retained_geometry.target_rapi->set_zmode_decal(zmode_decal);
+}
+
+static void gfx_retained_set_viewport(int x, int y, int width, int height) {
+    gfx_retained_record(RETAINED_SET_VIEWPORT, nullptr, x, y, width, height);
+    retained_geometry.target_rapi->set_viewport(x, y, width, height);
+}
+
+static void gfx_retained_set_scissor(int x, int y, int width, int height) {
+    gfx_retained_record(RETAINED_SET_SCISSOR, nullptr, x, y, width, height);
+    retained_geometry.target_rapi->set_scissor(x, y, width, height);
+}
+
+static void gfx_retained_set_use_alpha(bool use_alpha) {
+    gfx_retained_record(RETAINED_SET_USE_ALPHA, nullptr, use_alpha);
+    retained_geometry.target_rapi->set_use_alpha(use_alpha);
+}
+
+static void gfx_retained_draw_triangles(float buf_vbo[], size_t buf_vbo_len, size_t buf_vbo_num_tris) {
+    gfx_retained_record_draw(RETAINED_DRAW_TRIANGLES, buf_vbo, buf_vbo_len, nullptr, 0, buf_vbo_num_tris);
+    retained_geometry.target_rapi->draw_triangles(buf_vbo, buf_vbo_len, buf_vbo_num_tris);
+}
+
+static void gfx_retained_draw_indexed_triangles(float buf_vbo[], size_t buf_vbo_len, uint16_t buf_ibo[],
+                                                size_t buf_ibo_len, size_t buf_vbo_num_tris) {
+    gfx_retained_record_draw(RETAINED_DRAW_INDEXED_TRIANGLES, buf_vbo, buf_vbo_len, buf_ibo, buf_ibo_len,
+                             buf_vbo_num_tris);
+    retained_geometry.target_rapi->draw_indexed_triangles(buf_vbo, buf_vbo_len, buf_ibo, buf_ibo_len,
+                                                          buf_vbo_num_tris);
+}
+
+static int gfx_retained_create_framebuffer(void) {
+    gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
+    return retained_geometry.target_rapi->create_framebuffer();
+}
+
+static void gfx_retained_update_framebuffer_parameters(int fb_id, uint32_t width, uint32_t height,
+                                                       uint32_t msaa_level, bool opengl_invert_y, bool render_target,
+                                                       bool has_depth_buffer, bool can_extract_depth) {
+    gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
+    retained_geometry.target_rapi->update_framebuffer_parameters(fb_id, width, height, msaa_level, opengl_invert_y,
+                                                                 render_target, has_depth_buffer, can_extract_depth);
+}
+
+static void gfx_retained_start_draw_to_framebuffer(int fb_id, float noise_scale) {
+    gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
+    retained_geometry.target_rapi->start_draw_to_framebuffer(fb_id, noise_scale);
+}
+
+static void gfx_retained_clear_framebuffer(void) {
+    gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
+    retained_geometry.target_rapi->clear_framebuffer();
+}
+
+static void gfx_retained_resolve_msaa_color_buffer(int fb_id_target, int fb_id_source) {
+    gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
+    retained_geometry.target_rapi->resolve_msaa_color_buffer(fb_id_target, fb_id_source);
+}
+
+static void gfx_retained_select_texture_fb(int fb_id) {
+    gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
+    retained_geometry.target_rapi->select_texture_fb(fb_id);
+}
+
+static void gfx_retained_delete_texture(uint32_t texID) {
+    gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
+    retained_geometry.target_rapi->delete_texture(texID);
+}
+
+static void gfx_retained_set_texture_filter(FilteringMode mode) {
+    gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
+    retained_geometry.target_rapi->set_texture_filter(mode);
+}
+
+static void gfx_retained_begin_recording(RetainedGeometry* entry) {
+    struct GfxRenderingAPI* target = gfx_rapi;
+    struct GfxRenderingAPI* proxy = &retained_geometry.recording_rapi;
+
+    *proxy = *target;
+    proxy->unload_shader = gfx_retained_unload_shader;
+    proxy->load_shader = gfx_retained_load_shader;
+    proxy->create_and_load_new_shader = gfx_retained_create_and_load_new_shader;
+    proxy->new_texture = gfx_retained_new_texture;
+    proxy->select_texture = gfx_retained_select_texture;
+    proxy->upload_texture = gfx_retained_upload_texture;
+    if (target->upload_sub_texture != nullptr) {
+        proxy->upload_sub_texture = gfx_retained_upload_sub_texture;
+    }
+    if (target->upload_texture_format != nullptr) {
+        proxy->upload_texture_format = gfx_retained_upload_texture_format;
     }
+    proxy->set_sampler_parameters = gfx_retained_set_sampler_parameters;
+    proxy->set_depth_test_and_mask = gfx_retained_set_depth_test_and_mask;
+    proxy->set_zmode_decal = gfx_retained_set_zmode_decal;
+    proxy->set_viewport = gfx_retained_set_viewport;
+    proxy->set_scissor = gfx_retained_set_scissor;
+    proxy->set_use_alpha = gfx_retained_set_use_alpha;
+    proxy->draw_triangles = gfx_retained_draw_triangles;
+    if (target->draw_indexed_triangles != nullptr) {
+        proxy->draw_indexed_triangles = gfx_retained_draw_indexed_triangles;
+    }
+    proxy->create_framebuffer = gfx_retained_create_framebuffer;
+    proxy->update_framebuffer_parameters = gfx_retained_update_framebuffer_parameters;
+    proxy->start_draw_to_framebuffer = gfx_retained_start_draw_to_framebuffer;
+    proxy->clear_framebuffer = gfx_retained_clear_framebuffer;
+    proxy->resolve_msaa_color_buffer = gfx_retained_resolve_msaa_color_buffer;
+    proxy->select_texture_fb = gfx_retained_select_texture_fb;
+    proxy->delete_texture = gfx_retained_delete_texture;
+    proxy->set_texture_filter = gfx_retained_set_texture_filter;
+
+    retained_geometry.recording = entry;
+    retained_geometry.record_result = RETAINED_RECORD_OK;
+    retained_geometry.target_rapi = target;
+    gfx_rapi = proxy;
+}
+
+static RetainedRecordResult gfx_retained_end_recording(void) {
+    gfx_rapi = retained_geometry.target_rapi;
+    retained_geometry.recording = nullptr;
+    retained_geometry.target_rapi = nullptr;
+    return retained_geometry.record_result;
+}
+
+// Hashes each field on its own so padding between them never reaches the hash. Fields must be scalars, arrays of
+// scalars or structs without implicit padding (RGBA, Light_t, XYWidthHeight, GfxDimensions, GfxClipParameters).
+template <typename... T> static uint64_t gfx_hash_fields(uint64_t hash, const T&... fields) {
+    ((hash = gfx_hash_bytes(hash, &fields, sizeof(fields))), ...);
+    return hash;
+}
+
+static uint64_t gfx_hash_raw_tex_metadata(uint64_t hash, const struct RawTexMetadata& m) {
+    const LUS::Texture* resource = m.resource.get();
+    return gfx_hash_fields(hash, m.width, m.height, m.h_byte_scale, m.v_pixel_scale, resource, m.type);
+}
+
+// Everything a display list's output can depend on besides the game memory tracked in RetainedInput. Keep in sync
+// with RSP, LoadedVertex, RDP, RenderingState and DrawState.
+static uint64_t gfx_retained_key(const Gfx* dl) {
+    // A stale MP would make otherwise equal states hash differently
+    gfx_sp_update_mp_matrix();
+    uint64_t hash = gfx_hash_fields(0xCBF29CE484222325ULL, dl);
+
+    hash = gfx_hash_fields(hash, rsp.modelview_matrix_stack, rsp.modelview_matrix_stack_size, rsp.MP_matrix,
+                           rsp.P_matrix, rsp.MP_matrix_dirty, rsp.lookat, rsp.current_lights,
+                           rsp.current_lights_coeffs, rsp.current_lookat_coeffs, rsp.current_num_lights,
+                           rsp.lights_changed, rsp.geometry_mode, rsp.fog_mul, rsp.fog_offset,
+                           rsp.extra_geometry_mode, rsp.texture_scaling_factor.s, rsp.texture_scaling_factor.t);
+    for (const struct LoadedVertex& v : rsp.loaded_vertices) {
+        // buf_generation and buf_index only cache the vertex's slot in buf_vbo
+        hash = gfx_hash_fields(hash, v.x, v.y, v.z, v.w, v.u, v.v, v.color, v.clip_rej, v.has_clip_pos, v.cn, v.ob,
+                               v.gpu_matrix, v.gpu_lighting);
+    }
+
+    hash = gfx_hash_fields(hash, rdp.palettes, rdp.texture_to_load.addr, rdp.texture_to_load.siz,
+                           rdp.texture_to_load.width, rdp.texture_to_load.tex_flags);
+    hash = gfx_hash_raw_tex_metadata(hash, rdp.texture_to_load.raw_tex_metadata);
+    for (const auto& t : rdp.loaded_texture) {
+        hash = gfx_hash_fields(hash, t.addr, t.orig_size_bytes, t.size_bytes, t.full_image_line_size_bytes,
+                               t.line_size_bytes, t.tex_flags, t.masked, t.blended, t.blend_mask, t.blend_replacement);
+        hash = gfx_hash_raw_tex_metadata(hash, t.raw_tex_metadata);
+    }
+    for (const auto& t : rdp.texture_tile) {
+        hash = gfx_hash_fields(hash, t.fmt, t.siz, t.cms, t.cmt, t.shifts, t.shiftt, t.uls, t.ult, t.lrs, t.lrt, t.tmem,
+                               t.line_size_bytes, t.palette, t.tmem_index);
+    }
+    hash = gfx_hash_fields(hash, rdp.textures_changed, rdp.first_tile_index, rdp.other_mode_l, rdp.other_mode_h,
+                           rdp.combine_mode, rdp.grayscale, rdp.prim_lod_fraction, rdp.env_color, rdp.prim_color,
+                           rdp.fog_color, rdp.fill_color, rdp.grayscale_color, rdp.viewport, rdp.scissor,
+                           rdp.viewport_or_scissor_changed, rdp.draw_state_changed, rdp.z_buf_address,
+                           rdp.color_image_address);
+
+    hash = gfx_hash_fields(hash, rendering_state.depth_test_and_mask, rendering_state.decal_mode,
+                           rendering_state.alpha_blend, rendering_state.viewport, rendering_state.scissor,
+                           rendering_state.shader_program, rendering_state.textures, rendering_state.atlas_pages);
+
+    hash = gfx_hash_fields(hash, draw_state.comb, draw_state.tm, draw_state.use_alpha, draw_state.use_fog,
+                           draw_state.use_grayscale, draw_state.linear_filter, draw_state.num_inputs,
+                           draw_state.used_textures, draw_state.per_triangle_inputs, draw_state.clip_parameters,
+                           draw_state.tex_scale_s, draw_state.tex_scale_t, draw_state.tex_offset_s,
+                           draw_state.tex_offset_t, draw_state.tex_width, draw_state.tex_height,
+                           draw_state.tex_clamp_s, draw_state.tex_clamp_t, draw_state.fog_color,
+                           draw_state.grayscale_color, draw_state.input_colors, draw_state.gpu_transform,
+                           draw_state.tex_transform);
+
+    return gfx_hash_fields(hash, segmentPointers, gfx_current_dimensions, fbActive, game_renders_to_framebuffer);
+}
+
+static bool gfx_retained_inputs_match(const RetainedGeometry& entry) {
+    for (const RetainedInput& input : entry.inputs) {
+        if (input.is_matrix && current_mtx_replacements->contains((Mtx*)input.addr)) {
+            return false;
+        }
+        if (gfx_hash_bytes(0, input.addr, input.size) != input.hash) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void gfx_retained_replay(const RetainedGeometry& entry) {
+    for (const RetainedCommand& cmd : entry.commands) {
+        switch (cmd.type) {
+            case RETAINED_UNLOAD_SHADER:
+                gfx_rapi->unload_shader(cmd.prg);
+                break;
+            case RETAINED_LOAD_SHADER:
+                gfx_rapi->load_shader(cmd.prg);
+                break;
+            case RETAINED_SELECT_TEXTURE:
+                gfx_rapi->select_texture(cmd.args[0], (uint32_t)cmd.args[1]);
+                break;
+            case RETAINED_SET_SAMPLER_PARAMETERS:
+                gfx_rapi->set_sampler_parameters(cmd.args[0], cmd.args[1], (uint32_t)cmd.args[2],
+                                                 (uint32_t)cmd.args[3]);
+                break;
+            case RETAINED_SET_DEPTH_TEST_AND_MASK:
+                gfx_rapi->set_depth_test_and_mask(cmd.args[0], cmd.args[1]);
+                break;
+            case RETAINED_SET_ZMODE_DECAL:
+                gfx_rapi->set_zmode_decal(cmd.args[0]);
+                break;
+            case RETAINED_SET_VIEWPORT:
+                gfx_rapi->set_viewport(cmd.args[0], cmd.args[1], cmd.args[2], cmd.args[3]);
+                break;
+            case RETAINED_SET_SCISSOR:
+                gfx_rapi->set_scissor(cmd.args[0], cmd.args[1], cmd.args[2], cmd.args[3]);
+                break;
+            case RETAINED_SET_USE_ALPHA:
+                gfx_rapi->set_use_alpha(cmd.args[0]);
+                break;
+            case RETAINED_DRAW_TRIANGLES:
+                gfx_rapi->draw_triangles((float*)entry.vbo.data() + cmd.vbo_offset, cmd.vbo_len, cmd.num_tris);
+                break;
+            case RETAINED_DRAW_INDEXED_TRIANGLES:
+                gfx_rapi->draw_indexed_triangles((float*)entry.vbo.data() + cmd.vbo_offset, cmd.vbo_len,
+                                                 (uint16_t*)entry.ibo.data() + cmd.ibo_offset, cmd.ibo_len,
+                                                 cmd.num_tris);
+                break;
+        }
+    }
+
+    rsp = entry.rsp;
+    rdp = entry.rdp;
+    rendering_state = entry.rendering_state;
+    draw_state = entry.draw_state;
+    memcpy(segmentPointers, entry.segment_pointers, sizeof(segmentPointers));
+}
+
+// Recordings point into display list, vertex, matrix and texture data, other resource types can't affect them
+static void gfx_retained_geometry_listen(void) {
+    auto resourceManager = LUS::Context::GetInstance()->GetResourceManager();
+    if (resourceManager == nullptr) {
+        return;
+    }
+
+    resourceManager->AddInvalidationListener([](const std::shared_ptr<LUS::IResource>& resource) {
+        switch (resource->GetInitData()->Type) {
+            case LUS::ResourceType::DisplayList:
+            case LUS::ResourceType::Vertex:
+            case LUS::ResourceType::Matrix:
+            case LUS::ResourceType::Texture:
+                gfx_retained_geometry_invalidate();
+                break;
+            default:
+                break;
+        }
+    });
+    retained_geometry.listening = true;
+}
+
+static void gfx_retained_geometry_start_frame(void) {
+    // GPU transformed vertices reference per-frame matrix and lighting stores, so they can't be replayed
+    retained_geometry.enabled = CVarGetInteger("gRetainedGeometryCache", 0) != 0 && !gpu_vertex.enabled;
+    retained_geometry.frame++;
+    if (retained_geometry.enabled && !retained_geometry.listening) {
+        gfx_retained_geometry_listen();
+    }
+
+    uint32_t generation = retained_geometry_generation.load(std::memory_order_acquire);
+    if (!retained_geometry.enabled || generation != retained_geometry_seen_generation) {
+        retained_geometry_seen_generation = generation;
+        if (!retained_geometry.entries.empty() || !retained_geometry.uncacheable.empty()) {
+            gfx_retained_geometry_clear();
+        }
+        return;
+    }
+
+    for (auto it = retained_geometry.entries.begin(); it != retained_geometry.entries.end();) {
+        if (retained_geometry.frame - it->second.last_used_frame > RETAINED_GEOMETRY_MAX_AGE) {
+            retained_geometry.bytes_retained -= it->second.size_bytes;
+            it = retained_geometry.entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void gfx_retained_geometry_invalidate(void) {
+    retained_geometry_generation.fetch_add(1, std::memory_order_release);
+}
+
+struct GfxRetainedGeometryStats gfx_get_retained_geometry_stats(void) {
+    struct GfxRetainedGeometryStats stats;
+    stats.hits = retained_geometry.hits;
+    stats.misses = retained_geometry.misses;
+    stats.entries = retained_geometry.entries.size();
+    stats.bytes_retained = retained_geometry.bytes_retained;
+    return stats;
 }
 
 static struct ShaderProgram* gfx_lookup_or_create_shader_program(uint64_t shader_id0, uint32_t shader_id1) {
     struct ShaderProgram* prg = gfx_rapi->lookup_shader(shader_id0, shader_id1);
     if (prg == NULL) {
+        LUS_PROFILE_SCOPE("Create Shader");
+        render_stats.current.shader_compilations++;
         gfx_rapi->unload_shader(rendering_state.shader_program);
         prg = gfx_rapi->create_and_load_new_shader(shader_id0, shader_id1);
         rendering_state.shader_program = prg;
@@ -492,6 +1176,17 @@ static void gfx_generate_cc(struct ColorCombiner* comb, const ColorCombinerKey&
             }
         }
     }
+    if (shader_id1 & SHADER_OPT_GPU_TRANSFORM) {
+        // The vertex shader computes the shade colour, tell it which inputs receive it
+        for (int j = 0; j < 7; j++) {
+            if (shader_input_mapping[0][j] == G_CCMUX_SHADE) {
+                shader_id1 |= (j + 1) << SHADER_OPT_SHADE_RGB_SHIFT;
+            }
+            if (shader_input_mapping[1][j] == G_ACMUX_SHADE) {
+                shader_id1 |= (j + 1) << SHADER_OPT_SHADE_ALPHA_SHIFT;
+            }
+        }
+    }
     comb->shader_id0 = shader_id0;
     comb->shader_id1 = shader_id1;
     comb->used_textures[0] = used_textures[0];
@@ -509,24 +1204,57 @@ static struct ColorCombiner* gfx_lookup_or_create_color_combiner(const ColorComb
     if (prev_combiner != color_combiner_pool.end()) {
         return &prev_combiner->second;
     }
-    gfx_flush();
+    gfx_flush(GFX_FLUSH_SHADER);
     prev_combiner = color_combiner_pool.insert(make_pair(key, ColorCombiner())).first;
     gfx_generate_cc(&prev_combiner->second, key);
     return &prev_combiner->second;
 }
 
+static void gfx_texture_atlas_reset_page(struct TextureAtlasPage& page) {
+    page.shelf_x = 0;
+    page.shelf_y = 0;
+    page.shelf_height = 0;
+    page.num_textures = 0;
+}
+
+// Returns the texture id of an entry leaving the cache to the free list, or its space to the atlas page
+static void gfx_texture_cache_release(const TextureCacheValue& value) {
+    if (value.atlas_page < 0) {
+        gfx_texture_cache.free_texture_ids.push_back(value.texture_id);
+        return;
+    }
+
+    struct TextureAtlasPage& page = texture_atlas.pages[value.atlas_page];
+    if (--page.num_textures == 0) {
+        // Buffered vertices may still sample the space about to be reused
+        gfx_flush(GFX_FLUSH_TEXTURE);
+        gfx_texture_atlas_reset_page(page);
+    }
+}
+
 void gfx_texture_cache_clear() {
     for (const auto& entry : gfx_texture_cache.map) {
-        gfx_texture_cache.free_texture_ids.push_back(entry.second.texture_id);
+        if (entry.second.atlas_page < 0) {
+            gfx_texture_cache.free_texture_ids.push_back(entry.second.texture_id);
+        }
+    }
+    for (auto& page : texture_atlas.pages) {
+        gfx_texture_atlas_reset_page(page);
     }
     gfx_texture_cache.map.clear();
     gfx_texture_cache.lru.clear();
+    rdp.draw_state_changed = true;
+    gfx_retained_geometry_clear();
 }
 
 static bool gfx_texture_cache_lookup(int i, const TextureCacheKey& key) {
     TextureCacheMap::iterator it = gfx_texture_cache.map.find(key);
     TextureCacheNode** n = &rendering_state.textures[i];
 
+    if (i < 2) {
+        rendering_state.atlas_pages[i] = -1;
+    }
+
     if (it != gfx_texture_cache.map.end()) {
         gfx_rapi->select_texture(i, it->second.texture_id);
         *n = &*it;
@@ -538,7 +1266,8 @@ static bool gfx_texture_cache_lookup(int i, const TextureCacheKey& key) {
     if (gfx_texture_cache.map.size() >= TEXTURE_CACHE_MAX_SIZE) {
         // Remove the texture that was least recently used
         it = gfx_texture_cache.lru.front().it;
-        gfx_texture_cache.free_texture_ids.push_back(it->second.texture_id);
+        gfx_retained_geometry_clear();
+        gfx_texture_cache_release(it->second);
         gfx_texture_cache.map.erase(it);
         gfx_texture_cache.lru.pop_front();
     }
@@ -562,7 +1291,232 @@ static bool gfx_texture_cache_lookup(int i, const TextureCacheKey& key) {
     return false;
 }
 
-static std::string gfx_get_base_texture_path(const std::string& path) {
+// Small textures only ever read inside their own bounds by a texture rectangle can come from the atlas
+static bool gfx_texture_atlas_eligible(int i, uint32_t tile, bool is_rect, uint32_t tex_width, uint32_t tex_height) {
+    if (!texture_atlas.enabled || !is_rect || tex_width == 0 || tex_height == 0 ||
+        tex_width > TEXTURE_ATLAS_MAX_TEXTURE_SIZE || tex_height > TEXTURE_ATLAS_MAX_TEXTURE_SIZE) {
+        return false;
+    }
+
+    const auto& loaded = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index];
+    if (loaded.masked || loaded.blended || (loaded.tex_flags & TEX_FLAG_LOAD_AS_RAW) != 0) {
+        return false;
+    }
+
+    for (int v = MAX_VERTICES; v < MAX_VERTICES + 4; v++) {
+        const struct LoadedVertex& vtx = rsp.loaded_vertices[v];
+        float s = vtx.u * draw_state.tex_scale_s[i] - draw_state.tex_offset_s[i];
+        float t = vtx.v * draw_state.tex_scale_t[i] - draw_state.tex_offset_t[i];
+        if (s < 0.0f || s > tex_width || t < 0.0f || t > tex_height) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Binds the atlas page to texture unit i, flushing first if the unit had something else bound
+static void gfx_texture_atlas_select(int i, int16_t page) {
+    if (rendering_state.atlas_pages[i] == page) {
+        return;
+    }
+    gfx_flush(GFX_FLUSH_TEXTURE);
+    gfx_rapi->select_texture(i, texture_atlas.pages[page].texture_id);
+    rendering_state.atlas_pages[i] = page;
+}
+
+static bool gfx_texture_atlas_allocate(uint32_t width, uint32_t height, int16_t* page_index, uint16_t* x,
+                                       uint16_t* y) {
+    for (size_t p = 0; p <= texture_atlas.pages.size() && p < TEXTURE_ATLAS_MAX_PAGES; p++) {
+        if (p == texture_atlas.pages.size()) {
+            struct TextureAtlasPage page = {};
+            page.texture_id = gfx_rapi->new_texture();
+            texture_atlas.upload_buffer.assign(TEXTURE_ATLAS_PAGE_SIZE * TEXTURE_ATLAS_PAGE_SIZE * 4, 0);
+
+            gfx_flush(GFX_FLUSH_TEXTURE);
+            gfx_rapi->select_texture(texture_atlas.import_tile, page.texture_id);
+            gfx_rapi->upload_texture(texture_atlas.upload_buffer.data(), TEXTURE_ATLAS_PAGE_SIZE,
+                                     TEXTURE_ATLAS_PAGE_SIZE);
+            gfx_rapi->set_sampler_parameters(texture_atlas.import_tile, false, G_TX_CLAMP, G_TX_CLAMP);
+            page.cms = G_TX_CLAMP;
+            page.cmt = G_TX_CLAMP;
+            rendering_state.atlas_pages[texture_atlas.import_tile] = p;
+            texture_atlas.pages.push_back(page);
+        }
+
+        struct TextureAtlasPage& page = texture_atlas.pages[p];
+        if (page.shelf_x + width > TEXTURE_ATLAS_PAGE_SIZE) {
+            // Start a new shelf
+            page.shelf_x = 0;
+            page.shelf_y += page.shelf_height;
+            page.shelf_height = 0;
+        }
+        if (page.shelf_y + height > TEXTURE_ATLAS_PAGE_SIZE) {
+            continue;
+        }
+
+        *page_index = p;
+        *x = page.shelf_x;
+        *y = page.shelf_y;
+        page.shelf_x += width;
+        page.shelf_height = max<uint16_t>(page.shelf_height, height);
+        page.num_textures++;
+        return true;
+    }
+    return false;
+}
+
+// Copies the imported texture with its padding into the atlas. Returns false if it has to be a texture of its own.
+static bool gfx_texture_atlas_insert(TextureCacheValue& value, const uint8_t* rgba32_buf, uint32_t width,
+                                     uint32_t height) {
+    if (width > TEXTURE_ATLAS_MAX_TEXTURE_SIZE || height > TEXTURE_ATLAS_MAX_TEXTURE_SIZE) {
+        return false;
+    }
+
+    const uint32_t padded_width = width + 2 * TEXTURE_ATLAS_PADDING;
+    const uint32_t padded_height = height + 2 * TEXTURE_ATLAS_PADDING;
+    int16_t page;
+    uint16_t x, y;
+    if (!gfx_texture_atlas_allocate(padded_width, padded_height, &page, &x, &y)) {
+        return false;
+    }
+
+    texture_atlas.upload_buffer.resize(padded_width * padded_height * 4);
+    uint8_t* dst = texture_atlas.upload_buffer.data();
+    for (uint32_t row = 0; row < padded_height; row++) {
+        const uint32_t src_row = clamp<int32_t>((int32_t)row - TEXTURE_ATLAS_PADDING, 0, height - 1);
+        for (uint32_t col = 0; col < padded_width; col++) {
+            const uint32_t src_col = clamp<int32_t>((int32_t)col - TEXTURE_ATLAS_PADDING, 0, width - 1);
+            memcpy(dst + (row * padded_width + col) * 4, rgba32_buf + (src_row * width + src_col) * 4, 4);
+        }
+    }
+
+    // The pending batch may only use other parts of the page, so the upload doesn't need a flush
+    gfx_texture_atlas_select(texture_atlas.import_tile, page);
+    gfx_rapi->upload_sub_texture(dst, x, y, padded_width, padded_height);
+
+    value.texture_id = texture_atlas.pages[page].texture_id;
+    value.atlas_page = page;
+    value.atlas_x = x + TEXTURE_ATLAS_PADDING;
+    value.atlas_y = y + TEXTURE_ATLAS_PADDING;
+    return true;
+}
+
+// Cache entries of atlas keys get a texture of their own when the atlas is full or the import is not as expected
+static void gfx_texture_atlas_use_own_texture(int i, TextureCacheValue& value) {
+    gfx_flush(GFX_FLUSH_TEXTURE);
+    if (!gfx_texture_cache.free_texture_ids.empty()) {
+        value.texture_id = gfx_texture_cache.free_texture_ids.back();
+        gfx_texture_cache.free_texture_ids.pop_back();
+    } else {
+        value.texture_id = gfx_rapi->new_texture();
+    }
+    gfx_rapi->select_texture(i, value.texture_id);
+    gfx_rapi->set_sampler_parameters(i, false, 0, 0);
+    rendering_state.atlas_pages[i] = -1;
+}
+
+static bool gfx_texture_atlas_lookup(int i, const TextureCacheKey& key) {
+    TextureCacheMap::iterator it = gfx_texture_cache.map.find(key);
+    if (it != gfx_texture_cache.map.end()) {
+        if (it->second.atlas_page >= 0) {
+            gfx_texture_atlas_select(i, it->second.atlas_page);
+        } else {
+            gfx_flush(GFX_FLUSH_TEXTURE);
+            gfx_rapi->select_texture(i, it->second.texture_id);
+            rendering_state.atlas_pages[i] = -1;
+        }
+        rendering_state.textures[i] = &*it;
+        gfx_texture_cache.lru.splice(gfx_texture_cache.lru.end(), gfx_texture_cache.lru, it->second.lru_location);
+        return true;
+    }
+
+    if (gfx_texture_cache.map.size() >= TEXTURE_CACHE_MAX_SIZE) {
+        it = gfx_texture_cache.lru.front().it;
+        gfx_retained_geometry_clear();
+        gfx_texture_cache_release(it->second);
+        gfx_texture_cache.map.erase(it);
+        gfx_texture_cache.lru.pop_front();
+    }
+
+    it = gfx_texture_cache.map.insert(make_pair(key, TextureCacheValue())).first;
+    TextureCacheNode* node = &*it;
+    node->second.lru_location = gfx_texture_cache.lru.insert(gfx_texture_cache.lru.end(), { it });
+    rendering_state.textures[i] = node;
+
+    // The texture id is assigned once the import hands its pixels to gfx_upload_texture
+    texture_atlas.import_node = node;
+    texture_atlas.import_tile = i;
+    return false;
+}
+
+static void gfx_upload_texture(const uint8_t* rgba32_buf, uint32_t width, uint32_t height) {
+    render_stats.current.texture_uploads++;
+    render_stats.current.texture_upload_bytes += width * height * 4;
+
+    TextureCacheNode* node = texture_atlas.import_node;
+    if (node != nullptr) {
+        texture_atlas.import_node = nullptr;
+        if (gfx_texture_atlas_insert(node->second, rgba32_buf, width, height)) {
+            return;
+        }
+        gfx_texture_atlas_use_own_texture(texture_atlas.import_tile, node->second);
+    }
+
+    gfx_rapi->upload_texture(rgba32_buf, width, height);
+}
+
+// Narrows an import to the given format when the backend can sample it. Atlas pages are RGBA8 only.
+static enum GfxPixelFormat gfx_upload_pixel_format(enum GfxPixelFormat format) {
+    if (texture_atlas.import_node != nullptr || (supported_pixel_formats & (1 << format)) == 0) {
+        return GFX_PIXEL_FORMAT_RGBA8;
+    }
+    return format;
+}
+
+static void gfx_upload_texture_format(const uint8_t* buf, enum GfxPixelFormat format, uint32_t width,
+                                      uint32_t height) {
+    if (format == GFX_PIXEL_FORMAT_RGBA8) {
+        gfx_upload_texture(buf, width, height);
+    } else {
+        render_stats.current.texture_uploads++;
+        render_stats.current.texture_upload_bytes += width * height * (format == GFX_PIXEL_FORMAT_L8 ? 1 : 2);
+        gfx_rapi->upload_texture_format(buf, format, width, height);
+    }
+}
+
+static void gfx_texture_atlas_end_frame(void) {
+    struct GfxTextureAtlasStats& stats = texture_atlas.last_frame_stats;
+    stats.draw_calls = texture_atlas.draw_calls;
+    stats.draw_calls_saved = texture_atlas.draw_calls_saved;
+    stats.pages = texture_atlas.pages.size();
+    stats.textures = 0;
+    for (const auto& page : texture_atlas.pages) {
+        stats.textures += page.num_textures;
+    }
+
+    texture_atlas.draw_calls = 0;
+    texture_atlas.draw_calls_saved = 0;
+}
+
+struct GfxTextureAtlasStats gfx_get_texture_atlas_stats(void) {
+    return texture_atlas.last_frame_stats;
+}
+
+struct GfxRenderStats gfx_get_render_stats(void) {
+    return render_stats.last_frame;
+}
+
+static void gfx_render_stats_end_frame(void) {
+    render_stats.current.combiners = color_combiner_pool.size();
+    render_stats.last_frame = render_stats.current;
+    render_stats.current = {};
+}
+
+uint64_t gfx_get_frame_allocations(void) {
+    return frame_allocations;
+}
+
+static std::string_view gfx_get_base_texture_path(std::string_view path) {
     if (path.starts_with(LUS::IResource::gAltAssetPrefix)) {
         return path.substr(LUS::IResource::gAltAssetPrefix.length());
     }
@@ -577,8 +1531,9 @@ static void gfx_texture_cache_delete(const uint8_t* orig_addr) {
         bool again = false;
         for (auto it = gfx_texture_cache.map.begin(bucket); it != gfx_texture_cache.map.end(bucket); ++it) {
             if (it->first.texture_addr == orig_addr) {
+                gfx_retained_geometry_clear();
                 gfx_texture_cache.lru.erase(it->second.lru_location);
-                gfx_texture_cache.free_texture_ids.push_back(it->second.texture_id);
+                gfx_texture_cache_release(it->second);
                 gfx_texture_cache.map.erase(it->first);
                 again = true;
                 break;
@@ -591,44 +1546,44 @@ static void gfx_texture_cache_delete(const uint8_t* orig_addr) {
 }
 
 static void import_texture_rgba16(int tile, bool importReplacement) {
-    const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     // SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
+    const enum GfxPixelFormat format = gfx_upload_pixel_format(GFX_PIXEL_FORMAT_RGBA5551);
 
-    for (uint32_t i = 0; i < size_bytes / 2; i++) {
-        uint16_t col16 = (addr[2 * i] << 8) | addr[2 * i + 1];
-        uint8_t a = col16 & 1;
-        uint8_t r = col16 >> 11;
-        uint8_t g = (col16 >> 6) & 0x1f;
-        uint8_t b = (col16 >> 1) & 0x1f;
-        tex_upload_buffer[4 * i + 0] = SCALE_5_8(r);
-        tex_upload_buffer[4 * i + 1] = SCALE_5_8(g);
-        tex_upload_buffer[4 * i + 2] = SCALE_5_8(b);
-        tex_upload_buffer[4 * i + 3] = a ? 255 : 0;
+    if (format == GFX_PIXEL_FORMAT_RGBA5551) {
+        uint16_t* dst = (uint16_t*)tex_upload_buffer;
+        for (uint32_t i = 0; i < size_bytes / 2; i++) {
+            dst[i] = (addr[2 * i] << 8) | addr[2 * i + 1];
+        }
+    } else {
+        for (uint32_t i = 0; i < size_bytes / 2; i++) {
+            uint16_t col16 = (addr[2 * i] << 8) | addr[2 * i + 1];
+            uint8_t a = col16 & 1;
+            uint8_t r = col16 >> 11;
+            uint8_t g = (col16 >> 6) & 0x1f;
+            uint8_t b = (col16 >> 1) & 0x1f;
+            tex_upload_buffer[4 * i + 0] = SCALE_5_8(r);
+            tex_upload_buffer[4 * i + 1] = SCALE_5_8(g);
+            tex_upload_buffer[4 * i + 2] = SCALE_5_8(b);
+            tex_upload_buffer[4 * i + 3] = a ? 255 : 0;
+        }
     }
 
     uint32_t width = rdp.texture_tile[tile].line_size_bytes / 2;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(tex_upload_buffer, width, height);
+    gfx_upload_texture_format(tex_upload_buffer, format, width, height);
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
 static void import_texture_rgba32(int tile, bool importReplacement) {
-    const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
@@ -637,28 +1592,31 @@ static void import_texture_rgba32(int tile, bool importReplacement) {
 
     uint32_t width = rdp.texture_tile[tile].line_size_bytes / 2;
     uint32_t height = (size_bytes / 2) / rdp.texture_tile[tile].line_size_bytes;
-    gfx_rapi->upload_texture(addr, width, height);
+    gfx_upload_texture(addr, width, height);
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, addr, width, height);
 }
 
 static void import_texture_ia4(int tile, bool importReplacement) {
-    const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
+    const enum GfxPixelFormat format = gfx_upload_pixel_format(GFX_PIXEL_FORMAT_LA8);
+
     for (uint32_t i = 0; i < size_bytes * 2; i++) {
         uint8_t byte = addr[i / 2];
         uint8_t part = (byte >> (4 - (i % 2) * 4)) & 0xf;
         uint8_t intensity = part >> 1;
         uint8_t alpha = part & 1;
+        if (format == GFX_PIXEL_FORMAT_LA8) {
+            tex_upload_buffer[2 * i + 0] = SCALE_3_8(intensity);
+            tex_upload_buffer[2 * i + 1] = alpha ? 255 : 0;
+            continue;
+        }
         uint8_t r = intensity;
         uint8_t g = intensity;
         uint8_t b = intensity;
@@ -671,26 +1629,29 @@ static void import_texture_ia4(int tile, bool importReplacement) {
     uint32_t width = rdp.texture_tile[tile].line_size_bytes * 2;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(tex_upload_buffer, width, height);
+    gfx_upload_texture_format(tex_upload_buffer, format, width, height);
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
 static void import_texture_ia8(int tile, bool importReplacement) {
-    const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
+    const enum GfxPixelFormat format = gfx_upload_pixel_format(GFX_PIXEL_FORMAT_LA8);
+
     for (uint32_t i = 0; i < size_bytes; i++) {
         uint8_t intensity = addr[i] >> 4;
         uint8_t alpha = addr[i] & 0xf;
+        if (format == GFX_PIXEL_FORMAT_LA8) {
+            tex_upload_buffer[2 * i + 0] = SCALE_4_8(intensity);
+            tex_upload_buffer[2 * i + 1] = SCALE_4_8(alpha);
+            continue;
+        }
         uint8_t r = intensity;
         uint8_t g = intensity;
         uint8_t b = intensity;
@@ -703,23 +1664,28 @@ static void import_texture_ia8(int tile, bool importReplacement) {
     uint32_t width = rdp.texture_tile[tile].line_size_bytes;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(tex_upload_buffer, width, height);
+    gfx_upload_texture_format(tex_upload_buffer, format, width, height);
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
 static void import_texture_ia16(int tile, bool importReplacement) {
-    const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
+    uint32_t width = rdp.texture_tile[tile].line_size_bytes / 2;
+    uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
+
+    // IA16 texels already are LA8 pairs
+    if (gfx_upload_pixel_format(GFX_PIXEL_FORMAT_LA8) == GFX_PIXEL_FORMAT_LA8) {
+        gfx_upload_texture_format(addr, GFX_PIXEL_FORMAT_LA8, width, height);
+        return;
+    }
+
     for (uint32_t i = 0; i < size_bytes / 2; i++) {
         uint8_t intensity = addr[2 * i];
         uint8_t alpha = addr[2 * i + 1];
@@ -732,30 +1698,29 @@ static void import_texture_ia16(int tile, bool importReplacement) {
         tex_upload_buffer[4 * i + 3] = alpha;
     }
 
-    uint32_t width = rdp.texture_tile[tile].line_size_bytes / 2;
-    uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
-
-    gfx_rapi->upload_texture(tex_upload_buffer, width, height);
+    gfx_upload_texture(tex_upload_buffer, width, height);
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
 static void import_texture_i4(int tile, bool importReplacement) {
-    const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     // SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
+    const enum GfxPixelFormat format = gfx_upload_pixel_format(GFX_PIXEL_FORMAT_L8);
+
     for (uint32_t i = 0; i < size_bytes * 2; i++) {
         uint8_t byte = addr[i / 2];
         uint8_t part = (byte >> (4 - (i % 2) * 4)) & 0xf;
         uint8_t intensity = part;
+        if (format == GFX_PIXEL_FORMAT_L8) {
+            tex_upload_buffer[i] = SCALE_4_8(intensity);
+            continue;
+        }
         uint8_t r = intensity;
         uint8_t g = intensity;
         uint8_t b = intensity;
@@ -769,23 +1734,28 @@ static void import_texture_i4(int tile, bool importReplacement) {
     uint32_t width = rdp.texture_tile[tile].line_size_bytes * 2;
     uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
 
-    gfx_rapi->upload_texture(tex_upload_buffer, width, height);
+    gfx_upload_texture_format(tex_upload_buffer, format, width, height);
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
 static void import_texture_i8(int tile, bool importReplacement) {
-    const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
     // SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
 
+    uint32_t width = rdp.texture_tile[tile].line_size_bytes;
+    uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
+
+    // I8 texels already are L8
+    if (gfx_upload_pixel_format(GFX_PIXEL_FORMAT_L8) == GFX_PIXEL_FORMAT_L8) {
+        gfx_upload_texture_format(addr, GFX_PIXEL_FORMAT_L8, width, height);
+        return;
+    }
+
     for (uint32_t i = 0; i < size_bytes; i++) {
         uint8_t intensity = addr[i];
         uint8_t r = intensity;
@@ -798,20 +1768,14 @@ static void import_texture_i8(int tile, bool importReplacement) {
         tex_upload_buffer[4 * i + 3] = a;
     }
 
-    uint32_t width = rdp.texture_tile[tile].line_size_bytes;
-    uint32_t height = size_bytes / rdp.texture_tile[tile].line_size_bytes;
-
-    gfx_rapi->upload_texture(tex_upload_buffer, width, height);
+    gfx_upload_texture(tex_upload_buffer, width, height);
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
 static void import_texture_ci4(int tile, bool importReplacement) {
     const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
@@ -819,11 +1783,16 @@ static void import_texture_ci4(int tile, bool importReplacement) {
     uint32_t pal_idx = rdp.texture_tile[tile].palette;                           // 0-15
     const uint8_t* palette = rdp.palettes[pal_idx / 8] + (pal_idx % 8) * 16 * 2; // 16 pixel entries, 16 bits each
     SUPPORT_CHECK(full_image_line_size_bytes == line_size_bytes);
+    const enum GfxPixelFormat format = gfx_upload_pixel_format(GFX_PIXEL_FORMAT_RGBA5551);
 
     for (uint32_t i = 0; i < size_bytes * 2; i++) {
         uint8_t byte = addr[i / 2];
         uint8_t idx = (byte >> (4 - (i % 2) * 4)) & 0xf;
         uint16_t col16 = (palette[idx * 2] << 8) | palette[idx * 2 + 1]; // Big endian load
+        if (format == GFX_PIXEL_FORMAT_RGBA5551) {
+            ((uint16_t*)tex_upload_buffer)[i] = col16;
+            continue;
+        }
         uint8_t a = col16 & 1;
         uint8_t r = col16 >> 11;
         uint8_t g = (col16 >> 6) & 0x1f;
@@ -842,26 +1811,28 @@ static void import_texture_ci4(int tile, bool importReplacement) {
     uint32_t width = result_line_size * 2;
     uint32_t height = size_bytes / result_line_size;
 
-    gfx_rapi->upload_texture(tex_upload_buffer, width, height);
+    gfx_upload_texture_format(tex_upload_buffer, format, width, height);
 }
 
 static void import_texture_ci8(int tile, bool importReplacement) {
     const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
     uint32_t size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].size_bytes;
     uint32_t full_image_line_size_bytes =
         rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].full_image_line_size_bytes;
     uint32_t line_size_bytes = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].line_size_bytes;
+    const enum GfxPixelFormat format = gfx_upload_pixel_format(GFX_PIXEL_FORMAT_RGBA5551);
 
     for (uint32_t i = 0, j = 0; i < size_bytes; j += full_image_line_size_bytes - line_size_bytes) {
         for (uint32_t k = 0; k < line_size_bytes; i++, k++, j++) {
             uint8_t idx = addr[j];
             uint16_t col16 = (rdp.palettes[idx / 128][(idx % 128) * 2] << 8) |
                              rdp.palettes[idx / 128][(idx % 128) * 2 + 1]; // Big endian load
+            if (format == GFX_PIXEL_FORMAT_RGBA5551) {
+                ((uint16_t*)tex_upload_buffer)[i] = col16;
+                continue;
+            }
             uint8_t a = col16 & 1;
             uint8_t r = col16 >> 11;
             uint8_t g = (col16 >> 6) & 0x1f;
@@ -881,22 +1852,19 @@ static void import_texture_ci8(int tile, bool importReplacement) {
     uint32_t width = result_line_size;
     uint32_t height = size_bytes / result_line_size;
 
-    gfx_rapi->upload_texture(tex_upload_buffer, width, height);
+    gfx_upload_texture_format(tex_upload_buffer, format, width, height);
     // DumpTexture(rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].otr_path, rgba32_buf, width, height);
 }
 
 static void import_texture_raw(int tile, bool importReplacement) {
     const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
-    const uint8_t* addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
+    const uint8_t* addr = importReplacement ? rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blend_replacement
+                                            : rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr;
 
     uint16_t width = metadata->width;
     uint16_t height = metadata->height;
     LUS::TextureType type = metadata->type;
-    std::shared_ptr<LUS::Texture> resource = metadata->resource;
+    const std::shared_ptr<LUS::Texture>& resource = metadata->resource;
 
     // if texture type is CI4 or CI8 we need to apply tlut to it
     switch (type) {
@@ -925,7 +1893,7 @@ static void import_texture_raw(int tile, bool importReplacement) {
 
     if (result_new_line_size == 4 * width && result_new_height == height) {
         // Can use the texture directly since it has the correct dimensions
-        gfx_rapi->upload_texture(addr, width, height);
+        gfx_upload_texture(addr, width, height);
         return;
     }
 
@@ -959,31 +1927,28 @@ static void import_texture_raw(int tile, bool importReplacement) {
         memset(tex_upload_buffer + resource_image_size_bytes, 0, num_loaded_bytes - resource_image_size_bytes);
     }
 
-    gfx_rapi->upload_texture(tex_upload_buffer, result_new_line_size / 4, result_new_height);
+    gfx_upload_texture(tex_upload_buffer, result_new_line_size / 4, result_new_height);
 }
 
-static void import_texture(int i, int tile, bool importReplacement) {
+static void import_texture(int i, int tile, bool importReplacement, bool atlas) {
+    LUS_PROFILE_SCOPE("Import Texture");
     uint8_t fmt = rdp.texture_tile[tile].fmt;
     uint8_t siz = rdp.texture_tile[tile].siz;
     uint32_t texFlags = rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].tex_flags;
     uint32_t tmem_index = rdp.texture_tile[tile].tmem_index;
     uint8_t palette_index = rdp.texture_tile[tile].palette;
 
-    const RawTexMetadata* metadata = &rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata;
     const uint8_t* orig_addr =
-        importReplacement && (metadata->resource != nullptr)
-            ? masked_textures.find(gfx_get_base_texture_path(metadata->resource->GetInitData()->Path))
-                  ->second.replacementData
-            : rdp.loaded_texture[tmem_index].addr;
+        importReplacement ? rdp.loaded_texture[tmem_index].blend_replacement : rdp.loaded_texture[tmem_index].addr;
 
     TextureCacheKey key;
     if (fmt == G_IM_FMT_CI) {
-        key = { orig_addr, { rdp.palettes[0], rdp.palettes[1] }, fmt, siz, palette_index };
+        key = { orig_addr, { rdp.palettes[0], rdp.palettes[1] }, fmt, siz, palette_index, atlas };
     } else {
-        key = { orig_addr, {}, fmt, siz, palette_index };
+        key = { orig_addr, {}, fmt, siz, palette_index, atlas };
     }
 
-    if (gfx_texture_cache_lookup(i, key)) {
+    if (atlas ? gfx_texture_atlas_lookup(i, key) : gfx_texture_cache_lookup(i, key)) {
         return;
     }
 
@@ -1035,18 +2000,7 @@ static void import_texture(int i, int tile, bool importReplacement) {
 
 static void import_texture_mask(int i, int tile) {
     uint32_t tmem_index = rdp.texture_tile[tile].tmem_index;
-    RawTexMetadata metadata = rdp.loaded_texture[tmem_index].raw_tex_metadata;
-
-    if (metadata.resource == nullptr) {
-        return;
-    }
-
-    auto maskIter = masked_textures.find(gfx_get_base_texture_path(metadata.resource->GetInitData()->Path));
-    if (maskIter == masked_textures.end()) {
-        return;
-    }
-
-    const uint8_t* orig_addr = maskIter->second.mask;
+    const uint8_t* orig_addr = rdp.loaded_texture[tmem_index].blend_mask;
 
     if (orig_addr == nullptr) {
         return;
@@ -1091,7 +2045,7 @@ static void import_texture_mask(int i, int tile) {
         }
     }
 
-    gfx_rapi->upload_texture(tex_upload_buffer, width, height);
+    gfx_upload_texture(tex_upload_buffer, width, height);
 }
 
 static void gfx_normalize_vector(float v[3]) {
@@ -1114,7 +2068,34 @@ static void calculate_normal_dir(const Light_t* light, float coeffs[3]) {
     gfx_normalize_vector(coeffs);
 }
 
+// res may alias a or b
 static void gfx_matrix_mul(float res[4][4], const float a[4][4], const float b[4][4]) {
+#if defined(GFX_MATRIX_SSE)
+    // All of b is loaded up front and each row of a is read before the same row of res is written
+    const __m128 b0 = _mm_loadu_ps(b[0]);
+    const __m128 b1 = _mm_loadu_ps(b[1]);
+    const __m128 b2 = _mm_loadu_ps(b[2]);
+    const __m128 b3 = _mm_loadu_ps(b[3]);
+    for (int i = 0; i < 4; i++) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a[i][0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i][2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i][3]), b3));
+        _mm_storeu_ps(res[i], row);
+    }
+#elif defined(GFX_MATRIX_NEON)
+    const float32x4_t b0 = vld1q_f32(b[0]);
+    const float32x4_t b1 = vld1q_f32(b[1]);
+    const float32x4_t b2 = vld1q_f32(b[2]);
+    const float32x4_t b3 = vld1q_f32(b[3]);
+    for (int i = 0; i < 4; i++) {
+        float32x4_t row = vmulq_n_f32(b0, a[i][0]);
+        row = vaddq_f32(row, vmulq_n_f32(b1, a[i][1]));
+        row = vaddq_f32(row, vmulq_n_f32(b2, a[i][2]));
+        row = vaddq_f32(row, vmulq_n_f32(b3, a[i][3]));
+        vst1q_f32(res[i], row);
+    }
+#else
     float tmp[4][4];
     for (int i = 0; i < 4; i++) {
         for (int j = 0; j < 4; j++) {
@@ -1122,17 +2103,26 @@ static void gfx_matrix_mul(float res[4][4], const float a[4][4], const float b[4
         }
     }
     memcpy(res, tmp, sizeof(tmp));
+#endif
 }
 
-static void gfx_sp_matrix(uint8_t parameters, const int32_t* addr) {
-    float matrix[4][4];
+static const struct MatrixCacheEntry& gfx_decode_matrix(const int32_t* addr) {
+    const uintptr_t key = (uintptr_t)addr;
+    struct MatrixCacheEntry& entry = matrix_cache[((key >> 6) ^ (key >> 16)) & (MATRIX_CACHE_SIZE - 1)];
+    if (entry.addr == addr && entry.frame == matrix_cache_frame) {
+        return entry;
+    }
 
+    entry.addr = addr;
+    entry.frame = matrix_cache_frame;
+    entry.replaced = false;
     if (auto it = current_mtx_replacements->find((Mtx*)addr); it != current_mtx_replacements->end()) {
+        entry.replaced = true;
         for (int i = 0; i < 4; i++) {
             for (int j = 0; j < 4; j++) {
                 float v = it->second.mf[i][j];
                 int as_int = (int)(v * 65536.0f);
-                matrix[i][j] = as_int * (1.0f / 65536.0f);
+                entry.m[i][j] = as_int * (1.0f / 65536.0f);
             }
         }
     } else {
@@ -1142,19 +2132,29 @@ static void gfx_sp_matrix(uint8_t parameters, const int32_t* addr) {
             for (int j = 0; j < 4; j += 2) {
                 int32_t int_part = addr[i * 2 + j / 2];
                 uint32_t frac_part = addr[8 + i * 2 + j / 2];
-                matrix[i][j] = (int32_t)((int_part & 0xffff0000) | (frac_part >> 16)) / 65536.0f;
-                matrix[i][j + 1] = (int32_t)((int_part << 16) | (frac_part & 0xffff)) / 65536.0f;
+                entry.m[i][j] = (int32_t)((int_part & 0xffff0000) | (frac_part >> 16)) / 65536.0f;
+                entry.m[i][j + 1] = (int32_t)((int_part << 16) | (frac_part & 0xffff)) / 65536.0f;
             }
         }
 #else
         // For a modified GBI where fixed point values are replaced with floats
-        memcpy(matrix, addr, sizeof(matrix));
+        memcpy(entry.m, addr, sizeof(entry.m));
 #endif
     }
+    return entry;
+}
+
+static void gfx_sp_matrix(uint8_t parameters, const int32_t* addr) {
+    const struct MatrixCacheEntry& decoded = gfx_decode_matrix(addr);
+    const float(*matrix)[4] = decoded.m;
+
+    if (decoded.replaced) {
+        gfx_retained_fail(RETAINED_RECORD_SKIP);
+    }
 
     if (parameters & G_MTX_PROJECTION) {
         if (parameters & G_MTX_LOAD) {
-            memcpy(rsp.P_matrix, matrix, sizeof(matrix));
+            memcpy(rsp.P_matrix, matrix, sizeof(rsp.P_matrix));
         } else {
             gfx_matrix_mul(rsp.P_matrix, matrix, rsp.P_matrix);
         }
@@ -1162,17 +2162,17 @@ static void gfx_sp_matrix(uint8_t parameters, const int32_t* addr) {
         if ((parameters & G_MTX_PUSH) && rsp.modelview_matrix_stack_size < 11) {
             ++rsp.modelview_matrix_stack_size;
             memcpy(rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1],
-                   rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 2], sizeof(matrix));
+                   rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 2], sizeof(rsp.P_matrix));
         }
         if (parameters & G_MTX_LOAD) {
-            memcpy(rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], matrix, sizeof(matrix));
+            memcpy(rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], matrix, sizeof(rsp.P_matrix));
         } else {
             gfx_matrix_mul(rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], matrix,
                            rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1]);
         }
         rsp.lights_changed = 1;
     }
-    gfx_matrix_mul(rsp.MP_matrix, rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], rsp.P_matrix);
+    rsp.MP_matrix_dirty = true;
 }
 
 static void gfx_sp_pop_matrix(uint32_t count) {
@@ -1180,13 +2180,20 @@ static void gfx_sp_pop_matrix(uint32_t count) {
         if (rsp.modelview_matrix_stack_size > 0) {
             --rsp.modelview_matrix_stack_size;
             if (rsp.modelview_matrix_stack_size > 0) {
-                gfx_matrix_mul(rsp.MP_matrix, rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1],
-                               rsp.P_matrix);
+                rsp.MP_matrix_dirty = true;
             }
         }
     }
 }
 
+// Matrix commands only mark MP as dirty, runs of pushes and pops between vertex loads multiply it once
+static void gfx_sp_update_mp_matrix(void) {
+    if (rsp.MP_matrix_dirty) {
+        gfx_matrix_mul(rsp.MP_matrix, rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], rsp.P_matrix);
+        rsp.MP_matrix_dirty = false;
+    }
+}
+
 static float gfx_adjust_x_for_aspect_ratio(float x) {
     if (fbActive) {
         return x;
@@ -1206,7 +2213,153 @@ static void gfx_adjust_width_height_for_scale(uint32_t& width, uint32_t& height)
     }
 }
 
+static void gfx_calculate_light_coeffs(void) {
+    for (int i = 0; i < rsp.current_num_lights - 1; i++) {
+        calculate_normal_dir(&rsp.current_lights[i], rsp.current_lights_coeffs[i]);
+    }
+    /*static const Light_t lookat_x = {{0, 0, 0}, 0, {0, 0, 0}, 0, {127, 0, 0}, 0};
+    static const Light_t lookat_y = {{0, 0, 0}, 0, {0, 0, 0}, 0, {0, 127, 0}, 0};*/
+    calculate_normal_dir(&rsp.lookat[0], rsp.current_lookat_coeffs[0]);
+    calculate_normal_dir(&rsp.lookat[1], rsp.current_lookat_coeffs[1]);
+    rsp.lights_changed = false;
+}
+
+// trivial clip rejection
+static uint8_t gfx_clip_rejection(float x, float y, float z, float w) {
+    uint8_t clip_rej = 0;
+    if (x < -w) {
+        clip_rej |= 1; // CLIP_LEFT
+    }
+    if (x > w) {
+        clip_rej |= 2; // CLIP_RIGHT
+    }
+    if (y < -w) {
+        clip_rej |= 4; // CLIP_BOTTOM
+    }
+    if (y > w) {
+        clip_rej |= 8; // CLIP_TOP
+    }
+    // if (z < -w) clip_rej |= 16; // CLIP_NEAR
+    if (z > w) {
+        clip_rej |= 32; // CLIP_FAR
+    }
+    return clip_rej;
+}
+
+static uint32_t gfx_gpu_vertex_current_matrix(void) {
+    gfx_sp_update_mp_matrix();
+    struct GpuVertexMatrix entry = {};
+    memcpy(entry.m, rsp.MP_matrix, sizeof(entry.m));
+    const float aspect = gfx_adjust_x_for_aspect_ratio(1.0f);
+    for (int i = 0; i < 4; i++) {
+        entry.m[i][0] *= aspect;
+    }
+
+    if (!gpu_vertex.matrices.empty() && memcmp(gpu_vertex.matrices.back().m, entry.m, sizeof(entry.m)) == 0) {
+        return gpu_vertex.matrices.size() - 1;
+    }
+    gpu_vertex.matrices.push_back(entry);
+    return gpu_vertex.matrices.size() - 1;
+}
+
+static uint32_t gfx_gpu_vertex_current_lighting(void) {
+    // Zeroed so that states only differing in unused fields compare equal
+    struct GfxVertexLighting state = {};
+    state.lighting = (rsp.geometry_mode & G_LIGHTING) != 0;
+    state.fog = (rsp.geometry_mode & G_FOG) != 0;
+
+    if (state.lighting) {
+        if (rsp.lights_changed) {
+            gfx_calculate_light_coeffs();
+        }
+
+        int num_lights = rsp.current_num_lights - 1;
+        if (num_lights > GFX_VERTEX_MAX_LIGHTS) {
+            num_lights = GFX_VERTEX_MAX_LIGHTS;
+        }
+        for (int i = 0; i < num_lights; i++) {
+            for (int j = 0; j < 3; j++) {
+                state.light_dirs[i][j] = rsp.current_lights_coeffs[i][j];
+                state.light_colors[i][j] = rsp.current_lights[i].col[j];
+            }
+        }
+        if (num_lights >= 0) {
+            state.num_lights = num_lights;
+            for (int j = 0; j < 3; j++) {
+                state.ambient_color[j] = rsp.current_lights[num_lights].col[j];
+            }
+        }
+
+        if (rsp.geometry_mode & G_TEXTURE_GEN) {
+            state.texgen = true;
+            state.texgen_linear = (rsp.geometry_mode & G_TEXTURE_GEN_LINEAR) != 0;
+            memcpy(state.lookat, rsp.current_lookat_coeffs, sizeof(state.lookat));
+            state.texture_scaling[0] = rsp.texture_scaling_factor.s;
+            state.texture_scaling[1] = rsp.texture_scaling_factor.t;
+        }
+    }
+
+    if (state.fog) {
+        state.fog_mul = rsp.fog_mul;
+        state.fog_offset = rsp.fog_offset;
+    }
+
+    if (!gpu_vertex.lighting.empty() && memcmp(&gpu_vertex.lighting.back(), &state, sizeof(state)) == 0) {
+        return gpu_vertex.lighting.size() - 1;
+    }
+    gpu_vertex.lighting.push_back(state);
+    return gpu_vertex.lighting.size() - 1;
+}
+
+static void gfx_sp_vertex_gpu(size_t n_vertices, size_t dest_index, const Vtx* vertices) {
+    if (vertices == NULL) {
+        return;
+    }
+
+    const uint32_t matrix = gfx_gpu_vertex_current_matrix();
+    const uint32_t lighting = gfx_gpu_vertex_current_lighting();
+
+    for (size_t i = 0; i < n_vertices; i++, dest_index++) {
+        const Vtx_t* v = &vertices[i].v;
+        struct LoadedVertex* d = &rsp.loaded_vertices[dest_index];
+
+        d->buf_generation = 0;
+        d->has_clip_pos = false;
+        d->clip_rej = 0;
+        d->gpu_matrix = matrix;
+        d->gpu_lighting = lighting;
+        d->ob[0] = v->ob[0];
+        d->ob[1] = v->ob[1];
+        d->ob[2] = v->ob[2];
+        memcpy(d->cn, v->cn, sizeof(d->cn));
+        d->u = (short)(v->tc[0] * rsp.texture_scaling_factor.s >> 16);
+        d->v = (short)(v->tc[1] * rsp.texture_scaling_factor.t >> 16);
+    }
+}
+
+// Culling, G_BRANCH_Z and the LOD fraction hack need the clip space position of a GPU transformed vertex
+static void gfx_gpu_vertex_clip_position(struct LoadedVertex* d) {
+    if (d->has_clip_pos) {
+        return;
+    }
+
+    const float(*m)[4] = gpu_vertex.matrices[d->gpu_matrix].m;
+    d->x = d->ob[0] * m[0][0] + d->ob[1] * m[1][0] + d->ob[2] * m[2][0] + m[3][0];
+    d->y = d->ob[0] * m[0][1] + d->ob[1] * m[1][1] + d->ob[2] * m[2][1] + m[3][1];
+    d->z = d->ob[0] * m[0][2] + d->ob[1] * m[1][2] + d->ob[2] * m[2][2] + m[3][2];
+    d->w = d->ob[0] * m[0][3] + d->ob[1] * m[1][3] + d->ob[2] * m[2][3] + m[3][3];
+    d->clip_rej = gfx_clip_rejection(d->x, d->y, d->z, d->w);
+    d->has_clip_pos = true;
+}
+
 static void gfx_sp_vertex(size_t n_vertices, size_t dest_index, const Vtx* vertices) {
+    if (gpu_vertex.enabled) {
+        gfx_sp_vertex_gpu(n_vertices, dest_index, vertices);
+        return;
+    }
+
+    gfx_sp_update_mp_matrix();
+
     for (size_t i = 0; i < n_vertices; i++, dest_index++) {
         const Vtx_t* v = &vertices[i].v;
         const Vtx_tn* vn = &vertices[i].n;
@@ -1216,6 +2369,8 @@ static void gfx_sp_vertex(size_t n_vertices, size_t dest_index, const Vtx* verti
             return;
         }
 
+        d->buf_generation = 0;
+
         float x = v->ob[0] * rsp.MP_matrix[0][0] + v->ob[1] * rsp.MP_matrix[1][0] + v->ob[2] * rsp.MP_matrix[2][0] +
                   rsp.MP_matrix[3][0];
         float y = v->ob[0] * rsp.MP_matrix[0][1] + v->ob[1] * rsp.MP_matrix[1][1] + v->ob[2] * rsp.MP_matrix[2][1] +
@@ -1232,14 +2387,7 @@ static void gfx_sp_vertex(size_t n_vertices, size_t dest_index, const Vtx* verti
 
         if (rsp.geometry_mode & G_LIGHTING) {
             if (rsp.lights_changed) {
-                for (int i = 0; i < rsp.current_num_lights - 1; i++) {
-                    calculate_normal_dir(&rsp.current_lights[i], rsp.current_lights_coeffs[i]);
-                }
-                /*static const Light_t lookat_x = {{0, 0, 0}, 0, {0, 0, 0}, 0, {127, 0, 0}, 0};
-                static const Light_t lookat_y = {{0, 0, 0}, 0, {0, 0, 0}, 0, {0, 127, 0}, 0};*/
-                calculate_normal_dir(&rsp.lookat[0], rsp.current_lookat_coeffs[0]);
-                calculate_normal_dir(&rsp.lookat[1], rsp.current_lookat_coeffs[1]);
-                rsp.lights_changed = false;
+                gfx_calculate_light_coeffs();
             }
 
             int r = rsp.current_lights[rsp.current_num_lights - 1].col[0];
@@ -1303,24 +2451,8 @@ static void gfx_sp_vertex(size_t n_vertices, size_t dest_index, const Vtx* verti
         d->u = U;
         d->v = V;
 
-        // trivial clip rejection
-        d->clip_rej = 0;
-        if (x < -w) {
-            d->clip_rej |= 1; // CLIP_LEFT
-        }
-        if (x > w) {
-            d->clip_rej |= 2; // CLIP_RIGHT
-        }
-        if (y < -w) {
-            d->clip_rej |= 4; // CLIP_BOTTOM
-        }
-        if (y > w) {
-            d->clip_rej |= 8; // CLIP_TOP
-        }
-        // if (z < -w) d->clip_rej |= 16; // CLIP_NEAR
-        if (z > w) {
-            d->clip_rej |= 32; // CLIP_FAR
-        }
+        d->clip_rej = gfx_clip_rejection(x, y, z, w);
+        d->has_clip_pos = true;
 
         d->x = x;
         d->y = y;
@@ -1356,87 +2488,34 @@ static void gfx_sp_modify_vertex(uint16_t vtx_idx, uint8_t where, uint32_t val)
     struct LoadedVertex* v = &rsp.loaded_vertices[vtx_idx];
     v->u = s;
     v->v = t;
+    v->buf_generation = 0;
 }
 
-static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bool is_rect) {
-    struct LoadedVertex* v1 = &rsp.loaded_vertices[vtx1_idx];
-    struct LoadedVertex* v2 = &rsp.loaded_vertices[vtx2_idx];
-    struct LoadedVertex* v3 = &rsp.loaded_vertices[vtx3_idx];
-    struct LoadedVertex* v_arr[3] = { v1, v2, v3 };
-
-    // if (rand()%2) return;
-
-    if (v1->clip_rej & v2->clip_rej & v3->clip_rej) {
-        // The whole triangle lies outside the visible area
-        return;
-    }
-
-    if ((rsp.geometry_mode & G_CULL_BOTH) != 0) {
-        float dx1 = v1->x / (v1->w) - v2->x / (v2->w);
-        float dy1 = v1->y / (v1->w) - v2->y / (v2->w);
-        float dx2 = v3->x / (v3->w) - v2->x / (v2->w);
-        float dy2 = v3->y / (v3->w) - v2->y / (v2->w);
-        float cross = dx1 * dy2 - dy1 * dx2;
-
-        if ((v1->w < 0) ^ (v2->w < 0) ^ (v3->w < 0)) {
-            // If one vertex lies behind the eye, negating cross will give the correct result.
-            // If all vertices lie behind the eye, the triangle will be rejected anyway.
-            cross = -cross;
-        }
-
-        // If inverted culling is requested, negate the cross
-        if ((rsp.extra_geometry_mode & G_EX_INVERT_CULLING) == 1) {
-            cross = -cross;
-        }
-
-        switch (rsp.geometry_mode & G_CULL_BOTH) {
-            case G_CULL_FRONT:
-                if (cross <= 0) {
-                    return;
-                }
-                break;
-            case G_CULL_BACK:
-                if (cross >= 0) {
-                    return;
-                }
-                break;
-            case G_CULL_BOTH:
-                // Why is this even an option?
-                return;
-        }
+// Texture coordinates are S10.5, a shift of 11-15 scales them up instead of down.
+static inline float gfx_tex_coord_scale(int shift) {
+    if (shift == 0) {
+        return 1.0f / 32.0f;
     }
+    return (shift <= 10 ? 1.0f / (1 << shift) : (float)(1 << (16 - shift))) / 32.0f;
+}
 
+static void gfx_update_draw_state(bool is_rect) {
     bool depth_test = (rsp.geometry_mode & G_ZBUFFER) == G_ZBUFFER;
     bool depth_mask = (rdp.other_mode_l & Z_UPD) == Z_UPD;
     uint8_t depth_test_and_mask = (depth_test ? 1 : 0) | (depth_mask ? 2 : 0);
     if (depth_test_and_mask != rendering_state.depth_test_and_mask) {
-        gfx_flush();
+        gfx_flush(GFX_FLUSH_DEPTH);
         gfx_rapi->set_depth_test_and_mask(depth_test, depth_mask);
         rendering_state.depth_test_and_mask = depth_test_and_mask;
     }
 
     bool zmode_decal = (rdp.other_mode_l & ZMODE_DEC) == ZMODE_DEC;
     if (zmode_decal != rendering_state.decal_mode) {
-        gfx_flush();
+        gfx_flush(GFX_FLUSH_DEPTH);
         gfx_rapi->set_zmode_decal(zmode_decal);
         rendering_state.decal_mode = zmode_decal;
     }
 
-    if (rdp.viewport_or_scissor_changed) {
-        if (memcmp(&rdp.viewport, &rendering_state.viewport, sizeof(rdp.viewport)) != 0) {
-            gfx_flush();
-            gfx_rapi->set_viewport(rdp.viewport.x, rdp.viewport.y, rdp.viewport.width, rdp.viewport.height);
-            rendering_state.viewport = rdp.viewport;
-        }
-        if (memcmp(&rdp.scissor, &rendering_state.scissor, sizeof(rdp.scissor)) != 0) {
-            gfx_flush();
-            gfx_rapi->set_scissor(rdp.scissor.x, rdp.scissor.y, rdp.scissor.width, rdp.scissor.height);
-            rendering_state.scissor = rdp.scissor;
-        }
-        rdp.viewport_or_scissor_changed = false;
-    }
-
-    uint64_t cc_id = rdp.combine_mode;
     uint64_t cc_options = 0;
     bool use_alpha =
         (rdp.other_mode_l & (3 << 20)) == (G_BL_CLR_MEM << 20) && (rdp.other_mode_l & (3 << 16)) == (G_BL_1MA << 16);
@@ -1448,6 +2527,7 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
     bool invisible =
         (rdp.other_mode_l & (3 << 24)) == (G_BL_0 << 24) && (rdp.other_mode_l & (3 << 20)) == (G_BL_CLR_MEM << 20);
     bool use_grayscale = rdp.grayscale;
+    bool linear_filter = (rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT;
 
     if (texture_edge) {
         use_alpha = true;
@@ -1495,6 +2575,12 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
         cc_options &= ~((0xfff << 16) | ((uint64_t)0xfff << 44));
     }
 
+    // Rectangles are already in screen space
+    const bool gpu_transform = gpu_vertex.enabled && !is_rect;
+    if (gpu_transform) {
+        cc_options |= (uint64_t)SHADER_OPT_GPU_TRANSFORM;
+    }
+
     ColorCombinerKey key;
     key.combine_mode = rdp.combine_mode;
     key.options = cc_options;
@@ -1502,23 +2588,10 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
     ColorCombiner* comb = gfx_lookup_or_create_color_combiner(key);
 
     uint32_t tm = 0;
-    uint32_t tex_width[2], tex_height[2], tex_width2[2], tex_height2[2];
 
     for (int i = 0; i < 2; i++) {
         uint32_t tile = rdp.first_tile_index + i;
         if (comb->used_textures[i]) {
-            if (rdp.textures_changed[i]) {
-                gfx_flush();
-                import_texture(i, tile, false);
-                if (rdp.loaded_texture[i].masked) {
-                    import_texture_mask(SHADER_FIRST_MASK_TEXTURE + i, tile);
-                }
-                if (rdp.loaded_texture[i].blended) {
-                    import_texture(SHADER_FIRST_REPLACEMENT_TEXTURE + i, tile, true);
-                }
-                rdp.textures_changed[i] = false;
-            }
-
             uint8_t cms = rdp.texture_tile[tile].cms;
             uint8_t cmt = rdp.texture_tile[tile].cmt;
 
@@ -1529,7 +2602,7 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
                 line_size = 1;
             }
 
-            tex_height[i] = tex_size_bytes / line_size;
+            uint32_t tex_width, tex_height = tex_size_bytes / line_size;
             switch (rdp.texture_tile[tile].siz) {
                 case G_IM_SIZ_4b:
                     line_size <<= 1;
@@ -1541,35 +2614,91 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
                     break;
                 case G_IM_SIZ_32b:
                     line_size /= G_IM_SIZ_32b_LINE_BYTES; // this is 2!
-                    tex_height[i] /= 2;
+                    tex_height /= 2;
                     break;
             }
-            tex_width[i] = line_size;
+            tex_width = line_size;
 
-            tex_width2[i] = (rdp.texture_tile[tile].lrs - rdp.texture_tile[tile].uls + 4) / 4;
-            tex_height2[i] = (rdp.texture_tile[tile].lrt - rdp.texture_tile[tile].ult + 4) / 4;
+            uint32_t tex_width2 = (rdp.texture_tile[tile].lrs - rdp.texture_tile[tile].uls + 4) / 4;
+            uint32_t tex_height2 = (rdp.texture_tile[tile].lrt - rdp.texture_tile[tile].ult + 4) / 4;
 
-            uint32_t tex_width1 = tex_width[i] << (cms & G_TX_MIRROR);
-            uint32_t tex_height1 = tex_height[i] << (cmt & G_TX_MIRROR);
+            uint32_t tex_width1 = tex_width << (cms & G_TX_MIRROR);
+            uint32_t tex_height1 = tex_height << (cmt & G_TX_MIRROR);
 
-            if ((cms & G_TX_CLAMP) && ((cms & G_TX_MIRROR) || tex_width1 != tex_width2[i])) {
+            if ((cms & G_TX_CLAMP) && ((cms & G_TX_MIRROR) || tex_width1 != tex_width2)) {
                 tm |= 1 << 2 * i;
                 cms &= ~G_TX_CLAMP;
             }
-            if ((cmt & G_TX_CLAMP) && ((cmt & G_TX_MIRROR) || tex_height1 != tex_height2[i])) {
+            if ((cmt & G_TX_CLAMP) && ((cmt & G_TX_MIRROR) || tex_height1 != tex_height2)) {
                 tm |= 1 << 2 * i + 1;
                 cmt &= ~G_TX_CLAMP;
             }
 
-            bool linear_filter = (rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT;
-            if (linear_filter != rendering_state.textures[i]->second.linear_filter ||
-                cms != rendering_state.textures[i]->second.cms || cmt != rendering_state.textures[i]->second.cmt) {
-                gfx_flush();
+            draw_state.tex_scale_s[i] = gfx_tex_coord_scale(rdp.texture_tile[tile].shifts);
+            draw_state.tex_scale_t[i] = gfx_tex_coord_scale(rdp.texture_tile[tile].shiftt);
+            draw_state.tex_offset_s[i] = rdp.texture_tile[tile].uls / 4.0f;
+            draw_state.tex_offset_t[i] = rdp.texture_tile[tile].ult / 4.0f;
+            draw_state.tex_width[i] = tex_width;
+            draw_state.tex_height[i] = tex_height;
+            draw_state.tex_clamp_s[i] = (tex_width2 - 0.5f) / tex_width;
+            draw_state.tex_clamp_t[i] = (tex_height2 - 0.5f) / tex_height;
+
+            const bool atlas =
+                (tm & (3 << 2 * i)) == 0 && gfx_texture_atlas_eligible(i, tile, is_rect, tex_width, tex_height);
+            // An atlas copy can't serve a draw that may wrap, while a texture of its own can serve any draw
+            if (rdp.textures_changed[i] || (rendering_state.atlas_pages[i] >= 0 && !atlas)) {
+                const size_t pending_vbo_len = buf_vbo_len;
+                if (!atlas) {
+                    gfx_flush(GFX_FLUSH_TEXTURE);
+                }
+                import_texture(i, tile, false, atlas);
+                if (texture_atlas.import_node != nullptr) {
+                    // Nothing was uploaded
+                    gfx_texture_atlas_use_own_texture(i, texture_atlas.import_node->second);
+                    texture_atlas.import_node = nullptr;
+                }
+                if (atlas && pending_vbo_len > 0 && buf_vbo_len == pending_vbo_len) {
+                    texture_atlas.draw_calls_saved++;
+                }
+                if (rdp.loaded_texture[i].masked) {
+                    import_texture_mask(SHADER_FIRST_MASK_TEXTURE + i, tile);
+                }
+                if (rdp.loaded_texture[i].blended) {
+                    import_texture(SHADER_FIRST_REPLACEMENT_TEXTURE + i, tile, true, false);
+                }
+                rdp.textures_changed[i] = false;
+            }
+
+            if (rendering_state.atlas_pages[i] >= 0) {
+                // The padding replicates the edges, so the page can always clamp
+                struct TextureAtlasPage& page = texture_atlas.pages[rendering_state.atlas_pages[i]];
+                if (linear_filter != page.linear_filter) {
+                    gfx_flush(GFX_FLUSH_TEXTURE);
+                    gfx_rapi->set_sampler_parameters(i, linear_filter, G_TX_CLAMP, G_TX_CLAMP);
+                    page.linear_filter = linear_filter;
+                }
+
+                const TextureCacheValue& value = rendering_state.textures[i]->second;
+                draw_state.tex_offset_s[i] -= value.atlas_x;
+                draw_state.tex_offset_t[i] -= value.atlas_y;
+                draw_state.tex_width[i] = TEXTURE_ATLAS_PAGE_SIZE;
+                draw_state.tex_height[i] = TEXTURE_ATLAS_PAGE_SIZE;
+            } else if (linear_filter != rendering_state.textures[i]->second.linear_filter ||
+                       cms != rendering_state.textures[i]->second.cms ||
+                       cmt != rendering_state.textures[i]->second.cmt) {
+                gfx_flush(GFX_FLUSH_TEXTURE);
                 gfx_rapi->set_sampler_parameters(i, linear_filter, cms, cmt);
                 rendering_state.textures[i]->second.linear_filter = linear_filter;
                 rendering_state.textures[i]->second.cms = cms;
                 rendering_state.textures[i]->second.cmt = cmt;
             }
+
+            // gfx_emit_vertex's texture coordinate math folded into a scale and bias for the vertex shader
+            const float filter_offset = linear_filter ? 0.5f : 0.0f;
+            draw_state.tex_transform[i][0] = draw_state.tex_scale_s[i] / tex_width;
+            draw_state.tex_transform[i][1] = draw_state.tex_scale_t[i] / tex_height;
+            draw_state.tex_transform[i][2] = (filter_offset - draw_state.tex_offset_s[i]) / tex_width;
+            draw_state.tex_transform[i][3] = (filter_offset - draw_state.tex_offset_t[i]) / tex_height;
         }
     }
 
@@ -1579,201 +2708,420 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bo
             gfx_lookup_or_create_shader_program(comb->shader_id0, comb->shader_id1 | (tm * SHADER_OPT_TEXEL0_CLAMP_S));
     }
     if (prg != rendering_state.shader_program) {
-        gfx_flush();
+        gfx_flush(GFX_FLUSH_SHADER);
         gfx_rapi->unload_shader(rendering_state.shader_program);
         gfx_rapi->load_shader(prg);
         rendering_state.shader_program = prg;
     }
     if (use_alpha != rendering_state.alpha_blend) {
-        gfx_flush();
+        gfx_flush(GFX_FLUSH_BLEND);
         gfx_rapi->set_use_alpha(use_alpha);
         rendering_state.alpha_blend = use_alpha;
     }
-    uint8_t num_inputs;
-    bool used_textures[2];
 
-    gfx_rapi->shader_get_info(prg, &num_inputs, used_textures);
+    gfx_rapi->shader_get_info(prg, &draw_state.num_inputs, draw_state.used_textures);
+    draw_state.clip_parameters = gfx_rapi->get_clip_parameters();
+
+    draw_state.comb = comb;
+    draw_state.tm = tm;
+    draw_state.use_alpha = use_alpha;
+    draw_state.use_fog = use_fog;
+    draw_state.use_grayscale = use_grayscale;
+    draw_state.linear_filter = linear_filter;
+    draw_state.gpu_transform = gpu_transform;
+
+    // Resolve the combiner inputs to colours once, only shade and LOD fraction still vary per triangle
+    draw_state.per_triangle_inputs = false;
+    for (int k = 0; k < 2; k++) {
+        for (int j = 0; j < draw_state.num_inputs; j++) {
+            uint8_t input = comb->shader_input_mapping[k][j];
+            struct RGBA& color = draw_state.input_colors[k][j];
+            switch (input) {
+                    // Note: CCMUX constants and ACMUX constants used here have same value, which is why this works
+                    // (except LOD fraction).
+                case G_CCMUX_PRIMITIVE:
+                    color = rdp.prim_color;
+                    break;
+                case G_CCMUX_ENVIRONMENT:
+                    color = rdp.env_color;
+                    break;
+                case G_CCMUX_PRIMITIVE_ALPHA:
+                    color.r = color.g = color.b = color.a = rdp.prim_color.a;
+                    break;
+                case G_CCMUX_ENV_ALPHA:
+                    color.r = color.g = color.b = color.a = rdp.env_color.a;
+                    break;
+                case G_CCMUX_PRIM_LOD_FRAC:
+                    color.r = color.g = color.b = color.a = rdp.prim_lod_fraction;
+                    break;
+                case G_ACMUX_PRIM_LOD_FRAC:
+                    color = {};
+                    color.a = rdp.prim_lod_fraction;
+                    break;
+                case G_CCMUX_SHADE:
+                    break;
+                case G_CCMUX_LOD_FRACTION:
+                    draw_state.per_triangle_inputs = true;
+                    break;
+                default:
+                    color = {};
+                    break;
+            }
+        }
+    }
 
-    struct GfxClipParameters clip_parameters = gfx_rapi->get_clip_parameters();
+    draw_state.fog_color[0] = rdp.fog_color.r / 255.0f;
+    draw_state.fog_color[1] = rdp.fog_color.g / 255.0f;
+    draw_state.fog_color[2] = rdp.fog_color.b / 255.0f;
+    draw_state.grayscale_color[0] = rdp.grayscale_color.r / 255.0f;
+    draw_state.grayscale_color[1] = rdp.grayscale_color.g / 255.0f;
+    draw_state.grayscale_color[2] = rdp.grayscale_color.b / 255.0f;
+    draw_state.grayscale_color[3] = rdp.grayscale_color.a / 255.0f;
+
+    rdp.draw_state_changed = false;
+    // Vertices already in the buffer were written with the previous state
+    buf_vbo_generation++;
+}
 
-    for (int i = 0; i < 3; i++) {
-        float z = v_arr[i]->z, w = v_arr[i]->w;
-        if (clip_parameters.z_is_from_0_to_1) {
-            z = (z + w) / 2.0f;
-        }
+static void gfx_emit_vertex_inputs(const struct LoadedVertex* vtx, const struct LoadedVertex* v1);
 
-        buf_vbo[buf_vbo_len++] = v_arr[i]->x;
-        buf_vbo[buf_vbo_len++] = clip_parameters.invert_y ? -v_arr[i]->y : v_arr[i]->y;
-        buf_vbo[buf_vbo_len++] = z;
-        buf_vbo[buf_vbo_len++] = w;
+static void gfx_emit_vertex(const struct LoadedVertex* vtx, const struct LoadedVertex* v1, bool is_rect) {
+    const bool use_alpha = draw_state.use_alpha;
+    const bool use_fog = draw_state.use_fog;
+    const struct GfxClipParameters clip_parameters = draw_state.clip_parameters;
 
-        for (int t = 0; t < 2; t++) {
-            if (!used_textures[t]) {
-                continue;
+    float z = vtx->z, w = vtx->w;
+    if (clip_parameters.z_is_from_0_to_1) {
+        z = (z + w) / 2.0f;
+    }
+
+    buf_vbo[buf_vbo_len++] = vtx->x;
+    buf_vbo[buf_vbo_len++] = clip_parameters.invert_y ? -vtx->y : vtx->y;
+    buf_vbo[buf_vbo_len++] = z;
+    buf_vbo[buf_vbo_len++] = w;
+
+    for (int t = 0; t < 2; t++) {
+        if (!draw_state.used_textures[t]) {
+            continue;
+        }
+        float u = vtx->u * draw_state.tex_scale_s[t] - draw_state.tex_offset_s[t];
+        float v = vtx->v * draw_state.tex_scale_t[t] - draw_state.tex_offset_t[t];
+
+        if (draw_state.linear_filter) {
+            // Linear filter adds 0.5f to the coordinates
+            if (!is_rect) {
+                u += 0.5f;
+                v += 0.5f;
             }
-            float u = v_arr[i]->u / 32.0f;
-            float v = v_arr[i]->v / 32.0f;
-
-            int shifts = rdp.texture_tile[rdp.first_tile_index + t].shifts;
-            int shiftt = rdp.texture_tile[rdp.first_tile_index + t].shiftt;
-            if (shifts != 0) {
-                if (shifts <= 10) {
-                    u /= 1 << shifts;
-                } else {
-                    u *= 1 << (16 - shifts);
+        }
+
+        buf_vbo[buf_vbo_len++] = u / draw_state.tex_width[t];
+        buf_vbo[buf_vbo_len++] = v / draw_state.tex_height[t];
+
+        bool clampS = draw_state.tm & (1 << 2 * t);
+        bool clampT = draw_state.tm & (1 << 2 * t + 1);
+
+        if (clampS) {
+            buf_vbo[buf_vbo_len++] = draw_state.tex_clamp_s[t];
+        }
+#ifdef __WIIU__
+        else {
+            buf_vbo[buf_vbo_len++] = 0.0f;
+        }
+#endif
+        if (clampT) {
+            buf_vbo[buf_vbo_len++] = draw_state.tex_clamp_t[t];
+        }
+#ifdef __WIIU__
+        else {
+            buf_vbo[buf_vbo_len++] = 0.0f;
+        }
+#endif
+    }
+
+    if (use_fog) {
+        buf_vbo[buf_vbo_len++] = draw_state.fog_color[0];
+        buf_vbo[buf_vbo_len++] = draw_state.fog_color[1];
+        buf_vbo[buf_vbo_len++] = draw_state.fog_color[2];
+        buf_vbo[buf_vbo_len++] = vtx->color.a / 255.0f; // fog factor (not alpha)
+    }
+
+    gfx_emit_vertex_inputs(vtx, v1);
+}
+
+static void gfx_emit_vertex_inputs(const struct LoadedVertex* vtx, const struct LoadedVertex* v1) {
+    const bool use_alpha = draw_state.use_alpha;
+    const bool use_fog = draw_state.use_fog;
+
+    if (draw_state.use_grayscale) {
+        buf_vbo[buf_vbo_len++] = draw_state.grayscale_color[0];
+        buf_vbo[buf_vbo_len++] = draw_state.grayscale_color[1];
+        buf_vbo[buf_vbo_len++] = draw_state.grayscale_color[2];
+        buf_vbo[buf_vbo_len++] = draw_state.grayscale_color[3]; // lerp interpolation factor (not alpha)
+    }
+
+    for (int j = 0; j < draw_state.num_inputs; j++) {
+        const struct RGBA* color;
+        struct RGBA tmp;
+        for (int k = 0; k < 1 + (use_alpha ? 1 : 0); k++) {
+            switch (draw_state.comb->shader_input_mapping[k][j]) {
+                case G_CCMUX_SHADE:
+                    color = &vtx->color;
+                    break;
+                case G_CCMUX_LOD_FRACTION: {
+                    if (rdp.other_mode_l & G_TL_LOD) {
+                        // "Hack" that works for Bowser - Peach painting
+                        float distance_frac = (v1->w - 3000.0f) / 3000.0f;
+                        if (distance_frac < 0.0f) {
+                            distance_frac = 0.0f;
+                        }
+                        if (distance_frac > 1.0f) {
+                            distance_frac = 1.0f;
+                        }
+                        tmp.r = tmp.g = tmp.b = tmp.a = distance_frac * 255.0f;
+                    } else {
+                        tmp.r = tmp.g = tmp.b = tmp.a = 255.0f;
+                    }
+                    color = &tmp;
+                    break;
                 }
+                default:
+                    color = &draw_state.input_colors[k][j];
+                    break;
             }
-            if (shiftt != 0) {
-                if (shiftt <= 10) {
-                    v /= 1 << shiftt;
+            if (k == 0) {
+                buf_vbo[buf_vbo_len++] = color->r / 255.0f;
+                buf_vbo[buf_vbo_len++] = color->g / 255.0f;
+                buf_vbo[buf_vbo_len++] = color->b / 255.0f;
+#ifdef __WIIU__
+                // padding
+                if (!use_alpha) {
+                    buf_vbo[buf_vbo_len++] = 1.0f;
+                }
+#endif
+            } else {
+                if (use_fog && color == &vtx->color) {
+                    // Shade alpha is 100% for fog
+                    buf_vbo[buf_vbo_len++] = 1.0f;
                 } else {
-                    v *= 1 << (16 - shiftt);
+                    buf_vbo[buf_vbo_len++] = color->a / 255.0f;
                 }
             }
+        }
+    }
+}
 
-            u -= rdp.texture_tile[rdp.first_tile_index + t].uls / 4.0f;
-            v -= rdp.texture_tile[rdp.first_tile_index + t].ult / 4.0f;
+// Writes the model space vertex, the shader applies the matrix, lighting, texgen and fog from the batch state
+static void gfx_emit_vertex_gpu(const struct LoadedVertex* vtx, const struct LoadedVertex* v1) {
+    buf_vbo[buf_vbo_len++] = vtx->ob[0];
+    buf_vbo[buf_vbo_len++] = vtx->ob[1];
+    buf_vbo[buf_vbo_len++] = vtx->ob[2];
+    buf_vbo[buf_vbo_len++] = gpu_vertex.matrices[vtx->gpu_matrix].batch_slot;
+
+    if (gpu_vertex.batch.lighting.lighting) {
+        buf_vbo[buf_vbo_len++] = (int8_t)vtx->cn[0] / 127.0f;
+        buf_vbo[buf_vbo_len++] = (int8_t)vtx->cn[1] / 127.0f;
+        buf_vbo[buf_vbo_len++] = (int8_t)vtx->cn[2] / 127.0f;
+    } else {
+        buf_vbo[buf_vbo_len++] = vtx->cn[0] / 255.0f;
+        buf_vbo[buf_vbo_len++] = vtx->cn[1] / 255.0f;
+        buf_vbo[buf_vbo_len++] = vtx->cn[2] / 255.0f;
+    }
+    buf_vbo[buf_vbo_len++] = vtx->cn[3] / 255.0f;
 
-            if ((rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT) {
-                // Linear filter adds 0.5f to the coordinates
-                if (!is_rect) {
-                    u += 0.5f;
-                    v += 0.5f;
-                }
-            }
+    if (draw_state.used_textures[0] || draw_state.used_textures[1]) {
+        buf_vbo[buf_vbo_len++] = vtx->u;
+        buf_vbo[buf_vbo_len++] = vtx->v;
+    }
+
+    for (int t = 0; t < 2; t++) {
+        if (!draw_state.used_textures[t]) {
+            continue;
+        }
+        if (draw_state.tm & (1 << 2 * t)) {
+            buf_vbo[buf_vbo_len++] = draw_state.tex_clamp_s[t];
+        }
+        if (draw_state.tm & (1 << 2 * t + 1)) {
+            buf_vbo[buf_vbo_len++] = draw_state.tex_clamp_t[t];
+        }
+    }
+
+    gfx_emit_vertex_inputs(vtx, v1);
+}
 
-            buf_vbo[buf_vbo_len++] = u / tex_width[t];
-            buf_vbo[buf_vbo_len++] = v / tex_height[t];
+// Makes sure the active batch can take the triangle, flushing when its uniforms would have to change
+static void gfx_gpu_vertex_prepare_triangle(struct LoadedVertex* const v_arr[3]) {
+    struct GfxVertexTransform& batch = gpu_vertex.batch;
+    const bool invert_y = draw_state.clip_parameters.invert_y;
 
-            bool clampS = tm & (1 << 2 * t);
-            bool clampT = tm & (1 << 2 * t + 1);
+    // Lighting is uniform per batch, a triangle mixing vertices from different loads uses its first vertex's state
+    const uint32_t lighting = v_arr[0]->gpu_lighting;
 
-            if (clampS) {
-                buf_vbo[buf_vbo_len++] = (tex_width2[t] - 0.5f) / tex_width[t];
-            }
-#ifdef __WIIU__
-            else {
-                buf_vbo[buf_vbo_len++] = 0.0f;
+    uint8_t new_matrices = 0;
+    for (int i = 0; i < 3; i++) {
+        const struct GpuVertexMatrix& matrix = gpu_vertex.matrices[v_arr[i]->gpu_matrix];
+        const bool seen = (i > 0 && v_arr[i]->gpu_matrix == v_arr[0]->gpu_matrix) ||
+                          (i > 1 && v_arr[i]->gpu_matrix == v_arr[1]->gpu_matrix);
+        if (!seen && matrix.batch_id != gpu_vertex.batch_id) {
+            new_matrices++;
+        }
+    }
+
+    if (gpu_vertex.batch_active &&
+        (gpu_vertex.batch_lighting != lighting || gpu_vertex.batch_invert_y != invert_y ||
+         batch.num_matrices + new_matrices > GFX_VERTEX_MAX_MATRICES ||
+         memcmp(batch.tex_transform, draw_state.tex_transform, sizeof(batch.tex_transform)) != 0 ||
+         memcmp(batch.fog_color, draw_state.fog_color, sizeof(batch.fog_color)) != 0)) {
+        gfx_flush(GFX_FLUSH_VERTEX_BATCH);
+    }
+
+    if (!gpu_vertex.batch_active) {
+        gpu_vertex.batch_active = true;
+        gpu_vertex.batch_lighting = lighting;
+        gpu_vertex.batch_invert_y = invert_y;
+        batch.lighting = gpu_vertex.lighting[lighting];
+        memcpy(batch.tex_transform, draw_state.tex_transform, sizeof(batch.tex_transform));
+        memcpy(batch.fog_color, draw_state.fog_color, sizeof(batch.fog_color));
+    }
+
+    for (int i = 0; i < 3; i++) {
+        struct GpuVertexMatrix& matrix = gpu_vertex.matrices[v_arr[i]->gpu_matrix];
+        if (matrix.batch_id == gpu_vertex.batch_id) {
+            continue;
+        }
+        matrix.batch_id = gpu_vertex.batch_id;
+        matrix.batch_slot = batch.num_matrices++;
+        memcpy(batch.matrices[matrix.batch_slot], matrix.m, sizeof(matrix.m));
+        if (invert_y) {
+            for (int j = 0; j < 4; j++) {
+                batch.matrices[matrix.batch_slot][j][1] = -batch.matrices[matrix.batch_slot][j][1];
             }
-#endif
-            if (clampT) {
-                buf_vbo[buf_vbo_len++] = (tex_height2[t] - 0.5f) / tex_height[t];
+        }
+    }
+}
+
+static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx, bool is_rect) {
+    struct LoadedVertex* v1 = &rsp.loaded_vertices[vtx1_idx];
+    struct LoadedVertex* v2 = &rsp.loaded_vertices[vtx2_idx];
+    struct LoadedVertex* v3 = &rsp.loaded_vertices[vtx3_idx];
+    struct LoadedVertex* v_arr[3] = { v1, v2, v3 };
+
+    // if (rand()%2) return;
+
+    render_stats.current.triangles++;
+    if (v1->clip_rej & v2->clip_rej & v3->clip_rej) {
+        // The whole triangle lies outside the visible area
+        render_stats.current.triangles_rejected++;
+        return;
+    }
+
+    if ((rsp.geometry_mode & G_CULL_BOTH) != 0) {
+        if (gpu_vertex.enabled && !is_rect) {
+            for (int i = 0; i < 3; i++) {
+                gfx_gpu_vertex_clip_position(v_arr[i]);
             }
-#ifdef __WIIU__
-            else {
-                buf_vbo[buf_vbo_len++] = 0.0f;
+            if (v1->clip_rej & v2->clip_rej & v3->clip_rej) {
+                render_stats.current.triangles_rejected++;
+                return;
             }
-#endif
         }
 
-        if (use_fog) {
-            buf_vbo[buf_vbo_len++] = rdp.fog_color.r / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.fog_color.g / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.fog_color.b / 255.0f;
-            buf_vbo[buf_vbo_len++] = v_arr[i]->color.a / 255.0f; // fog factor (not alpha)
+        float dx1 = v1->x / (v1->w) - v2->x / (v2->w);
+        float dy1 = v1->y / (v1->w) - v2->y / (v2->w);
+        float dx2 = v3->x / (v3->w) - v2->x / (v2->w);
+        float dy2 = v3->y / (v3->w) - v2->y / (v2->w);
+        float cross = dx1 * dy2 - dy1 * dx2;
+
+        if ((v1->w < 0) ^ (v2->w < 0) ^ (v3->w < 0)) {
+            // If one vertex lies behind the eye, negating cross will give the correct result.
+            // If all vertices lie behind the eye, the triangle will be rejected anyway.
+            cross = -cross;
         }
 
-        if (use_grayscale) {
-            buf_vbo[buf_vbo_len++] = rdp.grayscale_color.r / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.grayscale_color.g / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.grayscale_color.b / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.grayscale_color.a / 255.0f; // lerp interpolation factor (not alpha)
+        // If inverted culling is requested, negate the cross
+        if ((rsp.extra_geometry_mode & G_EX_INVERT_CULLING) == 1) {
+            cross = -cross;
         }
 
-        for (int j = 0; j < num_inputs; j++) {
-            struct RGBA* color = 0;
-            struct RGBA tmp;
-            for (int k = 0; k < 1 + (use_alpha ? 1 : 0); k++) {
-                switch (comb->shader_input_mapping[k][j]) {
-                        // Note: CCMUX constants and ACMUX constants used here have same value, which is why this works
-                        // (except LOD fraction).
-                    case G_CCMUX_PRIMITIVE:
-                        color = &rdp.prim_color;
-                        break;
-                    case G_CCMUX_SHADE:
-                        color = &v_arr[i]->color;
-                        break;
-                    case G_CCMUX_ENVIRONMENT:
-                        color = &rdp.env_color;
-                        break;
-                    case G_CCMUX_PRIMITIVE_ALPHA: {
-                        tmp.r = tmp.g = tmp.b = rdp.prim_color.a;
-                        color = &tmp;
-                        break;
-                    }
-                    case G_CCMUX_ENV_ALPHA: {
-                        tmp.r = tmp.g = tmp.b = rdp.env_color.a;
-                        color = &tmp;
-                        break;
-                    }
-                    case G_CCMUX_PRIM_LOD_FRAC: {
-                        tmp.r = tmp.g = tmp.b = rdp.prim_lod_fraction;
-                        color = &tmp;
-                        break;
-                    }
-                    case G_CCMUX_LOD_FRACTION: {
-                        if (rdp.other_mode_l & G_TL_LOD) {
-                            // "Hack" that works for Bowser - Peach painting
-                            float distance_frac = (v1->w - 3000.0f) / 3000.0f;
-                            if (distance_frac < 0.0f) {
-                                distance_frac = 0.0f;
-                            }
-                            if (distance_frac > 1.0f) {
-                                distance_frac = 1.0f;
-                            }
-                            tmp.r = tmp.g = tmp.b = tmp.a = distance_frac * 255.0f;
-                        } else {
-                            tmp.r = tmp.g = tmp.b = tmp.a = 255.0f;
-                        }
-                        color = &tmp;
-                        break;
-                    }
-                    case G_ACMUX_PRIM_LOD_FRAC:
-                        tmp.a = rdp.prim_lod_fraction;
-                        color = &tmp;
-                        break;
-                    default:
-                        memset(&tmp, 0, sizeof(tmp));
-                        color = &tmp;
-                        break;
+        switch (rsp.geometry_mode & G_CULL_BOTH) {
+            case G_CULL_FRONT:
+                if (cross <= 0) {
+                    render_stats.current.triangles_rejected++;
+                    return;
                 }
-                if (k == 0) {
-                    buf_vbo[buf_vbo_len++] = color->r / 255.0f;
-                    buf_vbo[buf_vbo_len++] = color->g / 255.0f;
-                    buf_vbo[buf_vbo_len++] = color->b / 255.0f;
-#ifdef __WIIU__
-                    // padding
-                    if (!use_alpha) {
-                        buf_vbo[buf_vbo_len++] = 1.0f;
-                    }
-#endif
-                } else {
-                    if (use_fog && color == &v_arr[i]->color) {
-                        // Shade alpha is 100% for fog
-                        buf_vbo[buf_vbo_len++] = 1.0f;
-                    } else {
-                        buf_vbo[buf_vbo_len++] = color->a / 255.0f;
-                    }
+                break;
+            case G_CULL_BACK:
+                if (cross >= 0) {
+                    render_stats.current.triangles_rejected++;
+                    return;
                 }
-            }
+                break;
+            case G_CULL_BOTH:
+                // Why is this even an option?
+                render_stats.current.triangles_rejected++;
+                return;
+        }
+    }
+
+    if (rdp.viewport_or_scissor_changed) {
+        if (memcmp(&rdp.viewport, &rendering_state.viewport, sizeof(rdp.viewport)) != 0) {
+            gfx_flush(GFX_FLUSH_VIEWPORT);
+            gfx_rapi->set_viewport(rdp.viewport.x, rdp.viewport.y, rdp.viewport.width, rdp.viewport.height);
+            rendering_state.viewport = rdp.viewport;
+        }
+        if (memcmp(&rdp.scissor, &rendering_state.scissor, sizeof(rdp.scissor)) != 0) {
+            gfx_flush(GFX_FLUSH_VIEWPORT);
+            gfx_rapi->set_scissor(rdp.scissor.x, rdp.scissor.y, rdp.scissor.width, rdp.scissor.height);
+            rendering_state.scissor = rdp.scissor;
+        }
+        rdp.viewport_or_scissor_changed = false;
+    }
+
+    if (rdp.draw_state_changed) {
+        gfx_update_draw_state(is_rect);
+    }
+
+    if (draw_state.gpu_transform) {
+        if (draw_state.per_triangle_inputs) {
+            gfx_gpu_vertex_clip_position(v1);
         }
+        gfx_gpu_vertex_prepare_triangle(v_arr);
+    }
 
-        // struct RGBA *color = &v_arr[i]->color;
-        // buf_vbo[buf_vbo_len++] = color->r / 255.0f;
-        // buf_vbo[buf_vbo_len++] = color->g / 255.0f;
-        // buf_vbo[buf_vbo_len++] = color->b / 255.0f;
-        // buf_vbo[buf_vbo_len++] = color->a / 255.0f;
+    // Vertices shared by several triangles of a batch are written once and referenced by index. The LOD fraction hack
+    // depends on the triangle rather than the vertex, so those combiners always write fresh vertices.
+    const bool indexed = gfx_rapi->draw_indexed_triangles != nullptr;
+    const bool share_vertices = indexed && !draw_state.per_triangle_inputs;
+
+    for (int i = 0; i < 3; i++) {
+        struct LoadedVertex* v = v_arr[i];
+        if (indexed) {
+            if (share_vertices && v->buf_generation == buf_vbo_generation) {
+                buf_ibo[buf_ibo_len++] = v->buf_index;
+                continue;
+            }
+            v->buf_generation = buf_vbo_generation;
+            v->buf_index = (uint16_t)buf_vbo_num_verts;
+            buf_ibo[buf_ibo_len++] = v->buf_index;
+        }
+        buf_vbo_num_verts++;
+        if (draw_state.gpu_transform) {
+            gfx_emit_vertex_gpu(v, v1);
+        } else {
+            gfx_emit_vertex(v, v1, is_rect);
+        }
     }
 
     if (++buf_vbo_num_tris == MAX_BUFFERED) {
         // if (++buf_vbo_num_tris == 1) {
-        gfx_flush();
+        gfx_flush(GFX_FLUSH_BUFFER_FULL);
     }
 }
 
 static void gfx_sp_geometry_mode(uint32_t clear, uint32_t set) {
     rsp.geometry_mode &= ~clear;
     rsp.geometry_mode |= set;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_sp_extra_geometry_mode(uint32_t clear, uint32_t set) {
@@ -1823,6 +3171,7 @@ static void gfx_calc_and_set_viewport(const Vp_t* viewport) {
 }
 
 static void gfx_sp_movemem(uint8_t index, uint8_t offset, const void* data) {
+    gfx_retained_note_input(data, index == G_MV_VIEWPORT ? sizeof(Vp_t) : sizeof(Light_t), false);
     switch (index) {
         case G_MV_VIEWPORT:
             gfx_calc_and_set_viewport((const Vp_t*)data);
@@ -1888,6 +3237,7 @@ static void gfx_sp_texture(uint16_t sc, uint16_t tc, uint8_t level, uint8_t tile
     }
 
     rdp.first_tile_index = tile;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_set_scissor(uint32_t mode, uint32_t ulx, uint32_t uly, uint32_t lrx, uint32_t lry) {
@@ -1907,7 +3257,7 @@ static void gfx_dp_set_scissor(uint32_t mode, uint32_t ulx, uint32_t uly, uint32
 }
 
 static void gfx_dp_set_texture_image(uint32_t format, uint32_t size, uint32_t width, const char* texPath,
-                                     uint32_t texFlags, RawTexMetadata rawTexMetdata, const void* addr) {
+                                     uint32_t texFlags, const RawTexMetadata& rawTexMetdata, const void* addr) {
     rdp.texture_to_load.addr = (const uint8_t*)addr;
     rdp.texture_to_load.siz = size;
     rdp.texture_to_load.width = width;
@@ -1915,6 +3265,34 @@ static void gfx_dp_set_texture_image(uint32_t format, uint32_t size, uint32_t wi
     rdp.texture_to_load.raw_tex_metadata = rawTexMetdata;
 }
 
+// Takes the blend registered for the loaded texture from its resource, the registry is only searched again after a
+// new registration
+static void gfx_dp_load_texture_blend(uint32_t tmem_index) {
+    const std::shared_ptr<LUS::Texture>& texture = rdp.texture_to_load.raw_tex_metadata.resource;
+    auto& loaded = rdp.loaded_texture[tmem_index];
+
+    if (texture == nullptr) {
+        loaded.masked = false;
+        loaded.blended = false;
+        loaded.blend_mask = nullptr;
+        loaded.blend_replacement = nullptr;
+        return;
+    }
+
+    if (texture->BlendGeneration != masked_textures_generation) {
+        auto it = masked_textures.find(gfx_get_base_texture_path(texture->GetInitData()->Path));
+        texture->HasBlend = it != masked_textures.end();
+        texture->BlendMask = texture->HasBlend ? it->second.mask : nullptr;
+        texture->BlendReplacement = texture->HasBlend ? it->second.replacementData : nullptr;
+        texture->BlendGeneration = masked_textures_generation;
+    }
+
+    loaded.masked = texture->HasBlend;
+    loaded.blended = texture->BlendReplacement != nullptr;
+    loaded.blend_mask = texture->BlendMask;
+    loaded.blend_replacement = texture->BlendReplacement;
+}
+
 static void gfx_dp_set_tile(uint8_t fmt, uint32_t siz, uint32_t line, uint32_t tmem, uint8_t tile, uint32_t palette,
                             uint32_t cmt, uint32_t maskt, uint32_t shiftt, uint32_t cms, uint32_t masks,
                             uint32_t shifts) {
@@ -1947,6 +3325,7 @@ static void gfx_dp_set_tile(uint8_t fmt, uint32_t siz, uint32_t line, uint32_t t
         tmem != 0; // assume one texture is loaded at address 0 and another texture at any other address
     rdp.textures_changed[0] = true;
     rdp.textures_changed[1] = true;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_set_tile_size(uint8_t tile, uint16_t uls, uint16_t ult, uint16_t lrs, uint16_t lrt) {
@@ -1956,6 +3335,7 @@ static void gfx_dp_set_tile_size(uint8_t tile, uint16_t uls, uint16_t ult, uint1
     rdp.texture_tile[tile].lrt = lrt;
     rdp.textures_changed[0] = true;
     rdp.textures_changed[1] = true;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_load_tlut(uint8_t tile, uint32_t high_index) {
@@ -2012,21 +3392,10 @@ static void gfx_dp_load_block(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata = rdp.texture_to_load.raw_tex_metadata;
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr = rdp.texture_to_load.addr;
 
-    const std::string& texPath =
-        rdp.texture_to_load.raw_tex_metadata.resource != nullptr
-            ? gfx_get_base_texture_path(rdp.texture_to_load.raw_tex_metadata.resource->GetInitData()->Path)
-            : "";
-    auto maskedTextureIter = masked_textures.find(texPath);
-    if (maskedTextureIter != masked_textures.end()) {
-        rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].masked = true;
-        rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blended =
-            maskedTextureIter->second.replacementData != nullptr;
-    } else {
-        rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].masked = false;
-        rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blended = false;
-    }
+    gfx_dp_load_texture_blend(rdp.texture_tile[tile].tmem_index);
 
     rdp.textures_changed[rdp.texture_tile[tile].tmem_index] = true;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_load_tile(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t lrs, uint32_t lrt) {
@@ -2082,19 +3451,7 @@ static void gfx_dp_load_tile(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].raw_tex_metadata = rdp.texture_to_load.raw_tex_metadata;
     rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].addr = rdp.texture_to_load.addr + start_offset_bytes;
 
-    const std::string& texPath =
-        rdp.texture_to_load.raw_tex_metadata.resource != nullptr
-            ? gfx_get_base_texture_path(rdp.texture_to_load.raw_tex_metadata.resource->GetInitData()->Path)
-            : "";
-    auto maskedTextureIter = masked_textures.find(texPath);
-    if (maskedTextureIter != masked_textures.end()) {
-        rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].masked = true;
-        rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blended =
-            maskedTextureIter->second.replacementData != nullptr;
-    } else {
-        rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].masked = false;
-        rdp.loaded_texture[rdp.texture_tile[tile].tmem_index].blended = false;
-    }
+    gfx_dp_load_texture_blend(rdp.texture_tile[tile].tmem_index);
 
     rdp.texture_tile[tile].uls = uls;
     rdp.texture_tile[tile].ult = ult;
@@ -2102,6 +3459,7 @@ static void gfx_dp_load_tile(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t
     rdp.texture_tile[tile].lrt = lrt;
 
     rdp.textures_changed[rdp.texture_tile[tile].tmem_index] = true;
+    rdp.draw_state_changed = true;
 }
 
 /*static uint8_t color_comb_component(uint32_t v) {
@@ -2138,6 +3496,7 @@ static void gfx_dp_set_combine_mode(uint32_t rgb, uint32_t alpha) {
 
 static void gfx_dp_set_combine_mode(uint32_t rgb, uint32_t alpha, uint32_t rgb_cyc2, uint32_t alpha_cyc2) {
     rdp.combine_mode = rgb | (alpha << 16) | ((uint64_t)rgb_cyc2 << 28) | ((uint64_t)alpha_cyc2 << 44);
+    rdp.draw_state_changed = true;
 }
 
 static inline uint32_t color_comb(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
@@ -2153,6 +3512,7 @@ static void gfx_dp_set_grayscale_color(uint8_t r, uint8_t g, uint8_t b, uint8_t
     rdp.grayscale_color.g = g;
     rdp.grayscale_color.b = b;
     rdp.grayscale_color.a = a;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_set_env_color(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
@@ -2160,6 +3520,7 @@ static void gfx_dp_set_env_color(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
     rdp.env_color.g = g;
     rdp.env_color.b = b;
     rdp.env_color.a = a;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_set_prim_color(uint8_t m, uint8_t l, uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
@@ -2168,6 +3529,7 @@ static void gfx_dp_set_prim_color(uint8_t m, uint8_t l, uint8_t r, uint8_t g, ui
     rdp.prim_color.g = g;
     rdp.prim_color.b = b;
     rdp.prim_color.a = a;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_set_fog_color(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
@@ -2175,6 +3537,7 @@ static void gfx_dp_set_fog_color(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
     rdp.fog_color.g = g;
     rdp.fog_color.b = b;
     rdp.fog_color.a = a;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_set_fill_color(uint32_t packed_color) {
@@ -2196,6 +3559,7 @@ static void gfx_draw_rectangle(int32_t ulx, int32_t uly, int32_t lrx, int32_t lr
     if (cycle_type == G_CYC_COPY) {
         rdp.other_mode_h = (rdp.other_mode_h & ~(3U << G_MDSFT_TEXTFILT)) | G_TF_POINT;
     }
+    rdp.draw_state_changed = true;
 
     // U10.2 coordinates
     float ulxf = ulx;
@@ -2236,6 +3600,12 @@ static void gfx_draw_rectangle(int32_t ulx, int32_t uly, int32_t lrx, int32_t lr
     ur->z = -1.0f;
     ur->w = 1.0f;
 
+    for (int i = MAX_VERTICES; i < MAX_VERTICES + 4; i++) {
+        rsp.loaded_vertices[i].buf_generation = 0;
+        rsp.loaded_vertices[i].has_clip_pos = true;
+        rsp.loaded_vertices[i].clip_rej = 0;
+    }
+
     // The coordinates for texture rectangle shall bypass the viewport setting
     struct XYWidthHeight default_viewport = { 0, SCREEN_HEIGHT, SCREEN_WIDTH, SCREEN_HEIGHT };
     struct XYWidthHeight viewport_saved = rdp.viewport;
@@ -2257,6 +3627,7 @@ static void gfx_draw_rectangle(int32_t ulx, int32_t uly, int32_t lrx, int32_t lr
     if (cycle_type == G_CYC_COPY) {
         rdp.other_mode_h = saved_other_mode_h;
     }
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_texture_rectangle(int32_t ulx, int32_t uly, int32_t lrx, int32_t lry, uint8_t tile, int16_t uls,
@@ -2323,6 +3694,7 @@ static void gfx_dp_texture_rectangle(int32_t ulx, int32_t uly, int32_t lrx, int3
     }
     rdp.first_tile_index = saved_tile;
     rdp.combine_mode = saved_combine_mode;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_fill_rectangle(int32_t ulx, int32_t uly, int32_t lrx, int32_t lry) {
@@ -2359,6 +3731,7 @@ static void gfx_dp_fill_rectangle(int32_t ulx, int32_t uly, int32_t lrx, int32_t
 
     gfx_draw_rectangle(ulx, uly, lrx, lry);
     rdp.combine_mode = saved_combine_mode;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_set_z_image(void* z_buf_address) {
@@ -2375,11 +3748,13 @@ static void gfx_sp_set_other_mode(uint32_t shift, uint32_t num_bits, uint64_t mo
     om = (om & ~mask) | mode;
     rdp.other_mode_l = (uint32_t)om;
     rdp.other_mode_h = (uint32_t)(om >> 32);
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_dp_set_other_mode(uint32_t h, uint32_t l) {
     rdp.other_mode_h = h;
     rdp.other_mode_l = l;
+    rdp.draw_state_changed = true;
 }
 
 static void gfx_s2dex_bg_copy(uObjBg* bg) {
@@ -2459,6 +3834,133 @@ static inline void* seg_addr(uintptr_t w1) {
 
 uintptr_t clearMtx;
 
+static void gfx_run_dl(Gfx* cmd);
+
+static enum GfxCommandClass gfx_command_class(uint32_t opcode) {
+    switch (opcode) {
+        case G_VTX:
+        case G_VTX_OTR_HASH:
+        case G_VTX_OTR_FILEPATH:
+        case G_MODIFYVTX:
+            return GFX_COMMAND_VERTEX;
+        case (uint8_t)G_TRI1:
+        case (uint8_t)G_TRI1_OTR:
+#if defined(F3DEX_GBI) || defined(F3DLP_GBI)
+        case (uint8_t)G_TRI2:
+#endif
+#ifdef F3DEX_GBI_2
+        case G_QUAD:
+#endif
+            return GFX_COMMAND_TRIANGLE;
+        case G_MTX:
+        case G_MTX_OTR:
+        case (uint8_t)G_POPMTX:
+            return GFX_COMMAND_MATRIX;
+        case (uint8_t)G_TEXTURE:
+        case G_SETTIMG:
+        case G_SETTIMG_OTR_HASH:
+        case G_SETTIMG_OTR_FILEPATH:
+        case G_SETTIMG_FB:
+        case G_LOADBLOCK:
+        case G_LOADTILE:
+        case G_SETTILE:
+        case G_SETTILESIZE:
+        case G_LOADTLUT:
+        case G_INVALTEXCACHE:
+            return GFX_COMMAND_TEXTURE;
+        case G_TEXRECT:
+        case G_TEXRECTFLIP:
+        case G_TEXRECT_WIDE:
+        case G_FILLRECT:
+        case G_FILLWIDERECT:
+        case G_BG_COPY:
+            return GFX_COMMAND_RECTANGLE;
+        case G_DL:
+        case G_DL_OTR_HASH:
+        case G_DL_OTR_FILEPATH:
+        case G_BRANCH_Z_OTR:
+        case (uint8_t)G_ENDDL:
+            return GFX_COMMAND_DISPLAY_LIST;
+        case G_NOOP:
+        case G_MARKER:
+        case G_LOAD_UCODE:
+        case G_PUSHCD:
+            return GFX_COMMAND_OTHER;
+        default:
+            return GFX_COMMAND_STATE;
+    }
+}
+
+static void gfx_run_dl_retained(Gfx* dl) {
+    if (!retained_geometry.enabled || retained_geometry.recording != nullptr ||
+        retained_geometry.uncacheable.contains(dl)) {
+        gfx_run_dl(dl);
+        return;
+    }
+
+    const uint64_t key = gfx_retained_key(dl);
+    auto it = retained_geometry.entries.find(key);
+    if (it != retained_geometry.entries.end() && it->second.dl == dl && gfx_retained_inputs_match(it->second)) {
+        // Triangles buffered so far belong to the caller
+        gfx_flush(GFX_FLUSH_END);
+        retained_geometry.hits++;
+        it->second.last_used_frame = retained_geometry.frame;
+        gfx_retained_replay(it->second);
+        return;
+    }
+    retained_geometry.misses++;
+
+    // Recording flushes around the list and splits the caller's batch, so only lists that come back with the same
+    // state are recorded. Stale entries were worth recording before and are recorded again straight away.
+    if (it == retained_geometry.entries.end()) {
+        if (retained_geometry.entries.size() >= RETAINED_GEOMETRY_MAX_ENTRIES) {
+            gfx_run_dl(dl);
+            return;
+        }
+        if (retained_geometry.candidates.size() >= RETAINED_GEOMETRY_MAX_CANDIDATES) {
+            retained_geometry.candidates.clear();
+        }
+        if (retained_geometry.candidates.insert(key).second) {
+            gfx_run_dl(dl);
+            return;
+        }
+    }
+
+    gfx_flush(GFX_FLUSH_END);
+    RetainedGeometry entry;
+    entry.dl = dl;
+    gfx_retained_begin_recording(&entry);
+    gfx_run_dl(dl);
+    gfx_flush(GFX_FLUSH_END);
+    RetainedRecordResult result = gfx_retained_end_recording();
+
+    if (auto it = retained_geometry.entries.find(key); it != retained_geometry.entries.end()) {
+        retained_geometry.bytes_retained -= it->second.size_bytes;
+        retained_geometry.entries.erase(it);
+    }
+    if (result == RETAINED_RECORD_UNCACHEABLE) {
+        retained_geometry.uncacheable.insert(dl);
+        return;
+    }
+    if (result != RETAINED_RECORD_OK || retained_geometry.entries.size() >= RETAINED_GEOMETRY_MAX_ENTRIES) {
+        return;
+    }
+
+    entry.rsp = rsp;
+    entry.rdp = rdp;
+    entry.rendering_state = rendering_state;
+    entry.draw_state = draw_state;
+    memcpy(entry.segment_pointers, segmentPointers, sizeof(segmentPointers));
+    entry.last_used_frame = retained_geometry.frame;
+    entry.vbo.shrink_to_fit();
+    entry.ibo.shrink_to_fit();
+    entry.size_bytes = sizeof(RetainedGeometry) + entry.commands.capacity() * sizeof(RetainedCommand) +
+                       entry.vbo.capacity() * sizeof(float) + entry.ibo.capacity() * sizeof(uint16_t) +
+                       entry.inputs.capacity() * sizeof(RetainedInput);
+    retained_geometry.bytes_retained += entry.size_bytes;
+    retained_geometry.entries.emplace(key, std::move(entry));
+}
+
 static void gfx_run_dl(Gfx* cmd) {
     // puts("dl");
     int dummy = 0;
@@ -2471,6 +3973,7 @@ static void gfx_run_dl(Gfx* cmd) {
     for (;;) {
         uint32_t opcode = cmd->words.w0 >> 24;
         // uint32_t opcode = cmd->words.w0 & 0xFF;
+        render_stats.current.commands[gfx_command_class(opcode)]++;
 
         // if (markerOn)
         // printf("OP: %02X\n", opcode);
@@ -2514,8 +4017,10 @@ static void gfx_run_dl(Gfx* cmd) {
                 }
 
 #ifdef F3DEX_GBI_2
+                gfx_retained_note_input(seg_addr(mtxAddr), sizeof(Mtx), true);
                 gfx_sp_matrix(C0(0, 8) ^ G_MTX_PUSH, (const int32_t*)seg_addr(mtxAddr));
 #else
+                gfx_retained_note_input(seg_addr(cmd->words.w1), sizeof(Mtx), true);
                 gfx_sp_matrix(C0(16, 8), (const int32_t*)seg_addr(cmd->words.w1));
 #endif
                 break;
@@ -2568,10 +4073,13 @@ static void gfx_run_dl(Gfx* cmd) {
                 break;
             case G_VTX:
 #ifdef F3DEX_GBI_2
+                gfx_retained_note_input(seg_addr(cmd->words.w1), C0(12, 8) * sizeof(Vtx), false);
                 gfx_sp_vertex(C0(12, 8), C0(1, 7) - C0(12, 8), (const Vtx*)seg_addr(cmd->words.w1));
 #elif defined(F3DEX_GBI) || defined(F3DLP_GBI)
+                gfx_retained_note_input(seg_addr(cmd->words.w1), C0(10, 6) * sizeof(Vtx), false);
                 gfx_sp_vertex(C0(10, 6), C0(16, 8) / 2, seg_addr(cmd->words.w1));
 #else
+                gfx_retained_note_input(seg_addr(cmd->words.w1), C0(0, 16), false);
                 gfx_sp_vertex((C0(0, 16)) / sizeof(Vtx), C0(16, 4), seg_addr(cmd->words.w1));
 #endif
                 break;
@@ -2626,9 +4134,9 @@ static void gfx_run_dl(Gfx* cmd) {
 
                 if (C0(16, 1) == 0 && nDL != nullptr) {
                     // Push return address
-                    currentDir.push((char*)fileName);
-                    gfx_run_dl(nDL);
-                    currentDir.pop();
+                    currentDir.push_back(fileName);
+                    gfx_run_dl_retained(nDL);
+                    currentDir.pop_back();
                 } else {
                     if (nDL != nullptr) {
                         cmd = nDL;
@@ -2642,6 +4150,8 @@ static void gfx_run_dl(Gfx* cmd) {
                 gfx_sp_modify_vertex(C0(1, 15), C0(16, 8), cmd->words.w1);
                 break;
             case G_DL:
+                // Game memory display lists can change without their address changing
+                gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
                 if (C0(16, 1) == 0) {
                     // Push return address
                     Gfx* subGFX = (Gfx*)seg_addr(cmd->words.w1);
@@ -2672,13 +4182,15 @@ static void gfx_run_dl(Gfx* cmd) {
                     Gfx* gfx = (Gfx*)ResourceGetDataByCrc(hash);
 
                     if (gfx != 0) {
-                        gfx_run_dl(gfx);
+                        gfx_run_dl_retained(gfx);
                     }
                 } else {
+                    gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
                     cmd = (Gfx*)seg_addr(cmd->words.w1);
                 }
                 break;
             case G_PUSHCD:
+                gfx_retained_fail(RETAINED_RECORD_UNCACHEABLE);
                 gfx_push_current_dir((char*)cmd->words.w1);
                 break;
             case G_BRANCH_Z_OTR: {
@@ -2689,6 +4201,9 @@ static void gfx_run_dl(Gfx* cmd) {
 
                 cmd++;
 
+                if (gpu_vertex.enabled) {
+                    gfx_gpu_vertex_clip_position(&rsp.loaded_vertices[vbidx]);
+                }
                 if (rsp.loaded_vertices[vbidx].z <= zval) {
 
                     uint64_t hash = ((uint64_t)cmd->words.w0 << 32) + cmd->words.w1;
@@ -2851,7 +4366,7 @@ static void gfx_run_dl(Gfx* cmd) {
                         gfx_dp_set_texture_image(fmt, size, width, fileName, texFlags, rawTexMetadata, tex);
                     }
                 } else {
-                    SPDLOG_ERROR("G_SETTIMG_OTR_HASH: Texture is null");
+                    LUS_LOG_RATE_LIMITED(SPDLOG_ERROR, "G_SETTIMG_OTR_HASH: Texture is null");
                 }
 
                 cmd++;
@@ -2881,31 +4396,35 @@ static void gfx_run_dl(Gfx* cmd) {
                     gfx_dp_set_texture_image(fmt, size, width, fileName, texFlags, rawTexMetadata,
                                              reinterpret_cast<char*>(texture->ImageData));
                 } else {
-                    SPDLOG_ERROR("G_SETTIMG_OTR_FILEPATH: Texture is null");
+                    LUS_LOG_RATE_LIMITED(SPDLOG_ERROR, "G_SETTIMG_OTR_FILEPATH: Texture is null");
                 }
                 break;
             }
             case G_SETFB: {
-                gfx_flush();
+                gfx_flush(GFX_FLUSH_FRAMEBUFFER);
                 fbActive = 1;
                 active_fb = framebuffers.find(cmd->words.w1);
                 gfx_rapi->start_draw_to_framebuffer(active_fb->first, (float)active_fb->second.applied_height /
                                                                           active_fb->second.orig_height);
                 gfx_rapi->clear_framebuffer();
+                rdp.draw_state_changed = true;
                 break;
             }
             case G_RESETFB: {
-                gfx_flush();
+                gfx_flush(GFX_FLUSH_FRAMEBUFFER);
                 fbActive = 0;
                 gfx_rapi->start_draw_to_framebuffer(game_renders_to_framebuffer ? game_framebuffer : 0,
                                                     (float)gfx_current_dimensions.height / SCREEN_HEIGHT);
+                rdp.draw_state_changed = true;
                 break;
             }
             case G_SETTIMG_FB: {
-                gfx_flush();
+                gfx_flush(GFX_FLUSH_FRAMEBUFFER);
                 gfx_rapi->select_texture_fb(cmd->words.w1);
+                rendering_state.atlas_pages[0] = -1;
                 rdp.textures_changed[0] = false;
                 rdp.textures_changed[1] = false;
+                rdp.draw_state_changed = true;
 
                 // if (texPtr != NULL)
                 // gfx_dp_set_texture_image(C0(21, 3), C0(19, 2), C0(0, 10), texPtr);
@@ -2913,6 +4432,7 @@ static void gfx_run_dl(Gfx* cmd) {
             }
             case G_SETGRAYSCALE: {
                 rdp.grayscale = cmd->words.w1;
+                rdp.draw_state_changed = true;
                 break;
             }
             case G_LOADBLOCK:
@@ -3072,6 +4592,9 @@ void gfx_init(struct GfxWindowManagerAPI* wapi, struct GfxRenderingAPI* rapi, co
     gfx_rapi = rapi;
     gfx_wapi->init(game_name, rapi->get_name(), start_in_fullscreen, width, height, posX, posY);
     gfx_rapi->init();
+    if (gfx_rapi->get_supported_pixel_formats != nullptr && gfx_rapi->upload_texture_format != nullptr) {
+        supported_pixel_formats = gfx_rapi->get_supported_pixel_formats();
+    }
     gfx_rapi->update_framebuffer_parameters(0, width, height, 1, false, true, true, true);
 #ifdef __APPLE__
     gfx_current_dimensions.internal_mul = 1;
@@ -3095,6 +4618,9 @@ void gfx_init(struct GfxWindowManagerAPI* wapi, struct GfxRenderingAPI* rapi, co
         int max_tex_size = min(8192, gfx_rapi->get_max_texture_size());
         tex_upload_buffer = (uint8_t*)malloc(max_tex_size * max_tex_size * 4);
     }
+
+    rendering_state.atlas_pages[0] = -1;
+    rendering_state.atlas_pages[1] = -1;
 }
 
 void gfx_destroy(void) {
@@ -3185,6 +4711,17 @@ void gfx_run(Gfx* commands, const std::unordered_map<Mtx*, MtxF>& mtx_replacemen
     }
 
     current_mtx_replacements = &mtx_replacements;
+    matrix_cache_frame++;
+
+    gpu_vertex.enabled = CVarGetInteger("gGpuVertexTransform", 0) != 0 && gfx_rapi->set_vertex_transform != nullptr;
+    texture_atlas.enabled = CVarGetInteger("gTextureAtlas", 0) != 0 && gfx_rapi->upload_sub_texture != nullptr;
+    gpu_vertex.matrices.clear();
+    gpu_vertex.lighting.clear();
+    gpu_vertex.batch_active = false;
+    gpu_vertex.batch.num_matrices = 0;
+    gpu_vertex.batch_id++;
+
+    gfx_retained_geometry_start_frame();
 
     gfx_rapi->update_framebuffer_parameters(0, gfx_current_window_dimensions.width,
                                             gfx_current_window_dimensions.height, 1, false, true, true,
@@ -3194,12 +4731,21 @@ void gfx_run(Gfx* commands, const std::unordered_map<Mtx*, MtxF>& mtx_replacemen
                                         (float)gfx_current_dimensions.height / SCREEN_HEIGHT);
     gfx_rapi->clear_framebuffer();
     rdp.viewport_or_scissor_changed = true;
+    rdp.draw_state_changed = true;
     rendering_state.viewport = {};
     rendering_state.scissor = {};
-    gfx_run_dl(commands);
-    gfx_flush();
+    const uint64_t allocations = LUS::GetThreadAllocationCount();
+    {
+        LUS_PROFILE_SCOPE("gfx_run_dl");
+        gfx_run_dl(commands);
+    }
+    gfx_flush(GFX_FLUSH_END);
+    frame_allocations = LUS::GetThreadAllocationCount() - allocations;
+    gfx_texture_atlas_end_frame();
+    gfx_render_stats_end_frame();
     gfxFramebuffer = 0;
-    currentDir = std::stack<std::string>();
+    currentDir.clear();
+    gfx_frame_arena_reset();
 
     if (game_renders_to_framebuffer) {
         gfx_rapi->start_draw_to_framebuffer(0, 1);
@@ -3221,13 +4767,20 @@ void gfx_run(Gfx* commands, const std::unordered_map<Mtx*, MtxF>& mtx_replacemen
     }
     LUS::Context::GetInstance()->GetWindow()->GetGui()->StartFrame();
     LUS::Context::GetInstance()->GetWindow()->GetGui()->RenderViewports();
-    gfx_rapi->end_frame();
-    gfx_wapi->swap_buffers_begin();
+    {
+        LUS_PROFILE_SCOPE("End Frame");
+        gfx_rapi->end_frame();
+    }
+    {
+        LUS_PROFILE_SCOPE("Swap Buffers");
+        gfx_wapi->swap_buffers_begin();
+    }
     has_drawn_imgui_menu = false;
 }
 
 void gfx_end_frame(void) {
     if (!dropped_frame) {
+        LUS_PROFILE_SCOPE("Finish Frame");
         gfx_rapi->finish_render();
         gfx_wapi->swap_buffers_end();
     }
@@ -3237,10 +4790,26 @@ void gfx_set_target_fps(int fps) {
     gfx_wapi->set_target_fps(fps);
 }
 
+void gfx_set_target_frame_rate(double fps) {
+    if (gfx_wapi->set_target_frame_rate != nullptr) {
+        gfx_wapi->set_target_frame_rate(fps);
+    } else {
+        gfx_wapi->set_target_fps((int)lround(fps));
+    }
+}
+
 void gfx_set_maximum_frame_latency(int latency) {
     gfx_wapi->set_maximum_frame_latency(latency);
 }
 
+struct GfxFramePacingStats gfx_get_frame_pacing_stats(void) {
+    struct GfxFramePacingStats stats = {};
+    if (gfx_wapi != nullptr && gfx_wapi->get_frame_pacing_stats != nullptr) {
+        gfx_wapi->get_frame_pacing_stats(&stats);
+    }
+    return stats;
+}
+
 int gfx_create_framebuffer(uint32_t width, uint32_t height) {
     uint32_t orig_width = width, orig_height = height;
     gfx_adjust_width_height_for_scale(width, height);
@@ -3253,10 +4822,12 @@ int gfx_create_framebuffer(uint32_t width, uint32_t height) {
 void gfx_set_framebuffer(int fb, float noise_scale) {
     gfx_rapi->start_draw_to_framebuffer(fb, noise_scale);
     gfx_rapi->clear_framebuffer();
+    rdp.draw_state_changed = true;
 }
 
 void gfx_reset_framebuffer() {
     gfx_rapi->start_draw_to_framebuffer(0, (float)gfx_current_dimensions.height / SCREEN_HEIGHT);
+    rdp.draw_state_changed = true;
 }
 
 static void adjust_pixel_depth_coordinates(float& x, float& y) {
@@ -3297,7 +4868,11 @@ void gfx_push_current_dir(char* path) {
     if (gfx_check_image_signature(path) == 1)
         path = &path[7];
 
-    currentDir.push(GetPathWithoutFileName(path));
+    // The caller's string may not outlive the frame
+    std::string_view dir = GetPathWithoutFileName(path);
+    char* copy = (char*)gfx_frame_alloc(dir.size());
+    memcpy(copy, dir.data(), dir.size());
+    currentDir.emplace_back(copy, dir.size());
 }
 
 int32_t gfx_check_image_signature(const char* imgData) {
@@ -3329,4 +4904,5 @@ void gfx_register_blended_texture(const char* name, uint8_t* mask, uint8_t* repl
     }
 
     masked_textures[name] = MaskedTextureEntry{ mask, replacement };
+    masked_textures_generation++;
 }
@@ -19,6 +19,7 @@ extern uintptr_t gfxFramebuffer;
 
 struct GfxRenderingAPI;
 struct GfxWindowManagerAPI;
+struct GfxFramePacingStats;
 
 struct XYWidthHeight {
     int16_t x, y;
@@ -36,6 +37,7 @@ struct TextureCacheKey {
     const uint8_t* palette_addrs[2];
     uint8_t fmt, siz;
     uint8_t palette_index;
+    bool atlas; // packed into a shared texture atlas page, see gfx_texture_atlas_eligible
 
     bool operator==(const TextureCacheKey&) const noexcept = default;
 
@@ -54,6 +56,8 @@ struct TextureCacheValue {
     uint32_t texture_id;
     uint8_t cms, cmt;
     bool linear_filter;
+    int16_t atlas_page = -1;
+    uint16_t atlas_x, atlas_y; // texel offset inside the atlas page
 
     std::list<struct TextureCacheMapIter>::iterator lru_location;
 };
@@ -62,6 +66,58 @@ struct TextureCacheMapIter {
     TextureCacheMap::iterator it;
 };
 
+// Counts for the last completed frame
+struct GfxTextureAtlasStats {
+    uint32_t draw_calls;
+    uint32_t draw_calls_saved; // texture switches the atlas batched instead of flushing
+    uint32_t pages;
+    uint32_t textures;
+};
+
+enum GfxCommandClass {
+    GFX_COMMAND_VERTEX,
+    GFX_COMMAND_TRIANGLE,
+    GFX_COMMAND_MATRIX,
+    GFX_COMMAND_TEXTURE,
+    GFX_COMMAND_RECTANGLE,
+    GFX_COMMAND_DISPLAY_LIST, // calls, branches and ends
+    GFX_COMMAND_STATE,
+    GFX_COMMAND_OTHER,
+    GFX_COMMAND_CLASS_COUNT
+};
+
+// Why buffered triangles had to be drawn
+enum GfxFlushCause {
+    GFX_FLUSH_TEXTURE,
+    GFX_FLUSH_SHADER,
+    GFX_FLUSH_DEPTH,
+    GFX_FLUSH_VIEWPORT,
+    GFX_FLUSH_BLEND,
+    GFX_FLUSH_BUFFER_FULL,
+    GFX_FLUSH_VERTEX_BATCH, // GPU vertex transform batch is full or its uniforms changed
+    GFX_FLUSH_FRAMEBUFFER,
+    GFX_FLUSH_END, // end of the frame or of a retained display list
+    GFX_FLUSH_CAUSE_COUNT
+};
+
+// Counts for the last completed frame
+struct GfxRenderStats {
+    uint32_t commands[GFX_COMMAND_CLASS_COUNT];
+    uint32_t flushes[GFX_FLUSH_CAUSE_COUNT];
+    uint32_t triangles;
+    uint32_t triangles_rejected; // clipped or culled before reaching the vertex buffer
+    uint32_t texture_uploads;
+    uint64_t texture_upload_bytes;
+    uint32_t shader_compilations;
+    uint32_t combiners; // size of the combiner pool, not reset between frames
+};
+
+struct GfxRetainedGeometryStats {
+    uint64_t hits, misses;
+    size_t entries;
+    size_t bytes_retained;
+};
+
 extern "C" {
 
 extern struct GfxDimensions gfx_current_window_dimensions; // The dimensions of the window
@@ -81,6 +137,8 @@ void gfx_start_frame(void);
 void gfx_run(Gfx* commands, const std::unordered_map<Mtx*, MtxF>& mtx_replacements);
 void gfx_end_frame(void);
 void gfx_set_target_fps(int);
+// Fractional rates such as 59.94 are rounded on window managers without set_target_frame_rate
+void gfx_set_target_frame_rate(double fps);
 void gfx_set_maximum_frame_latency(int latency);
 extern "C" void gfx_texture_cache_clear();
 extern "C" int gfx_create_framebuffer(uint32_t width, uint32_t height);
@@ -89,5 +147,15 @@ uint16_t gfx_get_pixel_depth(float x, float y);
 void gfx_push_current_dir(char* path);
 int32_t gfx_check_image_signature(const char* imgData);
 void gfx_register_blended_texture(const char* name, uint8_t* mask, uint8_t* replacement = nullptr);
+// Safe to call from any thread, the cache is dropped at the start of the next frame.
+void gfx_retained_geometry_invalidate(void);
+struct GfxRetainedGeometryStats gfx_get_retained_geometry_stats(void);
+struct GfxTextureAtlasStats gfx_get_texture_atlas_stats(void);
+struct GfxRenderStats gfx_get_render_stats(void);
+// Heap allocations made while interpreting the last frame. Only counted with ENABLE_ALLOCATION_COUNTER, see
+// AllocationCounter.h.
+uint64_t gfx_get_frame_allocations(void);
+// Zeroed when the window manager does its own pacing
+struct GfxFramePacingStats gfx_get_frame_pacing_stats(void);
 
 #endif
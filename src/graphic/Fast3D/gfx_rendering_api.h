@@ -18,6 +18,38 @@ struct GfxClipParameters {
 
 enum FilteringMode { FILTER_THREE_POINT, FILTER_LINEAR, FILTER_NONE };
 
+// Texel layouts accepted by upload_texture_format. Luminance formats are sampled with the luminance replicated to
+// rgb, L8 also replicates it to alpha like N64 I textures do. RGBA5551 texels are native endian uint16s.
+enum GfxPixelFormat { GFX_PIXEL_FORMAT_RGBA8, GFX_PIXEL_FORMAT_RGBA5551, GFX_PIXEL_FORMAT_LA8, GFX_PIXEL_FORMAT_L8 };
+
+#define GFX_VERTEX_MAX_MATRICES 8
+#define GFX_VERTEX_MAX_LIGHTS 32
+
+// RSP state captured when vertices are loaded, evaluated by the vertex shader in the GPU transform path.
+struct GfxVertexLighting {
+    bool lighting;
+    bool texgen;
+    bool texgen_linear;
+    bool fog;
+    uint8_t num_lights; // directional lights, the ambient light is separate
+    float light_dirs[GFX_VERTEX_MAX_LIGHTS][3]; // normalized, in model space
+    float light_colors[GFX_VERTEX_MAX_LIGHTS][3];
+    float ambient_color[3];
+    float lookat[2][3];
+    float texture_scaling[2];
+    float fog_mul, fog_offset;
+};
+
+// Uniforms of one batch in the GPU transform path. Vertices carry their model space position and the index of their
+// matrix in the palette, matrices are row-vector RSP matrices (clip = v * m).
+struct GfxVertexTransform {
+    uint8_t num_matrices;
+    float matrices[GFX_VERTEX_MAX_MATRICES][4][4];
+    struct GfxVertexLighting lighting;
+    float tex_transform[2][4]; // s * [0] + [2], t * [1] + [3]
+    float fog_color[3];
+};
+
 // A hash function used to hash a: pair<float, float>
 struct hash_pair_ff {
     size_t operator()(const std::pair<float, float>& p) const {
@@ -41,6 +73,11 @@ struct GfxRenderingAPI {
     uint32_t (*new_texture)(void);
     void (*select_texture)(int tile, uint32_t texture_id);
     void (*upload_texture)(const uint8_t* rgba32_buf, uint32_t width, uint32_t height);
+    // Optional, replaces a region of the selected texture. Required for the texture atlas.
+    void (*upload_sub_texture)(const uint8_t* rgba32_buf, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    // Optional, returns a mask of (1 << GfxPixelFormat) that upload_texture_format accepts besides RGBA8.
+    uint32_t (*get_supported_pixel_formats)(void);
+    void (*upload_texture_format)(const uint8_t* buf, enum GfxPixelFormat format, uint32_t width, uint32_t height);
     void (*set_sampler_parameters)(int sampler, bool linear_filter, uint32_t cms, uint32_t cmt);
     void (*set_depth_test_and_mask)(bool depth_test, bool z_upd);
     void (*set_zmode_decal)(bool zmode_decal);
@@ -48,6 +85,12 @@ struct GfxRenderingAPI {
     void (*set_scissor)(int x, int y, int width, int height);
     void (*set_use_alpha)(bool use_alpha);
     void (*draw_triangles)(float buf_vbo[], size_t buf_vbo_len, size_t buf_vbo_num_tris);
+    // Optional, backends that leave this null get the expanded triangle stream through draw_triangles.
+    void (*draw_indexed_triangles)(float buf_vbo[], size_t buf_vbo_len, uint16_t buf_ibo[], size_t buf_ibo_len,
+                                   size_t buf_vbo_num_tris);
+    // Optional, backends that implement it generate SHADER_OPT_GPU_TRANSFORM shaders. Called before each draw of such
+    // a batch.
+    void (*set_vertex_transform)(const struct GfxVertexTransform* transform);
     void (*init)(void);
     void (*on_resize)(void);
     void (*start_frame)(void);
@@ -43,6 +43,8 @@
 #ifdef _WIN32
 #include <WTypesbase.h>
 #endif
+#include <algorithm>
+#include <thread>
 
 #define GFX_BACKEND_NAME "SDL"
 
@@ -274,15 +276,42 @@ static void gfx_sdl_get_active_window_refresh_rate(uint32_t* refresh_rate) {
     *refresh_rate = mode.refresh_rate;
 }
 
-static uint64_t previous_time;
 #ifdef _WIN32
 static HANDLE timer;
 #endif
 
-static int target_fps = 60;
+#define FRAME_PACER_SPIN_NS 2000000 // sleep until this close to the deadline, the OS timer is not more precise
+#define FRAME_PACER_YIELD_NS 200000 // busy wait once this close, a yield may not come back in time
+#define FRAME_PACER_MISS_NS 1000000
+#define FRAME_PACER_VBLANK_SLACK_NS 500000
+#define FRAME_PACER_HISTORY 256
+#define FRAME_PACER_MAX_QUEUED 4
+
+static struct {
+    double target_fps = 60.0;
+    uint64_t deadline;
+    uint64_t last_present;
+    float frame_times_ms[FRAME_PACER_HISTORY];
+    uint32_t frame_count;
+    uint64_t missed_deadlines;
+    uint32_t maximum_frame_latency; // 0 leaves queueing to the driver
+    void* fences[FRAME_PACER_MAX_QUEUED];
+    uint32_t queued_fences;
+} frame_pacer;
+
+#define GFX_GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GFX_GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#define GFX_GL_FENCE_TIMEOUT_NS 100000000
+#if defined(_WIN32) && !defined(_WIN64)
+#define GFX_GL_APIENTRY __stdcall
+#else
+#define GFX_GL_APIENTRY
+#endif
 
-#define FRAME_INTERVAL_US_NUMERATOR 1000000
-#define FRAME_INTERVAL_US_DENOMINATOR (target_fps)
+// Resolved at runtime, not every platform's GL headers declare sync objects
+static void*(GFX_GL_APIENTRY* gl_fence_sync)(uint32_t condition, uint32_t flags);
+static uint32_t(GFX_GL_APIENTRY* gl_client_wait_sync)(void* sync, uint32_t flags, uint64_t timeout);
+static void(GFX_GL_APIENTRY* gl_delete_sync)(void* sync);
 
 static void gfx_sdl_init(const char* game_name, const char* gfx_api_name, bool start_in_fullscreen, uint32_t width,
                          uint32_t height, int32_t posX, int32_t posY) {
@@ -368,6 +397,15 @@ static void gfx_sdl_init(const char* game_name, const char* gfx_api_name, bool s
         SDL_GL_MakeCurrent(wnd, ctx);
         SDL_GL_SetSwapInterval(vsync_enabled ? 1 : 0);
 
+        if (SDL_GL_ExtensionSupported("GL_ARB_sync")) {
+            gl_fence_sync = (decltype(gl_fence_sync))SDL_GL_GetProcAddress("glFenceSync");
+            gl_client_wait_sync = (decltype(gl_client_wait_sync))SDL_GL_GetProcAddress("glClientWaitSync");
+            gl_delete_sync = (decltype(gl_delete_sync))SDL_GL_GetProcAddress("glDeleteSync");
+            if (gl_fence_sync == nullptr || gl_client_wait_sync == nullptr || gl_delete_sync == nullptr) {
+                gl_fence_sync = nullptr;
+            }
+        }
+
         window_impl.Opengl = { wnd, ctx };
     } else {
         uint32_t flags = SDL_RENDERER_ACCELERATED;
@@ -525,43 +563,84 @@ static bool gfx_sdl_start_frame(void) {
     return true;
 }
 
-static uint64_t qpc_to_100ns(uint64_t qpc) {
+static uint64_t gfx_sdl_now_ns(void) {
+    const uint64_t qpc = SDL_GetPerformanceCounter();
     const uint64_t qpc_freq = SDL_GetPerformanceFrequency();
-    return qpc / qpc_freq * 10000000 + qpc % qpc_freq * 10000000 / qpc_freq;
+    return qpc / qpc_freq * 1000000000 + qpc % qpc_freq * 1000000000 / qpc_freq;
 }
 
-static inline void sync_framerate_with_timer(void) {
-    uint64_t t;
-    t = qpc_to_100ns(SDL_GetPerformanceCounter());
-
-    const int64_t next = previous_time + 10 * FRAME_INTERVAL_US_NUMERATOR / FRAME_INTERVAL_US_DENOMINATOR;
-    const int64_t left = next - t;
-    if (left > 0) {
+static void frame_pacer_sleep(uint64_t ns) {
 #ifndef _WIN32
-        const timespec spec = { 0, left * 100 };
-        nanosleep(&spec, nullptr);
+    const timespec spec = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+    nanosleep(&spec, nullptr);
 #else
-        // The accuracy of this timer seems to usually be within +- 1.0 ms
-        LARGE_INTEGER li;
-        li.QuadPart = -left;
-        SetWaitableTimer(timer, &li, 0, nullptr, nullptr, false);
-        WaitForSingleObject(timer, INFINITE);
+    // The accuracy of this timer seems to usually be within +- 1.0 ms
+    LARGE_INTEGER li;
+    li.QuadPart = -(LONGLONG)(ns / 100);
+    SetWaitableTimer(timer, &li, 0, nullptr, nullptr, false);
+    WaitForSingleObject(timer, INFINITE);
 #endif
+}
+
+static uint64_t frame_pacer_interval_ns(void) {
+    return (uint64_t)(1000000000.0 / frame_pacer.target_fps);
+}
+
+// Sleeps coarsely, then yields and spins for the last stretch so frames are released on the deadline rather than
+// whenever the OS timer fires.
+static void frame_pacer_wait(void) {
+    const uint64_t interval = frame_pacer_interval_ns();
+    uint64_t now = gfx_sdl_now_ns();
+
+    // On the first frame, or when a whole frame behind, restart the schedule instead of rushing to catch up
+    if (frame_pacer.deadline == 0 || now > frame_pacer.deadline + interval) {
+        frame_pacer.deadline = now;
+    }
+    if (frame_pacer.deadline > now + FRAME_PACER_SPIN_NS) {
+        frame_pacer_sleep(frame_pacer.deadline - now - FRAME_PACER_SPIN_NS);
+    }
+    while ((now = gfx_sdl_now_ns()) < frame_pacer.deadline) {
+        if (frame_pacer.deadline - now > FRAME_PACER_YIELD_NS) {
+            std::this_thread::yield();
+        }
+    }
+
+    if (now > frame_pacer.deadline + FRAME_PACER_MISS_NS) {
+        frame_pacer.missed_deadlines++;
     }
+    if (frame_pacer.last_present != 0) {
+        frame_pacer.frame_times_ms[frame_pacer.frame_count++ % FRAME_PACER_HISTORY] =
+            (now - frame_pacer.last_present) / 1000000.0f;
+    }
+    frame_pacer.last_present = now;
+    frame_pacer.deadline += interval;
+}
 
-    t = qpc_to_100ns(SDL_GetPerformanceCounter());
-    if (left > 0 && t - next < 10000) {
-        // In case it takes some time for the application to wake up after sleep,
-        // or inaccurate timer,
-        // don't let that slow down the framerate.
-        t = next;
+// Keeps the CPU at most maximum_frame_latency frames ahead of the GPU
+static void frame_pacer_queue_fence(void) {
+    if (gl_fence_sync == nullptr || ctx == nullptr) {
+        return;
+    }
+    if (frame_pacer.maximum_frame_latency > 0) {
+        frame_pacer.fences[frame_pacer.queued_fences++] = gl_fence_sync(GFX_GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    while (frame_pacer.queued_fences > frame_pacer.maximum_frame_latency) {
+        gl_client_wait_sync(frame_pacer.fences[0], GFX_GL_SYNC_FLUSH_COMMANDS_BIT, GFX_GL_FENCE_TIMEOUT_NS);
+        gl_delete_sync(frame_pacer.fences[0]);
+        frame_pacer.queued_fences--;
+        memmove(frame_pacer.fences, frame_pacer.fences + 1, frame_pacer.queued_fences * sizeof(void*));
     }
-    previous_time = t;
 }
 
 static void gfx_sdl_swap_buffers_begin(void) {
-    sync_framerate_with_timer();
+    frame_pacer_wait();
     SDL_GL_SwapWindow(wnd);
+    frame_pacer_queue_fence();
+
+    // With vsync the swap returns at the vblank, scheduling from there keeps the pacer in phase with the display
+    if (vsync_enabled && CVarGetInteger("gFramePacerAlignVblank", 0)) {
+        frame_pacer.deadline = gfx_sdl_now_ns() + frame_pacer_interval_ns() - FRAME_PACER_VBLANK_SLACK_NS;
+    }
 }
 
 static void gfx_sdl_swap_buffers_end(void) {
@@ -572,11 +651,41 @@ static double gfx_sdl_get_time(void) {
 }
 
 static void gfx_sdl_set_target_fps(int fps) {
-    target_fps = fps;
+    frame_pacer.target_fps = fps;
+}
+
+static void gfx_sdl_set_target_frame_rate(double fps) {
+    frame_pacer.target_fps = fps;
 }
 
 static void gfx_sdl_set_maximum_frame_latency(int latency) {
-    // Not supported by SDL :(
+    frame_pacer.maximum_frame_latency = std::clamp(latency, 0, FRAME_PACER_MAX_QUEUED - 1);
+}
+
+static void gfx_sdl_get_frame_pacing_stats(struct GfxFramePacingStats* stats) {
+    const uint32_t count = std::min<uint32_t>(frame_pacer.frame_count, FRAME_PACER_HISTORY);
+    float frame_times[FRAME_PACER_HISTORY];
+    float jitter[FRAME_PACER_HISTORY];
+    const float target = 1000.0f / frame_pacer.target_fps;
+    for (uint32_t i = 0; i < count; i++) {
+        frame_times[i] = frame_pacer.frame_times_ms[i];
+        jitter[i] = fabsf(frame_times[i] - target);
+    }
+
+    stats->target_frame_time_ms = target;
+    stats->frames = count;
+    stats->missed_deadlines = frame_pacer.missed_deadlines;
+    if (count == 0) {
+        return;
+    }
+    const uint32_t p50 = count / 2;
+    const uint32_t p99 = count * 99 / 100;
+    std::nth_element(frame_times, frame_times + p50, frame_times + count);
+    stats->p50_frame_time_ms = frame_times[p50];
+    std::nth_element(frame_times, frame_times + p99, frame_times + count);
+    stats->p99_frame_time_ms = frame_times[p99];
+    std::nth_element(jitter, jitter + p99, jitter + count);
+    stats->p99_jitter_ms = jitter[p99];
 }
 
 static const char* gfx_sdl_get_key_name(int scancode) {
@@ -604,6 +713,8 @@ struct GfxWindowManagerAPI gfx_sdl = { gfx_sdl_init,
                                        gfx_sdl_set_target_fps,
                                        gfx_sdl_set_maximum_frame_latency,
                                        gfx_sdl_get_key_name,
-                                       gfx_sdl_can_disable_vsync };
+                                       gfx_sdl_can_disable_vsync,
+                                       gfx_sdl_set_target_frame_rate,
+                                       gfx_sdl_get_frame_pacing_stats };
 
 #endif
@@ -482,6 +482,8 @@ struct GfxWindowManagerAPI gfx_wiiu = {
     gfx_wiiu_set_maximum_frame_latency,
     gfx_wiiu_get_key_name,
     gfx_wiiu_can_disable_vsync,
+    nullptr,
+    nullptr,
 };
 
 #endif
@@ -4,6 +4,16 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// Presented frame times over the last few seconds
+struct GfxFramePacingStats {
+    double target_frame_time_ms;
+    double p50_frame_time_ms;
+    double p99_frame_time_ms;
+    double p99_jitter_ms; // distance from the target frame time
+    uint32_t frames;
+    uint64_t missed_deadlines; // since startup
+};
+
 struct GfxWindowManagerAPI {
     void (*init)(const char* game_name, const char* gfx_api_name, bool start_in_fullscreen, uint32_t width,
                  uint32_t height, int32_t posX, int32_t posY);
@@ -25,6 +35,9 @@ struct GfxWindowManagerAPI {
     void (*set_maximum_frame_latency)(int latency);
     const char* (*get_key_name)(int scancode);
     bool (*can_disable_vsync)();
+    // Optional, may be nullptr
+    void (*set_target_frame_rate)(double fps);
+    void (*get_frame_pacing_stats)(struct GfxFramePacingStats* stats);
 };
 
 #endif
@@ -0,0 +1,34 @@
+#include "LogRateLimiter.h"
+#include <chrono>
+#include <spdlog/async.h>
+#include <spdlog/spdlog.h>
+
+namespace LUS {
+static std::atomic<uint64_t> sSuppressedTotal = 0;
+
+bool LogRateLimiter::ShouldLog(uint32_t* suppressed) {
+    const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch())
+                            .count();
+    int64_t nextAllowed = mNextAllowedMs.load(std::memory_order_relaxed);
+    if (now < nextAllowed ||
+        !mNextAllowedMs.compare_exchange_strong(nextAllowed, now + LOG_RATE_LIMIT_INTERVAL_MS,
+                                                std::memory_order_relaxed)) {
+        mSuppressed.fetch_add(1, std::memory_order_relaxed);
+        sSuppressedTotal.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    *suppressed = mSuppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+uint64_t GetDroppedLogMessageCount() {
+    uint64_t dropped = sSuppressedTotal.load(std::memory_order_relaxed);
+    auto threadPool = spdlog::thread_pool();
+    if (threadPool != nullptr) {
+        dropped += threadPool->overrun_counter();
+    }
+    return dropped;
+}
+} // namespace LUS
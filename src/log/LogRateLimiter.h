@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#define LOG_RATE_LIMIT_INTERVAL_MS 1000
+
+namespace LUS {
+// Per call site state of LUS_LOG_RATE_LIMITED. Lets one message through per interval and counts the ones it swallows,
+// the count is reported in front of the next message that gets through.
+class LogRateLimiter {
+  public:
+    // Returns true when the message should be logged, suppressed is set to the number dropped since the last one.
+    bool ShouldLog(uint32_t* suppressed);
+
+  private:
+    std::atomic<int64_t> mNextAllowedMs = 0;
+    std::atomic<uint32_t> mSuppressed = 0;
+};
+
+// Messages lost to rate limiting plus those the async log queue discarded because it was full.
+uint64_t GetDroppedLogMessageCount();
+} // namespace LUS
+
+// Rate limited variant of an SPDLOG_* macro for paths that can fail every frame, e.g.
+// LUS_LOG_RATE_LIMITED(SPDLOG_ERROR, "Texture {} is null", path);
+// Suppressed messages are only counted. Debug builds can see them by raising the log level to trace, release builds
+// compile the trace call out.
+#define LUS_LOG_RATE_LIMITED(LOG, ...)                                                  \
+    do {                                                                                \
+        static LUS::LogRateLimiter lusLogRateLimiter;                                   \
+        uint32_t lusLogSuppressed;                                                      \
+        if (lusLogRateLimiter.ShouldLog(&lusLogSuppressed)) {                           \
+            if (lusLogSuppressed > 0) {                                                 \
+                LOG("{} similar messages were suppressed", lusLogSuppressed);           \
+            }                                                                           \
+            LOG(__VA_ARGS__);                                                           \
+        } else {                                                                        \
+            SPDLOG_TRACE(__VA_ARGS__);                                                  \
+        }                                                                               \
+    } while (0)
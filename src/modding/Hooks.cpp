@@ -1,36 +1,105 @@
 #include "Hooks.h"
+#include "log/LogRateLimiter.h"
+
+#include <algorithm>
+#include <chrono>
 
 namespace LUS {
-void Hooks::Listen(const std::string& id, const std::string& name, sol::function func) {
-    this->mHooks[id].emplace_back(name, func);
+void HookTiming::SetBudget(uint64_t budgetUs, bool throttle) {
+    sBudgetNs = budgetUs * 1000;
+    sThrottle = throttle;
+}
+
+uint64_t HookTiming::Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+bool HookTiming::Record(uint64_t elapsedNs) {
+    Calls++;
+    TotalNs += elapsedNs;
+    MaxNs = std::max(MaxNs, elapsedNs);
+    if (sBudgetNs == 0 || elapsedNs <= sBudgetNs) {
+        return false;
+    }
+
+    OverBudget++;
+    if (sThrottle) {
+        // Skipping calls keeps the listener's average near the budget.
+        SkipCalls = static_cast<uint32_t>(std::min<uint64_t>(elapsedNs / sBudgetNs, HOOK_MAX_SKIPPED_CALLS));
+    }
+    return true;
+}
+
+void ReportHookOverBudget(const std::string& hook, const std::string& owner, const std::string& listener,
+                          uint64_t elapsedNs) {
+    LUS_LOG_RATE_LIMITED(SPDLOG_WARN, "Hook '{}' listener '{}' of '{}' took {:.2f} ms", hook, listener,
+                         owner.empty() ? "game" : owner, elapsedNs / 1000000.0);
+}
+
+HookId Hooks::Register(const std::string& name) {
+    auto it = this->mIds.find(name);
+    if (it != this->mIds.end()) {
+        return it->second;
+    }
+
+    const HookId id = static_cast<HookId>(this->mNames.size());
+    this->mIds.emplace(name, id);
+    this->mNames.push_back(name);
+    this->mHooks.emplace_back();
+    return id;
+}
+
+HookId Hooks::Find(const std::string& name) const {
+    auto it = this->mIds.find(name);
+    return it != this->mIds.end() ? it->second : INVALID_HOOK_ID;
+}
+
+const std::string& Hooks::GetName(HookId id) const {
+    return this->mNames.at(id);
+}
+
+const std::vector<std::vector<Hook>>& Hooks::GetListeners() const {
+    return this->mHooks;
 }
 
-void Hooks::Remove(const std::string& id, const std::string& name) {
-    auto nameMap = this->mHooks.find(id);
-    if (nameMap == this->mHooks.end()) {
+size_t Hooks::FindListener(HookId id, uint64_t serial) const {
+    const auto& arr = this->mHooks[id];
+    auto hook = std::lower_bound(arr.begin(), arr.end(), serial,
+                                 [](const Hook& elem, uint64_t value) { return elem.Serial < value; });
+    return hook - arr.begin();
+}
+
+void Hooks::Listen(const std::string& id, const std::string& name, sol::function func, const std::string& owner) {
+    this->mHooks[Register(id)].emplace_back(name, func, owner).Serial = this->mNextSerial++;
+    this->mGeneration++;
+}
+
+void Hooks::Remove(const std::string& id, const std::string& name, const std::string& owner) {
+    const HookId hookId = Find(id);
+    if (hookId == INVALID_HOOK_ID) {
         return;
     }
 
-    auto& arr = nameMap->second;
-    auto hook = std::find_if(arr.begin(), arr.end(), [&](auto& elem) { return elem.Name == name; });
+    auto& arr = this->mHooks[hookId];
+    auto hook =
+        std::find_if(arr.begin(), arr.end(), [&](auto& elem) { return elem.Name == name && elem.Owner == owner; });
 
     if (hook == arr.end()) {
         return;
     }
 
     arr.erase(hook);
-
-    if (arr.empty()) {
-        this->mHooks.erase(id);
-    }
+    this->mGeneration++;
 }
 
 // Utils ---
 size_t Hooks::Count() const {
-    return this->mHooks.size();
+    return std::count_if(this->mHooks.begin(), this->mHooks.end(), [](const auto& arr) { return !arr.empty(); });
 }
 bool Hooks::Empty() const {
-    return this->mHooks.empty();
+    return Count() == 0;
 }
 // ----
 
@@ -3,32 +3,124 @@
 #include "LuaUtils.h"
 #include <sol/sol.hpp>
 
+#include <stdint.h>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#define HOOK_MAX_SKIPPED_CALLS 8
+
 namespace LUS {
+typedef uint32_t HookId;
+constexpr HookId INVALID_HOOK_ID = UINT32_MAX;
+
+// CPU time spent in one listener. With a budget set, a call that overruns it is reported and, when throttling,
+// the listener skips the next few calls in proportion to the overrun.
+struct HookTiming {
+    uint64_t Calls = 0;
+    uint64_t TotalNs = 0;
+    uint64_t MaxNs = 0;
+    uint64_t OverBudget = 0;
+    uint64_t Skipped = 0;
+    uint32_t SkipCalls = 0;
+
+    static void SetBudget(uint64_t budgetUs, bool throttle);
+    static uint64_t Now();
+
+    bool ShouldSkip() {
+        if (SkipCalls == 0) {
+            return false;
+        }
+        SkipCalls--;
+        Skipped++;
+        return true;
+    }
+    // Returns true when the call went over budget.
+    bool Record(uint64_t elapsedNs);
+
+  private:
+    static inline uint64_t sBudgetNs = 0;
+    static inline bool sThrottle = false;
+};
+
 struct Hook {
     std::string Name;
     sol::function Func;
+    std::string Owner;
+    HookTiming Timing;
+    // Unique per Hooks instance, tells listeners with the same name and owner apart.
+    uint64_t Serial = 0;
 
-    Hook(std::string name, sol::function func) : Name(std::move(name)), Func(std::move(func)) {
+    Hook(std::string name, sol::function func, std::string owner = "")
+        : Name(std::move(name)), Func(std::move(func)), Owner(std::move(owner)) {
     }
 };
 
+void ReportHookOverBudget(const std::string& hook, const std::string& owner, const std::string& listener,
+                          uint64_t elapsedNs);
+
 class Hooks {
   protected:
-    std::unordered_map<std::string, std::vector<Hook>> mHooks;
+    std::unordered_map<std::string, HookId> mIds;
+    std::vector<std::string> mNames;
+    // Indexed by HookId
+    std::vector<std::vector<Hook>> mHooks;
+    uint64_t mNextSerial = 1;
+    // Bumped by Listen and Remove, Call only searches for its listener again when a callback changed it.
+    uint64_t mGeneration = 0;
+
+    // Index of the first listener whose serial isn't below serial. Listen appends and Remove erases, so each list
+    // stays sorted by serial.
+    size_t FindListener(HookId id, uint64_t serial) const;
 
   public:
-    template <typename... CallbackArgs> void Call(const std::string& name, CallbackArgs... args) {
-        for (auto& hook : mHooks[name]) {
-            LuaUtils::RunCallback(hook.Func, std::forward<CallbackArgs>(args)...);
+    // Hook names are resolved to dense ids once, callers on hot paths should keep the id around.
+    HookId Register(const std::string& name);
+    [[nodiscard]] HookId Find(const std::string& name) const;
+    [[nodiscard]] const std::string& GetName(HookId id) const;
+    [[nodiscard]] const std::vector<std::vector<Hook>>& GetListeners() const;
+
+    template <typename... CallbackArgs> void Call(HookId id, CallbackArgs... args) {
+        if (id >= mHooks.size() || mHooks[id].empty()) {
+            return;
+        }
+
+        // Indexed, a callback may add or remove listeners. When it did, the listener that ran is found again by its
+        // serial so its time isn't charged to whichever listener moved into its slot.
+        for (size_t i = 0; i < mHooks[id].size(); i++) {
+            Hook& hook = mHooks[id][i];
+            if (hook.Timing.ShouldSkip()) {
+                continue;
+            }
+
+            const uint64_t serial = hook.Serial;
+            const uint64_t generation = mGeneration;
+            const uint64_t start = HookTiming::Now();
+            LuaUtils::RunCallback(hook.Func, args...);
+            const uint64_t elapsed = HookTiming::Now() - start;
+            if (mGeneration != generation) {
+                i = FindListener(id, serial);
+                if (i == mHooks[id].size() || mHooks[id][i].Serial != serial) {
+                    // Removed by its own callback, i is the listener that followed it.
+                    i--;
+                    continue;
+                }
+            }
+
+            Hook& ran = mHooks[id][i];
+            if (ran.Timing.Record(elapsed)) {
+                ReportHookOverBudget(mNames[id], ran.Owner, ran.Name, elapsed);
+            }
         }
     }
 
-    void Listen(const std::string& id, const std::string& name, sol::function func);
-    void Remove(const std::string& id, const std::string& name);
+    template <typename... CallbackArgs> void Call(const std::string& name, CallbackArgs... args) {
+        Call(Find(name), std::forward<CallbackArgs>(args)...);
+    }
+
+    void Listen(const std::string& id, const std::string& name, sol::function func, const std::string& owner = "");
+    // Only removes listeners of the given owner, mods can't remove each other's listeners.
+    void Remove(const std::string& id, const std::string& name, const std::string& owner = "");
 
     // Utils ---
     [[nodiscard]] size_t Count() const;
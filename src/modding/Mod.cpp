@@ -14,7 +14,12 @@ Mod::~Mod() {
 
 void Mod::Init() {
     auto& lua = Scripting::GetLua();
-    this->mEnvironment = { lua, sol::create, lua.globals() };
+    auto& shared = Scripting::GetSharedEnvironment();
+    if (shared.valid()) {
+        this->mEnvironment = { lua, sol::create, shared };
+    } else {
+        this->mEnvironment = { lua, sol::create, lua.globals() };
+    }
 }
 
 bool Mod::Load() {
@@ -51,5 +56,9 @@ const std::filesystem::path& Mod::GetFolder() const {
 sol::environment& Mod::GetEnvironment() {
     return this->mEnvironment;
 }
+
+const std::vector<HookTiming>& Mod::GetHookTimings() const {
+    return this->mHookTimings;
+}
 // -----
 } // namespace LUS
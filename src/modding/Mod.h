@@ -1,5 +1,6 @@
 #pragma once
 #include "LuaUtils.h"
+#include "Hooks.h"
 
 #include <sol/sol.hpp>
 
@@ -17,6 +18,9 @@ class Mod {
     std::filesystem::path mFolder;
     std::string mId;
 
+    // Indexed by HookId
+    std::vector<HookTiming> mHookTimings;
+
   public:
     // std::function<void(std::filesystem::path)> onLUAReload = nullptr;
 
@@ -36,6 +40,7 @@ class Mod {
     [[nodiscard]] virtual const std::filesystem::path& GetFolder() const;
 
     virtual sol::environment& GetEnvironment();
+    [[nodiscard]] const std::vector<HookTiming>& GetHookTimings() const;
     // -----
 
     template <typename... CallbackArgs> void Call(const std::string& name, CallbackArgs&&... args) {
@@ -46,5 +51,28 @@ class Mod {
 
         LuaUtils::RunCallback(func, mModTable, std::forward<CallbackArgs>(args)...);
     }
+
+    // key is the hook name as a Lua string, see Scripting::GetHookKey. Looking it up raw skips interning the name.
+    template <typename... CallbackArgs>
+    void Call(HookId id, const std::string& name, const sol::object& key, CallbackArgs&&... args) {
+        sol::object func = mModTable.raw_get<sol::object>(key);
+        if (func.get_type() != sol::type::function) {
+            return;
+        }
+
+        if (id >= mHookTimings.size()) {
+            mHookTimings.resize(id + 1);
+        }
+        if (mHookTimings[id].ShouldSkip()) {
+            return;
+        }
+
+        const uint64_t start = HookTiming::Now();
+        LuaUtils::RunCallback(func.as<sol::function>(), mModTable, std::forward<CallbackArgs>(args)...);
+        const uint64_t elapsed = HookTiming::Now() - start;
+        if (mHookTimings[id].Record(elapsed)) {
+            ReportHookOverBudget(name, mId, "MOD." + name, elapsed);
+        }
+    }
 };
 } // namespace LUS
@@ -1,11 +1,146 @@
 #include "Scripting.h"
 #include "wrappers/HooksWrapper.h"
+#include "Context.h"
+#include "Utils/StringHelper.h"
 #include "spdlog/spdlog.h"
+#include <StrHash64.h>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#define LUA_CACHE_FOLDER "cache/lua"
+#define LUA_CACHE_KEY_FILE "cache.key"
+#define LUA_CACHE_MAGIC 0x4341554C // "LUAC"
+#define LUA_CACHE_VERSION 2
 
 namespace LUS {
+namespace {
+// Bytecode files start with this, Lua itself rejects bytecode from another Lua version or number format.
+struct LuaCacheHeader {
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t ContentHash;
+    // SipHash of ContentHash and the bytecode under this install's cache key. Lua runs bytecode without verifying
+    // it, so a chunk dropped next to a mod or copied from another install is never loaded.
+    uint64_t Tag;
+};
+
+typedef std::array<uint64_t, 2> LuaCacheKey;
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+void SipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) {
+    v0 += v1;
+    v1 = RotateLeft(v1, 13) ^ v0;
+    v0 = RotateLeft(v0, 32);
+    v2 += v3;
+    v3 = RotateLeft(v3, 16) ^ v2;
+    v0 += v3;
+    v3 = RotateLeft(v3, 21) ^ v0;
+    v2 += v1;
+    v1 = RotateLeft(v1, 17) ^ v2;
+    v2 = RotateLeft(v2, 32);
+}
+
+// SipHash-2-4 over the content hash followed by the bytecode.
+uint64_t ComputeTag(const LuaCacheKey& key, uint64_t contentHash, const std::string& bytecode) {
+    std::string message(reinterpret_cast<const char*>(&contentHash), sizeof(contentHash));
+    message += bytecode;
+
+    uint64_t v0 = key[0] ^ 0x736F6D6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646F72616E646F6DULL;
+    uint64_t v2 = key[0] ^ 0x6C7967656E657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+
+    const auto data = reinterpret_cast<const uint8_t*>(message.data());
+    const size_t size = message.size();
+    const size_t blocks = size & ~static_cast<size_t>(7);
+    for (size_t i = 0; i < blocks; i += 8) {
+        uint64_t m = 0;
+        for (int b = 0; b < 8; b++) {
+            m |= static_cast<uint64_t>(data[i + b]) << (b * 8);
+        }
+        v3 ^= m;
+        SipRound(v0, v1, v2, v3);
+        SipRound(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    uint64_t last = static_cast<uint64_t>(size) << 56;
+    for (size_t b = 0; b < size - blocks; b++) {
+        last |= static_cast<uint64_t>(data[blocks + b]) << (b * 8);
+    }
+    v3 ^= last;
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    v0 ^= last;
+
+    v2 ^= 0xFF;
+    for (int i = 0; i < 4; i++) {
+        SipRound(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+int WriteBytecode(lua_State*, const void* data, size_t size, void* userData) {
+    static_cast<std::string*>(userData)->append(static_cast<const char*>(data), size);
+    return 0;
+}
+
+std::string GetCacheFolder() {
+    return Context::GetPathRelativeToAppDirectory(LUA_CACHE_FOLDER);
+}
+
+std::string GetCachePath(const std::string& path) {
+    return StringHelper::Sprintf("%s/%016llX.luac", GetCacheFolder().c_str(),
+                                 (unsigned long long)crc64(path.data(), (uint32_t)path.size()));
+}
+
+// Random per install key, created the first time the cache is used. False disables the cache.
+bool GetCacheKey(LuaCacheKey* key) {
+    static LuaCacheKey sKey;
+    static bool sLoaded = false;
+    if (sLoaded) {
+        *key = sKey;
+        return true;
+    }
+
+    const std::string keyPath = GetCacheFolder() + "/" + LUA_CACHE_KEY_FILE;
+    std::ifstream input(keyPath, std::ios::in | std::ios::binary);
+    if (input && input.read(reinterpret_cast<char*>(sKey.data()), sizeof(sKey))) {
+        sLoaded = true;
+        *key = sKey;
+        return true;
+    }
+    input.close();
+
+    std::random_device random;
+    for (auto& word : sKey) {
+        word = (static_cast<uint64_t>(random()) << 32) | random();
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(GetCacheFolder(), error);
+    std::ofstream output(keyPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!output.write(reinterpret_cast<const char*>(sKey.data()), sizeof(sKey))) {
+        SPDLOG_WARN("Failed to create lua cache key {}, bytecode caching is disabled", keyPath);
+        return false;
+    }
+
+    sLoaded = true;
+    *key = sKey;
+    return true;
+}
+} // namespace
+
 // PROTECTED -----
 std::unordered_map<std::string, std::unique_ptr<Mod>> Scripting::mods = {};
 std::unique_ptr<sol::state> Scripting::lua = std::make_unique<sol::state>();
+sol::environment Scripting::sharedEnvironment;
+std::vector<sol::object> Scripting::hookKeys = {};
 std::vector<std::unique_ptr<Plugin>> Scripting::plugins = {};
 // ----------------
 
@@ -39,6 +174,8 @@ void Scripting::Shutdown() {
 
     mods.clear();
     plugins.clear();
+    sharedEnvironment.reset();
+    hookKeys.clear();
 
     lua->collect_garbage();
     lua.reset();
@@ -82,6 +219,32 @@ void Scripting::LoadTypes() {
     // ----
 }
 
+void Scripting::LoadSharedExtensions() {
+    if (lua == nullptr) {
+        throw std::runtime_error("LUA is not set! Reference got destroyed?");
+    }
+
+    if (sharedEnvironment.valid()) {
+        return;
+    }
+
+    sharedEnvironment = sol::environment(*lua, sol::create, lua->globals());
+    LoadLuaFile("./lua/table.lua", sharedEnvironment);
+    LoadLuaFile("./lua/string.lua", sharedEnvironment);
+    LoadLuaFile("./lua/math.lua", sharedEnvironment);
+    LoadLuaFile("./lua/json.lua", sharedEnvironment);
+    LoadLuaFile("./lua/sha2.lua", sharedEnvironment);
+    LoadLuaFile("./lua/util.lua", sharedEnvironment);
+
+    // Every mod sees these, so nothing gets to add globals here once the helpers are in. This only catches new keys
+    // on the shared table itself: keys that already exist can still be reassigned, rawset skips the metatable and the
+    // tables it hands out (string, math, json, ...) stay mutable, so a mod can still change them for every other mod.
+    sol::table metatable = sharedEnvironment[sol::metatable_key];
+    metatable[sol::meta_function::new_index] = [](sol::table, sol::object key, sol::object) {
+        SPDLOG_WARN("Ignoring write to shared lua global '{}'", key.is<std::string>() ? key.as<std::string>() : "?");
+    };
+}
+
 void Scripting::LoadLuaExtensions(Mod* mod) {
     if (lua == nullptr) {
         throw std::runtime_error("LUA is not set! Reference got destroyed?");
@@ -91,14 +254,6 @@ void Scripting::LoadLuaExtensions(Mod* mod) {
         throw std::runtime_error("Mod not set! Reference got destroyed?");
     }
 
-    auto& env = mod->GetEnvironment();
-    LoadLuaFile("./lua/table.lua", env);
-    LoadLuaFile("./lua/string.lua", env);
-    LoadLuaFile("./lua/math.lua", env);
-    LoadLuaFile("./lua/json.lua", env);
-    LoadLuaFile("./lua/sha2.lua", env);
-    LoadLuaFile("./lua/util.lua", env);
-
     // Register plugins types ---
     for (auto& p : plugins) {
         p->LoadLuaExtensions(mod);
@@ -186,7 +341,7 @@ void Scripting::LoadGlobals(Mod* mod) {
     // ---------------------
 
     // Global types ------------------------------------
-    env["hooks"] = HooksWrapper(hooks.get());
+    env["hooks"] = HooksWrapper(hooks.get(), mod->GetId());
     // -----------------------
 
     // Register plugins env types ---
@@ -222,6 +377,7 @@ void Scripting::Load() {
     }
 
     // Initialize
+    LoadSharedExtensions();
     for (auto& mod : mods) {
         mod.second->Init();
 
@@ -240,29 +396,106 @@ void Scripting::Load() {
 }
 
 bool Scripting::LoadLuaFile(const std::string& path, const sol::environment& env) {
-    if (!std::filesystem::exists(path)) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file) {
         SPDLOG_WARN("Failed to load lua : {}", path);
         return false;
     }
+    const std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const std::string chunkName = "@" + path;
+    const uint64_t contentHash = crc64(source.data(), (uint32_t)source.size());
+
+    // Sources are only ever loaded as text, binary chunks only come from our own cache.
+    sol::protected_function chunk = LoadCachedChunk(path, chunkName, contentHash);
+    if (!chunk.valid()) {
+        sol::load_result loaded = lua->load(source, chunkName, sol::load_mode::text);
+        if (!loaded.valid()) {
+            sol::error err = loaded;
+            SPDLOG_ERROR("Failed to load '{}'\n  └── Lua error : {}", path, err.what());
+            return false;
+        }
+        chunk = loaded.get<sol::protected_function>();
+        SaveCachedChunk(path, contentHash, chunk);
+    }
+
+    env.set_on(chunk);
+    auto result = chunk();
+    if (!result.valid()) {
+        sol::error err = result;
+        SPDLOG_ERROR("Failed to load '{}'\n  └── Lua error : {}", path, err.what());
+        return false;
+    }
 
-    std::string errStr;
-    // try to load the file while handling exceptions
-    auto ret = lua->safe_script_file(
-        path, env,
-        [&errStr](lua_State*, sol::protected_function_result pfr) {
-            sol::error err = pfr;
-            errStr = err.what();
-            return pfr;
-        },
-        sol::load_mode::text);
+    return true;
+}
 
-    // check if we loaded the file
-    if (errStr.empty()) {
-        return true;
+sol::protected_function Scripting::LoadCachedChunk(const std::string& path, const std::string& chunkName,
+                                                   uint64_t contentHash) {
+    std::ifstream file(GetCachePath(path), std::ios::in | std::ios::binary);
+    if (!file) {
+        return {};
+    }
+
+    LuaCacheHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.Magic != LUA_CACHE_MAGIC ||
+        header.Version != LUA_CACHE_VERSION || header.ContentHash != contentHash) {
+        return {};
+    }
+
+    LuaCacheKey key;
+    const std::string bytecode((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!GetCacheKey(&key) || ComputeTag(key, contentHash, bytecode) != header.Tag) {
+        SPDLOG_WARN("Ignoring lua bytecode for {} that this install didn't write", path);
+        return {};
+    }
+
+    sol::load_result loaded = lua->load(bytecode, chunkName, sol::load_mode::binary);
+    if (!loaded.valid()) {
+        // Usually a Lua update changed the bytecode format, the caller falls back to the source.
+        SPDLOG_DEBUG("Ignoring stale lua bytecode for {}", path);
+        return {};
+    }
+
+    return loaded.get<sol::protected_function>();
+}
+
+void Scripting::SaveCachedChunk(const std::string& path, uint64_t contentHash, sol::protected_function& chunk) {
+    lua_State* state = lua->lua_state();
+    std::string bytecode;
+    chunk.push(state);
+#if LUA_VERSION_NUM >= 503
+    const int status = lua_dump(state, WriteBytecode, &bytecode, 0);
+#else
+    const int status = lua_dump(state, WriteBytecode, &bytecode);
+#endif
+    lua_pop(state, 1);
+    LuaCacheKey key;
+    if (status != 0 || bytecode.empty() || !GetCacheKey(&key)) {
+        return;
     }
 
-    SPDLOG_ERROR("Failed to load '{}'\n  └── Lua error : {}", path, errStr);
-    return false;
+    std::error_code error;
+    std::filesystem::create_directories(GetCacheFolder(), error);
+
+    // Write next to the target and swap it in, so a crash never leaves a truncated chunk behind.
+    const std::string cachePath = GetCachePath(path);
+    const std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        const LuaCacheHeader header = { LUA_CACHE_MAGIC, LUA_CACHE_VERSION, contentHash,
+                                        ComputeTag(key, contentHash, bytecode) };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(bytecode.data(), bytecode.size());
+        if (!file) {
+            return;
+        }
+    }
+
+    std::filesystem::rename(tempPath, cachePath, error);
+    if (error) {
+        SPDLOG_WARN("Failed to cache lua bytecode for {}: {}", path, error.message());
+        std::filesystem::remove(tempPath, error);
+    }
 }
 
 // UTILS -----
@@ -270,6 +503,53 @@ sol::state& Scripting::GetLua() {
     return *lua;
 }
 
+sol::environment& Scripting::GetSharedEnvironment() {
+    return sharedEnvironment;
+}
+
+const sol::object& Scripting::GetHookKey(HookId id) {
+    if (id >= hookKeys.size()) {
+        hookKeys.resize(id + 1);
+    }
+    if (!hookKeys[id].valid()) {
+        hookKeys[id] = sol::make_object(*lua, hooks->GetName(id));
+    }
+    return hookKeys[id];
+}
+
+HookId Scripting::RegisterHook(const std::string& name) {
+    return hooks->Register(name);
+}
+
+void Scripting::SetHookBudget(uint64_t budgetUs, bool throttle) {
+    HookTiming::SetBudget(budgetUs, throttle);
+}
+
+void Scripting::LogHookTimings() {
+    auto logTiming = [](const std::string& hook, const std::string& owner, const std::string& listener,
+                        const HookTiming& timing) {
+        if (timing.Calls == 0) {
+            return;
+        }
+        SPDLOG_INFO("{} / {} / {}: {} calls, {:.3f} ms avg, {:.3f} ms max, {} over budget, {} skipped", owner, hook,
+                    listener, timing.Calls, timing.TotalNs / 1000000.0 / timing.Calls, timing.MaxNs / 1000000.0,
+                    timing.OverBudget, timing.Skipped);
+    };
+
+    const auto& listeners = hooks->GetListeners();
+    for (HookId id = 0; id < listeners.size(); id++) {
+        for (const auto& hook : listeners[id]) {
+            logTiming(hooks->GetName(id), hook.Owner.empty() ? "game" : hook.Owner, hook.Name, hook.Timing);
+        }
+    }
+    for (auto& mod : mods) {
+        const auto& timings = mod.second->GetHookTimings();
+        for (HookId id = 0; id < timings.size(); id++) {
+            logTiming(hooks->GetName(id), mod.first, "MOD." + hooks->GetName(id), timings[id]);
+        }
+    }
+}
+
 const std::unordered_map<std::string, std::unique_ptr<Mod>>& Scripting::GetMods() {
     return mods;
 }
@@ -15,6 +15,10 @@ class Scripting {
   protected:
     static std::unordered_map<std::string, std::unique_ptr<Mod>> mods;
     static std::unique_ptr<sol::state> lua;
+    // Holds the bundled lua/*.lua helpers, loaded once and used as the fallback of every mod environment.
+    static sol::environment sharedEnvironment;
+    // Hook names as Lua strings, indexed by HookId
+    static std::vector<sol::object> hookKeys;
 
     static std::vector<std::unique_ptr<Plugin>> plugins;
 
@@ -36,6 +40,7 @@ class Scripting {
     // LOAD -----
     static void LoadLibraries();
     static void LoadTypes();
+    static void LoadSharedExtensions();
     static void LoadLuaExtensions(Mod* mod);
     static void LoadGlobals(Mod* mod);
 
@@ -45,6 +50,8 @@ class Scripting {
 
     // UTILS -----
     [[nodiscard]] static sol::state& GetLua();
+    [[nodiscard]] static sol::environment& GetSharedEnvironment();
+    [[nodiscard]] static const sol::object& GetHookKey(HookId id);
     [[nodiscard]] static const std::unordered_map<std::string, std::unique_ptr<Mod>>& GetMods();
     [[nodiscard]] static const std::vector<std::string> GetModsIds();
     //------
@@ -70,10 +77,33 @@ class Scripting {
         }
     }
 
-    template <typename... CallbackArgs> static void Call(const std::string& hookName, CallbackArgs&&... args) {
+    // HOOKS ---
+    static HookId RegisterHook(const std::string& name);
+    // Listeners and MOD callbacks that take longer than budgetUs are reported, with throttle they also skip calls.
+    // A budget of 0 turns the check off.
+    static void SetHookBudget(uint64_t budgetUs, bool throttle = false);
+    static void LogHookTimings();
+
+    template <typename... CallbackArgs> static void Call(HookId id, CallbackArgs&&... args) {
+        if (mods.empty()) {
+            return;
+        }
+
+        const std::string& name = hooks->GetName(id);
+        const sol::object& key = GetHookKey(id);
         for (auto& mod : mods) {
-            mod.second->Call(hookName, args...);
+            mod.second->Call(id, name, key, args...);
         }
     }
+
+    template <typename... CallbackArgs> static void Call(const std::string& hookName, CallbackArgs&&... args) {
+        Call(RegisterHook(hookName), std::forward<CallbackArgs>(args)...);
+    }
+    // -----
+
+  private:
+    static sol::protected_function LoadCachedChunk(const std::string& path, const std::string& chunkName,
+                                                   uint64_t contentHash);
+    static void SaveCachedChunk(const std::string& path, uint64_t contentHash, sol::protected_function& chunk);
 };
 } // namespace LUS
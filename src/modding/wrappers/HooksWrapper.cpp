@@ -2,11 +2,11 @@
 #include "HooksWrapper.h"
 
 namespace LUS {
-HooksWrapper::HooksWrapper(Hooks* hooks_) : mHooks(hooks_) {
+HooksWrapper::HooksWrapper(Hooks* hooks_, std::string owner) : mHooks(hooks_), mOwner(std::move(owner)) {
 }
 
 void HooksWrapper::Listen(const std::string& hook, const std::string& name, sol::function callback) {
-    this->mHooks->Listen(hook, name, callback);
+    this->mHooks->Listen(hook, name, callback, this->mOwner);
 }
 
 void HooksWrapper::Call(const std::string& hook, sol::variadic_args args) {
@@ -14,7 +14,7 @@ void HooksWrapper::Call(const std::string& hook, sol::variadic_args args) {
 }
 
 void HooksWrapper::Remove(const std::string& hook, const std::string& id) {
-    this->mHooks->Remove(hook, id);
+    this->mHooks->Remove(hook, id, this->mOwner);
 }
 
 void HooksWrapper::RegisterLua(sol::state& lua) {
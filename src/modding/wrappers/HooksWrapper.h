@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sol/sol.hpp>
+#include <string>
 
 namespace LUS {
 class Hooks;
@@ -8,9 +9,11 @@ class Hooks;
 class HooksWrapper {
   protected:
     Hooks* mHooks = nullptr;
+    // Mod the listeners added through this wrapper are accounted to
+    std::string mOwner;
 
   public:
-    HooksWrapper(Hooks* hooks);
+    HooksWrapper(Hooks* hooks, std::string owner = "");
     HooksWrapper(const HooksWrapper&) = default;
     HooksWrapper(HooksWrapper&&) = default;
     HooksWrapper& operator=(const HooksWrapper&) = default;
@@ -110,9 +110,9 @@ void WiiUGamepad::ReadDevice(int32_t portIndex) {
         float gyroX = status->gyro.x * -8.0f;
         float gyroY = status->gyro.z * 8.0f;
 
-        float gyro_drift_x = profile->GyroData[DRIFT_X] / 100.0f;
-        float gyro_drift_y = profile->GyroData[DRIFT_Y] / 100.0f;
-        const float gyro_sensitivity = profile->GyroData[GYRO_SENSITIVITY];
+        float gyro_drift_x = GetProfileValue(profile->GyroData, DRIFT_X) / 100.0f;
+        float gyro_drift_y = GetProfileValue(profile->GyroData, DRIFT_Y) / 100.0f;
+        const float gyro_sensitivity = GetProfileValue(profile->GyroData, GYRO_SENSITIVITY);
 
         if (gyro_drift_x == 0) {
             gyro_drift_x = gyroX;
@@ -26,8 +26,7 @@ uint64_t ResourceGetCrcByName(const char* name) {
 }
 
 const char* ResourceGetNameByCrc(uint64_t crc) {
-    const std::string* hashStr = LUS::Context::GetInstance()->GetResourceManager()->GetArchive()->HashToString(crc);
-    return hashStr != nullptr ? hashStr->c_str() : nullptr;
+    return LUS::Context::GetInstance()->GetResourceManager()->GetArchive()->HashToPath(crc);
 }
 
 size_t ResourceGetSizeByName(const char* name) {
@@ -155,6 +154,10 @@ void ResourceLoadDirectoryAsync(const char* name) {
     LUS::Context::GetInstance()->GetResourceManager()->LoadDirectoryAsync(name);
 }
 
+void ResourcePrefetchDependencies(const char* name, int32_t depth) {
+    LUS::Context::GetInstance()->GetResourceManager()->PrefetchDependencies(name, depth);
+}
+
 uint32_t ResourceHasGameVersion(uint32_t hash) {
     auto list = LUS::Context::GetInstance()->GetResourceManager()->GetArchive()->GetGameVersions();
     return std::find(list.begin(), list.end(), hash) != list.end();
@@ -15,7 +15,12 @@ int32_t osContInit(OSMesgQueue* mq, uint8_t* controllerBits, OSContStatus* statu
 
 #ifndef __SWITCH__
     std::string controllerDb = LUS::Context::LocateFileAcrossAppDirs("gamecontrollerdb.txt");
-    int mappingsAdded = SDL_GameControllerAddMappingsFromFile(controllerDb.c_str());
+    // Context::Init usually read the file already, next to the rest of the startup I/O.
+    const std::string mappings = LUS::Context::GetInstance()->TakeControllerMappings();
+    int mappingsAdded =
+        mappings.empty()
+            ? SDL_GameControllerAddMappingsFromFile(controllerDb.c_str())
+            : SDL_GameControllerAddMappingsFromRW(SDL_RWFromConstMem(mappings.data(), (int)mappings.size()), 1);
     if (mappingsAdded >= 0) {
         SPDLOG_INFO("Added SDL game controllers from \"{}\" ({})", controllerDb, mappingsAdded);
     } else {
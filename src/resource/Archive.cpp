@@ -8,11 +8,26 @@
 #include <filesystem>
 #include "utils/binarytools/MemoryStream.h"
 #include "utils/binarytools/FileHelper.h"
+#include "thread-pool/BS_thread_pool.hpp"
+#include <array>
+#include <chrono>
 
 #ifdef __SWITCH__
 #include "port/switch/SwitchImpl.h"
 #endif
 
+// NOLINTNEXTLINE
+extern bool SFileCheckWildCard(const char* szString, const char* szWildCard);
+
+// Files that compress worse than this are stored.
+#define ARCHIVE_MIN_COMPRESSION_GAIN 0.95
+// Files AddFiles keeps compressed ahead of the writer, per worker.
+#define ARCHIVE_PRECOMPRESS_WINDOW 4
+// StormLib's slack for codecs that overrun the sector while compressing.
+#define ARCHIVE_SECTOR_SLACK 0x100
+// Paths HashToString keeps alive per thread.
+#define ARCHIVE_HASH_STRING_SLOTS 16
+
 namespace LUS {
 Archive::Archive(const std::string& mainPath, bool enableWriting)
     : Archive(mainPath, "", std::unordered_set<uint32_t>(), enableWriting) {
@@ -147,10 +162,149 @@ std::shared_ptr<File> Archive::LoadFileFromHandle(const std::string& filePath, b
 }
 
 std::shared_ptr<File> Archive::LoadFile(const std::string& filePath, bool includeParent) {
-    return LoadFileFromHandle(filePath, includeParent, nullptr);
+    // Read straight from the archive that owns the file rather than walking the patch chain.
+    return LoadFileFromHandle(filePath, includeParent, FindFileArchive(filePath));
 }
 
 bool Archive::AddFile(const std::string& filePath, uintptr_t fileData, DWORD fileSize) {
+    std::string updatedPath = filePath;
+
+    StringHelper::ReplaceOriginal(updatedPath, "\\", "/");
+
+    return AddFileToMpq(updatedPath, fileData, fileSize,
+                        GetCompressionPolicy()->Select(updatedPath, fileData, fileSize));
+}
+
+void Archive::SetCompressionPolicy(std::shared_ptr<ArchiveCompressionPolicy> policy) {
+    const std::lock_guard<std::mutex> lock(mMutex);
+    mCompressionPolicy = policy;
+}
+
+std::shared_ptr<ArchiveCompressionPolicy> Archive::GetCompressionPolicy() {
+    const std::lock_guard<std::mutex> lock(mMutex);
+    if (mCompressionPolicy == nullptr) {
+        mCompressionPolicy = ArchiveCompressionPolicy::CreateDefault();
+    }
+    return mCompressionPolicy;
+}
+
+bool Archive::AddFiles(const std::vector<ArchiveEntry>& entries,
+                       const std::function<void(const ArchiveBuildProgress&)>& onProgress, size_t threadCount) {
+    const auto start = std::chrono::steady_clock::now();
+    ArchiveBuildProgress progress = { 0, entries.size(), 0, 0, 0.0 };
+    for (const auto& entry : entries) {
+        progress.BytesTotal += entry.Size;
+    }
+
+    {
+        const std::lock_guard<std::mutex> lock(mMutex);
+        // Every file already in the archive, not just the ones this session added, takes a slot.
+        DWORD blockTableSize = 0;
+        SFileGetFileInfo(mMainMpq, SFileMpqBlockTableSize, &blockTableSize, sizeof(blockTableSize), nullptr);
+        const DWORD fileCount = static_cast<DWORD>(blockTableSize + entries.size());
+        if (SFileGetMaxFileCount(mMainMpq) < fileCount) {
+            SFileSetMaxFileCount(mMainMpq, fileCount);
+        }
+    }
+
+    DWORD sectorSize = 0;
+    {
+        const std::lock_guard<std::mutex> lock(mMutex);
+        SFileGetFileInfo(mMainMpq, SFileMpqSectorSize, &sectorSize, sizeof(sectorSize), nullptr);
+    }
+
+    // The workers pick each file's codec and compress its sectors, the writer only copies them into the archive
+    // through SFileSetPrecompressedSectors. Files that barely shrink, like already compressed textures or audio, are
+    // stored as is whatever the policy says. Only a few files per worker are kept compressed ahead of the writer.
+    const auto policy = GetCompressionPolicy();
+    BS::thread_pool pool(threadCount != 0 ? threadCount : std::thread::hardware_concurrency());
+    const size_t window = pool.get_thread_count() * ARCHIVE_PRECOMPRESS_WINDOW;
+    std::vector<std::future<PrecompressedFile>> files(entries.size());
+    auto submit = [&](size_t i) {
+        files[i] = pool.submit_back([&entry = entries[i], &policy, sectorSize]() {
+            std::string path = entry.Path;
+            StringHelper::ReplaceOriginal(path, "\\", "/");
+            return Precompress(entry, policy->Select(path, entry.Data, entry.Size), sectorSize);
+        });
+    };
+    for (size_t i = 0; i < std::min(window, entries.size()); i++) {
+        submit(i);
+    }
+
+    // Files are written in the order given while the workers run ahead.
+    size_t codecCounts[4] = {};
+    bool success = true;
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::string updatedPath = entries[i].Path;
+        StringHelper::ReplaceOriginal(updatedPath, "\\", "/");
+
+        const PrecompressedFile file = files[i].get();
+        if (i + window < entries.size()) {
+            submit(i + window);
+        }
+
+        const ArchiveCodec codec = file.Codec;
+        if (!AddFileToMpq(updatedPath, entries[i].Data, entries[i].Size, codec, &file)) {
+            success = false;
+            continue;
+        }
+        codecCounts[static_cast<size_t>(codec)]++;
+
+        progress.FilesDone++;
+        progress.BytesDone += entries[i].Size;
+        progress.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (onProgress != nullptr) {
+            onProgress(progress);
+        }
+    }
+
+    progress.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    SPDLOG_INFO("Added {} files ({:.1f} MiB) to {} in {:.2f} s, {:.1f} MiB/s, {} stored, {} zlib, {} bzip2, {} lzma",
+                progress.FilesDone, progress.BytesDone / (1024.0 * 1024.0), mMainPath, progress.Seconds,
+                progress.BytesDone / (1024.0 * 1024.0) / std::max(progress.Seconds, 0.001), codecCounts[0],
+                codecCounts[1], codecCounts[2], codecCounts[3]);
+    return success;
+}
+
+Archive::PrecompressedFile Archive::Precompress(const ArchiveEntry& entry, ArchiveCodec codec, DWORD sectorSize) {
+    PrecompressedFile file;
+    file.Codec = codec;
+    const DWORD mask = ArchiveCompressionPolicy::GetCompressionMask(codec);
+    if (mask == 0 || entry.Size == 0 || sectorSize == 0) {
+        file.Codec = ArchiveCodec::Store;
+        return file;
+    }
+
+    // Same call StormLib makes when it compresses a sector itself, so the archive comes out identical.
+    const DWORD sectorCount = (entry.Size + sectorSize - 1) / sectorSize;
+    std::vector<size_t> offsets;
+    offsets.reserve(sectorCount);
+    file.SectorSizes.reserve(sectorCount);
+    for (DWORD offset = 0; offset < entry.Size; offset += sectorSize) {
+        const int inSize = static_cast<int>(std::min<DWORD>(entry.Size - offset, sectorSize));
+        const size_t outOffset = file.Data.size();
+        file.Data.resize(outOffset + sectorSize + ARCHIVE_SECTOR_SLACK);
+        int outSize = inSize;
+        SCompCompress(file.Data.data() + outOffset, &outSize, (void*)(entry.Data + offset), inSize, mask, 0, -1);
+        file.Data.resize(outOffset + outSize);
+        offsets.push_back(outOffset);
+        file.SectorSizes.push_back(static_cast<DWORD>(outSize));
+    }
+
+    if (file.Data.size() >= entry.Size * ARCHIVE_MIN_COMPRESSION_GAIN) {
+        return { ArchiveCodec::Store };
+    }
+
+    file.Sectors.reserve(sectorCount);
+    for (const size_t offset : offsets) {
+        file.Sectors.push_back(file.Data.data() + offset);
+    }
+    return file;
+}
+
+bool Archive::AddFileToMpq(const std::string& updatedPath, uintptr_t fileData, DWORD fileSize, ArchiveCodec codec,
+                           const PrecompressedFile* precompressed) {
+    const DWORD compression = ArchiveCompressionPolicy::GetCompressionMask(codec);
     HANDLE hFile;
 #ifdef _WIN32
     SYSTEMTIME sysTime;
@@ -163,15 +317,11 @@ bool Archive::AddFile(const std::string& filePath, uintptr_t fileData, DWORD fil
     time(&theTime);
 #endif
 
-    std::string updatedPath = filePath;
-
-    StringHelper::ReplaceOriginal(updatedPath, "\\", "/");
-
     bool createFileSuccess;
     {
         const std::lock_guard<std::mutex> lock(mMutex);
-        createFileSuccess =
-            SFileCreateFile(mMainMpq, updatedPath.c_str(), theTime, fileSize, 0, MPQ_FILE_COMPRESS, &hFile);
+        createFileSuccess = SFileCreateFile(mMainMpq, updatedPath.c_str(), theTime, fileSize, 0,
+                                            compression != 0 ? MPQ_FILE_COMPRESS : 0, &hFile);
     }
     if (!createFileSuccess) {
         SPDLOG_ERROR("({}) Failed to create file of {} bytes {} in archive {}", GetLastError(), fileSize, updatedPath,
@@ -179,10 +329,20 @@ bool Archive::AddFile(const std::string& filePath, uintptr_t fileData, DWORD fil
         return false;
     }
 
+    if (precompressed != nullptr && !precompressed->Sectors.empty()) {
+        const std::lock_guard<std::mutex> lock(mMutex);
+        if (!SFileSetPrecompressedSectors(hFile, precompressed->Sectors.data(), precompressed->SectorSizes.data(),
+                                          static_cast<DWORD>(precompressed->Sectors.size()))) {
+            // Not fatal, SFileWriteFile compresses the sectors itself.
+            SPDLOG_WARN("({}) Failed to use precompressed sectors for {} in archive {}", GetLastError(), updatedPath,
+                        mMainPath);
+        }
+    }
+
     bool writeFileSuccess;
     {
         const std::lock_guard<std::mutex> lock(mMutex);
-        writeFileSuccess = SFileWriteFile(hFile, (void*)fileData, fileSize, MPQ_COMPRESSION_ZLIB);
+        writeFileSuccess = SFileWriteFile(hFile, (void*)fileData, fileSize, compression);
     }
     if (!writeFileSuccess) {
         SPDLOG_ERROR("({}) Failed to write {} bytes to {} in archive {}", GetLastError(), fileSize, updatedPath,
@@ -220,7 +380,8 @@ bool Archive::AddFile(const std::string& filePath, uintptr_t fileData, DWORD fil
     // SFileFinishFile already frees the handle, so no need to close it again.
 
     mAddedFiles.push_back(updatedPath);
-    mHashes[CRC64(updatedPath.c_str())] = updatedPath;
+    IndexFile(updatedPath, mMainMpq);
+    mAddedHashes[CRC64(updatedPath.c_str())] = updatedPath;
 
     return true;
 }
@@ -237,6 +398,7 @@ bool Archive::RemoveFile(const std::string& filePath) {
         SPDLOG_ERROR("({}) Failed to remove file {} in archive {}", GetLastError(), filePath, mMainPath);
         return false;
     }
+    UnindexFile(filePath);
 
     return true;
 }
@@ -254,6 +416,8 @@ bool Archive::RenameFile(const std::string& oldFilePath, const std::string& newF
                      mMainPath);
         return false;
     }
+    UnindexFile(oldFilePath);
+    IndexFile(newFilePath, mMainMpq);
 
     return true;
 }
@@ -312,23 +476,150 @@ std::shared_ptr<std::vector<SFILE_FIND_DATA>> Archive::FindFiles(const std::stri
 
 std::shared_ptr<std::vector<std::string>> Archive::ListFiles(const std::string& fileSearchMask) {
     auto result = std::make_shared<std::vector<std::string>>();
-    auto fileList = FindFiles(fileSearchMask);
 
-    for (size_t i = 0; i < fileList->size(); i++) {
-        result->push_back(fileList->operator[](i).cFileName);
+    const std::lock_guard<std::mutex> lock(mFileIndexMutex);
+    const auto files = FindIndexedFiles(fileSearchMask);
+    result->reserve(files.size());
+    for (const auto file : files) {
+        result->push_back(file->Path);
     }
 
     return result;
 }
 
 bool Archive::HasFile(const std::string& fileSearchMask) {
-    auto list = FindFiles(fileSearchMask);
-    return list->size() > 0;
+    const std::lock_guard<std::mutex> lock(mFileIndexMutex);
+    return !FindIndexedFiles(fileSearchMask, 1).empty();
+}
+
+void Archive::IndexArchiveFiles(HANDLE mpqHandle) {
+    std::vector<std::string> filePaths;
+    SFILE_FIND_DATA findContext;
+
+    {
+        const std::lock_guard<std::mutex> lock(mMutex);
+        HANDLE hFind = SFileFindFirstFile(mpqHandle, "*", &findContext, nullptr);
+        if (hFind != nullptr) {
+            do {
+                filePaths.push_back(findContext.cFileName);
+            } while (SFileFindNextFile(hFind, &findContext));
+
+            if (!SFileFindClose(hFind)) {
+                SPDLOG_ERROR("({}) Failed to close file search while indexing archive {}", GetLastError(), mMainPath);
+            }
+        }
+    }
+
+    for (const auto& filePath : filePaths) {
+        IndexFile(filePath, mpqHandle);
+    }
+}
+
+void Archive::IndexFile(const std::string& filePath, HANDLE mpqHandle) {
+    const std::lock_guard<std::mutex> lock(mFileIndexMutex);
+    // Archives are indexed in load order, so a later patch replaces the entry of the archive it overrides.
+    mFileIndex[NormalizeIndexPath(filePath)] = { filePath, mpqHandle };
+    mSortedFileIndexDirty = true;
+}
+
+void Archive::UnindexFile(const std::string& filePath) {
+    const std::lock_guard<std::mutex> lock(mFileIndexMutex);
+    mFileIndex.erase(NormalizeIndexPath(filePath));
+    mSortedFileIndexDirty = true;
+}
+
+HANDLE Archive::FindFileArchive(const std::string& filePath) {
+    const std::lock_guard<std::mutex> lock(mFileIndexMutex);
+    auto it = mFileIndex.find(NormalizeIndexPath(filePath));
+    return it != mFileIndex.end() ? it->second.MpqHandle : nullptr;
+}
+
+std::vector<const Archive::IndexedFile*> Archive::FindIndexedFiles(const std::string& fileSearchMask, size_t limit) {
+    std::vector<const IndexedFile*> files;
+    const std::string mask = NormalizeIndexPath(fileSearchMask);
+    const size_t wildCard = mask.find_first_of("*?");
+
+    if (wildCard == std::string::npos) {
+        auto it = mFileIndex.find(mask);
+        if (it != mFileIndex.end()) {
+            files.push_back(&it->second);
+        }
+        return files;
+    }
+
+    if (mSortedFileIndexDirty) {
+        mSortedFileIndex.clear();
+        mSortedFileIndex.reserve(mFileIndex.size());
+        for (const auto& [key, file] : mFileIndex) {
+            mSortedFileIndex.emplace_back(key, &file);
+        }
+        std::sort(mSortedFileIndex.begin(), mSortedFileIndex.end(),
+                  [](const auto& a, const auto& b) { return a.first < b.first; });
+        mSortedFileIndexDirty = false;
+    }
+
+    const std::string_view prefix(mask.data(), wildCard);
+    auto it = std::lower_bound(mSortedFileIndex.begin(), mSortedFileIndex.end(), prefix,
+                               [](const auto& entry, std::string_view value) { return entry.first < value; });
+    for (; it != mSortedFileIndex.end() && it->first.starts_with(prefix) && files.size() < limit; ++it) {
+        if (SFileCheckWildCard(it->first.data(), mask.c_str())) {
+            files.push_back(it->second);
+        }
+    }
+
+    return files;
+}
+
+std::string Archive::NormalizeIndexPath(const std::string& filePath) {
+    // Matches StormLib's name hashing, which ignores case and treats both slashes the same.
+    std::string normalized = filePath;
+    for (auto& c : normalized) {
+        if (c == '/') {
+            c = '\\';
+        } else if (c >= 'a' && c <= 'z') {
+            c -= 'a' - 'A';
+        }
+    }
+    return normalized;
 }
 
 const std::string* Archive::HashToString(uint64_t hash) const {
-    auto it = mHashes.find(hash);
-    return it != mHashes.end() ? &it->second : nullptr;
+    const char* path = mCrcMap.Find(hash);
+    if (path == nullptr) {
+        auto it = mAddedHashes.find(hash);
+        return it != mAddedHashes.end() ? &it->second : nullptr;
+    }
+
+    struct HashString {
+        const Archive* Owner = nullptr;
+        uint64_t Hash = 0;
+        std::string Path;
+    };
+    thread_local std::array<HashString, ARCHIVE_HASH_STRING_SLOTS> slots;
+    thread_local size_t nextSlot = 0;
+
+    for (auto& slot : slots) {
+        if (slot.Owner == this && slot.Hash == hash) {
+            return &slot.Path;
+        }
+    }
+
+    auto& slot = slots[nextSlot];
+    nextSlot = (nextSlot + 1) % slots.size();
+    slot.Owner = this;
+    slot.Hash = hash;
+    slot.Path = path;
+    return &slot.Path;
+}
+
+const char* Archive::HashToPath(uint64_t hash) const {
+    const char* path = mCrcMap.Find(hash);
+    if (path != nullptr) {
+        return path;
+    }
+
+    auto it = mAddedHashes.find(hash);
+    return it != mAddedHashes.end() ? it->second.c_str() : nullptr;
 }
 
 bool Archive::Load(bool enableWriting, bool generateCrcMap) {
@@ -351,6 +642,13 @@ bool Archive::Unload() {
 
     mMainMpq = nullptr;
 
+    {
+        const std::lock_guard<std::mutex> lock(mFileIndexMutex);
+        mFileIndex.clear();
+        mSortedFileIndex.clear();
+        mSortedFileIndexDirty = false;
+    }
+
     return success;
 }
 
@@ -375,21 +673,57 @@ bool Archive::LoadPatchMPQs() {
 }
 
 void Archive::GenerateCrcMap() {
-    auto listFile = LoadFile("(listfile)", false);
+    const uint64_t fingerprint = GetArchiveFingerprint();
+    const std::string crcMapPath = mMainPath + ".crc";
 
-    // Use std::string_view to avoid unnecessary string copies
-    std::vector<std::string_view> lines =
-        StringHelper::Split(std::string_view(listFile->Buffer.data(), listFile->Buffer.size()), "\n");
+    if (mCrcMap.Load(crcMapPath, fingerprint)) {
+        SPDLOG_INFO("Loaded {} CRC entries from {}", mCrcMap.GetCount(), crcMapPath);
+        return;
+    }
+
+    // Keep the list files alive until the map has copied the paths into its arena.
+    std::vector<std::shared_ptr<File>> listFiles;
+    std::vector<std::string_view> paths;
+    for (const auto& [archivePath, mpqHandle] : mMpqHandles) {
+        auto listFile = LoadFileFromHandle("(listfile)", false, mpqHandle);
+        if (listFile == nullptr) {
+            continue;
+        }
 
-    for (size_t i = 0; i < lines.size(); i++) {
         // Use std::string_view to avoid unnecessary string copies
-        std::string_view line = lines[i].substr(0, lines[i].length() - 1); // Trim \r
-        std::string lineStr = std::string(line);
+        std::vector<std::string_view> lines =
+            StringHelper::Split(std::string_view(listFile->Buffer.data(), listFile->Buffer.size()), "\n");
+        for (auto line : lines) {
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (!line.empty()) {
+                paths.push_back(line);
+            }
+        }
+        listFiles.push_back(listFile);
+    }
+
+    mCrcMap.Build(paths, fingerprint);
+    SPDLOG_INFO("Generated {} CRC entries ({} bytes)", mCrcMap.GetCount(), mCrcMap.GetMemoryUsage());
+
+    if (!mCrcMap.Save(crcMapPath)) {
+        SPDLOG_WARN("Failed to save CRC map to {}", crcMapPath);
+    }
+}
 
-        // Not NULL terminated str
-        uint64_t hash = ~crc64(line.data(), line.length());
-        mHashes.emplace(hash, std::move(lineStr));
+uint64_t Archive::GetArchiveFingerprint() {
+    // Size and modification time of every archive in the chain, so replacing or patching any of them rebuilds the map.
+    std::string fingerprint;
+    for (const auto& [archivePath, mpqHandle] : mMpqHandles) {
+        std::error_code error;
+        const auto fileSize = std::filesystem::file_size(archivePath, error);
+        const auto writeTime = std::filesystem::last_write_time(archivePath, error);
+        fingerprint += archivePath + "|" + std::to_string(error ? 0 : fileSize) + "|" +
+                       std::to_string(error ? 0 : writeTime.time_since_epoch().count()) + "\n";
     }
+
+    return ~crc64(fingerprint.data(), fingerprint.length());
 }
 
 bool Archive::ProcessOtrVersion(HANDLE mpqHandle) {
@@ -461,9 +795,7 @@ bool Archive::LoadMainMPQ(bool enableWriting, bool generateCrcMap) {
                 mMainMpq = nullptr;
             } else {
                 mMpqHandles[fullPath] = mpqHandle;
-                if (generateCrcMap) {
-                    GenerateCrcMap();
-                }
+                IndexArchiveFiles(mpqHandle);
                 baseLoaded = true;
             }
         }
@@ -484,9 +816,11 @@ bool Archive::LoadMainMPQ(bool enableWriting, bool generateCrcMap) {
         if (LoadPatchMPQ(fullPath, true)) {
             SPDLOG_INFO("({}) Patched in mpq file.", fullPath);
         }
-        if (generateCrcMap) {
-            GenerateCrcMap();
-        }
+    }
+
+    // Built once over every loaded archive instead of re-reading the list file after each one.
+    if (generateCrcMap) {
+        GenerateCrcMap();
     }
 
     return true;
@@ -530,6 +864,7 @@ bool Archive::LoadPatchMPQ(const std::string& otrPath, bool validateVersion) {
     }
 
     mMpqHandles[fullPath] = patchHandle;
+    IndexArchiveFiles(patchHandle);
 
     return true;
 }
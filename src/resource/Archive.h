@@ -5,18 +5,36 @@
 #include <string>
 
 #include <stdint.h>
+#include <string_view>
 #include <map>
 #include <unordered_map>
 #include <string>
 #include <vector>
 #include <unordered_set>
 #include "Resource.h"
+#include "CrcMap.h"
+#include "ArchiveCompressionPolicy.h"
 #include <StormLib.h>
+#include <functional>
 #include <mutex>
 
 namespace LUS {
 struct File;
 
+struct ArchiveEntry {
+    std::string Path;
+    uintptr_t Data;
+    DWORD Size;
+};
+
+struct ArchiveBuildProgress {
+    size_t FilesDone;
+    size_t FilesTotal;
+    uint64_t BytesDone;
+    uint64_t BytesTotal;
+    double Seconds;
+};
+
 class Archive : public std::enable_shared_from_this<Archive> {
   public:
     Archive(const std::string& mainPath, bool enableWriting);
@@ -31,11 +49,22 @@ class Archive : public std::enable_shared_from_this<Archive> {
     bool IsMainMPQValid();
     std::shared_ptr<File> LoadFile(const std::string& filePath, bool includeParent = true);
     bool AddFile(const std::string& filePath, uintptr_t fileData, DWORD fileSize);
+    // Adds many files at once. The entries' buffers must stay alive until this returns. threadCount 0 uses every core.
+    bool AddFiles(const std::vector<ArchiveEntry>& entries,
+                  const std::function<void(const ArchiveBuildProgress&)>& onProgress = nullptr,
+                  size_t threadCount = 0);
+    // Decides the codec of every file added from now on, the default policy is used when none is set.
+    void SetCompressionPolicy(std::shared_ptr<ArchiveCompressionPolicy> policy);
+    std::shared_ptr<ArchiveCompressionPolicy> GetCompressionPolicy();
     bool RemoveFile(const std::string& filePath);
     bool RenameFile(const std::string& oldFilePath, const std::string& newFilePath);
     std::shared_ptr<std::vector<std::string>> ListFiles(const std::string& fileSearchMask);
     bool HasFile(const std::string& fileSearchMask);
+    // Paths from the CRC map are copied into a small per thread buffer, the string stays valid until the calling thread
+    // has looked up ARCHIVE_HASH_STRING_SLOTS other hashes.
     const std::string* HashToString(uint64_t hash) const;
+    // Same lookup without copying the path out of the CRC map, valid for as long as the archive is loaded.
+    const char* HashToPath(uint64_t hash) const;
     std::vector<uint32_t> GetGameVersions();
     void PushGameVersion(uint32_t newGameVersion);
 
@@ -52,14 +81,45 @@ class Archive : public std::enable_shared_from_this<Archive> {
     std::map<std::string, HANDLE> mMpqHandles;
     std::vector<std::string> mAddedFiles;
     std::vector<uint32_t> mGameVersions;
-    std::unordered_map<uint64_t, std::string> mHashes;
+    CrcMap mCrcMap;
+    std::unordered_map<uint64_t, std::string> mAddedHashes;
     HANDLE mMainMpq;
     std::mutex mMutex;
+    std::shared_ptr<ArchiveCompressionPolicy> mCompressionPolicy;
+
+    struct IndexedFile {
+        std::string Path;
+        HANDLE MpqHandle;
+    };
+    // Every file visible through the archive chain, keyed by its normalized path. The sorted view serves wildcard
+    // queries by narrowing them to the literal prefix of the mask.
+    std::unordered_map<std::string, IndexedFile> mFileIndex;
+    std::vector<std::pair<std::string_view, const IndexedFile*>> mSortedFileIndex;
+    bool mSortedFileIndexDirty = false;
+    std::mutex mFileIndexMutex;
+
+    // A file's sectors compressed by an AddFiles worker, Sectors points into Data.
+    struct PrecompressedFile {
+        ArchiveCodec Codec;
+        std::vector<char> Data;
+        std::vector<const void*> Sectors;
+        std::vector<DWORD> SectorSizes;
+    };
 
+    static PrecompressedFile Precompress(const ArchiveEntry& entry, ArchiveCodec codec, DWORD sectorSize);
+    bool AddFileToMpq(const std::string& filePath, uintptr_t fileData, DWORD fileSize, ArchiveCodec codec,
+                      const PrecompressedFile* precompressed = nullptr);
     bool LoadMainMPQ(bool enableWriting, bool generateCrcMap);
     bool LoadPatchMPQs();
     bool LoadPatchMPQ(const std::string& otrPath, bool validateVersion = false);
     void GenerateCrcMap();
+    void IndexArchiveFiles(HANDLE mpqHandle);
+    void IndexFile(const std::string& filePath, HANDLE mpqHandle);
+    void UnindexFile(const std::string& filePath);
+    HANDLE FindFileArchive(const std::string& filePath);
+    std::vector<const IndexedFile*> FindIndexedFiles(const std::string& fileSearchMask, size_t limit = SIZE_MAX);
+    static std::string NormalizeIndexPath(const std::string& filePath);
+    uint64_t GetArchiveFingerprint();
     bool ProcessOtrVersion(HANDLE mpqHandle = nullptr);
     std::shared_ptr<File> LoadFileFromHandle(const std::string& filePath, bool includeParent = true,
                                              HANDLE mpqHandle = nullptr);
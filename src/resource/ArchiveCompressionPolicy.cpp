@@ -0,0 +1,198 @@
+#include "ArchiveCompressionPolicy.h"
+#include "File.h"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+
+// NOLINTNEXTLINE
+extern bool SFileCheckWildCard(const char* szString, const char* szWildCard);
+
+// Below this the sector table and codec header eat most of what compression saves.
+#define ARCHIVE_STORE_MAX_SIZE 512
+// Hot resources up to this size are stored so loading them is a plain copy.
+#define ARCHIVE_HOT_STORE_MAX_SIZE (16 * 1024)
+// Matches the default sector size of archives made by Archive::CreateArchive.
+#define ARCHIVE_BENCHMARK_SECTOR_SIZE 0x1000
+#define OTR_HEADER_SIZE 64
+
+namespace LUS {
+ArchiveCompressionPolicy::ArchiveCompressionPolicy(ArchiveCodec defaultCodec) : mDefaultCodec(defaultCodec) {
+}
+
+std::shared_ptr<ArchiveCompressionPolicy> ArchiveCompressionPolicy::CreateDefault() {
+    auto policy = std::make_shared<ArchiveCompressionPolicy>(ArchiveCodec::Zlib);
+    policy->AddRule({ ResourceType::None, "", 0, ARCHIVE_STORE_MAX_SIZE, ArchiveCodec::Store });
+
+    // Parsed every time a scene loads.
+    for (const auto type : { ResourceType::DisplayList, ResourceType::Vertex, ResourceType::Matrix }) {
+        policy->AddRule({ type, "", 0, ARCHIVE_HOT_STORE_MAX_SIZE, ArchiveCodec::Store });
+    }
+
+    // Loaded once in a while and compress well.
+    for (const auto type : { ResourceType::SOH_Cutscene, ResourceType::SOH_Text, ResourceType::SOH_AudioSequence }) {
+        policy->AddRule({ type, "", 0, UINT32_MAX, ArchiveCodec::Lzma });
+    }
+
+    return policy;
+}
+
+void ArchiveCompressionPolicy::AddRule(const ArchiveCompressionRule& rule) {
+    mRules.push_back(rule);
+}
+
+void ArchiveCompressionPolicy::ClearRules() {
+    mRules.clear();
+}
+
+const std::vector<ArchiveCompressionRule>& ArchiveCompressionPolicy::GetRules() const {
+    return mRules;
+}
+
+void ArchiveCompressionPolicy::SetDefaultCodec(ArchiveCodec codec) {
+    mDefaultCodec = codec;
+}
+
+ArchiveCodec ArchiveCompressionPolicy::GetDefaultCodec() const {
+    return mDefaultCodec;
+}
+
+ArchiveCodec ArchiveCompressionPolicy::Select(const std::string& filePath, uintptr_t fileData, DWORD fileSize) const {
+    const ResourceType type = ReadResourceType(fileData, fileSize);
+    for (const auto& rule : mRules) {
+        if (fileSize < rule.MinSize || fileSize > rule.MaxSize) {
+            continue;
+        }
+        if (rule.Type != ResourceType::None && rule.Type != type) {
+            continue;
+        }
+        if (!rule.PathMask.empty() && !SFileCheckWildCard(filePath.c_str(), rule.PathMask.c_str())) {
+            continue;
+        }
+        return rule.Codec;
+    }
+
+    return mDefaultCodec;
+}
+
+DWORD ArchiveCompressionPolicy::GetCompressionMask(ArchiveCodec codec) {
+    switch (codec) {
+        case ArchiveCodec::Zlib:
+            return MPQ_COMPRESSION_ZLIB;
+        case ArchiveCodec::Bzip2:
+            return MPQ_COMPRESSION_BZIP2;
+        case ArchiveCodec::Lzma:
+            return MPQ_COMPRESSION_LZMA;
+        case ArchiveCodec::Store:
+        default:
+            return 0;
+    }
+}
+
+const char* ArchiveCompressionPolicy::GetCodecName(ArchiveCodec codec) {
+    switch (codec) {
+        case ArchiveCodec::Zlib:
+            return "zlib";
+        case ArchiveCodec::Bzip2:
+            return "bzip2";
+        case ArchiveCodec::Lzma:
+            return "lzma";
+        case ArchiveCodec::Store:
+        default:
+            return "store";
+    }
+}
+
+bool ArchiveCompressionPolicy::ParseCodec(const std::string& name, ArchiveCodec* codec) {
+    for (const auto candidate : { ArchiveCodec::Store, ArchiveCodec::Zlib, ArchiveCodec::Bzip2, ArchiveCodec::Lzma }) {
+        if (name == GetCodecName(candidate)) {
+            *codec = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+ResourceType ArchiveCompressionPolicy::ReadResourceType(uintptr_t fileData, DWORD fileSize) {
+    const auto header = reinterpret_cast<const uint8_t*>(fileData);
+    // The first byte is the byte order, 0 for little endian and 1 for big endian.
+    if (header == nullptr || fileSize < OTR_HEADER_SIZE || header[0] > 1) {
+        return ResourceType::None;
+    }
+
+    uint32_t type = 0;
+    for (int i = 0; i < 4; i++) {
+        const int shift = header[0] == 0 ? i * 8 : (3 - i) * 8;
+        type |= static_cast<uint32_t>(header[4 + i]) << shift;
+    }
+    return static_cast<ResourceType>(type);
+}
+
+std::vector<ArchiveCodecStats> ArchiveCompressionPolicy::Benchmark(const std::vector<std::shared_ptr<File>>& files) {
+    std::map<std::pair<ArchiveCodec, ResourceType>, ArchiveCodecStats> stats;
+    std::vector<char> compressed(ARCHIVE_BENCHMARK_SECTOR_SIZE);
+    std::vector<char> decoded(ARCHIVE_BENCHMARK_SECTOR_SIZE);
+
+    for (const auto codec : { ArchiveCodec::Store, ArchiveCodec::Zlib, ArchiveCodec::Bzip2, ArchiveCodec::Lzma }) {
+        const DWORD mask = GetCompressionMask(codec);
+        for (const auto& file : files) {
+            if (file == nullptr || !file->IsLoaded) {
+                continue;
+            }
+
+            const DWORD fileSize = static_cast<DWORD>(file->Buffer.size());
+            const ResourceType type = ReadResourceType((uintptr_t)file->Buffer.data(), fileSize);
+            uint64_t compressedBytes = 0;
+            std::chrono::steady_clock::duration decodeTime(0);
+
+            for (DWORD offset = 0; offset < fileSize; offset += ARCHIVE_BENCHMARK_SECTOR_SIZE) {
+                char* sector = file->Buffer.data() + offset;
+                const int sectorSize =
+                    static_cast<int>(std::min<DWORD>(fileSize - offset, ARCHIVE_BENCHMARK_SECTOR_SIZE));
+                int compressedSize = sectorSize;
+                if (mask == 0 || !SCompCompress(compressed.data(), &compressedSize, sector, sectorSize, mask, 0, 0)) {
+                    compressedSize = sectorSize;
+                }
+                compressedBytes += compressedSize;
+
+                // StormLib keeps sectors that didn't shrink as they are and copies them on read.
+                const auto start = std::chrono::steady_clock::now();
+                if (compressedSize < sectorSize) {
+                    int decodedSize = sectorSize;
+                    SCompDecompress2(decoded.data(), &decodedSize, compressed.data(), compressedSize);
+                } else {
+                    memcpy(decoded.data(), sector, sectorSize);
+                }
+                decodeTime += std::chrono::steady_clock::now() - start;
+            }
+
+            const double decodeSeconds = std::chrono::duration<double>(decodeTime).count();
+            auto add = [&](ResourceType key) {
+                auto& entry = stats.try_emplace({ codec, key }, ArchiveCodecStats{ codec, key, 0, 0, 0, 0.0 })
+                                  .first->second;
+                entry.Files++;
+                entry.RawBytes += fileSize;
+                entry.CompressedBytes += compressedBytes;
+                entry.DecodeSeconds += decodeSeconds;
+            };
+            add(ResourceType::None);
+            if (type != ResourceType::None) {
+                add(type);
+            }
+        }
+    }
+
+    std::vector<ArchiveCodecStats> result;
+    result.reserve(stats.size());
+    for (const auto& [key, entry] : stats) {
+        const double ratio = entry.RawBytes != 0 ? (double)entry.CompressedBytes / entry.RawBytes : 1.0;
+        SPDLOG_INFO("Codec {} type {:08X}: {} files, {} -> {} bytes ({:.1f}%), decode {:.2f} ms",
+                    GetCodecName(key.first), (uint32_t)key.second, entry.Files, entry.RawBytes, entry.CompressedBytes,
+                    ratio * 100.0, entry.DecodeSeconds * 1000.0);
+        result.push_back(entry);
+    }
+    return result;
+}
+} // namespace LUS
@@ -0,0 +1,66 @@
+#pragma once
+
+#undef _DLL
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <StormLib.h>
+#include "ResourceType.h"
+
+namespace LUS {
+struct File;
+
+enum class ArchiveCodec { Store, Zlib, Bzip2, Lzma };
+
+struct ArchiveCompressionRule {
+    // None matches every file, including ones without an OTR header.
+    ResourceType Type = ResourceType::None;
+    // StormLib wildcard, empty matches every path.
+    std::string PathMask;
+    DWORD MinSize = 0;
+    DWORD MaxSize = UINT32_MAX;
+    ArchiveCodec Codec = ArchiveCodec::Zlib;
+};
+
+struct ArchiveCodecStats {
+    ArchiveCodec Codec;
+    ResourceType Type;
+    size_t Files;
+    uint64_t RawBytes;
+    uint64_t CompressedBytes;
+    double DecodeSeconds;
+};
+
+// Picks the codec a file is written with when it is added to an archive. Rules are checked in the order they were
+// added and the first match wins, files matching no rule use the default codec.
+class ArchiveCompressionPolicy {
+  public:
+    ArchiveCompressionPolicy(ArchiveCodec defaultCodec = ArchiveCodec::Zlib);
+
+    // Tiny files and hot runtime data are stored, cold bulk data uses LZMA and everything else zlib.
+    static std::shared_ptr<ArchiveCompressionPolicy> CreateDefault();
+
+    void AddRule(const ArchiveCompressionRule& rule);
+    void ClearRules();
+    const std::vector<ArchiveCompressionRule>& GetRules() const;
+    void SetDefaultCodec(ArchiveCodec codec);
+    ArchiveCodec GetDefaultCodec() const;
+    ArchiveCodec Select(const std::string& filePath, uintptr_t fileData, DWORD fileSize) const;
+
+    static DWORD GetCompressionMask(ArchiveCodec codec);
+    static const char* GetCodecName(ArchiveCodec codec);
+    static bool ParseCodec(const std::string& name, ArchiveCodec* codec);
+    // Reads the type from the OTR header, None when the buffer doesn't start with one.
+    static ResourceType ReadResourceType(uintptr_t fileData, DWORD fileSize);
+
+    // Compresses every file sector by sector with each codec and times decoding it back the way the archive reads it.
+    // Returns one entry per codec and resource type, plus per codec totals with the type set to None.
+    static std::vector<ArchiveCodecStats> Benchmark(const std::vector<std::shared_ptr<File>>& files);
+
+  private:
+    std::vector<ArchiveCompressionRule> mRules;
+    ArchiveCodec mDefaultCodec;
+};
+} // namespace LUS
@@ -0,0 +1,334 @@
+#define NOMINMAX
+
+#include "CrcMap.h"
+#include <StrHash64.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)
+#define CRC_MAP_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CRC_MAP_MAGIC 0x4D43524C // "LRCM"
+#define CRC_MAP_VERSION 1
+#define CRC_MAP_MIN_BUCKET_BITS 4
+#define CRC_MAP_MAX_BUCKET_BITS 24
+
+namespace LUS {
+namespace {
+size_t AlignTo8(size_t value) {
+    return (value + 7) & ~static_cast<size_t>(7);
+}
+
+size_t BucketsOffset() {
+    return AlignTo8(sizeof(uint32_t) * 8);
+}
+
+size_t EntriesOffset(uint32_t bucketBits) {
+    return AlignTo8(BucketsOffset() + ((static_cast<size_t>(1) << bucketBits) + 1) * sizeof(uint32_t));
+}
+
+size_t ArenaOffset(uint32_t bucketBits, uint32_t entryCount) {
+    return EntriesOffset(bucketBits) + static_cast<size_t>(entryCount) * sizeof(uint64_t) * 2;
+}
+} // namespace
+
+CrcMap::CrcMap()
+    : mData(nullptr), mSize(0), mMapping(nullptr), mMappingHandle(nullptr), mHeader(nullptr), mBuckets(nullptr),
+      mEntries(nullptr), mArena(nullptr) {
+    static_assert(sizeof(Header) == sizeof(uint32_t) * 8);
+    static_assert(sizeof(Entry) == sizeof(uint64_t) * 2);
+}
+
+CrcMap::~CrcMap() {
+    Clear();
+}
+
+void CrcMap::Build(const std::vector<std::string_view>& paths, uint64_t fingerprint) {
+    Clear();
+
+    std::vector<std::pair<uint64_t, std::string_view>> sorted;
+    sorted.reserve(paths.size());
+    for (const auto& path : paths) {
+        // Not NULL terminated str
+        sorted.emplace_back(~crc64(path.data(), path.length()), path);
+    }
+
+    // Stable so the first listed path wins when the same file appears in several list files.
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    sorted.erase(std::unique(sorted.begin(), sorted.end(),
+                             [](const auto& a, const auto& b) { return a.first == b.first; }),
+                 sorted.end());
+
+    const uint32_t entryCount = static_cast<uint32_t>(sorted.size());
+    uint32_t bucketBits = CRC_MAP_MIN_BUCKET_BITS;
+    while (bucketBits < CRC_MAP_MAX_BUCKET_BITS && (1u << bucketBits) < entryCount) {
+        bucketBits++;
+    }
+
+    size_t arenaSize = 0;
+    for (const auto& [hash, path] : sorted) {
+        arenaSize += path.length() + 1;
+    }
+
+    const size_t arenaOffset = ArenaOffset(bucketBits, entryCount);
+    mOwnedData.assign(arenaOffset + arenaSize, 0);
+
+    Header header = {};
+    header.Magic = CRC_MAP_MAGIC;
+    header.Version = CRC_MAP_VERSION;
+    header.Fingerprint = fingerprint;
+    header.EntryCount = entryCount;
+    header.BucketBits = bucketBits;
+    header.ArenaSize = static_cast<uint32_t>(arenaSize);
+    memcpy(mOwnedData.data(), &header, sizeof(Header));
+
+    auto buckets = reinterpret_cast<uint32_t*>(mOwnedData.data() + BucketsOffset());
+    auto entries = reinterpret_cast<Entry*>(mOwnedData.data() + EntriesOffset(bucketBits));
+    auto arena = reinterpret_cast<char*>(mOwnedData.data() + arenaOffset);
+
+    const uint32_t bucketCount = 1u << bucketBits;
+    uint32_t offset = 0;
+    uint32_t bucket = 0;
+    for (uint32_t i = 0; i < entryCount; i++) {
+        const auto& [hash, path] = sorted[i];
+        const uint32_t entryBucket = static_cast<uint32_t>(hash >> (64 - bucketBits));
+        while (bucket <= entryBucket) {
+            buckets[bucket++] = i;
+        }
+
+        entries[i] = { hash, offset, static_cast<uint32_t>(path.length()) };
+        memcpy(arena + offset, path.data(), path.length());
+        offset += static_cast<uint32_t>(path.length()) + 1;
+    }
+    while (bucket <= bucketCount) {
+        buckets[bucket++] = entryCount;
+    }
+
+    Attach(mOwnedData.data(), mOwnedData.size(), fingerprint);
+}
+
+bool CrcMap::Load(const std::string& filePath, uint64_t fingerprint) {
+    Clear();
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(Header)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) {
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    mMapping = view;
+    mMappingHandle = mapping;
+    mSize = static_cast<size_t>(fileSize.QuadPart);
+#elif defined(CRC_MAP_USE_MMAP)
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+
+    mMapping = view;
+    mSize = static_cast<size_t>(fileStat.st_size);
+#else
+    // No memory mapping on this platform, read the map in one go instead.
+    std::ifstream file(filePath, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+
+    const std::streamoff fileSize = file.tellg();
+    if (fileSize < (std::streamoff)sizeof(Header)) {
+        return false;
+    }
+
+    mOwnedData.resize(static_cast<size_t>(fileSize));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(mOwnedData.data()), fileSize)) {
+        mOwnedData.clear();
+        return false;
+    }
+#endif
+
+    const uint8_t* data = mMapping != nullptr ? static_cast<const uint8_t*>(mMapping) : mOwnedData.data();
+    const size_t size = mMapping != nullptr ? mSize : mOwnedData.size();
+    if (!Attach(data, size, fingerprint)) {
+        Clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool CrcMap::Save(const std::string& filePath) const {
+    if (mHeader == nullptr) {
+        return false;
+    }
+
+    // Write next to the target and swap it in, so a concurrent reader never maps a partial file.
+    const std::string tempPath = filePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(mData), mSize);
+        if (!file) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, filePath, error);
+    if (error) {
+        SPDLOG_WARN("Failed to replace CRC map {}: {}", filePath, error.message());
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+
+    return true;
+}
+
+void CrcMap::Clear() {
+    Unmap();
+    mOwnedData.clear();
+    mOwnedData.shrink_to_fit();
+    mData = nullptr;
+    mSize = 0;
+    mHeader = nullptr;
+    mBuckets = nullptr;
+    mEntries = nullptr;
+    mArena = nullptr;
+}
+
+const char* CrcMap::Find(uint64_t hash) const {
+    if (mHeader == nullptr) {
+        return nullptr;
+    }
+
+    // Attach only checks the table bounds, the bucket range and entry are validated here as they are used.
+    const uint32_t bucket = static_cast<uint32_t>(hash >> (64 - mHeader->BucketBits));
+    const uint32_t end = std::min(mBuckets[bucket + 1], mHeader->EntryCount);
+    for (uint32_t i = mBuckets[bucket]; i < end; i++) {
+        const Entry& entry = mEntries[i];
+        if (entry.Hash == hash) {
+            if (static_cast<uint64_t>(entry.Offset) + entry.Length >= mHeader->ArenaSize ||
+                mArena[entry.Offset + entry.Length] != '\0') {
+                SPDLOG_WARN("Corrupt CRC map entry for {:016X}", hash);
+                return nullptr;
+            }
+            return mArena + entry.Offset;
+        }
+        if (entry.Hash > hash) {
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+size_t CrcMap::GetCount() const {
+    return mHeader != nullptr ? mHeader->EntryCount : 0;
+}
+
+size_t CrcMap::GetMemoryUsage() const {
+    return mSize;
+}
+
+bool CrcMap::IsMapped() const {
+    return mMapping != nullptr;
+}
+
+bool CrcMap::Attach(const uint8_t* data, size_t size, uint64_t fingerprint) {
+    if (data == nullptr || size < sizeof(Header)) {
+        return false;
+    }
+
+    const auto header = reinterpret_cast<const Header*>(data);
+    if (header->Magic != CRC_MAP_MAGIC || header->Version != CRC_MAP_VERSION || header->Fingerprint != fingerprint) {
+        return false;
+    }
+    if (header->BucketBits < CRC_MAP_MIN_BUCKET_BITS || header->BucketBits > CRC_MAP_MAX_BUCKET_BITS) {
+        return false;
+    }
+
+    const size_t arenaOffset = ArenaOffset(header->BucketBits, header->EntryCount);
+    if (arenaOffset + header->ArenaSize != size) {
+        return false;
+    }
+
+    const auto buckets = reinterpret_cast<const uint32_t*>(data + BucketsOffset());
+    const auto entries = reinterpret_cast<const Entry*>(data + EntriesOffset(header->BucketBits));
+    const auto arena = reinterpret_cast<const char*>(data + arenaOffset);
+
+    // Walking every bucket and entry here would page in the whole file on startup. Find checks what it reads.
+    if (buckets[1u << header->BucketBits] != header->EntryCount) {
+        return false;
+    }
+    if (header->EntryCount > 0 && (header->ArenaSize == 0 || arena[header->ArenaSize - 1] != '\0')) {
+        return false;
+    }
+
+    mData = data;
+    mSize = size;
+    mHeader = header;
+    mBuckets = buckets;
+    mEntries = entries;
+    mArena = arena;
+    return true;
+}
+
+void CrcMap::Unmap() {
+    if (mMapping == nullptr) {
+        return;
+    }
+
+#if defined(_WIN32)
+    UnmapViewOfFile(mMapping);
+    CloseHandle(static_cast<HANDLE>(mMappingHandle));
+#elif defined(CRC_MAP_USE_MMAP)
+    munmap(mMapping, mSize);
+#endif
+
+    mMapping = nullptr;
+    mMappingHandle = nullptr;
+}
+} // namespace LUS
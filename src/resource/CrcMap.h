@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace LUS {
+
+// Immutable CRC64 -> path lookup table. All paths live in a single NUL terminated string arena next to a hash sorted
+// entry table, so the map can be written to disk as-is and memory mapped on the next startup.
+class CrcMap {
+  public:
+    CrcMap();
+    ~CrcMap();
+    CrcMap(const CrcMap&) = delete;
+    CrcMap& operator=(const CrcMap&) = delete;
+
+    void Build(const std::vector<std::string_view>& paths, uint64_t fingerprint);
+    bool Load(const std::string& filePath, uint64_t fingerprint);
+    bool Save(const std::string& filePath) const;
+    void Clear();
+
+    const char* Find(uint64_t hash) const;
+    size_t GetCount() const;
+    size_t GetMemoryUsage() const;
+    bool IsMapped() const;
+
+  private:
+    struct Header {
+        uint32_t Magic;
+        uint32_t Version;
+        uint64_t Fingerprint;
+        uint32_t EntryCount;
+        uint32_t BucketBits;
+        uint32_t ArenaSize;
+        uint32_t Reserved;
+    };
+
+    struct Entry {
+        uint64_t Hash;
+        uint32_t Offset;
+        uint32_t Length;
+    };
+
+    bool Attach(const uint8_t* data, size_t size, uint64_t fingerprint);
+    void Unmap();
+
+    std::vector<uint8_t> mOwnedData;
+    const uint8_t* mData;
+    size_t mSize;
+    void* mMapping;
+    void* mMappingHandle;
+
+    const Header* mHeader;
+    const uint32_t* mBuckets;
+    const Entry* mEntries;
+    const char* mArena;
+};
+} // namespace LUS
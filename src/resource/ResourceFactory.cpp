@@ -19,4 +19,8 @@ std::shared_ptr<IResource> ResourceFactory::ReadResourceXML(std::shared_ptr<Reso
                                                             tinyxml2::XMLElement* reader) {
     return nullptr;
 }
+
+bool ResourceFactory::WriteResource(std::shared_ptr<IResource> resource, std::shared_ptr<BinaryWriter> writer) {
+    return false;
+}
 } // namespace LUS
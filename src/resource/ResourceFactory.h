@@ -13,6 +13,9 @@ class ResourceFactory {
                                                     std::shared_ptr<BinaryReader> reader) = 0;
     virtual std::shared_ptr<IResource> ReadResourceXML(std::shared_ptr<ResourceInitData> initData,
                                                        tinyxml2::XMLElement* reader);
+    // Writes the resource body in the form ReadResource parses, used to cache resources loaded from XML. Returns false
+    // when the factory can't, in which case the XML is parsed on every load.
+    virtual bool WriteResource(std::shared_ptr<IResource> resource, std::shared_ptr<BinaryWriter> writer);
 };
 
 class ResourceVersionFactory {
@@ -12,9 +12,29 @@
 #include "factory/BlobFactory.h"
 #include "factory/DisplayListFactory.h"
 #include "factory/MatrixFactory.h"
+#include "log/LogRateLimiter.h"
+#include "Utils/StringHelper.h"
+#include <StrHash64.h>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#define COMPILED_RESOURCE_MAGIC 0x5352434C // "LCRS"
+// Bump when a factory changes what it writes, so stale compiled resources are rebuilt.
+#define COMPILED_RESOURCE_VERSION 1
+#define OTR_HEADER_SIZE 64
 
 namespace LUS {
+namespace {
+struct CompiledResourceHeader {
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t ContentHash;
+};
+} // namespace
+
 ResourceLoader::ResourceLoader() {
+    mCompiledCacheFolder = Context::GetPathRelativeToAppDirectory("cache/resources");
     RegisterGlobalResourceFactories();
 }
 
@@ -64,6 +84,12 @@ std::shared_ptr<IResource> ResourceLoader::LoadResource(std::shared_ptr<File> fi
         // If first byte is '<' then we are loading XML, else we are loading OTR binary.
         if (firstByte == '<') {
             // XML
+            const uint64_t contentHash = crc64(fileToLoad->Buffer.data(), (uint32_t)fileToLoad->Buffer.size());
+            result = LoadCompiledResource(fileToLoad->Path, contentHash);
+            if (result != nullptr) {
+                return result;
+            }
+
             resourceInitData->IsCustom = true;
             reader->Seek(-1, SeekOffsetType::Current);
 
@@ -85,46 +111,144 @@ std::shared_ptr<IResource> ResourceLoader::LoadResource(std::shared_ptr<File> fi
             if (factory != nullptr) {
                 result = factory->ReadResourceXML(resourceInitData, root);
             }
-        } else {
-            // OTR HEADER BEGIN
-            // Byte Order
-            resourceInitData->ByteOrder = (Endianness)firstByte;
-            reader->SetEndianness(resourceInitData->ByteOrder);
-            // Is this asset custom?
-            resourceInitData->IsCustom = (bool)reader->ReadInt8();
-            // Unused two bytes
-            for (int i = 0; i < 2; i++) {
-                reader->ReadInt8();
-            }
-            // The type of the resource
-            resourceInitData->Type = (ResourceType)reader->ReadUInt32();
-            // Resource version
-            resourceInitData->ResourceVersion = reader->ReadUInt32();
-            // Unique asset ID
-            resourceInitData->Id = reader->ReadUInt64();
-            // ????
-            reader->ReadUInt32();
-            // ROM CRC
-            reader->ReadUInt64();
-            // ROM Enum
-            reader->ReadUInt32();
-            // Reserved for future file format versions...
-            reader->Seek(64, SeekOffsetType::Start);
-            // OTR HEADER END
-
-            auto factory = mFactories[resourceInitData->Type];
 
-            if (factory != nullptr) {
-                result = factory->ReadResource(resourceInitData, reader);
+            if (result != nullptr) {
+                SaveCompiledResource(result, contentHash);
             }
+        } else {
+            result = ReadResourceBinary(resourceInitData, reader, firstByte);
         }
 
         if (result == nullptr) {
-            SPDLOG_ERROR("Failed to load resource of type {} \"{}\"", (uint32_t)resourceInitData->Type,
-                         resourceInitData->Path);
+            LUS_LOG_RATE_LIMITED(SPDLOG_ERROR, "Failed to load resource of type {} \"{}\"",
+                                 (uint32_t)resourceInitData->Type, resourceInitData->Path);
         }
     }
 
     return result;
 }
+
+std::shared_ptr<IResource> ResourceLoader::ReadResourceBinary(std::shared_ptr<ResourceInitData> initData,
+                                                              std::shared_ptr<BinaryReader> reader,
+                                                              uint8_t byteOrder) {
+    // OTR HEADER BEGIN
+    // Byte Order
+    initData->ByteOrder = (Endianness)byteOrder;
+    reader->SetEndianness(initData->ByteOrder);
+    // Is this asset custom?
+    initData->IsCustom = (bool)reader->ReadInt8();
+    // Unused two bytes
+    for (int i = 0; i < 2; i++) {
+        reader->ReadInt8();
+    }
+    // The type of the resource
+    initData->Type = (ResourceType)reader->ReadUInt32();
+    // Resource version
+    initData->ResourceVersion = reader->ReadUInt32();
+    // Unique asset ID
+    initData->Id = reader->ReadUInt64();
+    // ????
+    reader->ReadUInt32();
+    // ROM CRC
+    reader->ReadUInt64();
+    // ROM Enum
+    reader->ReadUInt32();
+    // Reserved for future file format versions...
+    reader->Seek(OTR_HEADER_SIZE, SeekOffsetType::Start);
+    // OTR HEADER END
+
+    auto factory = mFactories[initData->Type];
+
+    if (factory == nullptr) {
+        return nullptr;
+    }
+
+    return factory->ReadResource(initData, reader);
+}
+
+std::string ResourceLoader::GetCompiledResourcePath(const std::string& path) {
+    return StringHelper::Sprintf("%s/%016llX.res", mCompiledCacheFolder.c_str(),
+                                 (unsigned long long)crc64(path.data(), (uint32_t)path.size()));
+}
+
+std::shared_ptr<IResource> ResourceLoader::LoadCompiledResource(const std::string& path, uint64_t contentHash) {
+    std::ifstream file(GetCompiledResourcePath(path), std::ios::in | std::ios::binary);
+    if (!file) {
+        return nullptr;
+    }
+
+    CompiledResourceHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.Magic != COMPILED_RESOURCE_MAGIC ||
+        header.Version != COMPILED_RESOURCE_VERSION || header.ContentHash != contentHash) {
+        return nullptr;
+    }
+
+    std::vector<char> buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (buffer.size() <= OTR_HEADER_SIZE) {
+        return nullptr;
+    }
+
+    auto stream = std::make_shared<MemoryStream>(buffer.data(), buffer.size());
+    auto reader = std::make_shared<BinaryReader>(stream);
+    auto initData = std::make_shared<ResourceInitData>();
+    initData->Path = path;
+    const uint8_t byteOrder = reader->ReadInt8();
+    auto resource = ReadResourceBinary(initData, reader, byteOrder);
+    if (resource != nullptr) {
+        SPDLOG_TRACE("Loaded compiled resource for {}", path);
+    }
+    return resource;
+}
+
+void ResourceLoader::SaveCompiledResource(std::shared_ptr<IResource> resource, uint64_t contentHash) {
+    auto initData = resource->GetInitData();
+    auto factory = mFactories[initData->Type];
+    if (factory == nullptr) {
+        return;
+    }
+
+    auto writer = std::make_shared<BinaryWriter>();
+    // Same layout ReadResourceBinary reads back.
+    writer->Write((uint8_t)Endianness::Native);
+    writer->Write((uint8_t)initData->IsCustom);
+    writer->Write((uint8_t)0);
+    writer->Write((uint8_t)0);
+    writer->Write((uint32_t)initData->Type);
+    writer->Write((uint32_t)initData->ResourceVersion);
+    writer->Write((uint64_t)initData->Id);
+    writer->Write((uint32_t)0);
+    writer->Write((uint64_t)0);
+    writer->Write((uint32_t)0);
+    while (writer->GetBaseAddress() < OTR_HEADER_SIZE) {
+        writer->Write((uint8_t)0);
+    }
+    if (!factory->WriteResource(resource, writer)) {
+        return;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(mCompiledCacheFolder, error);
+
+    // Resources load on several threads, so the temporary file is per thread.
+    const std::string compiledPath = GetCompiledResourcePath(initData->Path);
+    const std::string tempPath =
+        compiledPath + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        const CompiledResourceHeader header = { COMPILED_RESOURCE_MAGIC, COMPILED_RESOURCE_VERSION, contentHash };
+        const std::vector<char> body = writer->ToVector();
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(body.data(), body.size());
+        if (!file) {
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(tempPath, compiledPath, error);
+    if (error) {
+        SPDLOG_WARN("Failed to cache compiled resource {}: {}", initData->Path, error.message());
+        std::filesystem::remove(tempPath, error);
+    }
+}
 } // namespace LUS
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include "ResourceType.h"
 #include "ResourceFactory.h"
@@ -21,9 +22,17 @@ class ResourceLoader {
   protected:
     void RegisterGlobalResourceFactories();
 
+    std::shared_ptr<IResource> ReadResourceBinary(std::shared_ptr<ResourceInitData> initData,
+                                                  std::shared_ptr<BinaryReader> reader, uint8_t byteOrder);
+    // Custom assets authored as XML are converted to the binary form on first load and read from there afterwards.
+    std::shared_ptr<IResource> LoadCompiledResource(const std::string& path, uint64_t contentHash);
+    void SaveCompiledResource(std::shared_ptr<IResource> resource, uint64_t contentHash);
+    std::string GetCompiledResourcePath(const std::string& path);
+
   private:
     std::unordered_map<ResourceType, std::shared_ptr<ResourceFactory>> mFactories;
     std::unordered_map<std::string, std::shared_ptr<ResourceFactory>> mFactoriesStr;
     std::unordered_map<std::string, ResourceType> mFactoriesTypes;
+    std::string mCompiledCacheFolder;
 };
 } // namespace LUS
@@ -2,17 +2,30 @@
 #include <spdlog/spdlog.h>
 #include "File.h"
 #include "Archive.h"
+#include "resource/type/DisplayList.h"
 #include <algorithm>
 #include <thread>
 #include <Utils/StringHelper.h>
 #include "public/bridge/consolevariablebridge.h"
 #include "Context.h"
+#include "debug/Profiler.h"
+#include "log/LogRateLimiter.h"
 
 // Comes from stormlib. May not be the most efficient, but it's also important to be consistent.
 // NOLINTNEXTLINE
 extern bool SFileCheckWildCard(const char* szString, const char* szWildCard);
 
 namespace LUS {
+namespace {
+// Builds "alt/<filePath>" in a per-thread buffer, so looking up alternate assets doesn't allocate once the buffer has
+// grown. The view is only valid until the next call on the same thread.
+std::string_view AltAssetPath(std::string_view filePath) {
+    thread_local std::string altPath;
+    altPath.assign(IResource::gAltAssetPrefix);
+    altPath.append(filePath);
+    return altPath;
+}
+} // namespace
 
 ResourceManager::ResourceManager(const std::string& mainPath, const std::string& patchesPath,
                                  const std::unordered_set<uint32_t>& validHashes, int32_t reservedThreadCount) {
@@ -68,18 +81,16 @@ std::shared_ptr<File> ResourceManager::LoadFileProcess(const std::string& filePa
     return file;
 }
 
-std::shared_ptr<IResource> ResourceManager::LoadResourceProcess(const std::string& filePath, bool loadExact) {
+std::shared_ptr<IResource> ResourceManager::LoadResourceProcess(std::string_view filePathView, bool loadExact) {
     // Check for and remove the OTR signature
-    if (OtrSignatureCheck(filePath.c_str())) {
-        const auto newFilePath = filePath.substr(7);
-        return LoadResourceProcess(newFilePath);
+    if (OtrSignatureCheck(filePathView)) {
+        return LoadResourceProcess(filePathView.substr(7));
     }
 
     // Attempt to load the alternate version of the asset, if we fail then we continue trying to load the standard
     // asset.
-    if (!loadExact && CVarGetInteger("gAltAssets", 0) && !filePath.starts_with(IResource::gAltAssetPrefix)) {
-        const auto altPath = IResource::gAltAssetPrefix + filePath;
-        auto altResource = LoadResourceProcess(altPath, loadExact);
+    if (!loadExact && CVarGetInteger("gAltAssets", 0) && !filePathView.starts_with(IResource::gAltAssetPrefix)) {
+        auto altResource = LoadResourceProcess(AltAssetPath(filePathView), loadExact);
 
         if (altResource != nullptr) {
             return altResource;
@@ -88,12 +99,18 @@ std::shared_ptr<IResource> ResourceManager::LoadResourceProcess(const std::strin
 
     // While waiting in the queue, another thread could have loaded the resource.
     // In a last attempt to avoid doing work that will be discarded, let's check if the cached version exists.
-    auto cacheLine = CheckCache(filePath, loadExact);
+    // Cache hits are the common case when called from the renderer, so they stay allocation free.
+    auto cacheLine = CheckCache(filePathView, loadExact);
     auto cachedResource = GetCachedResource(cacheLine);
     if (cachedResource != nullptr) {
         return cachedResource;
     }
 
+    LUS_PROFILE_SCOPE("Load Resource");
+
+    // Loading may look up other paths and reuse the alternate path buffer, so own the path from here on.
+    const std::string filePath(filePathView);
+
     // Check for resource load errors which can indicate an alternate asset.
     // If we are attempting to load an alternate asset, we can return null
     if (!loadExact && CVarGetInteger("gAltAssets", 0) && filePath.starts_with(IResource::gAltAssetPrefix)) {
@@ -119,6 +136,7 @@ std::shared_ptr<IResource> ResourceManager::LoadResourceProcess(const std::strin
 
     // Transform the raw data into a resource
     auto resource = GetResourceLoader()->LoadResource(file);
+    auto dependencies = ReadDependencies(resource);
 
     // Another thread could have loaded the resource while we were processing, so we want to check before setting to
     // the cache.
@@ -135,8 +153,14 @@ std::shared_ptr<IResource> ResourceManager::LoadResourceProcess(const std::strin
         // Set the cache to the loaded resource
         if (resource != nullptr) {
             mResourceCache[filePath] = resource;
+            if (!dependencies.empty()) {
+                mDependencies[filePath] = std::move(dependencies);
+            } else {
+                mDependencies.erase(filePath);
+            }
         } else {
             mResourceCache[filePath] = ResourceLoadError::NotFound;
+            mDependencies.erase(filePath);
         }
     }
 
@@ -163,10 +187,17 @@ std::shared_ptr<File> ResourceManager::LoadFile(const std::string& filePath) {
 
 std::shared_future<std::shared_ptr<IResource>> ResourceManager::LoadResourceAsync(const std::string& filePath,
                                                                                   bool loadExact, bool priority) {
+    return LoadResourceAsync(filePath, loadExact,
+                             priority ? ResourceLoadPriority::High : ResourceLoadPriority::Normal);
+}
+
+std::shared_future<std::shared_ptr<IResource>>
+ResourceManager::LoadResourceAsync(const std::string& filePath, bool loadExact, ResourceLoadPriority priority,
+                                   std::shared_ptr<ResourceLoadToken> token) {
     // Check for and remove the OTR signature
     if (OtrSignatureCheck(filePath.c_str())) {
         auto newFilePath = filePath.substr(7);
-        return LoadResourceAsync(newFilePath, loadExact, priority);
+        return LoadResourceAsync(newFilePath, loadExact, priority, token);
     }
 
     // Check the cache before queueing the job.
@@ -177,28 +208,276 @@ std::shared_future<std::shared_ptr<IResource>> ResourceManager::LoadResourceAsyn
         return promise->get_future().share();
     }
 
-    const auto newFilePath = std::string(filePath);
+    return RequestLoad(filePath, loadExact, priority, token, 0);
+}
+
+std::shared_future<std::shared_ptr<IResource>>
+ResourceManager::RequestLoad(const std::string& filePath, bool loadExact, ResourceLoadPriority priority,
+                             std::shared_ptr<ResourceLoadToken> token, int32_t prefetchDepth) {
+    // Takes mMutex through the cache lookup below, nothing may take mLoadRequestMutex while holding mMutex.
+    const std::lock_guard<std::mutex> lock(mLoadRequestMutex);
+
+    // If someone already asked for this resource, wait on their load instead of decoding it a second time.
+    auto requestFind = mLoadRequests.find(filePath);
+    if (requestFind != mLoadRequests.end() && requestFind->second->LoadExact == loadExact) {
+        auto request = requestFind->second;
+        request->Cancelled = false;
+        if (token == nullptr) {
+            request->Pinned = true;
+        } else {
+            request->Tokens.push_back(token);
+        }
 
-    if (priority) {
-        return mThreadPool->submit_front(&ResourceManager::LoadResourceProcess, this, newFilePath, loadExact);
+        if (prefetchDepth > request->PrefetchDepth) {
+            request->PrefetchDepth = prefetchDepth;
+            request->PrefetchToken = token;
+        }
+
+        if (!request->Started && priority > request->Priority) {
+            // Queue it again at the new priority, the stale entry is skipped when it is dequeued.
+            request->Priority = priority;
+            QueueLoadRequest(request);
+        }
+
+        return request->Future;
+    }
+
+    // The caller checked the cache before taking the lock, a load that finished since then has already removed its
+    // request. Look again so the resource isn't decoded twice.
+    auto cachedResource = GetCachedResource(filePath, loadExact);
+    if (cachedResource != nullptr) {
+        std::promise<std::shared_ptr<IResource>> promise;
+        promise.set_value(cachedResource);
+        return promise.get_future().share();
+    }
+
+    auto request = std::make_shared<ResourceLoadRequest>();
+    request->Path = filePath;
+    request->LoadExact = loadExact;
+    request->Priority = priority;
+    request->Pinned = token == nullptr;
+    if (token != nullptr) {
+        request->Tokens.push_back(token);
+    }
+    request->PrefetchDepth = prefetchDepth;
+    request->PrefetchToken = token;
+    request->Future = request->Promise.get_future().share();
+
+    // A request for the same path with a different loadExact is rare enough that it simply isn't shared.
+    if (requestFind == mLoadRequests.end()) {
+        mLoadRequests[filePath] = request;
+    }
+
+    QueueLoadRequest(request);
+    return request->Future;
+}
+
+void ResourceManager::QueueLoadRequest(std::shared_ptr<ResourceLoadRequest> request) {
+    // Must be called with mLoadRequestMutex held.
+    mLoadQueues[static_cast<size_t>(request->Priority)].push_back(request);
+
+    // Each job picks up the most important request that is waiting when it runs, not necessarily this one.
+    if (request->Priority == ResourceLoadPriority::Immediate) {
+        mThreadPool->push_task_front(&ResourceManager::RunNextLoadRequest, this);
     } else {
-        return mThreadPool->submit_back(&ResourceManager::LoadResourceProcess, this, newFilePath, loadExact);
+        mThreadPool->push_task_back(&ResourceManager::RunNextLoadRequest, this);
+    }
+}
+
+bool ResourceManager::IsLoadRequestCancelled(const std::shared_ptr<ResourceLoadRequest>& request) {
+    // Must be called with mLoadRequestMutex held.
+    if (request->Pinned) {
+        return false;
+    }
+
+    if (request->Cancelled) {
+        return true;
     }
+
+    return std::all_of(request->Tokens.begin(), request->Tokens.end(),
+                       [](const std::shared_ptr<ResourceLoadToken>& token) { return token->IsCancelled(); });
 }
 
-std::shared_ptr<IResource> ResourceManager::LoadResource(const std::string& filePath, bool loadExact) {
-    auto resource = LoadResourceAsync(filePath, loadExact, true).get();
+void ResourceManager::RunNextLoadRequest() {
+    std::shared_ptr<ResourceLoadRequest> request = nullptr;
+    bool cancelled = false;
+    {
+        const std::lock_guard<std::mutex> lock(mLoadRequestMutex);
+
+        for (size_t i = mLoadQueues.size(); i > 0 && request == nullptr; i--) {
+            auto& queue = mLoadQueues[i - 1];
+            while (!queue.empty()) {
+                auto candidate = queue.front();
+                queue.pop_front();
+
+                // Skip entries that were already picked up from another queue after a priority change.
+                if (candidate->Started || static_cast<size_t>(candidate->Priority) != i - 1) {
+                    continue;
+                }
+
+                request = candidate;
+                break;
+            }
+        }
+
+        if (request == nullptr) {
+            return;
+        }
+
+        request->Started = true;
+        cancelled = IsLoadRequestCancelled(request);
+        if (cancelled) {
+            auto requestFind = mLoadRequests.find(request->Path);
+            if (requestFind != mLoadRequests.end() && requestFind->second == request) {
+                mLoadRequests.erase(requestFind);
+            }
+        }
+    }
+
+    if (cancelled) {
+        SPDLOG_TRACE("Skipped cancelled load of {} on ResourceManager", request->Path);
+        request->Promise.set_value(nullptr);
+        return;
+    }
+
+    std::shared_ptr<IResource> resource = nullptr;
+    std::exception_ptr exception = nullptr;
+    try {
+        resource = LoadResourceProcess(request->Path, request->LoadExact);
+    } catch (...) {
+        exception = std::current_exception();
+    }
+
+    // Remove the request before resolving it. The resource is already in the cache, so anyone asking from now on gets
+    // it from there.
+    int32_t prefetchDepth = 0;
+    std::shared_ptr<ResourceLoadToken> prefetchToken = nullptr;
+    {
+        const std::lock_guard<std::mutex> lock(mLoadRequestMutex);
+        auto requestFind = mLoadRequests.find(request->Path);
+        if (requestFind != mLoadRequests.end() && requestFind->second == request) {
+            mLoadRequests.erase(requestFind);
+        }
+        prefetchDepth = request->PrefetchDepth;
+        prefetchToken = request->PrefetchToken;
+    }
+
+    if (exception != nullptr) {
+        request->Promise.set_exception(exception);
+        return;
+    }
+
+    request->Promise.set_value(resource);
+
+    if (resource != nullptr && prefetchDepth > 0) {
+        std::unordered_set<std::string> visited = { request->Path };
+        for (const auto& dependency : ReadDependencies(resource)) {
+            QueuePrefetch(dependency, prefetchDepth - 1, prefetchToken, visited);
+        }
+    }
+}
+
+std::vector<std::string> ResourceManager::ReadDependencies(std::shared_ptr<IResource> resource) {
+    std::vector<std::string> dependencies;
+    if (resource == nullptr || resource->GetInitData()->Type != ResourceType::DisplayList) {
+        return dependencies;
+    }
+
+    auto displayList = std::static_pointer_cast<DisplayList>(resource);
+    std::unordered_set<std::string> seen;
+
+    for (const auto hash : displayList->DependencyHashes) {
+        const char* path = mArchive->HashToPath(hash);
+        if (path != nullptr && path[0] != '\0' && seen.insert(path).second) {
+            dependencies.push_back(path);
+        }
+    }
+
+    for (const auto& path : displayList->DependencyPaths) {
+        if (seen.insert(path).second) {
+            dependencies.push_back(path);
+        }
+    }
+
+    return dependencies;
+}
+
+std::shared_ptr<std::vector<std::string>> ResourceManager::GetDependencies(const std::string& filePath) {
+    auto list = std::make_shared<std::vector<std::string>>();
+
+    const std::lock_guard<std::mutex> lock(mMutex);
+    auto dependenciesFind = mDependencies.find(filePath);
+    if (dependenciesFind != mDependencies.end()) {
+        *list = dependenciesFind->second;
+    }
+
+    return list;
+}
+
+void ResourceManager::PrefetchDependencies(const std::string& filePath, int32_t depth,
+                                           std::shared_ptr<ResourceLoadToken> token) {
+    // Check for and remove the OTR signature
+    if (OtrSignatureCheck(filePath.c_str())) {
+        return PrefetchDependencies(filePath.substr(7), depth, token);
+    }
+
+    // Prefetches are always cancellable so that unloading a directory also stops warming it up.
+    if (token == nullptr) {
+        token = std::make_shared<ResourceLoadToken>();
+    }
+
+    std::unordered_set<std::string> visited;
+    QueuePrefetch(filePath, depth, token, visited);
+}
+
+void ResourceManager::QueuePrefetch(const std::string& filePath, int32_t depth,
+                                    std::shared_ptr<ResourceLoadToken> token,
+                                    std::unordered_set<std::string>& visited) {
+    if (depth < 0 || !visited.insert(filePath).second) {
+        return;
+    }
+
+    auto resource = GetCachedResource(filePath);
+    if (resource == nullptr) {
+        // The worker queues the next level once the resource has been parsed and its dependencies are known.
+        RequestLoad(filePath, false, ResourceLoadPriority::Background, token, depth);
+        return;
+    }
+
+    if (depth == 0) {
+        return;
+    }
+
+    for (const auto& dependency : ReadDependencies(resource)) {
+        QueuePrefetch(dependency, depth - 1, token, visited);
+    }
+}
+
+std::shared_ptr<IResource> ResourceManager::LoadResource(std::string_view filePath, bool loadExact) {
+    // Answer cache hits directly, going through LoadResourceAsync would allocate a promise for each of them.
+    auto cachedResource =
+        GetCachedResource(OtrSignatureCheck(filePath) ? filePath.substr(7) : filePath, loadExact);
+    if (cachedResource != nullptr) {
+        mCacheHits.fetch_add(1, std::memory_order_relaxed);
+        return cachedResource;
+    }
+    mCacheMisses.fetch_add(1, std::memory_order_relaxed);
+
+    auto resource = LoadResourceAsync(std::string(filePath), loadExact, ResourceLoadPriority::Immediate).get();
     if (resource == nullptr) {
-        SPDLOG_ERROR("Failed to load resource file at path {}", filePath);
+        LUS_LOG_RATE_LIMITED(SPDLOG_ERROR, "Failed to load resource file at path {}", filePath);
     }
     return resource;
 }
 
+ResourceCacheStats ResourceManager::GetCacheStats() const {
+    return { mCacheHits.load(std::memory_order_relaxed), mCacheMisses.load(std::memory_order_relaxed) };
+}
+
 std::variant<ResourceManager::ResourceLoadError, std::shared_ptr<IResource>>
-ResourceManager::CheckCache(const std::string& filePath, bool loadExact) {
+ResourceManager::CheckCache(std::string_view filePath, bool loadExact) {
     if (!loadExact && CVarGetInteger("gAltAssets", 0) && !filePath.starts_with(IResource::gAltAssetPrefix)) {
-        const auto altPath = IResource::gAltAssetPrefix + filePath;
-        auto altCacheResult = CheckCache(altPath, loadExact);
+        auto altCacheResult = CheckCache(AltAssetPath(filePath), loadExact);
 
         // If the type held at this cache index is a resource, then we return it.
         // Else we attempt to load standard definition assets.
@@ -217,7 +496,7 @@ ResourceManager::CheckCache(const std::string& filePath, bool loadExact) {
     return resourceCacheFind->second;
 }
 
-std::shared_ptr<IResource> ResourceManager::GetCachedResource(const std::string& filePath, bool loadExact) {
+std::shared_ptr<IResource> ResourceManager::GetCachedResource(std::string_view filePath, bool loadExact) {
     // Gets the cached resource based on filePath.
     return GetCachedResource(CheckCache(filePath, loadExact));
 }
@@ -248,13 +527,25 @@ ResourceManager::GetCachedResource(std::variant<ResourceLoadError, std::shared_p
 
 std::shared_ptr<std::vector<std::shared_future<std::shared_ptr<IResource>>>>
 ResourceManager::LoadDirectoryAsync(const std::string& searchMask, bool priority) {
+    return LoadDirectoryAsync(searchMask, priority ? ResourceLoadPriority::High : ResourceLoadPriority::Normal);
+}
+
+std::shared_ptr<std::vector<std::shared_future<std::shared_ptr<IResource>>>>
+ResourceManager::LoadDirectoryAsync(const std::string& searchMask, ResourceLoadPriority priority,
+                                    std::shared_ptr<ResourceLoadToken> token) {
     auto loadedList = std::make_shared<std::vector<std::shared_future<std::shared_ptr<IResource>>>>();
     auto fileList = GetArchive()->ListFiles(searchMask);
     loadedList->reserve(fileList->size());
 
+    // Directory loads are always cancellable, so that unloading the directory stops the files that haven't been
+    // decoded yet.
+    if (token == nullptr && priority != ResourceLoadPriority::Immediate) {
+        token = std::make_shared<ResourceLoadToken>();
+    }
+
     for (size_t i = 0; i < fileList->size(); i++) {
         auto fileName = std::string(fileList->operator[](i));
-        auto future = LoadResourceAsync(fileName, false, priority);
+        auto future = LoadResourceAsync(fileName, false, priority, token);
         loadedList->push_back(future);
     }
 
@@ -262,7 +553,7 @@ ResourceManager::LoadDirectoryAsync(const std::string& searchMask, bool priority
 }
 
 std::shared_ptr<std::vector<std::shared_ptr<IResource>>> ResourceManager::LoadDirectory(const std::string& searchMask) {
-    auto futureList = LoadDirectoryAsync(searchMask, true);
+    auto futureList = LoadDirectoryAsync(searchMask, ResourceLoadPriority::Immediate);
     auto loadedList = std::make_shared<std::vector<std::shared_ptr<IResource>>>();
 
     for (size_t i = 0; i < futureList->size(); i++) {
@@ -278,6 +569,9 @@ std::shared_ptr<std::vector<std::string>> ResourceManager::FindLoadedFiles(const
     const char* wildCard = searchMask.c_str();
     auto list = std::make_shared<std::vector<std::string>>();
 
+    // Matched against the cache keys rather than the archive index: a resource can be cached under another spelling
+    // of its path, or outlive its file in the archives. SFileCheckWildCard ignores case and slash direction.
+    const std::lock_guard<std::mutex> lock(mMutex);
     for (const auto& [key, value] : mResourceCache) {
         if (SFileCheckWildCard(key.c_str(), wildCard)) {
             list->push_back(key);
@@ -295,6 +589,12 @@ void ResourceManager::DirtyDirectory(const std::string& searchMask) {
         // If it's a resource, we will set the dirty flag, else we will just unload it.
         if (resource != nullptr) {
             resource->Dirty();
+            {
+                // Read again when the dirty resource is reloaded.
+                const std::lock_guard<std::mutex> lock(mMutex);
+                mDependencies.erase(key);
+            }
+            NotifyInvalidated(resource);
         } else {
             UnloadResource(key);
         }
@@ -302,6 +602,8 @@ void ResourceManager::DirtyDirectory(const std::string& searchMask) {
 }
 
 void ResourceManager::UnloadDirectory(const std::string& searchMask) {
+    CancelDirectory(searchMask);
+
     auto list = FindLoadedFiles(searchMask);
 
     for (const auto& key : *list.get()) {
@@ -309,6 +611,22 @@ void ResourceManager::UnloadDirectory(const std::string& searchMask) {
     }
 }
 
+size_t ResourceManager::CancelDirectory(const std::string& searchMask) {
+    const char* wildCard = searchMask.c_str();
+    size_t cancelled = 0;
+
+    const std::lock_guard<std::mutex> lock(mLoadRequestMutex);
+    for (const auto& [key, request] : mLoadRequests) {
+        // Loads somebody is blocking on without a token keep going, they are still wanted.
+        if (!request->Started && !request->Pinned && SFileCheckWildCard(key.c_str(), wildCard)) {
+            request->Cancelled = true;
+            cancelled++;
+        }
+    }
+
+    return cancelled;
+}
+
 std::shared_ptr<Archive> ResourceManager::GetArchive() {
     return mArchive;
 }
@@ -317,6 +635,10 @@ std::shared_ptr<ResourceLoader> ResourceManager::GetResourceLoader() {
     return mResourceLoader;
 }
 
+std::shared_ptr<BS::thread_pool> ResourceManager::GetThreadPool() {
+    return mThreadPool;
+}
+
 size_t ResourceManager::UnloadResource(const std::string& filePath) {
     // Store a shared pointer here so that erase doesn't destruct the resource.
     // The resource will attempt to load other resources on the destructor, and this will fail because we already hold
@@ -327,14 +649,42 @@ size_t ResourceManager::UnloadResource(const std::string& filePath) {
         const std::lock_guard<std::mutex> lock(mMutex);
         value = mResourceCache[filePath];
         ret = mResourceCache.erase(filePath);
+        mDependencies.erase(filePath);
+    }
+
+    if (std::holds_alternative<std::shared_ptr<IResource>>(value)) {
+        NotifyInvalidated(std::get<std::shared_ptr<IResource>>(value));
     }
 
     return ret;
 }
 
-bool ResourceManager::OtrSignatureCheck(const char* fileName) {
-    static const char* sOtrSignature = "__OTR__";
-    return strncmp(fileName, sOtrSignature, strlen(sOtrSignature)) == 0;
+void ResourceManager::AddInvalidationListener(std::function<void(const std::shared_ptr<IResource>&)> listener) {
+    const std::lock_guard<std::mutex> lock(mInvalidationListenersMutex);
+    mInvalidationListeners.push_back(std::move(listener));
+}
+
+void ResourceManager::NotifyInvalidated(const std::shared_ptr<IResource>& resource) {
+    if (resource == nullptr) {
+        return;
+    }
+
+    const std::lock_guard<std::mutex> lock(mInvalidationListenersMutex);
+    for (const auto& listener : mInvalidationListeners) {
+        listener(resource);
+    }
+}
+
+void ResourceLoadToken::Cancel() {
+    mCancelled = true;
+}
+
+bool ResourceLoadToken::IsCancelled() const {
+    return mCancelled;
+}
+
+bool ResourceManager::OtrSignatureCheck(std::string_view fileName) {
+    return fileName.starts_with("__OTR__");
 }
 
 } // namespace LUS
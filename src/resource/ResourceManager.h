@@ -1,10 +1,17 @@
 #pragma once
 
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <string_view>
 #include <mutex>
 #include <queue>
 #include <variant>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <functional>
 #include "Resource.h"
 #include "ResourceLoader.h"
 #include "Archive.h"
@@ -13,6 +20,25 @@
 namespace LUS {
 struct File;
 
+enum class ResourceLoadPriority { Background, Normal, High, Immediate };
+
+// Handed to asynchronous loads by callers that may stop caring about the result, e.g. when a scene is unloaded before
+// its assets finish streaming in. A queued load is only skipped once every caller waiting on it has cancelled.
+class ResourceLoadToken {
+  public:
+    void Cancel();
+    bool IsCancelled() const;
+
+  private:
+    std::atomic<bool> mCancelled = false;
+};
+
+// Returned by ResourceManager::GetCacheStats.
+struct ResourceCacheStats {
+    uint64_t Hits;
+    uint64_t Misses;
+};
+
 // Resource manager caches any and all files it comes across into memory. This will be unoptimal in the future when
 // modifications have gigabytes of assets. It works with the original game's assets because the entire ROM is 64MB and
 // fits into RAM of any semi-modern PC.
@@ -29,33 +55,99 @@ class ResourceManager {
     bool DidLoadSuccessfully();
     std::shared_ptr<Archive> GetArchive();
     std::shared_ptr<ResourceLoader> GetResourceLoader();
+    // Shared with the asynchronous loads, long running jobs delay them.
+    std::shared_ptr<BS::thread_pool> GetThreadPool();
     std::shared_future<std::shared_ptr<File>> LoadFileAsync(const std::string& filePath, bool priority = false);
     std::shared_ptr<File> LoadFile(const std::string& filePath);
-    std::shared_ptr<IResource> GetCachedResource(const std::string& filePath, bool loadExact = false);
-    std::shared_ptr<IResource> LoadResource(const std::string& filePath, bool loadExact = false);
-    std::shared_ptr<IResource> LoadResourceProcess(const std::string& filePath, bool loadExact = false);
+    std::shared_ptr<IResource> GetCachedResource(std::string_view filePath, bool loadExact = false);
+    std::shared_ptr<IResource> LoadResource(std::string_view filePath, bool loadExact = false);
+    std::shared_ptr<IResource> LoadResourceProcess(std::string_view filePath, bool loadExact = false);
     size_t UnloadResource(const std::string& filePath);
     std::shared_future<std::shared_ptr<IResource>> LoadResourceAsync(const std::string& filePath,
                                                                      bool loadExact = false, bool priority = false);
+    std::shared_future<std::shared_ptr<IResource>>
+    LoadResourceAsync(const std::string& filePath, bool loadExact, ResourceLoadPriority priority,
+                      std::shared_ptr<ResourceLoadToken> token = nullptr);
     std::shared_ptr<std::vector<std::shared_ptr<IResource>>> LoadDirectory(const std::string& searchMask);
     std::shared_ptr<std::vector<std::shared_future<std::shared_ptr<IResource>>>>
     LoadDirectoryAsync(const std::string& searchMask, bool priority = false);
+    std::shared_ptr<std::vector<std::shared_future<std::shared_ptr<IResource>>>>
+    LoadDirectoryAsync(const std::string& searchMask, ResourceLoadPriority priority,
+                       std::shared_ptr<ResourceLoadToken> token = nullptr);
     std::shared_ptr<std::vector<std::string>> FindLoadedFiles(const std::string& searchMask);
     void DirtyDirectory(const std::string& searchMask);
     void UnloadDirectory(const std::string& searchMask);
-    bool OtrSignatureCheck(const char* fileName);
+    size_t CancelDirectory(const std::string& searchMask);
+    std::shared_ptr<std::vector<std::string>> GetDependencies(const std::string& filePath);
+    void PrefetchDependencies(const std::string& filePath, int32_t depth,
+                              std::shared_ptr<ResourceLoadToken> token = nullptr);
+    bool OtrSignatureCheck(std::string_view fileName);
+    // Synchronous LoadResource calls answered from the cache, and those that had to load, since startup.
+    ResourceCacheStats GetCacheStats() const;
+    // Called with every resource the manager unloads or marks dirty, on whichever thread did it, so caches built
+    // from resource data can drop what they derived from it.
+    void AddInvalidationListener(std::function<void(const std::shared_ptr<IResource>&)> listener);
 
   protected:
     std::shared_ptr<File> LoadFileProcess(const std::string& filePath);
     std::shared_ptr<IResource> GetCachedResource(std::variant<ResourceLoadError, std::shared_ptr<IResource>> cacheLine);
-    std::variant<ResourceLoadError, std::shared_ptr<IResource>> CheckCache(const std::string& filePath,
+    std::variant<ResourceLoadError, std::shared_ptr<IResource>> CheckCache(std::string_view filePath,
                                                                            bool loadExact = false);
 
   private:
-    std::unordered_map<std::string, std::variant<ResourceLoadError, std::shared_ptr<IResource>>> mResourceCache;
+    // Lets the cache be searched with a std::string_view without building a std::string key.
+    struct PathHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view path) const {
+            return std::hash<std::string_view>{}(path);
+        }
+    };
+
+    struct ResourceLoadRequest {
+        std::string Path;
+        bool LoadExact = false;
+        ResourceLoadPriority Priority = ResourceLoadPriority::Normal;
+        // Set when at least one caller asked for the resource without a cancellation token.
+        bool Pinned = false;
+        bool Cancelled = false;
+        bool Started = false;
+        // How many levels of the resource's dependencies to queue once it has loaded.
+        int32_t PrefetchDepth = 0;
+        std::shared_ptr<ResourceLoadToken> PrefetchToken;
+        std::vector<std::shared_ptr<ResourceLoadToken>> Tokens;
+        std::promise<std::shared_ptr<IResource>> Promise;
+        std::shared_future<std::shared_ptr<IResource>> Future;
+    };
+
+    std::shared_future<std::shared_ptr<IResource>> RequestLoad(const std::string& filePath, bool loadExact,
+                                                               ResourceLoadPriority priority,
+                                                               std::shared_ptr<ResourceLoadToken> token,
+                                                               int32_t prefetchDepth);
+    void QueueLoadRequest(std::shared_ptr<ResourceLoadRequest> request);
+    void RunNextLoadRequest();
+    bool IsLoadRequestCancelled(const std::shared_ptr<ResourceLoadRequest>& request);
+    std::vector<std::string> ReadDependencies(std::shared_ptr<IResource> resource);
+    void NotifyInvalidated(const std::shared_ptr<IResource>& resource);
+    void QueuePrefetch(const std::string& filePath, int32_t depth, std::shared_ptr<ResourceLoadToken> token,
+                       std::unordered_set<std::string>& visited);
+
+    std::unordered_map<std::string, std::variant<ResourceLoadError, std::shared_ptr<IResource>>, PathHash,
+                       std::equal_to<>>
+        mResourceCache;
     std::shared_ptr<ResourceLoader> mResourceLoader;
     std::shared_ptr<Archive> mArchive;
+    // Resources referenced by each loaded display list, keyed by the display list's path.
+    std::unordered_map<std::string, std::vector<std::string>> mDependencies;
+    // Requests that are queued or being loaded, keyed by path, so concurrent requests share a single decode.
+    // Declared before the thread pool so queued jobs never outlive them.
+    std::unordered_map<std::string, std::shared_ptr<ResourceLoadRequest>> mLoadRequests;
+    std::array<std::deque<std::shared_ptr<ResourceLoadRequest>>, 4> mLoadQueues;
+    std::mutex mLoadRequestMutex;
     std::shared_ptr<BS::thread_pool> mThreadPool;
     std::mutex mMutex;
+    std::vector<std::function<void(const std::shared_ptr<IResource>&)>> mInvalidationListeners;
+    std::mutex mInvalidationListenersMutex;
+    std::atomic<uint64_t> mCacheHits = 0;
+    std::atomic<uint64_t> mCacheMisses = 0;
 };
 } // namespace LUS
@@ -5,6 +5,32 @@
 #define ARRAY_COUNT(arr) (s32)(sizeof(arr) / sizeof(arr[0]))
 
 namespace LUS {
+// Commands whose second word points at a file path. Only display lists authored as XML have them, the binary form
+// stores the path inline after the first word.
+static bool IsFilePathOpcode(uint8_t opcode) {
+    return opcode == G_SETTIMG_OTR_FILEPATH || opcode == G_DL_OTR_FILEPATH || opcode == G_VTX_OTR_FILEPATH ||
+           opcode == G_MTX_OTR2;
+}
+
+// 128-bit commands, the binary form reads the following 64 bits together with them.
+static bool IsWideOpcode(uint8_t opcode) {
+    return opcode == G_SETTIMG_OTR_HASH || opcode == G_DL_OTR_HASH || opcode == G_VTX_OTR_HASH ||
+           opcode == G_BRANCH_Z_OTR || opcode == G_MARKER || opcode == G_MTX_OTR;
+}
+
+// Walks the instructions the way ParseFileBinary reads them back and checks that it stops exactly at the end.
+static bool CanWriteBinary(const std::vector<Gfx>& instructions) {
+    size_t i = 0;
+    while (i < instructions.size()) {
+        const uint8_t opcode = (uint8_t)(instructions[i].words.w0 >> 24);
+        if (opcode == G_ENDDL) {
+            return i + 1 == instructions.size();
+        }
+        i += (IsWideOpcode(opcode) || opcode == G_VTX_OTR_FILEPATH) ? 2 : 1;
+    }
+    return false;
+}
+
 std::shared_ptr<IResource> DisplayListFactory::ReadResource(std::shared_ptr<ResourceInitData> initData,
                                                             std::shared_ptr<BinaryReader> reader) {
     auto resource = std::make_shared<DisplayList>(initData);
@@ -47,6 +73,22 @@ std::shared_ptr<IResource> DisplayListFactory::ReadResourceXML(std::shared_ptr<R
     return resource;
 }
 
+bool DisplayListFactory::WriteResource(std::shared_ptr<IResource> resource, std::shared_ptr<BinaryWriter> writer) {
+    auto displayList = std::static_pointer_cast<DisplayList>(resource);
+
+    if (!CanWriteBinary(displayList->Instructions)) {
+        return false;
+    }
+
+    switch (resource->GetInitData()->ResourceVersion) {
+        case 0:
+            DisplayListFactoryV0().WriteFileBinary(writer, resource);
+            return true;
+    }
+
+    return false;
+}
+
 void DisplayListFactoryV0::ParseFileBinary(std::shared_ptr<BinaryReader> reader, std::shared_ptr<IResource> resource) {
     std::shared_ptr<DisplayList> displayList = std::static_pointer_cast<DisplayList>(resource);
     ResourceVersionFactory::ParseFileBinary(reader, displayList);
@@ -58,19 +100,41 @@ void DisplayListFactoryV0::ParseFileBinary(std::shared_ptr<BinaryReader> reader,
     while (true) {
         Gfx command;
         command.words.w0 = reader->ReadUInt32();
+
+        uint8_t opcode = (uint8_t)(command.words.w0 >> 24);
+
+        if (IsFilePathOpcode(opcode)) {
+            const std::string path = reader->ReadString();
+            char* filePath = (char*)malloc(path.size() + 1);
+            strcpy(filePath, path.c_str());
+            command.words.w1 = (uintptr_t)filePath;
+            displayList->Instructions.push_back(command);
+            displayList->DependencyPaths.push_back(filePath);
+
+            // The second half of a vertex load holds the counts and offsets.
+            if (opcode == G_VTX_OTR_FILEPATH) {
+                command.words.w0 = reader->ReadUInt32();
+                command.words.w1 = reader->ReadUInt32();
+                displayList->Instructions.push_back(command);
+            }
+            continue;
+        }
+
         command.words.w1 = reader->ReadUInt32();
 
         displayList->Instructions.push_back(command);
 
-        uint8_t opcode = (uint8_t)(command.words.w0 >> 24);
-
         // These are 128-bit commands, so read an extra 64 bits...
-        if (opcode == G_SETTIMG_OTR_HASH || opcode == G_DL_OTR_HASH || opcode == G_VTX_OTR_HASH ||
-            opcode == G_BRANCH_Z_OTR || opcode == G_MARKER || opcode == G_MTX_OTR) {
+        if (IsWideOpcode(opcode)) {
             command.words.w0 = reader->ReadUInt32();
             command.words.w1 = reader->ReadUInt32();
 
             displayList->Instructions.push_back(command);
+
+            // Apart from markers, the second half is the CRC64 of another resource the display list depends on.
+            if (opcode != G_MARKER) {
+                displayList->DependencyHashes.push_back(((uint64_t)command.words.w0 << 32) + command.words.w1);
+            }
         }
 
         if (opcode == G_ENDDL) {
@@ -1031,6 +1095,48 @@ void DisplayListFactoryV0::ParseFileXML(tinyxml2::XMLElement* reader, std::share
 
         child = child->NextSiblingElement();
     }
+
+    // Record the resources referenced by file path so they can be prefetched.
+    for (size_t i = 0; i < dl->Instructions.size(); i++) {
+        const Gfx& g = dl->Instructions[i];
+        const uint8_t opcode = (uint8_t)(g.words.w0 >> 24);
+
+        if (opcode == G_SETTIMG_OTR_FILEPATH || opcode == G_DL_OTR_FILEPATH || opcode == G_VTX_OTR_FILEPATH ||
+            opcode == G_MTX_OTR2) {
+            dl->DependencyPaths.push_back((const char*)g.words.w1);
+        }
+
+        // The second half of a vertex load holds the counts and offsets.
+        if (opcode == G_VTX_OTR_FILEPATH) {
+            i++;
+        }
+    }
+}
+
+void DisplayListFactoryV0::WriteFileBinary(std::shared_ptr<BinaryWriter> writer, std::shared_ptr<IResource> resource) {
+    std::shared_ptr<DisplayList> displayList = std::static_pointer_cast<DisplayList>(resource);
+
+    while (writer->GetBaseAddress() % 8 != 0) {
+        writer->Write((uint8_t)0);
+    }
+
+    for (size_t i = 0; i < displayList->Instructions.size(); i++) {
+        const Gfx& command = displayList->Instructions[i];
+        const uint8_t opcode = (uint8_t)(command.words.w0 >> 24);
+
+        writer->Write((uint32_t)command.words.w0);
+        if (!IsFilePathOpcode(opcode)) {
+            writer->Write((uint32_t)command.words.w1);
+            continue;
+        }
+
+        writer->Write(std::string((const char*)command.words.w1));
+        if (opcode == G_VTX_OTR_FILEPATH && i + 1 < displayList->Instructions.size()) {
+            i++;
+            writer->Write((uint32_t)displayList->Instructions[i].words.w0);
+            writer->Write((uint32_t)displayList->Instructions[i].words.w1);
+        }
+    }
 }
 
 uint32_t DisplayListFactoryV0::GetCombineLERPValue(std::string valStr) {
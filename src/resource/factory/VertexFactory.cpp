@@ -45,6 +45,16 @@ std::shared_ptr<IResource> VertexFactory::ReadResourceXML(std::shared_ptr<Resour
     return resource;
 }
 
+bool VertexFactory::WriteResource(std::shared_ptr<IResource> resource, std::shared_ptr<BinaryWriter> writer) {
+    switch (resource->GetInitData()->ResourceVersion) {
+        case 0:
+            VertexFactoryV0().WriteFileBinary(writer, resource);
+            return true;
+    }
+
+    return false;
+}
+
 void VertexFactoryV0::ParseFileBinary(std::shared_ptr<BinaryReader> reader, std::shared_ptr<IResource> resource) {
     std::shared_ptr<Vertex> vertex = std::static_pointer_cast<Vertex>(resource);
     ResourceVersionFactory::ParseFileBinary(reader, vertex);
@@ -93,4 +103,22 @@ void LUS::VertexFactoryV0::ParseFileXML(tinyxml2::XMLElement* reader, std::share
         child = child->NextSiblingElement();
     }
 }
+
+void VertexFactoryV0::WriteFileBinary(std::shared_ptr<BinaryWriter> writer, std::shared_ptr<IResource> resource) {
+    std::shared_ptr<Vertex> vertex = std::static_pointer_cast<Vertex>(resource);
+
+    writer->Write((uint32_t)vertex->VertexList.size());
+    for (const Vtx& data : vertex->VertexList) {
+        writer->Write(data.v.ob[0]);
+        writer->Write(data.v.ob[1]);
+        writer->Write(data.v.ob[2]);
+        writer->Write(data.v.flag);
+        writer->Write(data.v.tc[0]);
+        writer->Write(data.v.tc[1]);
+        writer->Write(data.v.cn[0]);
+        writer->Write(data.v.cn[1]);
+        writer->Write(data.v.cn[2]);
+        writer->Write(data.v.cn[3]);
+    }
+}
 } // namespace LUS
@@ -11,11 +11,13 @@ class VertexFactory : public ResourceFactory {
                                             std::shared_ptr<BinaryReader> reader) override;
     std::shared_ptr<IResource> ReadResourceXML(std::shared_ptr<ResourceInitData> initData,
                                                tinyxml2::XMLElement* reader);
+    bool WriteResource(std::shared_ptr<IResource> resource, std::shared_ptr<BinaryWriter> writer) override;
 };
 
 class VertexFactoryV0 : public ResourceVersionFactory {
   public:
     void ParseFileBinary(std::shared_ptr<BinaryReader> reader, std::shared_ptr<IResource> resource) override;
     void ParseFileXML(tinyxml2::XMLElement* reader, std::shared_ptr<IResource> resource) override;
+    void WriteFileBinary(std::shared_ptr<BinaryWriter> writer, std::shared_ptr<IResource> resource) override;
 };
 } // namespace LUS
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include "resource/Resource.h"
 #include "libultraship/libultra/gbi.h"
@@ -15,5 +16,8 @@ class DisplayList : public Resource<Gfx> {
     size_t GetPointerSize() override;
 
     std::vector<Gfx> Instructions;
+    // Resources referenced through OTR hash or file path commands, recorded when the display list is parsed.
+    std::vector<uint64_t> DependencyHashes;
+    std::vector<std::string> DependencyPaths;
 };
 } // namespace LUS
@@ -36,6 +36,13 @@ class Texture : public Resource<uint8_t> {
     uint32_t ImageDataSize;
     uint8_t* ImageData = nullptr;
 
+    // Blend mask and replacement registered for this texture's path, resolved by the renderer when the texture is first
+    // loaded after a registration, so drawing doesn't have to look the path up.
+    bool HasBlend = false;
+    uint8_t* BlendMask = nullptr;
+    uint8_t* BlendReplacement = nullptr;
+    uint32_t BlendGeneration = 0;
+
     ~Texture();
 };
 } // namespace LUS
@@ -112,6 +112,10 @@ void Window::SetTargetFps(int32_t fps) {
     gfx_set_target_fps(fps);
 }
 
+void Window::SetTargetFrameRate(double fps) {
+    gfx_set_target_frame_rate(fps);
+}
+
 void Window::SetMaximumFrameLatency(int32_t latency) {
     gfx_set_maximum_frame_latency(latency);
 }
@@ -150,6 +154,7 @@ bool Window::KeyUp(int32_t scancode) {
 
     bool isProcessed = false;
     auto controlDeck = Context::GetInstance()->GetControlDeck();
+    const auto lock = controlDeck->LockDevices();
     const auto pad = dynamic_cast<KeyboardController*>(
         controlDeck->GetDeviceFromDeviceIndex(controlDeck->GetNumDevices() - 2).get());
     if (pad != nullptr) {
@@ -164,6 +169,7 @@ bool Window::KeyUp(int32_t scancode) {
 bool Window::KeyDown(int32_t scancode) {
     bool isProcessed = false;
     auto controlDeck = Context::GetInstance()->GetControlDeck();
+    const auto lock = controlDeck->LockDevices();
     const auto pad = dynamic_cast<KeyboardController*>(
         controlDeck->GetDeviceFromDeviceIndex(controlDeck->GetNumDevices() - 2).get());
     if (pad != nullptr) {
@@ -179,6 +185,7 @@ bool Window::KeyDown(int32_t scancode) {
 
 void Window::AllKeysUp(void) {
     auto controlDeck = Context::GetInstance()->GetControlDeck();
+    const auto lock = controlDeck->LockDevices();
     const auto pad = dynamic_cast<KeyboardController*>(
         controlDeck->GetDeviceFromDeviceIndex(controlDeck->GetNumDevices() - 2).get());
     if (pad != nullptr) {
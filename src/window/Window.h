@@ -25,6 +25,7 @@ class Window {
     void Close();
     void StartFrame();
     void SetTargetFps(int32_t fps);
+    void SetTargetFrameRate(double fps);
     void SetMaximumFrameLatency(int32_t latency);
     void GetPixelDepthPrepare(float x, float y);
     uint16_t GetPixelDepth(float x, float y);
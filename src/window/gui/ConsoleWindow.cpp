@@ -4,7 +4,16 @@
 #include "Context.h"
 #include <Utils/StringHelper.h>
 #include "utils/Utils.h"
+#include "debug/Profiler.h"
+#include "resource/File.h"
+#include "resource/ResourceManager.h"
 #include <sstream>
+#include <algorithm>
+
+#define CONSOLE_MAX_LINES 16384 // per channel
+#define CONSOLE_MAX_LINE_LENGTH 2048
+#define CONSOLE_CHUNK_SIZE (64 * 1024)
+#define CONSOLE_MAX_CHUNKS 64
 
 namespace LUS {
 
@@ -113,6 +122,109 @@ int32_t ConsoleWindow::BindToggleCommand(std::shared_ptr<Console> console, const
     return 0;
 }
 
+int32_t ConsoleWindow::ProfilerCommand(std::shared_ptr<Console> console, const std::vector<std::string>& args,
+                                       std::string* output) {
+    if (args.size() < 2) {
+        if (output) {
+            *output += "Not enough arguments.";
+        }
+        return 1;
+    }
+
+    if (args[1] == "start") {
+        Profiler::Start();
+        return 0;
+    }
+    if (args[1] == "stop") {
+        Profiler::Stop();
+        return 0;
+    }
+    if (args[1] == "dump") {
+        const std::string path =
+            args.size() > 2 ? args[2] : Context::GetPathRelativeToAppDirectory("profiler-trace.json");
+        if (!Profiler::WriteChromeTrace(path)) {
+            if (output) {
+                *output += "Failed to write " + path;
+            }
+            return 1;
+        }
+        if (output) {
+            *output += "Trace written to " + path;
+        }
+        return 0;
+    }
+
+    if (output) {
+        *output += "Unknown profiler action " + args[1];
+    }
+    return 1;
+}
+
+int32_t ConsoleWindow::ArchiveBenchmarkCommand(std::shared_ptr<Console> console, const std::vector<std::string>& args,
+                                               std::string* output) {
+    static std::atomic<bool> sRunning = false;
+
+    auto resourceManager = Context::GetInstance()->GetResourceManager();
+    auto archive = resourceManager != nullptr ? resourceManager->GetArchive() : nullptr;
+    if (archive == nullptr) {
+        if (output) {
+            *output += "No archive is loaded";
+        }
+        return 1;
+    }
+
+    if (sRunning.exchange(true)) {
+        if (output) {
+            *output += "A benchmark is already running";
+        }
+        return 1;
+    }
+
+    const std::string mask = args.size() > 1 ? args[1] : "*";
+    const size_t limit = args.size() > 2 ? std::strtoul(args[2].c_str(), nullptr, 10) : 1000;
+    auto window = std::static_pointer_cast<LUS::ConsoleWindow>(
+        Context::GetInstance()->GetWindow()->GetGui()->GetGuiWindow("Console"));
+
+    // Loading and compressing the sample takes seconds, so it runs on a loader thread and posts the totals back.
+    resourceManager->GetThreadPool()->push_task_back([archive, window, mask, limit]() {
+        std::vector<std::shared_ptr<File>> files;
+        for (const auto& path : *archive->ListFiles(mask)) {
+            if (files.size() >= limit) {
+                break;
+            }
+            auto file = archive->LoadFile(path, false);
+            if (file != nullptr && file->IsLoaded) {
+                files.push_back(file);
+            }
+        }
+
+        std::string result = files.empty() ? "No files match " + mask : "";
+        // Per type results go to the log, the console only gets the totals.
+        for (const auto& stats : ArchiveCompressionPolicy::Benchmark(files)) {
+            if (stats.Type != ResourceType::None) {
+                continue;
+            }
+            const double ratio = stats.RawBytes != 0 ? (double)stats.CompressedBytes / stats.RawBytes : 1.0;
+            const double decodeMiBs = stats.RawBytes / (1024.0 * 1024.0) / std::max(stats.DecodeSeconds, 0.000001);
+            result += StringHelper::Sprintf("%s: %.1f%% of %zu files, decode %.1f MiB/s\n",
+                                            ArchiveCompressionPolicy::GetCodecName(stats.Codec), ratio * 100.0,
+                                            stats.Files, decodeMiBs);
+        }
+
+        if (window != nullptr) {
+            window->QueueInfoMessage(result);
+        } else {
+            SPDLOG_INFO("Archive benchmark: {}", result);
+        }
+        sRunning = false;
+    });
+
+    if (output) {
+        *output += "Benchmarking up to " + std::to_string(limit) + " files matching " + mask;
+    }
+    return 0;
+}
+
 #define VARTYPE_INTEGER 0
 #define VARTYPE_FLOAT 1
 #define VARTYPE_STRING 2
@@ -244,9 +356,26 @@ void ConsoleWindow::InitElement() {
         "bind-toggle", { BindToggleCommand,
                          "Bind key as a bool toggle",
                          { { "key", LUS::ArgumentType::TEXT }, { "cmd", LUS::ArgumentType::TEXT } } });
+    Context::GetInstance()->GetConsole()->AddCommand(
+        "profiler", { ProfilerCommand,
+                      "Captures frame timings, dump writes a Chrome trace",
+                      { { "start|stop|dump", LUS::ArgumentType::TEXT }, { "file", LUS::ArgumentType::TEXT, true } } });
+    Context::GetInstance()->GetConsole()->AddCommand(
+        "archive_benchmark",
+        { ArchiveBenchmarkCommand,
+          "Compares the size and decode speed of every archive codec on a sample of files",
+          { { "mask", LUS::ArgumentType::TEXT, true }, { "limit", LUS::ArgumentType::NUMBER, true } } });
 }
 
 void ConsoleWindow::UpdateElement() {
+    {
+        const std::lock_guard<std::mutex> lock(mQueuedMessagesMutex);
+        for (const auto& message : mQueuedMessages) {
+            SendInfoMessage(message);
+        }
+        mQueuedMessages.clear();
+    }
+
     for (auto [key, cmd] : mBindings) {
         if (ImGui::IsKeyPressed(key)) {
             Dispatch(cmd);
@@ -305,7 +434,10 @@ void ConsoleWindow::DrawElement() {
 
     if (ImGui::BeginPopupContextWindow("Context Menu")) {
         if (ImGui::MenuItem("Copy Text")) {
-            ImGui::SetClipboardText(mLog[mCurrentChannel][mSelectedId].Text.c_str());
+            const ConsoleLine* line = mLog[mCurrentChannel].GetLine(mSelectedId);
+            if (line != nullptr) {
+                ImGui::SetClipboardText(line->Text);
+            }
             mSelectedId = -1;
         }
         ImGui::EndPopup();
@@ -316,7 +448,7 @@ void ConsoleWindow::DrawElement() {
 
     // Renders top bar filters
     if (ImGui::Button("Clear")) {
-        mLog[mCurrentChannel].clear();
+        mLog[mCurrentChannel].Clear();
     }
 
     if (CVarGetInteger("gSinkEnabled", 0)) {
@@ -369,45 +501,51 @@ void ConsoleWindow::DrawElement() {
                       ImGuiWindowFlags_HorizontalScrollbar);
     ImGui::PushStyleColor(ImGuiCol_FrameBgActive, ImVec4(.3f, .3f, .3f, 1.0f));
     if (ImGui::BeginTable("History", 1)) {
+        LogChannel& channel = mLog[mCurrentChannel];
+        channel.SetFilter(mFilter, mLevelFilter);
+        const std::deque<int64_t>& rows = channel.GetFilteredLines();
 
         if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_DownArrow))) {
-            if (mSelectedId < (int32_t)mLog.size() - 1) {
-                ++mSelectedId;
+            auto next = std::upper_bound(rows.begin(), rows.end(), mSelectedId);
+            if (next != rows.end()) {
+                mSelectedId = *next;
             }
         }
         if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_UpArrow))) {
-            if (mSelectedId > 0) {
-                --mSelectedId;
+            auto selected = std::lower_bound(rows.begin(), rows.end(), mSelectedId);
+            if (mSelectedId >= 0 && selected != rows.begin()) {
+                mSelectedId = *(selected - 1);
             }
         }
 
-        const std::vector<ConsoleLine> channel = mLog[mCurrentChannel];
-        for (size_t i = 0; i < static_cast<int32_t>(channel.size()); i++) {
-            ConsoleLine line = channel[i];
-            if (!mFilter.empty() && line.Text.find(mFilter) == std::string::npos) {
-                continue;
-            }
-            if (mLevelFilter > line.Priority) {
-                continue;
-            }
-            std::string id = line.Text + "##" + std::to_string(i);
-            ImGui::TableNextRow();
-            ImGui::TableSetColumnIndex(0);
-            const bool isSelected = (mSelectedId == i) || std::find(mSelectedEntries.begin(), mSelectedEntries.end(),
-                                                                    i) != mSelectedEntries.end();
-            ImGui::PushStyleColor(ImGuiCol_Text, mPriorityColours[line.Priority]);
-            if (ImGui::Selectable(id.c_str(), isSelected)) {
-                if (ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_LeftCtrl)) && !isSelected) {
-                    mSelectedEntries.push_back(i);
-
-                } else {
-                    mSelectedEntries.clear();
+        // Only the rows in view are laid out, the rest is skipped over by height
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(rows.size()));
+        while (clipper.Step()) {
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+                const int64_t sequence = rows[row];
+                const ConsoleLine* line = channel.GetLine(sequence);
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                const bool isSelected =
+                    (mSelectedId == sequence) ||
+                    std::find(mSelectedEntries.begin(), mSelectedEntries.end(), sequence) != mSelectedEntries.end();
+                ImGui::PushID(static_cast<int>(sequence));
+                ImGui::PushStyleColor(ImGuiCol_Text, mPriorityColours[line->Priority]);
+                if (ImGui::Selectable(line->Text, isSelected)) {
+                    if (ImGui::IsKeyDown(ImGui::GetKeyIndex(ImGuiKey_LeftCtrl)) && !isSelected) {
+                        mSelectedEntries.push_back(sequence);
+
+                    } else {
+                        mSelectedEntries.clear();
+                    }
+                    mSelectedId = isSelected ? -1 : sequence;
+                }
+                ImGui::PopStyleColor();
+                ImGui::PopID();
+                if (isSelected) {
+                    ImGui::SetItemDefaultFocus();
                 }
-                mSelectedId = isSelected ? -1 : i;
-            }
-            ImGui::PopStyleColor();
-            if (isSelected) {
-                ImGui::SetItemDefaultFocus();
             }
         }
         ImGui::EndTable();
@@ -565,10 +703,11 @@ int ConsoleWindow::CallbackStub(ImGuiInputTextCallbackData* data) {
 
 void ConsoleWindow::Append(const std::string& channel, spdlog::level::level_enum priority, const char* fmt,
                            va_list args) {
-    char buf[2048];
-    vsnprintf(buf, IM_ARRAYSIZE(buf), fmt, args);
-    buf[IM_ARRAYSIZE(buf) - 1] = 0;
-    mLog[channel].push_back({ std::string(buf), priority });
+    LogChannel& log = mLog[channel];
+    // Formats straight into the channel's arena, longer lines are cut off
+    char* buf = log.BeginLine(CONSOLE_MAX_LINE_LENGTH);
+    const int length = vsnprintf(buf, CONSOLE_MAX_LINE_LENGTH, fmt, args);
+    log.EndLine(std::clamp(length, 0, CONSOLE_MAX_LINE_LENGTH - 1), priority);
 }
 
 void ConsoleWindow::Append(const std::string& channel, spdlog::level::level_enum priority, const char* fmt, ...) {
@@ -593,20 +732,125 @@ void ConsoleWindow::SendErrorMessage(const char* fmt, ...) {
 }
 
 void ConsoleWindow::SendInfoMessage(const std::string& str) {
-    Append("Console", spdlog::level::info, str.c_str());
+    Append("Console", spdlog::level::info, "%s", str.c_str());
 }
 
 void ConsoleWindow::SendErrorMessage(const std::string& str) {
-    Append("Console", spdlog::level::err, str.c_str());
+    Append("Console", spdlog::level::err, "%s", str.c_str());
+}
+
+void ConsoleWindow::QueueInfoMessage(const std::string& str) {
+    const std::lock_guard<std::mutex> lock(mQueuedMessagesMutex);
+    mQueuedMessages.push_back(str);
 }
 
 void ConsoleWindow::ClearLogs(std::string channel) {
-    mLog[channel].clear();
+    mLog[channel].Clear();
 }
 
 void ConsoleWindow::ClearLogs() {
-    for (auto [key, var] : mLog) {
-        var.clear();
+    for (auto& [key, var] : mLog) {
+        var.Clear();
+    }
+}
+
+char* ConsoleWindow::LogChannel::BeginLine(size_t maxLength) {
+    if (mLines.empty()) {
+        mLines.resize(CONSOLE_MAX_LINES);
+    }
+
+    if (mChunks.empty() || mChunks.back().Used + maxLength + 1 > CONSOLE_CHUNK_SIZE) {
+        while (mChunks.size() >= CONSOLE_MAX_CHUNKS && mFirst != mEnd) {
+            DropOldestLine();
+        }
+
+        Chunk chunk = { nullptr, 0, mNextChunkId++ };
+        if (!mFreeChunks.empty()) {
+            chunk.Data = std::move(mFreeChunks.back());
+            mFreeChunks.pop_back();
+        } else {
+            chunk.Data = std::make_unique<char[]>(CONSOLE_CHUNK_SIZE);
+        }
+        mChunks.push_back(std::move(chunk));
+    }
+
+    return mChunks.back().Data.get() + mChunks.back().Used;
+}
+
+void ConsoleWindow::LogChannel::EndLine(size_t length, spdlog::level::level_enum priority) {
+    Chunk& chunk = mChunks.back();
+    char* text = chunk.Data.get() + chunk.Used;
+    text[length] = '\0';
+    chunk.Used += length + 1;
+
+    if (mEnd - mFirst == CONSOLE_MAX_LINES) {
+        DropOldestLine();
+    }
+
+    ConsoleLine& line = mLines[mEnd % CONSOLE_MAX_LINES];
+    line = { text, static_cast<uint32_t>(length), chunk.Id, priority };
+    if (Matches(line)) {
+        mFilteredLines.push_back(mEnd);
+    }
+    mEnd++;
+}
+
+void ConsoleWindow::LogChannel::Clear() {
+    mFirst = mEnd;
+    mFilteredLines.clear();
+    ReleaseUnusedChunks();
+    if (!mChunks.empty()) {
+        mChunks.back().Used = 0;
+    }
+}
+
+const ConsoleWindow::ConsoleLine* ConsoleWindow::LogChannel::GetLine(int64_t sequence) const {
+    if (sequence < mFirst || sequence >= mEnd) {
+        return nullptr;
+    }
+    return &mLines[sequence % CONSOLE_MAX_LINES];
+}
+
+void ConsoleWindow::LogChannel::SetFilter(const std::string& filter, spdlog::level::level_enum levelFilter) {
+    if (filter == mFilter && levelFilter == mLevelFilter) {
+        return;
+    }
+
+    mFilter = filter;
+    mLevelFilter = levelFilter;
+    mFilteredLines.clear();
+    for (int64_t sequence = mFirst; sequence < mEnd; sequence++) {
+        if (Matches(mLines[sequence % CONSOLE_MAX_LINES])) {
+            mFilteredLines.push_back(sequence);
+        }
+    }
+}
+
+const std::deque<int64_t>& ConsoleWindow::LogChannel::GetFilteredLines() const {
+    return mFilteredLines;
+}
+
+bool ConsoleWindow::LogChannel::Matches(const ConsoleLine& line) const {
+    if (mLevelFilter > line.Priority) {
+        return false;
+    }
+    return mFilter.empty() || std::string_view(line.Text, line.Length).find(mFilter) != std::string_view::npos;
+}
+
+void ConsoleWindow::LogChannel::DropOldestLine() {
+    mFirst++;
+    while (!mFilteredLines.empty() && mFilteredLines.front() < mFirst) {
+        mFilteredLines.pop_front();
+    }
+    ReleaseUnusedChunks();
+}
+
+void ConsoleWindow::LogChannel::ReleaseUnusedChunks() {
+    // The newest chunk is kept, it may hold a line that is still being written
+    while (mChunks.size() > 1 &&
+           (mFirst == mEnd || mLines[mFirst % CONSOLE_MAX_LINES].Chunk != mChunks.front().Id)) {
+        mFreeChunks.push_back(std::move(mChunks.front().Data));
+        mChunks.pop_front();
     }
 }
 
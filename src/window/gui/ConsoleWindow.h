@@ -1,6 +1,9 @@
 #pragma once
 
 #include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <functional>
@@ -24,6 +27,8 @@ class ConsoleWindow : public GuiWindow {
     void SendErrorMessage(const char* fmt, ...);
     void SendInfoMessage(const std::string& str);
     void SendErrorMessage(const std::string& str);
+    // Safe to call from any thread, the message is added to the console on the next frame.
+    void QueueInfoMessage(const std::string& str);
     void Append(const std::string& channel, spdlog::level::level_enum priority, const char* fmt, ...);
     std::string GetCurrentChannel();
 
@@ -35,9 +40,44 @@ class ConsoleWindow : public GuiWindow {
 
   private:
     struct ConsoleLine {
-        std::string Text;
+        const char* Text; // NUL terminated, owned by the channel's arena
+        uint32_t Length;
+        uint64_t Chunk;
         spdlog::level::level_enum Priority = spdlog::level::info;
-        std::string Channel = "Console";
+    };
+
+    // Keeps the newest lines of a channel in a fixed capacity ring, with their text in fixed size chunks that are
+    // recycled once the oldest line using them is dropped. Lines are addressed by a sequence number that keeps
+    // counting up across evictions, and the lines passing the current filter are tracked as they are added.
+    class LogChannel {
+      public:
+        char* BeginLine(size_t maxLength);
+        void EndLine(size_t length, spdlog::level::level_enum priority);
+        void Clear();
+        const ConsoleLine* GetLine(int64_t sequence) const;
+        void SetFilter(const std::string& filter, spdlog::level::level_enum levelFilter);
+        const std::deque<int64_t>& GetFilteredLines() const;
+
+      private:
+        struct Chunk {
+            std::unique_ptr<char[]> Data;
+            size_t Used;
+            uint64_t Id;
+        };
+
+        bool Matches(const ConsoleLine& line) const;
+        void DropOldestLine();
+        void ReleaseUnusedChunks();
+
+        std::vector<ConsoleLine> mLines;
+        int64_t mFirst = 0;
+        int64_t mEnd = 0;
+        std::deque<Chunk> mChunks;
+        std::vector<std::unique_ptr<char[]>> mFreeChunks;
+        uint64_t mNextChunkId = 0;
+        std::deque<int64_t> mFilteredLines;
+        std::string mFilter;
+        spdlog::level::level_enum mLevelFilter = spdlog::level::trace;
     };
 
     static int CallbackStub(ImGuiInputTextCallbackData* data);
@@ -53,11 +93,15 @@ class ConsoleWindow : public GuiWindow {
                               std::string* output);
     static int32_t GetCommand(std::shared_ptr<Console> console, const std::vector<std::string>& args,
                               std::string* output);
+    static int32_t ProfilerCommand(std::shared_ptr<Console> console, const std::vector<std::string>& args,
+                                   std::string* output);
+    static int32_t ArchiveBenchmarkCommand(std::shared_ptr<Console> console, const std::vector<std::string>& args,
+                                           std::string* output);
     static int32_t CheckVarType(const std::string& input);
 
-    int32_t mSelectedId = -1;
+    int64_t mSelectedId = -1;
     int32_t mHistoryIndex = -1;
-    std::vector<int> mSelectedEntries;
+    std::vector<int64_t> mSelectedEntries;
     std::string mFilter;
     std::string mCurrentChannel = "Console";
     bool mOpenAutocomplete = false;
@@ -69,7 +113,9 @@ class ConsoleWindow : public GuiWindow {
     std::map<ImGuiKey, std::string> mBindingToggle;
     std::vector<std::string> mHistory;
     std::vector<std::string> mAutoComplete;
-    std::map<std::string, std::vector<ConsoleLine>> mLog;
+    std::map<std::string, LogChannel> mLog;
+    std::vector<std::string> mQueuedMessages;
+    std::mutex mQueuedMessagesMutex;
     const std::vector<std::string> mLogChannels = { "Console", "Logs" };
     const std::vector<spdlog::level::level_enum> mPriorityFilters = { spdlog::level::off,  spdlog::level::critical,
                                                                       spdlog::level::err,  spdlog::level::warn,
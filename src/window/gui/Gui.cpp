@@ -15,6 +15,7 @@
 #include "resource/File.h"
 #include <stb/stb_image.h>
 #include "window/gui/Fonts.h"
+#include "debug/Profiler.h"
 
 #ifdef __WIIU__
 #include <gx2/registers.h> // GX2SetViewport / GX2SetScissor
@@ -281,6 +282,7 @@ void Gui::Update(WindowEvent event) {
 }
 
 void Gui::DrawMenu() {
+    LUS_PROFILE_SCOPE("Gui::DrawMenu");
     LUS::Context::GetInstance()->GetWindow()->GetGui()->GetGuiWindow("Console")->Update();
     ImGuiBackendNewFrame();
     ImGuiWMNewFrame();
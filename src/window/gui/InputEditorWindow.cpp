@@ -168,11 +168,15 @@ void InputEditorWindow::DrawVirtualStick(const char* label, ImVec2 stick, float
 }
 
 void InputEditorWindow::DrawControllerSchema() {
-    auto backend = Context::GetInstance()->GetControlDeck()->GetDeviceFromPortIndex(mCurrentPort);
+    auto controlDeck = Context::GetInstance()->GetControlDeck();
+    auto backend = controlDeck->GetDeviceFromPortIndex(mCurrentPort);
     auto profile = backend->GetProfile(mCurrentPort);
     bool isKeyboard = backend->GetGuid() == "Keyboard" || backend->GetGuid() == "Auto" || !backend->Connected();
 
-    backend->ReadToPad(nullptr, mCurrentPort);
+    // The input thread keeps the device state up to date on its own, reading from here would race with it.
+    if (!controlDeck->IsSamplingInput()) {
+        backend->ReadToPad(nullptr, mCurrentPort);
+    }
 
     DrawControllerSelect(mCurrentPort);
 
@@ -478,8 +482,11 @@ void InputEditorWindow::DrawElement() {
 
     ImGui::EndTabBar();
 
-    // Draw current cfg
-    DrawControllerSchema();
+    // Draw current cfg. The widgets write straight into the device profiles, which the input thread reads.
+    {
+        const auto lock = Context::GetInstance()->GetControlDeck()->LockDevices();
+        DrawControllerSchema();
+    }
 
     ImGui::End();
 }
@@ -1,9 +1,25 @@
 #include "StatsWindow.h"
 #include "ImGui/imgui.h"
 #include "public/bridge/consolevariablebridge.h"
+#include "Context.h"
+#include "graphic/Fast3D/gfx_pc.h"
+#include "debug/AllocationCounter.h"
+#include "debug/Profiler.h"
+#include "log/LogRateLimiter.h"
 #include "spdlog/spdlog.h"
+#include <algorithm>
+
+#define STATS_HISTOGRAM_BUCKETS 50 // 1 ms each, the last one also holds anything slower
 
 namespace LUS {
+static const char* sCommandClassNames[GFX_COMMAND_CLASS_COUNT] = {
+    "Vertex", "Triangle", "Matrix", "Texture", "Rectangle", "Display List", "State", "Other",
+};
+
+static const char* sFlushCauseNames[GFX_FLUSH_CAUSE_COUNT] = {
+    "Texture", "Shader", "Depth", "Viewport", "Blend", "Buffer Full", "Vertex Batch", "Framebuffer", "End",
+};
+
 StatsWindow::~StatsWindow() {
     SPDLOG_TRACE("destruct stats window");
 }
@@ -30,10 +46,105 @@ void StatsWindow::DrawElement() {
     ImGui::Text("Platform: Unknown");
 #endif
     ImGui::Text("Status: %.3f ms/frame (%.1f FPS)", 1000.0f / framerate, framerate);
+
+    const GfxTextureAtlasStats atlas = gfx_get_texture_atlas_stats();
+    ImGui::Text("Draw Calls: %u (%u without texture atlas)", atlas.draw_calls,
+                atlas.draw_calls + atlas.draw_calls_saved);
+    if (atlas.pages > 0) {
+        ImGui::Text("Texture Atlas: %u textures in %u pages", atlas.textures, atlas.pages);
+    }
+    const GfxFramePacingStats pacing = gfx_get_frame_pacing_stats();
+    if (pacing.frames > 0) {
+        ImGui::Text("Frame Pacing: p50 %.2f ms, p99 %.2f ms (target %.2f ms)", pacing.p50_frame_time_ms,
+                    pacing.p99_frame_time_ms, pacing.target_frame_time_ms);
+        ImGui::Text("Frame Jitter: p99 %.2f ms, %llu missed deadlines", pacing.p99_jitter_ms,
+                    (unsigned long long)pacing.missed_deadlines);
+    }
+    if (IsAllocationCounterEnabled()) {
+        ImGui::Text("Heap Allocations: %llu per frame", (unsigned long long)gfx_get_frame_allocations());
+    }
+    const uint64_t droppedLogs = GetDroppedLogMessageCount();
+    if (droppedLogs > 0) {
+        ImGui::Text("Log Messages Dropped: %llu", (unsigned long long)droppedLogs);
+    }
+    if (Profiler::IsCapturing()) {
+        ImGui::Text("Profiler: capturing, use \"profiler dump\" to write a trace");
+    }
+
+    auto controlDeck = Context::GetInstance()->GetControlDeck();
+    if (controlDeck != nullptr) {
+        const InputLatencyStats input = controlDeck->GetInputLatencyStats();
+        if (input.SamplingRate > 0) {
+            ImGui::Text("Input: sampled at %u Hz", input.SamplingRate);
+            ImGui::Text("Input Sample Age: %.3f ms (avg %.3f ms, peak %.3f ms)", input.LastSampleAgeMs,
+                        input.AverageSampleAgeMs, input.PeakSampleAgeMs);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Time since the devices were sampled, not end to end latency. SDL controllers and "
+                                  "the keyboard are sampled on the same input thread and share this delay. Keyboard "
+                                  "state only changes when the main thread handles window events.");
+            }
+        } else {
+            ImGui::Text("Input: polled on read");
+        }
+        ImGui::Text("Input Read: %.3f ms (avg %.3f ms)", input.LastReadTimeMs, input.AverageReadTimeMs);
+    }
+    DrawRenderStats();
     ImGui::End();
     ImGui::PopStyleColor();
 }
 
+void StatsWindow::DrawRenderStats() {
+    const GfxRenderStats render = gfx_get_render_stats();
+    const GfxTextureAtlasStats atlas = gfx_get_texture_atlas_stats();
+    mFrameTimes[mHistoryOffset] = ImGui::GetIO().DeltaTime * 1000.0f;
+    mDrawCalls[mHistoryOffset] = atlas.draw_calls;
+    mTriangles[mHistoryOffset] = render.triangles - render.triangles_rejected;
+    mHistoryOffset = (mHistoryOffset + 1) % STATS_HISTORY_SIZE;
+
+    ImGui::Text("Triangles: %u (%u clipped or culled)", render.triangles, render.triangles_rejected);
+    ImGui::Text("Texture Uploads: %u (%.1f KiB)", render.texture_uploads, render.texture_upload_bytes / 1024.0);
+    ImGui::Text("Shader Compilations: %u, Combiners: %u", render.shader_compilations, render.combiners);
+
+    auto resourceManager = Context::GetInstance()->GetResourceManager();
+    if (resourceManager != nullptr) {
+        const ResourceCacheStats cache = resourceManager->GetCacheStats();
+        ImGui::Text("Resource Cache: %llu hits, %llu misses", (unsigned long long)(cache.Hits - mLastCacheStats.Hits),
+                    (unsigned long long)(cache.Misses - mLastCacheStats.Misses));
+        mLastCacheStats = cache;
+    }
+
+    if (ImGui::CollapsingHeader("Display List Commands")) {
+        for (int32_t i = 0; i < GFX_COMMAND_CLASS_COUNT; i++) {
+            ImGui::Text("%s: %u", sCommandClassNames[i], render.commands[i]);
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Draw Calls by Cause")) {
+        for (int32_t i = 0; i < GFX_FLUSH_CAUSE_COUNT; i++) {
+            ImGui::Text("%s: %u", sFlushCauseNames[i], render.flushes[i]);
+        }
+    }
+
+    if (ImGui::CollapsingHeader("History")) {
+        const ImVec2 graphSize(0, 60);
+        ImGui::PlotLines("Frame Time (ms)", mFrameTimes, STATS_HISTORY_SIZE, mHistoryOffset, nullptr, 0.0f,
+                         FLT_MAX, graphSize);
+        ImGui::PlotLines("Draw Calls", mDrawCalls, STATS_HISTORY_SIZE, mHistoryOffset, nullptr, 0.0f, FLT_MAX,
+                         graphSize);
+        ImGui::PlotLines("Triangles", mTriangles, STATS_HISTORY_SIZE, mHistoryOffset, nullptr, 0.0f, FLT_MAX,
+                         graphSize);
+
+        float histogram[STATS_HISTOGRAM_BUCKETS] = {};
+        for (float frameTime : mFrameTimes) {
+            if (frameTime > 0.0f) {
+                histogram[std::min((int32_t)frameTime, STATS_HISTOGRAM_BUCKETS - 1)]++;
+            }
+        }
+        ImGui::PlotHistogram("Frame Times (1 ms buckets)", histogram, STATS_HISTOGRAM_BUCKETS, 0, nullptr, 0.0f,
+                             FLT_MAX, graphSize);
+    }
+}
+
 void StatsWindow::UpdateElement() {
 }
 } // namespace LUS
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "window/gui/GuiWindow.h"
+#include "resource/ResourceManager.h"
+
+#define STATS_HISTORY_SIZE 240
 
 namespace LUS {
 class StatsWindow : public GuiWindow {
@@ -12,5 +15,12 @@ class StatsWindow : public GuiWindow {
     void InitElement() override;
     void DrawElement() override;
     void UpdateElement() override;
+    void DrawRenderStats();
+
+    float mFrameTimes[STATS_HISTORY_SIZE] = {};
+    float mDrawCalls[STATS_HISTORY_SIZE] = {};
+    float mTriangles[STATS_HISTORY_SIZE] = {};
+    int32_t mHistoryOffset = 0;
+    ResourceCacheStats mLastCacheStats = {};
 };
 } // namespace LUS
\ No newline at end of file